@@ -304,6 +304,9 @@ var (
 		mkField("RememberStatePerDocument", Bool, true,
 			"if true, we store display settings for each document separately (i.e. everything "+
 				"after UseDefaultState in FileStates)"),
+		mkField("RenderBandThreads", Int, 0,
+			"maximum number of threads rendering horizontal bands of a large PDF page in parallel. "+
+				"0 means the number of cores, 1 renders pages on a single thread").setExpert().setVersion("3.6"),
 		mkField("RestoreSession", Bool, true,
 			"if true and SessionData isn't empty, that session will be restored at startup").setExpert(),
 		mkField("ReuseInstance", Bool, true,
@@ -29,20 +29,6 @@
 #include "jbig2_priv.h"
 #include "jbig2_arith.h"
 
-struct _Jbig2ArithState {
-    uint32_t C;
-    uint32_t A;
-
-    int CT;
-
-    uint32_t next_word;
-    size_t next_word_bytes;
-    int err;
-
-    Jbig2WordStream *ws;
-    size_t offset;
-};
-
 /*
   Previous versions of this code had a #define to allow
   us to choose between using the revised arithmetic decoding
@@ -236,19 +222,12 @@ jbig2_arith_new(Jbig2Ctx *ctx, Jbig2WordStream *ws)
     return result;
 }
 
-#define MAX_QE_ARRAY_SIZE 47
-
-/* could put bit fields in to minimize memory usage */
-typedef struct {
-    uint16_t Qe;
-    byte mps_xor;               /* mps_xor = index ^ NMPS */
-    byte lps_xor;               /* lps_xor = index ^ NLPS ^ (SWITCH << 7) */
-} Jbig2ArithQe;
+#define MAX_QE_ARRAY_SIZE JBIG2_ARITH_QE_SIZE
 
 #define MPS(index, nmps) ((index) ^ (nmps))
 #define LPS(index, nlps, swtch) ((index) ^ (nlps) ^ ((swtch) << 7))
 
-static const Jbig2ArithQe jbig2_arith_Qe[MAX_QE_ARRAY_SIZE] = {
+const Jbig2ArithQe jbig2_arith_Qe[MAX_QE_ARRAY_SIZE] = {
     {0x5601, MPS(0, 1), LPS(0, 1, 1)},
     {0x3401, MPS(1, 2), LPS(1, 6, 0)},
     {0x1801, MPS(2, 3), LPS(2, 9, 0)},
@@ -302,20 +281,25 @@ static int
 jbig2_arith_renormd(Jbig2Ctx *ctx, Jbig2ArithState *as)
 {
     /* Figure E.18 */
+    /* SumatraPDF: shift by as many bits at once as are needed and available */
     do {
+        int shift = 1;
+
         if (as->CT == 0 && jbig2_arith_bytein(ctx, as) < 0) {
             return jbig2_error(ctx, JBIG2_SEVERITY_WARNING, JBIG2_UNKNOWN_SEGMENT_NUMBER, "failed to read byte from compressed data stream");
         }
-        as->A <<= 1;
-        as->C <<= 1;
-        as->CT--;
+        while (shift < as->CT && ((as->A << shift) & 0x8000) == 0)
+            shift++;
+        as->A <<= shift;
+        as->C <<= shift;
+        as->CT -= shift;
     } while ((as->A & 0x8000) == 0);
 
     return 0;
 }
 
 int
-jbig2_arith_decode(Jbig2Ctx *ctx, Jbig2ArithState *as, Jbig2ArithCx *pcx)
+jbig2_arith_decode_full(Jbig2Ctx *ctx, Jbig2ArithState *as, Jbig2ArithCx *pcx)
 {
     Jbig2ArithCx cx = *pcx;
     const Jbig2ArithQe *pqe;
@@ -22,6 +22,33 @@
 
 typedef struct _Jbig2ArithState Jbig2ArithState;
 
+/* SumatraPDF: the state and the probability estimates are public so that
+   the common case of jbig2_arith_decode can be inlined */
+struct _Jbig2ArithState {
+    uint32_t C;
+    uint32_t A;
+
+    int CT;
+
+    uint32_t next_word;
+    size_t next_word_bytes;
+    int err;
+
+    Jbig2WordStream *ws;
+    size_t offset;
+};
+
+#define JBIG2_ARITH_QE_SIZE 47
+
+/* could put bit fields in to minimize memory usage */
+typedef struct {
+    uint16_t Qe;
+    byte mps_xor;               /* mps_xor = index ^ NMPS */
+    byte lps_xor;               /* lps_xor = index ^ NLPS ^ (SWITCH << 7) */
+} Jbig2ArithQe;
+
+extern const Jbig2ArithQe jbig2_arith_Qe[JBIG2_ARITH_QE_SIZE];
+
 /* An arithmetic coding context is stored as a single byte, with the
    index in the low order 7 bits (actually only 6 are used), and the
    MPS in the top bit. */
@@ -30,9 +57,29 @@ typedef unsigned char Jbig2ArithCx;
 /* allocate and initialize a new arithmetic coding state */
 Jbig2ArithState *jbig2_arith_new(Jbig2Ctx *ctx, Jbig2WordStream *ws);
 
+/* decode a bit, handling all cases */
+int jbig2_arith_decode_full(Jbig2Ctx *ctx, Jbig2ArithState *as, Jbig2ArithCx *pcx);
+
 /* decode a bit */
 /* Normally returns 0 or 1. May return negative in case of error. */
-int jbig2_arith_decode(Jbig2Ctx *ctx, Jbig2ArithState *as, Jbig2ArithCx *pcx);
+/* SumatraPDF: decoding the MPS without renormalization (which is by far the
+   most common case) doesn't need a function call */
+static inline int
+jbig2_arith_decode(Jbig2Ctx *ctx, Jbig2ArithState *as, Jbig2ArithCx *pcx)
+{
+    const Jbig2ArithCx cx = *pcx;
+    const unsigned int index = cx & 0x7f;
+
+    if (index < JBIG2_ARITH_QE_SIZE) {
+        const uint32_t A = as->A - jbig2_arith_Qe[index].Qe;
+
+        if ((A & 0x8000) != 0 && (as->C >> 16) < A) {
+            as->A = A;
+            return cx >> 7;
+        }
+    }
+    return jbig2_arith_decode_full(ctx, as, pcx);
+}
 
 /* returns true if the end of the data stream has been reached (for sanity checks) */
 bool jbig2_arith_has_reached_marker(Jbig2ArithState *as);
@@ -352,6 +352,28 @@ jbig2_image_get_pixel_fast(Jbig2Image *image, int x, int y)
     return ((image->data[byte] >> bit) & 1);
 }
 
+/* SumatraPDF: adaptive template pixels can be anywhere within the field, so
+   the unoptimized decoders have to check their bounds. Looking up their rows
+   once per row (NULL if outside of the image) leaves only the check on x. */
+static inline const byte *
+jbig2_image_get_at_line(const Jbig2Image *image, uint32_t y, int dy)
+{
+    const int64_t yy = (int64_t) y + dy;
+
+    if (yy < 0 || yy >= (int64_t) image->height)
+        return NULL;
+    return image->data + (size_t) yy * image->stride;
+}
+
+static inline int
+jbig2_image_get_at_pixel(const byte *line, uint32_t width, uint32_t x)
+{
+    /* x wraps around for pixels left of the image */
+    if (line == NULL || x >= width)
+        return 0;
+    return (line[x >> 3] >> (7 - (x & 7))) & 1;
+}
+
 /* return the appropriate context size for the given template */
 int
 jbig2_generic_stats_size(Jbig2Ctx *ctx, int template)
@@ -439,6 +461,7 @@ jbig2_decode_generic_template0_unopt(Jbig2Ctx *ctx,
     const uint32_t GBH = image->height;
     uint32_t CONTEXT;
     uint32_t x, y;
+    const byte *at0, *at1, *at2, *at3;
     int bit;
 
     if (pixel_outside_field(params->gbat[0], params->gbat[1]) ||
@@ -466,17 +489,21 @@ jbig2_decode_generic_template0_unopt(Jbig2Ctx *ctx,
                     ppd |= *ppline++;
             }
         }
+        at0 = jbig2_image_get_at_line(image, y, params->gbat[1]);
+        at1 = jbig2_image_get_at_line(image, y, params->gbat[3]);
+        at2 = jbig2_image_get_at_line(image, y, params->gbat[5]);
+        at3 = jbig2_image_get_at_line(image, y, params->gbat[7]);
         for (x = 0; x < GBW; x++) {
             if (params->USESKIP && jbig2_image_get_pixel(params->SKIP, x, y)) {
                 bit = 0;
             } else {
                 CONTEXT  = out_byte & 0x000F; /* First 4 pixels */
-                CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[0], y + params->gbat[1]) << 4;
+                CONTEXT |= jbig2_image_get_at_pixel(at0, GBW, x + params->gbat[0]) << 4;
                 CONTEXT |= (pd>>8) & 0x03E0; /* Next 5 pixels */
-                CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[2], y + params->gbat[3]) << 10;
-                CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[4], y + params->gbat[5]) << 11;
+                CONTEXT |= jbig2_image_get_at_pixel(at1, GBW, x + params->gbat[2]) << 10;
+                CONTEXT |= jbig2_image_get_at_pixel(at2, GBW, x + params->gbat[4]) << 11;
                 CONTEXT |= (ppd>>2) & 0x7000; /* Next 3 pixels */
-                CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[6], y + params->gbat[7]) << 15;
+                CONTEXT |= jbig2_image_get_at_pixel(at3, GBW, x + params->gbat[6]) << 15;
                 bit = jbig2_arith_decode(ctx, as, &GB_stats[CONTEXT]);
                 if (bit < 0)
                     return jbig2_error(ctx, JBIG2_SEVERITY_WARNING, segment->number, "failed to decode arithmetic code when handling generic template0 unoptimized");
@@ -511,6 +538,7 @@ jbig2_decode_generic_template1_unopt(Jbig2Ctx *ctx,
     const uint32_t GBH = image->height;
     uint32_t CONTEXT;
     uint32_t x, y;
+    const byte *at0;
     int bit;
 
     if (pixel_outside_field(params->gbat[0], params->gbat[1]))
@@ -535,12 +563,13 @@ jbig2_decode_generic_template1_unopt(Jbig2Ctx *ctx,
                     ppd |= *ppline++;
             }
         }
+        at0 = jbig2_image_get_at_line(image, y, params->gbat[1]);
         for (x = 0; x < GBW; x++) {
             if (params->USESKIP && jbig2_image_get_pixel(params->SKIP, x, y)) {
                 bit = 0;
             } else {
                 CONTEXT  = out_byte & 0x0007; /* First 3 pixels */
-                CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[0], y + params->gbat[1]) << 3;
+                CONTEXT |= jbig2_image_get_at_pixel(at0, GBW, x + params->gbat[0]) << 3;
                 CONTEXT |= (pd>>9) & 0x01F0; /* Next 5 pixels */
                 CONTEXT |= (ppd>>4) & 0x1E00; /* Next 4 pixels */
                 bit = jbig2_arith_decode(ctx, as, &GB_stats[CONTEXT]);
@@ -642,6 +671,7 @@ jbig2_decode_generic_template2_unopt(Jbig2Ctx *ctx,
     const uint32_t GBH = image->height;
     uint32_t CONTEXT;
     uint32_t x, y;
+    const byte *at0;
     int bit;
 
     if (pixel_outside_field(params->gbat[0], params->gbat[1]))
@@ -666,12 +696,13 @@ jbig2_decode_generic_template2_unopt(Jbig2Ctx *ctx,
                     ppd |= *ppline++;
             }
         }
+        at0 = jbig2_image_get_at_line(image, y, params->gbat[1]);
         for (x = 0; x < GBW; x++) {
             if (params->USESKIP && jbig2_image_get_pixel(params->SKIP, x, y)) {
                 bit = 0;
             } else {
                 CONTEXT  = out_byte & 0x003; /* First 2 pixels */
-                CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[0], y + params->gbat[1]) << 2;
+                CONTEXT |= jbig2_image_get_at_pixel(at0, GBW, x + params->gbat[0]) << 2;
                 CONTEXT |= (pd>>11) & 0x078; /* Next 4 pixels */
                 CONTEXT |= (ppd>>7) & 0x380; /* Next 3 pixels */
                 bit = jbig2_arith_decode(ctx, as, &GB_stats[CONTEXT]);
@@ -832,6 +863,7 @@ jbig2_decode_generic_template3_unopt(Jbig2Ctx *ctx,
     const uint32_t GBH = image->height;
     uint32_t CONTEXT;
     uint32_t x, y;
+    const byte *at0;
     int bit;
 
     if (pixel_outside_field(params->gbat[0], params->gbat[1]))
@@ -849,12 +881,13 @@ jbig2_decode_generic_template3_unopt(Jbig2Ctx *ctx,
             if (GBW > 8)
                 pd |= *pline++;
         }
+        at0 = jbig2_image_get_at_line(image, y, params->gbat[1]);
         for (x = 0; x < GBW; x++) {
             if (params->USESKIP && jbig2_image_get_pixel(params->SKIP, x, y)) {
                 bit = 0;
             } else {
                 CONTEXT  = out_byte & 0x00F; /* First 4 pixels */
-                CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[0], y + params->gbat[1]) << 4;
+                CONTEXT |= jbig2_image_get_at_pixel(at0, GBW, x + params->gbat[0]) << 4;
                 CONTEXT |= (pd>>9) & 0x3E0; /* Next 5 pixels */
                 bit = jbig2_arith_decode(ctx, as, &GB_stats[CONTEXT]);
                 if (bit < 0)
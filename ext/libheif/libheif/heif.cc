@@ -45,6 +45,7 @@
 #include <utility>
 #include <vector>
 #include <cstring>
+#include <mutex>
 
 #if (defined(__MINGW32__) || defined(__MINGW64__) || defined(_MSC_VER)) && !defined(HAVE_UNISTD_H)
 // for _write
@@ -883,7 +884,7 @@ heif_decoding_options* heif_decoding_options_alloc()
 {
   auto options = new heif_decoding_options;
 
-  options->version = 3;
+  options->version = 4;
 
   options->ignore_transformations = false;
 
@@ -900,6 +901,11 @@ heif_decoding_options* heif_decoding_options_alloc()
 
   options->strict_decoding = false;
 
+  // version 4
+
+  options->decoder_threads = 0;
+  options->decoder_context_pool = NULL;
+
   return options;
 }
 
@@ -910,6 +916,66 @@ void heif_decoding_options_free(heif_decoding_options* options)
 }
 
 
+// SumatraPDF: added
+struct heif_decoder_context_pool
+{
+  struct entry
+  {
+    int key;
+    void* context;
+    void (* free_context)(void*);
+  };
+
+  std::mutex mutex;
+  int max_idle = 0;
+  std::vector<entry> idle;
+};
+
+heif_decoder_context_pool* heif_decoder_context_pool_alloc(int max_idle)
+{
+  auto pool = new heif_decoder_context_pool;
+  pool->max_idle = std::max(max_idle, 0);
+  return pool;
+}
+
+void heif_decoder_context_pool_free(heif_decoder_context_pool* pool)
+{
+  if (!pool) {
+    return;
+  }
+  for (auto& e : pool->idle) {
+    e.free_context(e.context);
+  }
+  delete pool;
+}
+
+void* heif_decoder_context_pool_take(heif_decoder_context_pool* pool, int key)
+{
+  std::lock_guard<std::mutex> lock(pool->mutex);
+  for (size_t i = 0; i < pool->idle.size(); i++) {
+    if (pool->idle[i].key == key) {
+      void* context = pool->idle[i].context;
+      pool->idle.erase(pool->idle.begin() + i);
+      return context;
+    }
+  }
+  return nullptr;
+}
+
+void heif_decoder_context_pool_put(heif_decoder_context_pool* pool, int key, void* context,
+                                   void (* free_context)(void*))
+{
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    if ((int) pool->idle.size() < pool->max_idle) {
+      pool->idle.push_back({key, context, free_context});
+      return;
+    }
+  }
+  free_context(context);
+}
+
+
 struct heif_error heif_decode_image(const struct heif_image_handle* in_handle,
                                     struct heif_image** out_img,
                                     heif_colorspace colorspace,
@@ -44,6 +44,7 @@ extern "C" {
 //  1.10         1             2            3             1             1            1
 //  1.11         1             2            4             1             1            1
 //  1.13         1             3            4             1             1            1
+//  SumatraPDF   1             4            4             1             1            1
 
 #if !defined(LIBHEIF_STATIC_BUILD)
 #error "haha"`
@@ -950,6 +951,17 @@ struct heif_decoding_options
   // When enabled, an error is returned for invalid input. Otherwise, it will try its best and
   // add decoding warnings to the decoded heif_image. Default is non-strict.
   uint8_t strict_decoding;
+
+  // SumatraPDF: version 4 options
+
+  // Maximum number of threads the codec may use to decode an image.
+  // Default: 0 (codec default).
+  int decoder_threads;
+
+  // If not NULL, decoder contexts are taken from and returned to this pool
+  // instead of being created and destroyed for every image.
+  // Default: NULL.
+  struct heif_decoder_context_pool* decoder_context_pool;
 };
 
 
@@ -962,6 +974,16 @@ struct heif_decoding_options* heif_decoding_options_alloc();
 LIBHEIF_API
 void heif_decoding_options_free(struct heif_decoding_options*);
 
+// SumatraPDF: decoder contexts can be reused between images (e.g. the pages
+// of a comic book), which saves their initialization and allocations.
+// At most max_idle unused contexts are kept. The pool can be shared between
+// threads and has to outlive the decoding of all images that use it.
+LIBHEIF_API
+struct heif_decoder_context_pool* heif_decoder_context_pool_alloc(int max_idle);
+
+LIBHEIF_API
+void heif_decoder_context_pool_free(struct heif_decoder_context_pool*);
+
 // Decode an heif_image_handle into the actual pixel image and also carry out
 // all geometric transformations specified in the HEIF file (rotation, cropping, mirroring).
 //
@@ -1094,6 +1094,17 @@ Error HeifContext::decode_image_planar(heif_item_id ID,
       }
     }
 
+    // SumatraPDF: let the caller limit the threads used by the codec
+    // and reuse codec contexts between images
+    if (decoder_plugin->plugin_api_version >= 3 && options && options->version >= 4) {
+      if (decoder_plugin->set_max_threads) {
+        decoder_plugin->set_max_threads(decoder, options->decoder_threads);
+      }
+      if (decoder_plugin->set_context_pool && options->decoder_context_pool) {
+        decoder_plugin->set_context_pool(decoder, options->decoder_context_pool);
+      }
+    }
+
     err = decoder_plugin->push_data(decoder, data.data(), data.size());
     if (err.code != heif_error_Ok) {
       decoder_plugin->free_decoder(decoder);
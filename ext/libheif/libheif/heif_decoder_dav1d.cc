@@ -40,6 +40,8 @@ struct dav1d_decoder
   Dav1dContext* context;
   Dav1dData data;
   bool strict_decoding = false;
+  // SumatraPDF: the context is taken from and returned to this pool
+  heif_decoder_context_pool* context_pool = nullptr;
 };
 
 static const char kEmptyString[] = "";
@@ -94,11 +96,13 @@ struct heif_error dav1d_new_decoder(void** dec)
 
   decoder->settings.frame_size_limit = MAX_IMAGE_WIDTH * MAX_IMAGE_HEIGHT;
   decoder->settings.all_layers = 0;
+  // SumatraPDF: we only ever decode a single frame, so frame threading
+  // only costs memory; tile and post-filter threads are still used
+  decoder->settings.max_frame_delay = 1;
 
-  if (dav1d_open(&decoder->context, &decoder->settings) != 0) {
-    struct heif_error err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kSuccess};
-    return err;
-  }
+  // SumatraPDF: the context is opened in dav1d_push_data(), after
+  // dav1d_set_max_threads() had a chance to change the settings
+  decoder->context = nullptr;
 
   memset(&decoder->data, 0, sizeof(Dav1dData));
 
@@ -109,6 +113,13 @@ struct heif_error dav1d_new_decoder(void** dec)
 }
 
 
+// SumatraPDF: added
+static void dav1d_close_context(void* context_raw)
+{
+  auto* context = (Dav1dContext*) context_raw;
+  dav1d_close(&context);
+}
+
 void dav1d_free_decoder(void* decoder_raw)
 {
   auto* decoder = (dav1d_decoder*) decoder_raw;
@@ -120,6 +131,13 @@ void dav1d_free_decoder(void* decoder_raw)
   if (decoder->data.sz) {
     dav1d_data_unref(&decoder->data);
   }
+  if (decoder->context && decoder->context_pool) {
+    // SumatraPDF: flushing resets the context for decoding another image
+    dav1d_flush(decoder->context);
+    heif_decoder_context_pool_put(decoder->context_pool, decoder->settings.n_threads, decoder->context,
+                                  dav1d_close_context);
+    decoder->context = nullptr;
+  }
   if (decoder->context) {
     dav1d_close(&decoder->context);
   }
@@ -135,12 +153,37 @@ void dav1d_set_strict_decoding(void* decoder_raw, int flag)
   decoder->strict_decoding = flag;
 }
 
+// SumatraPDF: added
+void dav1d_set_max_threads(void* decoder_raw, int max_threads)
+{
+  struct dav1d_decoder* decoder = (dav1d_decoder*) decoder_raw;
+
+  decoder->settings.n_threads = max_threads > 0 ? max_threads : 0;
+}
+
+// SumatraPDF: added
+void dav1d_set_context_pool(void* decoder_raw, heif_decoder_context_pool* pool)
+{
+  struct dav1d_decoder* decoder = (dav1d_decoder*) decoder_raw;
+
+  decoder->context_pool = pool;
+}
+
 struct heif_error dav1d_push_data(void* decoder_raw, const void* frame_data, size_t frame_size)
 {
   auto* decoder = (struct dav1d_decoder*) decoder_raw;
 
   assert(decoder->data.sz == 0);
 
+  if (!decoder->context && decoder->context_pool) {
+    decoder->context = (Dav1dContext*) heif_decoder_context_pool_take(decoder->context_pool,
+                                                                      decoder->settings.n_threads);
+  }
+  if (!decoder->context && dav1d_open(&decoder->context, &decoder->settings) != 0) {
+    struct heif_error err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kSuccess};
+    return err;
+  }
+
   uint8_t* d = dav1d_data_create(&decoder->data, frame_size);
   if (d == nullptr) {
     struct heif_error err = {heif_error_Memory_allocation_error, heif_suberror_Unspecified, kSuccess};
@@ -296,7 +339,7 @@ struct heif_error dav1d_decode_image(void* decoder_raw, struct heif_image** out_
 
 static const struct heif_decoder_plugin decoder_dav1d
     {
-        2,
+        3,
         dav1d_plugin_name,
         dav1d_init_plugin,
         dav1d_deinit_plugin,
@@ -305,7 +348,9 @@ static const struct heif_decoder_plugin decoder_dav1d
         dav1d_free_decoder,
         dav1d_push_data,
         dav1d_decode_image,
-        dav1d_set_strict_decoding
+        dav1d_set_strict_decoding,
+        dav1d_set_max_threads,
+        dav1d_set_context_pool
     };
 
 
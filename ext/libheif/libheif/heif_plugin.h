@@ -91,6 +91,16 @@ struct heif_decoder_plugin
 
   void (*set_strict_decoding)(void* decoder, int flag);
 
+  // SumatraPDF: --- version 3 functions ---
+
+  // Limit the number of threads the decoder may use (0 = codec default).
+  // Has to be called before push_data().
+  void (*set_max_threads)(void* decoder, int max_threads);
+
+  // Reuse codec contexts from the pool (see heif_decoder_context_pool_take()).
+  // Has to be called before push_data().
+  void (*set_context_pool)(void* decoder, struct heif_decoder_context_pool* pool);
+
   // If not NULL, this can provide a specialized function to convert YCbCr to sRGB, because
   // only the codec itself knows how to interpret the chroma samples and their locations.
   /*
@@ -105,6 +115,19 @@ struct heif_decoder_plugin
 };
 
 
+// SumatraPDF: used by decoder plugins to reuse their codec contexts.
+// Contexts are only interchangeable if they were created with the same key
+// (e.g. the number of threads). Returns NULL if there's no matching context.
+LIBHEIF_API
+void* heif_decoder_context_pool_take(struct heif_decoder_context_pool* pool, int key);
+
+// Returns a context to the pool, it's freed with free_context() if the pool is full
+// or once the pool is freed.
+LIBHEIF_API
+void heif_decoder_context_pool_put(struct heif_decoder_context_pool* pool, int key, void* context,
+                                   void (* free_context)(void* context));
+
+
 enum heif_encoded_data_type
 {
   heif_encoded_data_type_HEVC_header = 1,
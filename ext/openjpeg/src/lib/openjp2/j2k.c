@@ -6712,7 +6712,10 @@ OPJ_BOOL opj_j2k_set_threads(opj_j2k_t *j2k, OPJ_UINT32 num_threads)
     /* Currently we pass the thread-pool to the tcd, so we cannot re-set it */
     /* afterwards */
     if (opj_has_thread_support() && j2k->m_tcd == NULL) {
-        opj_thread_pool_destroy(j2k->m_tp);
+        if (!j2k->m_tp_is_shared) {
+            opj_thread_pool_destroy(j2k->m_tp);
+        }
+        j2k->m_tp_is_shared = OPJ_FALSE;
         j2k->m_tp = NULL;
         if (num_threads <= (OPJ_UINT32)INT_MAX) {
             j2k->m_tp = opj_thread_pool_create((int)num_threads);
@@ -6726,6 +6729,19 @@ OPJ_BOOL opj_j2k_set_threads(opj_j2k_t *j2k, OPJ_UINT32 num_threads)
     return OPJ_FALSE;
 }
 
+OPJ_BOOL opj_j2k_set_thread_pool(opj_j2k_t *j2k, opj_thread_pool_t *tp)
+{
+    if (tp == NULL || j2k->m_tcd != NULL) {
+        return OPJ_FALSE;
+    }
+    if (!j2k->m_tp_is_shared) {
+        opj_thread_pool_destroy(j2k->m_tp);
+    }
+    j2k->m_tp = tp;
+    j2k->m_tp_is_shared = OPJ_TRUE;
+    return OPJ_TRUE;
+}
+
 static int opj_j2k_get_default_thread_count()
 {
     const char* num_threads_str = getenv("OPJ_NUM_THREADS");
@@ -9219,6 +9235,11 @@ void opj_j2k_destroy(opj_j2k_t *p_j2k)
         }
     }
 
+    /* SumatraPDF: a shared thread pool must not run jobs of this codec anymore */
+    if (p_j2k->m_tp_is_shared) {
+        opj_thread_pool_wait_completion(p_j2k->m_tp, 0);
+    }
+
     opj_tcd_destroy(p_j2k->m_tcd);
 
     opj_j2k_cp_destroy(&(p_j2k->m_cp));
@@ -9239,7 +9260,9 @@ void opj_j2k_destroy(opj_j2k_t *p_j2k)
     opj_image_destroy(p_j2k->m_output_image);
     p_j2k->m_output_image = NULL;
 
-    opj_thread_pool_destroy(p_j2k->m_tp);
+    if (!p_j2k->m_tp_is_shared) {
+        opj_thread_pool_destroy(p_j2k->m_tp);
+    }
     p_j2k->m_tp = NULL;
 
     opj_free(p_j2k);
@@ -601,6 +601,9 @@ typedef struct opj_j2k {
     /** Thread pool */
     opj_thread_pool_t* m_tp;
 
+    /** SumatraPDF: m_tp is owned by the caller, see opj_j2k_set_thread_pool() */
+    OPJ_BOOL m_tp_is_shared;
+
     /** Image width coming from JP2 IHDR box. 0 from a pure codestream */
     OPJ_UINT32 ihdr_w;
 
@@ -631,6 +634,9 @@ void opj_j2k_decoder_set_strict_mode(opj_j2k_t *j2k, OPJ_BOOL strict);
 
 OPJ_BOOL opj_j2k_set_threads(opj_j2k_t *j2k, OPJ_UINT32 num_threads);
 
+/** SumatraPDF: use a thread pool owned by the caller instead of an own one */
+OPJ_BOOL opj_j2k_set_thread_pool(opj_j2k_t *j2k, opj_thread_pool_t *tp);
+
 /**
  * Creates a J2K compression structure
  *
@@ -1911,6 +1911,11 @@ OPJ_BOOL opj_jp2_set_threads(opj_jp2_t *jp2, OPJ_UINT32 num_threads)
     return opj_j2k_set_threads(jp2->j2k, num_threads);
 }
 
+OPJ_BOOL opj_jp2_set_thread_pool(opj_jp2_t *jp2, opj_thread_pool_t *tp)
+{
+    return opj_j2k_set_thread_pool(jp2->j2k, tp);
+}
+
 /* ----------------------------------------------------------------------- */
 /* JP2 encoder interface                                             */
 /* ----------------------------------------------------------------------- */
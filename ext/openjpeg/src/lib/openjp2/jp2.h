@@ -252,6 +252,9 @@ void opj_jp2_decoder_set_strict_mode(opj_jp2_t *jp2, OPJ_BOOL strict);
  */
 OPJ_BOOL opj_jp2_set_threads(opj_jp2_t *jp2, OPJ_UINT32 num_threads);
 
+/** SumatraPDF: see opj_j2k_set_thread_pool() */
+OPJ_BOOL opj_jp2_set_thread_pool(opj_jp2_t *jp2, opj_thread_pool_t *tp);
+
 /**
  * Decode an image from a JPEG-2000 file stream
  * @param jp2 JP2 decompressor handle
@@ -269,6 +269,9 @@ opj_codec_t* OPJ_CALLCONV opj_create_decompress(OPJ_CODEC_FORMAT p_format)
         l_codec->opj_set_threads =
             (OPJ_BOOL(*)(void * p_codec, OPJ_UINT32 num_threads)) opj_j2k_set_threads;
 
+        l_codec->opj_set_thread_pool =
+            (OPJ_BOOL(*)(void * p_codec, opj_thread_pool_t* tp)) opj_j2k_set_thread_pool;
+
         l_codec->m_codec = opj_j2k_create_decompress();
 
         if (! l_codec->m_codec) {
@@ -360,6 +363,9 @@ opj_codec_t* OPJ_CALLCONV opj_create_decompress(OPJ_CODEC_FORMAT p_format)
         l_codec->opj_set_threads =
             (OPJ_BOOL(*)(void * p_codec, OPJ_UINT32 num_threads)) opj_jp2_set_threads;
 
+        l_codec->opj_set_thread_pool =
+            (OPJ_BOOL(*)(void * p_codec, opj_thread_pool_t* tp)) opj_jp2_set_thread_pool;
+
         l_codec->m_codec = opj_jp2_create(OPJ_TRUE);
 
         if (! l_codec->m_codec) {
@@ -413,6 +419,33 @@ OPJ_BOOL OPJ_CALLCONV opj_codec_set_threads(opj_codec_t *p_codec,
     return OPJ_FALSE;
 }
 
+/* SumatraPDF */
+struct opj_thread_pool_t* OPJ_CALLCONV opj_take_shared_thread_pool(
+    int num_threads)
+{
+    return opj_thread_pool_take_shared(num_threads);
+}
+
+/* SumatraPDF */
+void OPJ_CALLCONV opj_give_back_shared_thread_pool(struct opj_thread_pool_t* tp)
+{
+    opj_thread_pool_give_back_shared(tp);
+}
+
+/* SumatraPDF */
+OPJ_BOOL OPJ_CALLCONV opj_codec_set_thread_pool(opj_codec_t *p_codec,
+        struct opj_thread_pool_t* tp)
+{
+    if (p_codec) {
+        opj_codec_private_t * l_codec = (opj_codec_private_t *) p_codec;
+
+        if (l_codec->opj_set_thread_pool) {
+            return l_codec->opj_set_thread_pool(l_codec->m_codec, tp);
+        }
+    }
+    return OPJ_FALSE;
+}
+
 OPJ_BOOL OPJ_CALLCONV opj_setup_decoder(opj_codec_t *p_codec,
                                         opj_dparameters_t *parameters
                                        )
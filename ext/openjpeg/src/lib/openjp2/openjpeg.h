@@ -1380,6 +1380,42 @@ OPJ_API OPJ_BOOL OPJ_CALLCONV opj_decoder_set_strict_mode(opj_codec_t *p_codec,
 OPJ_API OPJ_BOOL OPJ_CALLCONV opj_codec_set_threads(opj_codec_t *p_codec,
         int num_threads);
 
+/**
+ * SumatraPDF: Takes the thread pool shared by all decompressors of the
+ * process (one at a time, see opj_codec_set_thread_pool) so that its worker
+ * threads are only started once. The pool is created with num_threads
+ * threads by the first call and never destroyed.
+ *
+ * @param num_threads   number of threads if the pool is created.
+ *
+ * @return the thread pool or NULL if it's used by another decompressor.
+ */
+OPJ_API struct opj_thread_pool_t* OPJ_CALLCONV opj_take_shared_thread_pool(
+    int num_threads);
+
+/**
+ * SumatraPDF: Gives back a thread pool taken with opj_take_shared_thread_pool.
+ * The decompressor using it must have been destroyed.
+ */
+OPJ_API void OPJ_CALLCONV opj_give_back_shared_thread_pool(
+    struct opj_thread_pool_t* tp);
+
+/**
+ * SumatraPDF: Makes a decompressor use a thread pool taken with
+ * opj_take_shared_thread_pool instead of starting its own threads. The pool
+ * must not be used by any other decompressor until this one is destroyed.
+ *
+ * This function must be called after opj_setup_decoder() and before
+ * opj_read_header().
+ *
+ * @param p_codec       decompressor handler
+ * @param tp            shared thread pool.
+ *
+ * @return OPJ_TRUE     if the function is successful.
+ */
+OPJ_API OPJ_BOOL OPJ_CALLCONV opj_codec_set_thread_pool(opj_codec_t *p_codec,
+        struct opj_thread_pool_t* tp);
+
 /**
  * Decodes an image header.
  *
@@ -171,6 +171,9 @@ typedef struct opj_codec_private {
 
     /** Set number of threads */
     OPJ_BOOL(*opj_set_threads)(void * p_codec, OPJ_UINT32 num_threads);
+
+    /** SumatraPDF: use a shared thread pool (decompressors only) */
+    OPJ_BOOL(*opj_set_thread_pool)(void * p_codec, opj_thread_pool_t* tp);
 }
 opj_codec_private_t;
 
@@ -93,6 +93,12 @@ Deallocates or frees a memory block.
 */
 void opj_free(void * m);
 
+/* SumatraPDF: the allocation functions are provided by mupdf (load-jpx.c)
+   and allocate through a per thread context. Worker threads of a thread pool
+   have to use the allocation context of the thread which created the pool. */
+void * opj_get_thread_alloc_context(void);
+void opj_set_thread_alloc_context(void * alloc_ctx);
+
 #if defined(__GNUC__) && !defined(OPJ_SKIP_POISON)
 #pragma GCC poison malloc calloc realloc free
 #endif
@@ -282,6 +282,25 @@ void opj_thread_join(opj_thread_t* thread)
     opj_free(thread);
 }
 
+/* SumatraPDF: see opj_thread_pool_take_shared() */
+static volatile LONG shared_thread_pool_taken = 0;
+
+static OPJ_BOOL opj_shared_thread_pool_try_lock(void)
+{
+#if HAVE_INTERLOCKED_COMPARE_EXCHANGE
+    return InterlockedCompareExchange(&shared_thread_pool_taken, 1, 0) == 0;
+#else
+    return OPJ_FALSE;
+#endif
+}
+
+static void opj_shared_thread_pool_unlock(void)
+{
+#if HAVE_INTERLOCKED_COMPARE_EXCHANGE
+    InterlockedCompareExchange(&shared_thread_pool_taken, 0, 1);
+#endif
+}
+
 #elif MUTEX_pthread
 
 #include <pthread.h>
@@ -425,6 +444,27 @@ void opj_thread_join(opj_thread_t* thread)
     opj_free(thread);
 }
 
+/* SumatraPDF: see opj_thread_pool_take_shared() */
+static pthread_mutex_t shared_thread_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static OPJ_BOOL shared_thread_pool_taken = OPJ_FALSE;
+
+static OPJ_BOOL opj_shared_thread_pool_try_lock(void)
+{
+    OPJ_BOOL taken;
+    pthread_mutex_lock(&shared_thread_pool_mutex);
+    taken = !shared_thread_pool_taken;
+    shared_thread_pool_taken = OPJ_TRUE;
+    pthread_mutex_unlock(&shared_thread_pool_mutex);
+    return taken;
+}
+
+static void opj_shared_thread_pool_unlock(void)
+{
+    pthread_mutex_lock(&shared_thread_pool_mutex);
+    shared_thread_pool_taken = OPJ_FALSE;
+    pthread_mutex_unlock(&shared_thread_pool_mutex);
+}
+
 #else
 /* Stub implementation */
 
@@ -493,6 +533,15 @@ void opj_thread_join(opj_thread_t* thread)
     (void) thread;
 }
 
+static OPJ_BOOL opj_shared_thread_pool_try_lock(void)
+{
+    return OPJ_FALSE;
+}
+
+static void opj_shared_thread_pool_unlock(void)
+{
+}
+
 #endif
 
 typedef struct {
@@ -614,6 +663,8 @@ struct opj_thread_pool_t {
     int                              waiting_worker_thread_count;
     opj_tls_t*                       tls;
     int                              signaling_threshold;
+    /* SumatraPDF: see opj_get_thread_alloc_context() */
+    void*                            alloc_ctx;
 };
 
 static OPJ_BOOL opj_thread_pool_setup(opj_thread_pool_t* tp, int num_threads);
@@ -631,6 +682,7 @@ opj_thread_pool_t* opj_thread_pool_create(int num_threads)
         return NULL;
     }
     tp->state = OPJWTS_OK;
+    tp->alloc_ctx = opj_get_thread_alloc_context();
 
     if (num_threads <= 0) {
         tp->tls = opj_tls_new();
@@ -662,6 +714,7 @@ static void opj_worker_thread_function(void* user_data)
 
     worker_thread = (opj_worker_thread_t*) user_data;
     tp = worker_thread->tp;
+    opj_set_thread_alloc_context(tp->alloc_ctx);
     tls = opj_tls_new();
 
     while (OPJ_TRUE) {
@@ -679,6 +732,7 @@ static void opj_worker_thread_function(void* user_data)
     }
 
     opj_tls_destroy(tls);
+    opj_set_thread_alloc_context(NULL);
 }
 
 static OPJ_BOOL opj_thread_pool_setup(opj_thread_pool_t* tp, int num_threads)
@@ -952,3 +1006,29 @@ void opj_thread_pool_destroy(opj_thread_pool_t* tp)
     opj_tls_destroy(tp->tls);
     opj_free(tp);
 }
+
+/* SumatraPDF: the process wide pool is created by the first decompressor
+ * which takes it and is never destroyed (its threads wait for jobs) */
+static opj_thread_pool_t* shared_thread_pool = NULL;
+
+opj_thread_pool_t* opj_thread_pool_take_shared(int num_threads)
+{
+    if (!opj_shared_thread_pool_try_lock()) {
+        return NULL;
+    }
+    /* nobody else accesses shared_thread_pool while it's taken */
+    if (!shared_thread_pool) {
+        shared_thread_pool = opj_thread_pool_create(num_threads);
+    }
+    if (!shared_thread_pool) {
+        opj_shared_thread_pool_unlock();
+    }
+    return shared_thread_pool;
+}
+
+void opj_thread_pool_give_back_shared(opj_thread_pool_t* tp)
+{
+    if (tp) {
+        opj_shared_thread_pool_unlock();
+    }
+}
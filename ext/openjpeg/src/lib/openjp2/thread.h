@@ -249,6 +249,20 @@ int opj_thread_pool_get_thread_count(opj_thread_pool_t* tp);
  */
 void opj_thread_pool_destroy(opj_thread_pool_t* tp);
 
+/** SumatraPDF: Takes the thread pool shared by the whole process, creating it
+ * with num_threads threads the first time. Returns NULL if another decompressor
+ * is using it.
+ *
+ * @param num_threads the number of threads if the pool is created.
+ * @return the shared thread pool or NULL.
+ */
+opj_thread_pool_t* opj_thread_pool_take_shared(int num_threads);
+
+/** SumatraPDF: Gives back a pool returned by opj_thread_pool_take_shared().
+ * @param tp the thread pool handle (can be NULL).
+ */
+void opj_thread_pool_give_back_shared(opj_thread_pool_t* tp);
+
 /*@}*/
 
 /*@}*/
@@ -38,6 +38,7 @@ typedef struct fz_style_context fz_style_context;
 typedef struct fz_tuning_context fz_tuning_context;
 typedef struct fz_store fz_store;
 typedef struct fz_glyph_cache fz_glyph_cache;
+typedef struct fz_glyph_front_cache fz_glyph_front_cache;
 typedef struct fz_document_handler_context fz_document_handler_context;
 typedef struct fz_archive_handler_context fz_archive_handler_context;
 typedef struct fz_output fz_output;
@@ -518,6 +519,16 @@ void fz_tune_image_decode(fz_context *ctx, fz_tune_image_decode_fn *image_decode
 */
 void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, void *arg);
 
+/**
+	SumatraPDF: Set the number of threads used for decoding large
+	JPX images (0 or 1 decodes them on the calling thread). The
+	threads are shared by all contexts in the process (the first
+	context to decode a large JPX image decides their number) and
+	used by one decoder at a time (others decode on their calling
+	thread). Only contexts with the default allocator use them.
+*/
+void fz_tune_jpx_threads(fz_context *ctx, int threads);
+
 /**
 	Get the number of bits of antialiasing we are
 	using (for graphics). Between 0 and 8.
@@ -831,6 +842,8 @@ struct fz_context
 	int icc_enabled;
 #endif
 	int throw_on_repair;
+	/* SumatraPDF: recently used glyphs, in front of the shared glyph cache */
+	fz_glyph_front_cache *glyph_front;
 
 	/* TODO: should these be unshared? */
 	fz_document_handler_context *handler;
@@ -139,4 +139,11 @@ fz_image *fz_new_image_from_display_list(fz_context *ctx, float w, float h, fz_d
 */
 int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list);
 
+/**
+	SumatraPDF: Size of the display list in display nodes
+	(including their inline data). A rough measure of how
+	expensive the list is to run.
+*/
+size_t fz_display_list_len(fz_context *ctx, const fz_display_list *list);
+
 #endif
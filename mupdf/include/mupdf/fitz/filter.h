@@ -118,6 +118,16 @@ fz_stream *fz_open_rld(fz_context *ctx, fz_stream *chain);
 */
 fz_stream *fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int invert_cmyk, int l2factor, fz_stream *jpegtables);
 
+/*
+	SumatraPDF: tell a DCT decode stream (from fz_open_dctd, before it is
+	read from) that only the given region (in pixels of the possibly
+	subsampled output) is needed. Rows and columns outside of it are
+	still returned but aren't fully decoded and contain garbage.
+
+	Does nothing for other streams.
+*/
+void fz_dctd_set_region(fz_context *ctx, fz_stream *stm, fz_irect region);
+
 /**
 	faxd filter performs FAX decoding of data read from
 	the chained filter.
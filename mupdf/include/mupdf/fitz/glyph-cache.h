@@ -34,6 +34,35 @@
 */
 void fz_purge_glyph_cache(fz_context *ctx);
 
+/**
+	SumatraPDF: Set the number of bytes the glyph cache may use
+	(shared between all clones of the context), including the glyphs
+	held by the per-context front caches. Glyphs taking up more than
+	1/16th of it aren't cached. Pass 0 to restore the default of 1MB.
+*/
+void fz_set_glyph_cache_size(fz_context *ctx, size_t max_size);
+
+typedef struct
+{
+	size_t size;
+	size_t front_size;
+	size_t max_size;
+	int entries;
+	int buckets;
+	int hits;
+	int front_hits;
+	int misses;
+	int evictions;
+	size_t evicted;
+} fz_glyph_cache_stats;
+
+/**
+	SumatraPDF: Get usage statistics for the glyph cache. front_hits
+	counts lookups answered by the per-context front caches of this
+	context and of clones that have already been dropped.
+*/
+void fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats);
+
 /**
 	Create a pixmap containing a rendered glyph.
 
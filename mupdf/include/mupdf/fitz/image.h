@@ -414,6 +414,43 @@ void fz_set_compressed_image_buffer(fz_context *ctx, fz_compressed_image *cimg,
 fz_pixmap *fz_pixmap_image_tile(fz_context *ctx, fz_pixmap_image *cimg);
 void fz_set_pixmap_image_tile(fz_context *ctx, fz_pixmap_image *cimg, fz_pixmap *pix);
 
+/*
+	SumatraPDF: a process-wide cache of decoded image samples, shared
+	by all contexts (and thus by documents which don't share a store).
+
+	Tiles are identified by an md5 digest of the compressed image data,
+	everything which affects decoding and the requested subarea and
+	subsampling. They only contain plain samples, which are copied
+	into a new pixmap using the image's own colorspace on a hit, so no
+	context specific objects cross between contexts.
+
+	find returns a tile (to be given back with release) or NULL. store
+	must copy the samples. All callbacks can be called from any thread
+	and must not throw.
+*/
+typedef struct
+{
+	fz_irect rect; /* subarea actually decoded, in image coordinates */
+	int w, h, n, alpha;
+	int xres, yres;
+	int interpolate;
+	const unsigned char *samples; /* w * n bytes per row */
+} fz_shared_image_tile;
+
+typedef struct
+{
+	void *opaque;
+	const fz_shared_image_tile *(*find)(void *opaque, const unsigned char digest[16]);
+	void (*release)(void *opaque, const fz_shared_image_tile *tile);
+	void (*store)(void *opaque, const unsigned char digest[16], const fz_shared_image_tile *tile);
+} fz_shared_image_cache;
+
+/*
+	SumatraPDF: install (or with NULL remove) the shared image cache.
+	Not thread safe, must be done while no images are being decoded.
+*/
+void fz_set_shared_image_cache(const fz_shared_image_cache *cache);
+
 /* Implementation details: subject to change. */
 
 /**
@@ -421,6 +458,22 @@ void fz_set_pixmap_image_tile(fz_context *ctx, fz_pixmap_image *cimg, fz_pixmap
 */
 fz_pixmap *fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs);
 
+/**
+	SumatraPDF: Decode a JPX image at a reduced resolution. l2factor
+	is the requested log2 subsampling factor. On return it is the part
+	of it which still has to be applied to the returned pixmap (as not
+	all images have enough resolution levels).
+*/
+fz_pixmap *fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs, int *l2factor);
+
+/**
+	SumatraPDF: Get the size, colorspace and whether there's an alpha
+	channel of a JPX image the way fz_load_jpx picks them for the
+	colorspace cs, without decoding more than the lowest resolution
+	level.
+*/
+void fz_load_jpx_header(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs, int *w, int *h, int *alpha, fz_colorspace **cspacep);
+
 /**
 	Exposed because compression and decompression need to share this.
 */
@@ -388,6 +388,18 @@ int fz_store_scavenge_external(fz_context *ctx, size_t size, int *phase);
 */
 int fz_shrink_store(fz_context *ctx, unsigned int percent);
 
+/*
+	SumatraPDF: the total size of the objects in the store. If max
+	is non NULL, it is set to the store's limit.
+*/
+size_t fz_store_size(fz_context *ctx, size_t *max);
+
+/*
+	SumatraPDF: change the limit of the store (as given to
+	fz_new_context), evicting unused objects over the new limit.
+*/
+void fz_set_store_max(fz_context *ctx, size_t max);
+
 /**
 	Callback function called by fz_filter_store on every item within
 	the store.
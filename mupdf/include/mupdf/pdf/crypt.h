@@ -64,6 +64,13 @@ unsigned char *pdf_crypt_user_encryption(fz_context *ctx, pdf_crypt *crypt);
 unsigned char *pdf_crypt_permissions_encryption(fz_context *ctx, pdf_crypt *crypt);
 unsigned char *pdf_crypt_key(fz_context *ctx, pdf_crypt *crypt);
 
+/*
+	SumatraPDF: number of per-object key derivations that were
+	served from the derived key cache (hits) and that had to be
+	computed (misses).
+*/
+void pdf_crypt_key_cache_stats(fz_context *ctx, pdf_crypt *crypt, int *hits, int *misses);
+
 void pdf_print_crypt(fz_context *ctx, fz_output *out, pdf_crypt *crypt);
 
 void pdf_write_digest(fz_context *ctx, fz_output *out, pdf_obj *byte_range, pdf_obj *field, size_t digest_offset, size_t digest_length, pdf_pkcs7_signer *signer);
@@ -496,6 +496,10 @@ struct pdf_document
 
 	int resources_localised;
 
+	/* SumatraPDF: content streams with at least that many operators are
+	 * cached as bytecode, 0 disables it. see pdf_set_content_bytecode_threshold */
+	int content_bytecode_min_ops;
+
 	pdf_lexbuf_large lexbuf;
 
 	pdf_js *js;
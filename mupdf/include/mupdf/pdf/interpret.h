@@ -449,6 +449,23 @@ void pdf_process_glyph(fz_context *ctx, pdf_processor *proc, pdf_document *doc,
 */
 void pdf_process_raw_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_obj *rdb, pdf_obj *stmobj, fz_cookie *cookie);
 
+/*
+	SumatraPDF: content streams with at least min_ops operators are
+	compiled into a bytecode when they are first processed. It is kept
+	in the store and replayed instead of re-parsing the stream when the
+	stream is processed again. 0 disables the cache.
+
+	Smaller streams are cheap enough to parse again.
+*/
+#define PDF_CONTENT_BYTECODE_MIN_OPS 2000
+void pdf_set_content_bytecode_threshold(fz_context *ctx, pdf_document *doc, int min_ops);
+
+/*
+	SumatraPDF: drop the cached bytecode of content stream object num/gen
+	after the object or its data has changed.
+*/
+void pdf_drop_cached_content_bytecode(fz_context *ctx, pdf_document *doc, int num, int gen);
+
 /* Text handling helper functions */
 typedef struct
 {
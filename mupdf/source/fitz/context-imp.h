@@ -55,6 +55,10 @@ struct fz_tuning_context
 	void *image_decode_arg;
 	fz_tune_image_scale_fn *image_scale;
 	void *image_scale_arg;
+	/* SumatraPDF: see fz_tune_jpx_threads */
+	int jpx_threads;
+	/* OpenJPEG's worker threads allocate through this (see load-jpx.c) */
+	fz_alloc_context jpx_alloc;
 };
 
 void fz_default_image_decode(void *arg, int w, int h, int l2factor, fz_irect *subarea);
@@ -94,6 +94,7 @@ static void fz_new_tuning_context(fz_context *ctx)
 		ctx->tuning->refs = 1;
 		ctx->tuning->image_decode = fz_default_image_decode;
 		ctx->tuning->image_scale = fz_default_image_scale;
+		ctx->tuning->jpx_alloc = ctx->alloc;
 	}
 }
 
@@ -126,6 +127,11 @@ void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, v
 	ctx->tuning->image_scale_arg = arg;
 }
 
+void fz_tune_jpx_threads(fz_context *ctx, int threads)
+{
+	ctx->tuning->jpx_threads = threads;
+}
+
 static void fz_init_random_context(fz_context *ctx)
 {
 	if (!ctx)
@@ -267,6 +273,9 @@ fz_clone_context(fz_context *ctx)
 	/* Reset error context to initial state. */
 	fz_init_error_context(new_ctx);
 
+	/* SumatraPDF: the glyph front cache isn't shared */
+	new_ctx->glyph_front = NULL;
+
 	/* Then keep lock checking happy by keeping shared contexts with new context */
 	fz_keep_document_handler_context(new_ctx);
 	fz_keep_archive_handler_context(new_ctx);
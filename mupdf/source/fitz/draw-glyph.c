@@ -33,6 +33,20 @@
 
 #define GLYPH_HASH_LEN 509
 
+/* SumatraPDF: the bucket table grows as entries are added (up to
+ * GLYPH_HASH_MAX_LEN buckets) so that a larger budget doesn't turn
+ * into long bucket chains. */
+#define GLYPH_HASH_MAX_LEN (1<<20)
+#define GLYPH_HASH_LOAD 2
+
+/* SumatraPDF: every context keeps a small direct mapped cache of the
+ * glyphs it used most recently, so that repeated lookups don't need
+ * the shared glyph cache lock. */
+#define GLYPH_FRONT_LEN 64
+/* SumatraPDF: glyphs kept alive by front caches count towards the
+ * budget and may take at most this share of it between them. */
+#define GLYPH_FRONT_SHARE 4
+
 typedef struct
 {
 	fz_font *font;
@@ -58,13 +72,31 @@ struct fz_glyph_cache
 {
 	int refs;
 	size_t total;
-#ifndef NDEBUG
-	int num_evictions;
-	ptrdiff_t evicted;
-#endif
-	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
+	/* bytes of the glyphs held by all the front caches */
+	size_t front_total;
+	size_t max_size;
+	int num_entries;
+	int hash_len;
+	fz_glyph_cache_entry **entry;
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
+	int hits;
+	int front_hits;
+	int misses;
+	int num_evictions;
+	size_t evicted;
+};
+
+typedef struct
+{
+	fz_glyph_key key;
+	fz_glyph *val;
+} fz_glyph_front_entry;
+
+struct fz_glyph_front_cache
+{
+	int hits;
+	fz_glyph_front_entry entry[GLYPH_FRONT_LEN];
 };
 
 static size_t
@@ -81,6 +113,15 @@ fz_new_glyph_cache_context(fz_context *ctx)
 	fz_glyph_cache *cache;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
+	fz_try(ctx)
+		cache->entry = fz_calloc(ctx, GLYPH_HASH_LEN, sizeof(*cache->entry));
+	fz_catch(ctx)
+	{
+		fz_free(ctx, cache);
+		fz_rethrow(ctx);
+	}
+	cache->hash_len = GLYPH_HASH_LEN;
+	cache->max_size = MAX_CACHE_SIZE;
 	cache->total = 0;
 	cache->refs = 1;
 
@@ -106,12 +147,112 @@ drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
 	if (entry->bucket_prev)
 		entry->bucket_prev->bucket_next = entry->bucket_next;
 	else
-		cache->entry[entry->hash] = entry->bucket_next;
+		cache->entry[entry->hash % cache->hash_len] = entry->bucket_next;
+	cache->num_entries--;
 	fz_drop_font(ctx, entry->key.font);
 	fz_drop_glyph(ctx, entry->val);
 	fz_free(ctx, entry);
 }
 
+/* The glyph cache lock is always held when this function is called. */
+static void
+evict_glyphs(fz_context *ctx, fz_glyph_cache *cache)
+{
+	while (cache->total + cache->front_total > cache->max_size && cache->lru_tail)
+	{
+		cache->num_evictions++;
+		cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
+		drop_glyph_cache_entry(ctx, cache->lru_tail);
+	}
+}
+
+/* The glyph cache lock is always held when this function is called.
+ * Failing to grow the table isn't an error, the chains just get longer. */
+static void
+grow_glyph_cache_table(fz_context *ctx, fz_glyph_cache *cache)
+{
+	fz_glyph_cache_entry **table, *entry, *next;
+	int len = cache->hash_len * 2 + 1;
+	int i;
+
+	table = fz_calloc_no_throw(ctx, len, sizeof(*table));
+	if (!table)
+		return;
+	for (i = 0; i < cache->hash_len; i++)
+	{
+		for (entry = cache->entry[i]; entry; entry = next)
+		{
+			next = entry->bucket_next;
+			entry->bucket_prev = NULL;
+			entry->bucket_next = table[entry->hash % len];
+			if (entry->bucket_next)
+				entry->bucket_next->bucket_prev = entry;
+			table[entry->hash % len] = entry;
+		}
+	}
+	fz_free(ctx, cache->entry);
+	cache->entry = table;
+	cache->hash_len = len;
+}
+
+/* The glyph cache lock is always held when this function is called.
+ * Drops all the glyphs remembered by this context. */
+static void
+drop_glyph_front_cache(fz_context *ctx, fz_glyph_cache *cache)
+{
+	fz_glyph_front_cache *front = ctx->glyph_front;
+	int i;
+
+	if (!front)
+		return;
+	ctx->glyph_front = NULL;
+	for (i = 0; i < GLYPH_FRONT_LEN; i++)
+	{
+		if (front->entry[i].val)
+		{
+			cache->front_total -= fz_glyph_size(ctx, front->entry[i].val);
+			fz_drop_font(ctx, front->entry[i].key.font);
+			fz_drop_glyph(ctx, front->entry[i].val);
+		}
+	}
+	cache->front_hits += front->hits;
+	fz_free(ctx, front);
+}
+
+/* The glyph cache lock is always held when this function is called.
+ * Only glyphs from FreeType fonts are remembered: they don't reference
+ * any document objects and so stay valid after fz_purge_glyph_cache
+ * has been called from another context. */
+static void
+remember_glyph(fz_context *ctx, fz_glyph_cache *cache, const fz_glyph_key *key, unsigned hash, fz_glyph *val)
+{
+	fz_glyph_front_entry *fe;
+	size_t size = fz_glyph_size(ctx, val);
+	size_t old_size = 0;
+
+	if (!ctx->glyph_front)
+	{
+		ctx->glyph_front = fz_calloc_no_throw(ctx, 1, sizeof(fz_glyph_front_cache));
+		if (!ctx->glyph_front)
+			return;
+	}
+	fe = &ctx->glyph_front->entry[hash % GLYPH_FRONT_LEN];
+	if (fe->val)
+		old_size = fz_glyph_size(ctx, fe->val);
+	if (cache->front_total - old_size + size > cache->max_size / GLYPH_FRONT_SHARE)
+		return;
+	if (fe->val)
+	{
+		fz_drop_font(ctx, fe->key.font);
+		fz_drop_glyph(ctx, fe->val);
+	}
+	cache->front_total = cache->front_total - old_size + size;
+	fe->key = *key;
+	fe->val = fz_keep_glyph(ctx, val);
+	fz_keep_font(ctx, key->font);
+	evict_glyphs(ctx, cache);
+}
+
 /* The glyph cache lock is always held when this function is called. */
 static void
 do_purge(fz_context *ctx)
@@ -119,7 +260,7 @@ do_purge(fz_context *ctx)
 	fz_glyph_cache *cache = ctx->glyph_cache;
 	int i;
 
-	for (i = 0; i < GLYPH_HASH_LEN; i++)
+	for (i = 0; i < cache->hash_len; i++)
 	{
 		while (cache->entry[i])
 			drop_glyph_cache_entry(ctx, cache->entry[i]);
@@ -132,10 +273,45 @@ void
 fz_purge_glyph_cache(fz_context *ctx)
 {
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	drop_glyph_front_cache(ctx, ctx->glyph_cache);
 	do_purge(ctx);
 	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
 }
 
+void
+fz_set_glyph_cache_size(fz_context *ctx, size_t max_size)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	cache->max_size = max_size ? max_size : MAX_CACHE_SIZE;
+	evict_glyphs(ctx, cache);
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+}
+
+void
+fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	stats->size = cache->total;
+	stats->front_size = cache->front_total;
+	stats->max_size = cache->max_size;
+	stats->entries = cache->num_entries;
+	stats->buckets = cache->hash_len;
+	stats->hits = cache->hits;
+	stats->front_hits = cache->front_hits;
+	stats->misses = cache->misses;
+	stats->evictions = cache->num_evictions;
+	stats->evicted = cache->evicted;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+
+	/* hits in other live contexts are only added once they're dropped */
+	if (ctx->glyph_front)
+		stats->front_hits += ctx->glyph_front->hits;
+}
+
 void
 fz_drop_glyph_cache_context(fz_context *ctx)
 {
@@ -143,10 +319,12 @@ fz_drop_glyph_cache_context(fz_context *ctx)
 		return;
 
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	drop_glyph_front_cache(ctx, ctx->glyph_cache);
 	ctx->glyph_cache->refs--;
 	if (ctx->glyph_cache->refs == 0)
 	{
 		do_purge(ctx);
+		fz_free(ctx, ctx->glyph_cache->entry);
 		fz_free(ctx, ctx->glyph_cache);
 		ctx->glyph_cache = NULL;
 	}
@@ -284,8 +462,9 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	fz_irect subpix_scissor;
 	float size;
 	fz_glyph *val;
-	int do_cache, locked, caching;
+	int do_cache, locked, caching, remember;
 	fz_glyph_cache_entry *entry;
+	fz_glyph_front_entry *fe;
 	unsigned hash;
 	int is_ft_font = !!fz_font_ft_face(ctx, font);
 
@@ -322,20 +501,36 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.d = subpix_ctm.d * 65536;
 	key.aa = aa;
 
-	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
+	hash = do_hash((unsigned char *)&key, sizeof(key));
+	remember = do_cache && is_ft_font;
+	if (remember && ctx->glyph_front)
+	{
+		fe = &ctx->glyph_front->entry[hash % GLYPH_FRONT_LEN];
+		if (fe->val && memcmp(&fe->key, &key, sizeof(key)) == 0)
+		{
+			ctx->glyph_front->hits++;
+			return fz_keep_glyph(ctx, fe->val);
+		}
+	}
+
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	entry = cache->entry[hash];
+	entry = cache->entry[hash % cache->hash_len];
 	while (entry)
 	{
 		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
 		{
 			move_to_front(cache, entry);
+			cache->hits++;
 			val = fz_keep_glyph(ctx, entry->val);
+			if (remember)
+				remember_glyph(ctx, cache, &key, hash, val);
 			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
 			return val;
 		}
 		entry = entry->bucket_next;
 	}
+	if (do_cache)
+		cache->misses++;
 
 	locked = 1;
 	caching = 0;
@@ -370,7 +565,10 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		}
 		if (val && do_cache)
 		{
-			if (val->w < MAX_GLYPH_SIZE && val->h < MAX_GLYPH_SIZE)
+			/* SumatraPDF: with a larger budget, larger glyphs are worth
+			 * caching as well (the default budget keeps the old limit
+			 * of 256x256 pixels) */
+			if (fz_glyph_size(ctx, val) <= cache->max_size / 16)
 			{
 				/* If we throw an exception whilst caching,
 				 * just ignore the exception and carry on. */
@@ -379,7 +577,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				{
 					/* We had to unlock. Someone else might
 					 * have rendered in the meantime */
-					entry = cache->entry[hash];
+					entry = cache->entry[hash % cache->hash_len];
 					while (entry)
 					{
 						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
@@ -396,10 +594,11 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
 				entry->key = key;
 				entry->hash = hash;
-				entry->bucket_next = cache->entry[hash];
+				entry->bucket_next = cache->entry[hash % cache->hash_len];
 				if (entry->bucket_next)
 					entry->bucket_next->bucket_prev = entry;
-				cache->entry[hash] = entry;
+				cache->entry[hash % cache->hash_len] = entry;
+				cache->num_entries++;
 				entry->val = fz_keep_glyph(ctx, val);
 				fz_keep_font(ctx, key.font);
 
@@ -411,14 +610,11 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				cache->lru_head = entry;
 
 				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
-				{
-#ifndef NDEBUG
-					cache->num_evictions++;
-					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
-				}
+				evict_glyphs(ctx, cache);
+				if (cache->num_entries > cache->hash_len * GLYPH_HASH_LOAD && cache->hash_len < GLYPH_HASH_MAX_LEN)
+					grow_glyph_cache_table(ctx, cache);
+				if (remember)
+					remember_glyph(ctx, cache, &key, hash, val);
 			}
 		}
 unlock_and_return_val:
@@ -480,9 +676,10 @@ fz_render_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm,
 void
 fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
-	fz_write_printf(ctx, out, "Glyph Cache Size: %zu\n", cache->total);
-#ifndef NDEBUG
-	fz_write_printf(ctx, out, "Glyph Cache Evictions: %d (%zu bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+	fz_glyph_cache_stats stats;
+	fz_get_glyph_cache_stats(ctx, &stats);
+	fz_write_printf(ctx, out, "Glyph Cache Size: %zu (max %zu)\n", stats.size, stats.max_size);
+	fz_write_printf(ctx, out, "Glyph Cache Entries: %d in %d buckets\n", stats.entries, stats.buckets);
+	fz_write_printf(ctx, out, "Glyph Cache Lookups: %d hits, %d front hits, %d misses\n", stats.hits, stats.front_hits, stats.misses);
+	fz_write_printf(ctx, out, "Glyph Cache Evictions: %d (%zu bytes)\n", stats.evictions, stats.evicted);
 }
@@ -30,6 +30,30 @@ typedef void * backing_store_ptr;
 #include "jmemcust.h"
 #endif
 
+/* SumatraPDF: the parts of jpegint.h needed to skip decoding outside of a
+ * region of interest (jpeglib.h only declares them). These have been the
+ * same in all libjpeg versions since 6b. */
+typedef void (*fz_jpeg_idct_fn)(j_decompress_ptr cinfo, jpeg_component_info *compptr, JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col);
+typedef void (*fz_jpeg_color_convert_fn)(j_decompress_ptr cinfo, JSAMPIMAGE input_buf, JDIMENSION input_row, JSAMPARRAY output_buf, int num_rows);
+
+struct jpeg_inverse_dct
+{
+	void (*start_pass)(j_decompress_ptr cinfo);
+	fz_jpeg_idct_fn inverse_DCT[MAX_COMPONENTS];
+};
+
+struct jpeg_color_deconverter
+{
+	void (*start_pass)(j_decompress_ptr cinfo);
+	fz_jpeg_color_convert_fn color_convert;
+};
+
+#if JPEG_LIB_VERSION >= 70
+#define MIN_DCT_V_SCALED_SIZE(cinfo) ((cinfo)->min_DCT_v_scaled_size)
+#else
+#define MIN_DCT_V_SCALED_SIZE(cinfo) ((cinfo)->min_DCT_scaled_size)
+#endif
+
 typedef struct
 {
 	fz_stream *chain;
@@ -49,6 +73,12 @@ typedef struct
 	jmp_buf jb;
 	char msg[JMSG_LENGTH_MAX];
 
+	/* SumatraPDF: see fz_dctd_set_region() */
+	int has_region;
+	fz_irect region;
+	fz_jpeg_idct_fn idct[MAX_COMPONENTS];
+	fz_jpeg_color_convert_fn color_convert;
+
 	unsigned char buffer[4096];
 } fz_dctd;
 
@@ -196,6 +226,58 @@ static void invert_cmyk(unsigned char *p, int n)
 		p[i] = 255 - p[i];
 }
 
+/* SumatraPDF: blocks whose output doesn't touch the region (with a margin
+ * of a block, as fancy upsampling looks at neighbouring samples) are left
+ * undecoded. Entropy decoding can't be skipped. */
+static void
+idct_region_dct(j_decompress_ptr cinfo, jpeg_component_info *compptr, JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+	fz_dctd *state = JZ_DCT_STATE_FROM_CINFO(cinfo);
+	int row_h = cinfo->max_v_samp_factor * MIN_DCT_V_SCALED_SIZE(cinfo);
+	int margin = 2 * DCTSIZE * cinfo->max_h_samp_factor;
+	int x = (int)(((int64_t)output_col * cinfo->output_width) / compptr->downsampled_width);
+
+	if (((int)cinfo->output_iMCU_row + 2) * row_h <= state->region.y0)
+		return;
+	if (x >= state->region.x1 + margin || x + margin <= state->region.x0)
+		return;
+	state->idct[compptr->component_index](cinfo, compptr, coef_block, output_buf, output_col);
+}
+
+/* SumatraPDF: rows above the region aren't converted to the output colorspace */
+static void
+color_convert_region_dct(j_decompress_ptr cinfo, JSAMPIMAGE input_buf, JDIMENSION input_row, JSAMPARRAY output_buf, int num_rows)
+{
+	fz_dctd *state = JZ_DCT_STATE_FROM_CINFO(cinfo);
+
+	if ((int)cinfo->output_scanline + num_rows <= state->region.y0)
+		return;
+	state->color_convert(cinfo, input_buf, input_row, output_buf, num_rows);
+}
+
+static void
+start_region_dct(fz_dctd *state)
+{
+	j_decompress_ptr cinfo = &state->cinfo;
+	int ci;
+
+	if (state->region.x0 <= 0 && state->region.y0 <= 0 && state->region.x1 >= (int)cinfo->output_width)
+		return;
+
+	/* The IDCT and color conversion methods are set up for the output
+	 * pass by jpeg_start_decompress and aren't changed afterwards. */
+	for (ci = 0; ci < cinfo->num_components; ci++)
+	{
+		state->idct[ci] = cinfo->idct->inverse_DCT[ci];
+		cinfo->idct->inverse_DCT[ci] = idct_region_dct;
+	}
+	if (cinfo->cconvert && state->region.y0 > 0)
+	{
+		state->color_convert = cinfo->cconvert->color_convert;
+		cinfo->cconvert->color_convert = color_convert_region_dct;
+	}
+}
+
 static int
 next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 {
@@ -265,6 +347,8 @@ next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 			cinfo->scale_denom = 8;
 
 			jpeg_start_decompress(cinfo);
+			if (state->has_region)
+				start_region_dct(state);
 
 			state->stride = cinfo->output_width * cinfo->output_components;
 			state->scanline = Memento_label(fz_malloc(ctx, state->stride), "dct_scanline");
@@ -349,6 +433,20 @@ close_dctd(fz_context *ctx, void *state_)
 	fz_free(ctx, state);
 }
 
+void
+fz_dctd_set_region(fz_context *ctx, fz_stream *stm, fz_irect region)
+{
+	fz_dctd *state;
+
+	if (stm->next != next_dctd)
+		return;
+	state = stm->state;
+	if (state->init)
+		return;
+	state->has_region = 1;
+	state->region = region;
+}
+
 fz_stream *
 fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int invert_cmyk, int l2factor, fz_stream *jpegtables)
 {
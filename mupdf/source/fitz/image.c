@@ -46,6 +46,9 @@ struct fz_compressed_image
 {
 	fz_image super;
 	fz_compressed_buffer *buffer;
+	/* SumatraPDF: see shared_image_digest() */
+	int shared_digest_state; /* 0: not computed, 1: valid, -1: not shareable */
+	unsigned char shared_digest[16];
 };
 
 struct fz_pixmap_image
@@ -445,6 +448,9 @@ subarea_next(fz_context *ctx, fz_stream *stm, size_t len)
 
 	stm->wp = stm->rp = NULL;
 
+	/* SumatraPDF: don't decode the rows below the subarea just to skip them */
+	if (state->lines == 0)
+		return EOF;
 	while (state->nskip > 0)
 	{
 		n = fz_skip(ctx, state->src, state->nskip);
@@ -452,8 +458,6 @@ subarea_next(fz_context *ctx, fz_stream *stm, size_t len)
 			return EOF;
 		state->nskip -= n;
 	}
-	if (state->lines == 0)
-		return EOF;
 	n = fz_available(ctx, state->src, state->nread);
 	if (n > state->nread)
 		n = state->nread;
@@ -804,7 +808,8 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 		tile = fz_load_jxr(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
 	case FZ_IMAGE_JPX:
-		tile = fz_load_jpx(ctx, image->buffer->buffer->data, image->buffer->buffer->len, image->super.colorspace);
+		/* SumatraPDF: only decode the resolution levels which are needed */
+		tile = fz_load_jpx_reduced(ctx, image->buffer->buffer->data, image->buffer->buffer->len, image->super.colorspace, l2factor);
 		break;
 	case FZ_IMAGE_PSD:
 		tile = fz_load_psd(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
@@ -835,6 +840,17 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 		{
 			if (l2factor)
 				native_l2factor -= *l2factor;
+			/* SumatraPDF: only decode the blocks of a JPEG which cover the subarea */
+			if (subarea && image->buffer->params.type == FZ_IMAGE_JPEG)
+			{
+				int f = 1 << native_l2factor;
+				fz_irect region;
+				region.x0 = subarea->x0 >> native_l2factor;
+				region.y0 = subarea->y0 >> native_l2factor;
+				region.x1 = (subarea->x1 + f - 1) >> native_l2factor;
+				region.y1 = (subarea->y1 + f - 1) >> native_l2factor;
+				fz_dctd_set_region(ctx, stm, region);
+			}
 			indexed = fz_colorspace_is_indexed(ctx, image->super.colorspace);
 			can_sub = 1;
 			tile = fz_decomp_image_from_stream(ctx, stm, image, subarea, indexed, native_l2factor, l2factor);
@@ -932,6 +948,495 @@ fz_find_image_tile(fz_context *ctx, fz_image *image, fz_image_key *key, fz_matri
 	return NULL;
 }
 
+/* SumatraPDF: large images which are drawn in parts (e.g. a scanned page
+ * rendered in tiles at a high zoom level) are decoded into blocks of
+ * IMAGE_BLOCK_SIZE x IMAGE_BLOCK_SIZE pixels at the requested subsampling
+ * level. The blocks are kept in the store individually, so that panning
+ * only has to decode the parts of the image that haven't been seen before
+ * (or have been evicted) and can assemble everything else from blocks. */
+#define IMAGE_BLOCK_SIZE 256
+/* Smaller images (at the subsampling level) are cached as a whole */
+#define IMAGE_BLOCK_MIN_PIXELS (1024 * 1024)
+/* Larger subareas are decoded and cached as usual */
+#define IMAGE_BLOCK_MAX_COUNT 256
+
+static void
+store_image_block(fz_context *ctx, fz_image *image, int l2factor, const fz_irect *rect, fz_pixmap *block)
+{
+	fz_image_key *keyp = NULL;
+	fz_pixmap *existing;
+
+	fz_var(keyp);
+
+	fz_try(ctx)
+	{
+		keyp = fz_malloc_struct(ctx, fz_image_key);
+		keyp->refs = 1;
+		keyp->image = fz_keep_image_store_key(ctx, image);
+		keyp->l2factor = l2factor;
+		keyp->rect = *rect;
+		existing = fz_store_item(ctx, keyp, block, fz_pixmap_size(ctx, block), &fz_image_store_type);
+		fz_drop_pixmap(ctx, existing);
+	}
+	fz_always(ctx)
+		fz_drop_image_key(ctx, keyp);
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
+		fz_report_error(ctx);
+	}
+}
+
+/* Copy the part of src (covering src_rect of the image) which covers rect
+ * into dst (covering dst_rect), both subsampled by l2factor. */
+static void
+copy_image_block(fz_pixmap *dst, const fz_irect *dst_rect, fz_pixmap *src, const fz_irect *src_rect, const fz_irect *rect, int l2factor)
+{
+	int f = 1 << l2factor;
+	int w = (rect->x1 - rect->x0 + f - 1) >> l2factor;
+	int h = (rect->y1 - rect->y0 + f - 1) >> l2factor;
+	unsigned char *s = src->samples + ((rect->y0 - src_rect->y0) >> l2factor) * src->stride + ((rect->x0 - src_rect->x0) >> l2factor) * src->n;
+	unsigned char *d = dst->samples + ((rect->y0 - dst_rect->y0) >> l2factor) * dst->stride + ((rect->x0 - dst_rect->x0) >> l2factor) * dst->n;
+
+	while (h--)
+	{
+		memcpy(d, s, (size_t)w * src->n);
+		s += src->stride;
+		d += dst->stride;
+	}
+}
+
+/* Cut every block fully covered by tile out of it and store them. */
+static void
+store_image_blocks(fz_context *ctx, fz_image *image, int l2factor, fz_pixmap *tile, const fz_irect *tile_rect)
+{
+	int f = 1 << l2factor;
+	int bs = IMAGE_BLOCK_SIZE << l2factor;
+	fz_pixmap *block = NULL;
+	fz_image_key key;
+	fz_irect r;
+	int bx, by;
+
+	fz_var(block);
+
+	key.refs = 1;
+	key.image = image;
+	key.l2factor = l2factor;
+
+	for (by = (tile_rect->y0 + bs - 1) / bs; by * bs < tile_rect->y1; by++)
+	{
+		for (bx = (tile_rect->x0 + bs - 1) / bs; bx * bs < tile_rect->x1; bx++)
+		{
+			r.x0 = bx * bs;
+			r.y0 = by * bs;
+			r.x1 = fz_mini(r.x0 + bs, image->w);
+			r.y1 = fz_mini(r.y0 + bs, image->h);
+			if (r.x1 > tile_rect->x1 || r.y1 > tile_rect->y1)
+				continue;
+			if (((r.x1 - tile_rect->x0 + f - 1) >> l2factor) > tile->w || ((r.y1 - tile_rect->y0 + f - 1) >> l2factor) > tile->h)
+				continue;
+			key.rect = r;
+			block = fz_find_item(ctx, fz_drop_pixmap_imp, &key, &fz_image_store_type);
+			if (block)
+			{
+				fz_drop_pixmap(ctx, block);
+				block = NULL;
+				continue;
+			}
+
+			fz_try(ctx)
+			{
+				block = fz_new_pixmap(ctx, tile->colorspace, (r.x1 - r.x0 + f - 1) >> l2factor, (r.y1 - r.y0 + f - 1) >> l2factor, tile->seps, tile->alpha);
+				block->xres = tile->xres;
+				block->yres = tile->yres;
+				block->flags = (block->flags & ~FZ_PIXMAP_FLAG_INTERPOLATE) | (tile->flags & FZ_PIXMAP_FLAG_INTERPOLATE);
+				copy_image_block(block, &r, tile, tile_rect, &r, l2factor);
+				store_image_block(ctx, image, l2factor, &r, block);
+			}
+			fz_always(ctx)
+			{
+				fz_drop_pixmap(ctx, block);
+				block = NULL;
+			}
+			fz_catch(ctx)
+			{
+				fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
+				fz_report_error(ctx);
+			}
+		}
+	}
+}
+
+/* Returns a pixmap covering at least *rect (which is updated to the area it
+ * does cover) made from blocks, or NULL if the image isn't cached in blocks. */
+static fz_pixmap *
+get_image_blocks(fz_context *ctx, fz_image *image, int l2factor, fz_irect *rect)
+{
+	int f = 1 << l2factor;
+	int bs = IMAGE_BLOCK_SIZE << l2factor;
+	int bx0, by0, bx1, by1, bx, by, i, n;
+	fz_pixmap **blocks = NULL;
+	fz_pixmap *decoded = NULL;
+	fz_pixmap *tile = NULL;
+	fz_irect missing = fz_empty_irect;
+	fz_irect decoded_rect = fz_empty_irect;
+	fz_irect covered;
+	fz_image_key key;
+	int mismatch = 0;
+
+	if (image->get_pixmap != compressed_image_get_pixmap || (image->use_colorkey && image->mask))
+		return NULL;
+	if ((int64_t)((image->w + f - 1) >> l2factor) * ((image->h + f - 1) >> l2factor) < IMAGE_BLOCK_MIN_PIXELS)
+		return NULL;
+	if (rect->x0 == 0 && rect->y0 == 0 && rect->x1 == image->w && rect->y1 == image->h)
+		return NULL;
+
+	bx0 = rect->x0 / bs;
+	by0 = rect->y0 / bs;
+	bx1 = (rect->x1 + bs - 1) / bs;
+	by1 = (rect->y1 + bs - 1) / bs;
+	n = (bx1 - bx0) * (by1 - by0);
+	if (n <= 0 || n > IMAGE_BLOCK_MAX_COUNT)
+		return NULL;
+
+	covered.x0 = bx0 * bs;
+	covered.y0 = by0 * bs;
+	covered.x1 = fz_mini(bx1 * bs, image->w);
+	covered.y1 = fz_mini(by1 * bs, image->h);
+
+	fz_var(tile);
+	fz_var(decoded);
+	fz_var(mismatch);
+
+	blocks = fz_calloc(ctx, n, sizeof(*blocks));
+	fz_try(ctx)
+	{
+		key.refs = 1;
+		key.image = image;
+		key.l2factor = l2factor;
+		for (i = 0, by = by0; by < by1; by++)
+		{
+			for (bx = bx0; bx < bx1; bx++, i++)
+			{
+				key.rect.x0 = bx * bs;
+				key.rect.y0 = by * bs;
+				key.rect.x1 = fz_mini(key.rect.x0 + bs, image->w);
+				key.rect.y1 = fz_mini(key.rect.y0 + bs, image->h);
+				blocks[i] = fz_find_item(ctx, fz_drop_pixmap_imp, &key, &fz_image_store_type);
+				if (blocks[i])
+					continue;
+				if (fz_is_empty_irect(missing))
+					missing = key.rect;
+				else
+				{
+					missing.x0 = fz_mini(missing.x0, key.rect.x0);
+					missing.y0 = fz_mini(missing.y0, key.rect.y0);
+					missing.x1 = fz_maxi(missing.x1, key.rect.x1);
+					missing.y1 = fz_maxi(missing.y1, key.rect.y1);
+				}
+			}
+		}
+
+		if (!fz_is_empty_irect(missing))
+		{
+			/* Decode what's missing (the decoder might return more) */
+			int l2factor_remaining = l2factor;
+			decoded_rect = missing;
+			decoded = image->get_pixmap(ctx, image, &decoded_rect, (image->w + f - 1) >> l2factor, (image->h + f - 1) >> l2factor, &l2factor_remaining);
+			if (l2factor_remaining)
+				fz_subsample_pixmap(ctx, decoded, l2factor_remaining);
+			store_image_blocks(ctx, image, l2factor, decoded, &decoded_rect);
+		}
+
+		/* Assemble the blocks we found and the ones we decoded */
+		for (i = 0, by = by0; by < by1; by++)
+		{
+			for (bx = bx0; bx < bx1; bx++, i++)
+			{
+				fz_pixmap *src = blocks[i] ? blocks[i] : decoded;
+				fz_irect r;
+				r.x0 = bx * bs;
+				r.y0 = by * bs;
+				r.x1 = fz_mini(r.x0 + bs, image->w);
+				r.y1 = fz_mini(r.y0 + bs, image->h);
+				if (!tile)
+				{
+					tile = fz_new_pixmap(ctx, src->colorspace, (covered.x1 - covered.x0 + f - 1) >> l2factor, (covered.y1 - covered.y0 + f - 1) >> l2factor, src->seps, src->alpha);
+					tile->xres = src->xres;
+					tile->yres = src->yres;
+					tile->flags = (tile->flags & ~FZ_PIXMAP_FLAG_INTERPOLATE) | (src->flags & FZ_PIXMAP_FLAG_INTERPOLATE);
+				}
+				if (src->n != tile->n)
+					mismatch = 1;
+				else if (blocks[i])
+					copy_image_block(tile, &covered, src, &r, &r, l2factor);
+				else if (decoded_rect.x0 <= r.x0 && decoded_rect.y0 <= r.y0 && decoded_rect.x1 >= r.x1 && decoded_rect.y1 >= r.y1 &&
+					((r.x1 - decoded_rect.x0 + f - 1) >> l2factor) <= src->w && ((r.y1 - decoded_rect.y0 + f - 1) >> l2factor) <= src->h)
+					copy_image_block(tile, &covered, src, &decoded_rect, &r, l2factor);
+				else
+					mismatch = 1;
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < n; i++)
+			fz_drop_pixmap(ctx, blocks[i]);
+		fz_free(ctx, blocks);
+		fz_drop_pixmap(ctx, decoded);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, tile);
+		fz_rethrow(ctx);
+	}
+
+	/* Shouldn't happen, decode the usual way */
+	if (mismatch)
+	{
+		fz_drop_pixmap(ctx, tile);
+		return NULL;
+	}
+
+	*rect = covered;
+	return tile;
+}
+
+/* SumatraPDF: see fz_set_shared_image_cache() */
+static const fz_shared_image_cache *shared_image_cache;
+
+void
+fz_set_shared_image_cache(const fz_shared_image_cache *cache)
+{
+	shared_image_cache = cache;
+}
+
+/* Colorspaces of different documents are different objects, so they're
+ * identified by what they are: ICC colorspaces by the md5 of their profile. */
+static void
+md5_colorspace(fz_context *ctx, fz_md5 *md5, fz_colorspace *cs)
+{
+	int info[3] = { 0 };
+	int i;
+
+	if (cs)
+	{
+		info[0] = cs->type;
+		info[1] = cs->n;
+		info[2] = cs->flags & (FZ_COLORSPACE_IS_DEVICE | FZ_COLORSPACE_IS_ICC);
+	}
+	fz_md5_update(md5, (unsigned char *)info, sizeof(info));
+	if (!cs)
+		return;
+	if (cs->name)
+		fz_md5_update(md5, (unsigned char *)cs->name, strlen(cs->name) + 1);
+#if FZ_ENABLE_ICC
+	if (cs->flags & FZ_COLORSPACE_IS_ICC)
+		fz_md5_update(md5, cs->u.icc.md5, 16);
+#endif
+	if (cs->type == FZ_COLORSPACE_SEPARATION)
+	{
+		for (i = 0; i < cs->n; i++)
+			if (cs->u.separation.colorant[i])
+				fz_md5_update(md5, (unsigned char *)cs->u.separation.colorant[i], strlen(cs->u.separation.colorant[i]) + 1);
+		md5_colorspace(ctx, md5, cs->u.separation.base);
+	}
+}
+
+/* Only the fields used by params->type are hashed as the others
+ * (and any padding) are undefined. */
+static void
+md5_compression_params(fz_md5 *md5, const fz_compression_params *params)
+{
+	int info[9] = { 0 };
+
+	info[0] = params->type;
+	switch (params->type)
+	{
+	case FZ_IMAGE_JPEG:
+		info[1] = params->u.jpeg.color_transform;
+		info[2] = params->u.jpeg.invert_cmyk;
+		break;
+	case FZ_IMAGE_JPX:
+		info[1] = params->u.jpx.smask_in_data;
+		break;
+	case FZ_IMAGE_FAX:
+		info[1] = params->u.fax.columns;
+		info[2] = params->u.fax.rows;
+		info[3] = params->u.fax.k;
+		info[4] = params->u.fax.end_of_line;
+		info[5] = params->u.fax.encoded_byte_align;
+		info[6] = params->u.fax.end_of_block;
+		info[7] = params->u.fax.black_is_1;
+		info[8] = params->u.fax.damaged_rows_before_error;
+		break;
+	case FZ_IMAGE_FLATE:
+		info[1] = params->u.flate.columns;
+		info[2] = params->u.flate.colors;
+		info[3] = params->u.flate.predictor;
+		info[4] = params->u.flate.bpc;
+		break;
+	case FZ_IMAGE_LZW:
+		info[1] = params->u.lzw.columns;
+		info[2] = params->u.lzw.colors;
+		info[3] = params->u.lzw.predictor;
+		info[4] = params->u.lzw.bpc;
+		info[5] = params->u.lzw.early_change;
+		break;
+	}
+	fz_md5_update(md5, (unsigned char *)info, sizeof(info));
+}
+
+/* Digest of the compressed data and everything else that determines
+ * the decoded samples. JBIG2 globals, palettes and /Matte masks live
+ * outside of the image, so those images are never shared.
+ * An image can be used by several threads (e.g. rendering bands of a page)
+ * so the digest is computed without a lock and published under FZ_LOCK_ALLOC. */
+static int
+compressed_image_digest(fz_context *ctx, fz_compressed_image *cimg, unsigned char digest[16])
+{
+	fz_image *image = &cimg->super;
+	fz_compressed_buffer *cbuf = cimg->buffer;
+	fz_md5 md5;
+	int info[8];
+	int state;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	state = cimg->shared_digest_state;
+	if (state > 0)
+		memcpy(digest, cimg->shared_digest, 16);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (state)
+		return state > 0;
+
+	if (!cbuf || !cbuf->buffer || cbuf->params.type == FZ_IMAGE_JBIG2 ||
+		fz_colorspace_is_indexed(ctx, image->colorspace) ||
+		(image->use_colorkey && image->mask))
+	{
+		state = -1;
+	}
+	else
+	{
+		info[0] = image->w;
+		info[1] = image->h;
+		info[2] = image->n;
+		info[3] = image->bpc;
+		info[4] = image->imagemask;
+		info[5] = image->interpolate;
+		info[6] = image->use_colorkey;
+		info[7] = image->use_decode;
+
+		fz_md5_init(&md5);
+		fz_md5_update(&md5, (unsigned char *)info, sizeof(info));
+		md5_colorspace(ctx, &md5, image->colorspace);
+		if (image->use_colorkey)
+			fz_md5_update(&md5, (unsigned char *)image->colorkey, image->n * 2 * sizeof(image->colorkey[0]));
+		fz_md5_update(&md5, (unsigned char *)image->decode, image->n * 2 * sizeof(image->decode[0]));
+		md5_compression_params(&md5, &cbuf->params);
+		fz_md5_update(&md5, cbuf->buffer->data, cbuf->buffer->len);
+		fz_md5_final(&md5, digest);
+		state = 1;
+	}
+
+	/* another thread might have got here first, with the same result */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (state > 0)
+		memcpy(cimg->shared_digest, digest, 16);
+	cimg->shared_digest_state = state;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	return state > 0;
+}
+
+/* Digest of a tile decoded from the image at the given subarea and
+ * subsampling. Returns 0 if the image can't be shared. */
+static int
+shared_image_digest(fz_context *ctx, fz_image *image, const fz_image_key *key, unsigned char digest[16])
+{
+	fz_compressed_image *cimg = (fz_compressed_image *)image;
+	unsigned char image_digest[16];
+	fz_md5 md5;
+	int info[5];
+
+	if (!shared_image_cache || image->get_pixmap != compressed_image_get_pixmap)
+		return 0;
+	if (!compressed_image_digest(ctx, cimg, image_digest))
+		return 0;
+
+	info[0] = key->l2factor;
+	info[1] = key->rect.x0;
+	info[2] = key->rect.y0;
+	info[3] = key->rect.x1;
+	info[4] = key->rect.y1;
+
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, image_digest, 16);
+	fz_md5_update(&md5, (unsigned char *)info, sizeof(info));
+	fz_md5_final(&md5, digest);
+	return 1;
+}
+
+static fz_pixmap *
+find_shared_image_tile(fz_context *ctx, fz_image *image, const unsigned char digest[16], fz_irect *rect)
+{
+	const fz_shared_image_tile *shared;
+	fz_pixmap *tile = NULL;
+
+	shared = shared_image_cache->find(shared_image_cache->opaque, digest);
+	if (!shared)
+		return NULL;
+
+	fz_var(tile);
+
+	fz_try(ctx)
+	{
+		if (shared->n == fz_colorspace_n(ctx, image->colorspace) + shared->alpha)
+		{
+			tile = fz_new_pixmap(ctx, image->colorspace, shared->w, shared->h, NULL, shared->alpha);
+			memcpy(tile->samples, shared->samples, (size_t)tile->stride * tile->h);
+			tile->xres = shared->xres;
+			tile->yres = shared->yres;
+			if (shared->interpolate)
+				tile->flags |= FZ_PIXMAP_FLAG_INTERPOLATE;
+			else
+				tile->flags &= ~FZ_PIXMAP_FLAG_INTERPOLATE;
+			*rect = shared->rect;
+		}
+	}
+	fz_always(ctx)
+		shared_image_cache->release(shared_image_cache->opaque, shared);
+	fz_catch(ctx)
+	{
+		/* Decode it ourselves instead */
+		fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
+		fz_report_error(ctx);
+		tile = NULL;
+	}
+
+	return tile;
+}
+
+static void
+store_shared_image_tile(fz_context *ctx, fz_image *image, const unsigned char digest[16], const fz_irect *rect, fz_pixmap *tile)
+{
+	fz_shared_image_tile shared;
+
+	/* Only plain samples in the image's own colorspace can be copied
+	 * into a pixmap of another context. */
+	if (tile->colorspace != image->colorspace || tile->s != 0 || tile->stride != (ptrdiff_t)tile->w * tile->n)
+		return;
+
+	shared.rect = *rect;
+	shared.w = tile->w;
+	shared.h = tile->h;
+	shared.n = tile->n;
+	shared.alpha = tile->alpha;
+	shared.xres = tile->xres;
+	shared.yres = tile->yres;
+	shared.interpolate = (tile->flags & FZ_PIXMAP_FLAG_INTERPOLATE) != 0;
+	shared.samples = tile->samples;
+	shared_image_cache->store(shared_image_cache->opaque, digest, &shared);
+}
+
 fz_pixmap *
 fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subarea, fz_matrix *ctm, int *dw, int *dh)
 {
@@ -941,6 +1446,8 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 	fz_image_key *keyp = NULL;
 	int w;
 	int h;
+	unsigned char shared_digest[16];
+	int shared;
 
 	fz_var(keyp);
 
@@ -1017,24 +1524,69 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 	if (subarea)
 		fz_compute_image_key(ctx, image, ctm, &key, subarea, l2factor, &w, &h, dw, dh);
 
-	/* We'll have to decode the image; request the correct amount of downscaling. */
-	l2factor_remaining = l2factor;
-	tile = image->get_pixmap(ctx, image, &key.rect, w, h, &l2factor_remaining);
-
-	/* Update the ctm to allow for subareas. */
-	update_ctm_for_subarea(ctm, &key.rect, image->w, image->h);
+	/* SumatraPDF: assemble parts of large images from cached blocks */
+	if (subarea)
+	{
+		fz_irect rect = key.rect;
+		tile = get_image_blocks(ctx, image, l2factor, &rect);
+		if (tile)
+		{
+			/* The tile covers more than requested, so it needs to be
+			 * scaled to a larger size as well. Without a ctm, the
+			 * image is at its natural size. */
+			if (ctm)
+			{
+				float frac_w = (float)(rect.x1 - rect.x0) / image->w;
+				float frac_h = (float)(rect.y1 - rect.y0) / image->h;
+				if (dw)
+					*dw = frac_w * sqrtf(ctm->a * ctm->a + ctm->b * ctm->b);
+				if (dh)
+					*dh = frac_h * sqrtf(ctm->c * ctm->c + ctm->d * ctm->d);
+			}
+			else
+			{
+				if (dw)
+					*dw = rect.x1 - rect.x0;
+				if (dh)
+					*dh = rect.y1 - rect.y0;
+			}
+			update_ctm_for_subarea(ctm, &rect, image->w, image->h);
+			return tile;
+		}
+	}
 
-	/* l2factor_remaining is updated to the amount of subscaling left to do */
-	assert(l2factor_remaining >= 0 && l2factor_remaining <= 6);
-	if (l2factor_remaining)
+	/* SumatraPDF: another document may already have decoded the same image */
+	key.l2factor = l2factor;
+	shared = shared_image_digest(ctx, image, &key, shared_digest);
+	tile = shared ? find_shared_image_tile(ctx, image, shared_digest, &key.rect) : NULL;
+	if (tile)
 	{
-		fz_try(ctx)
-			fz_subsample_pixmap(ctx, tile, l2factor_remaining);
-		fz_catch(ctx)
+		update_ctm_for_subarea(ctm, &key.rect, image->w, image->h);
+	}
+	else
+	{
+		/* We'll have to decode the image; request the correct amount of downscaling. */
+		l2factor_remaining = l2factor;
+		tile = image->get_pixmap(ctx, image, &key.rect, w, h, &l2factor_remaining);
+
+		/* Update the ctm to allow for subareas. */
+		update_ctm_for_subarea(ctm, &key.rect, image->w, image->h);
+
+		/* l2factor_remaining is updated to the amount of subscaling left to do */
+		assert(l2factor_remaining >= 0 && l2factor_remaining <= 6);
+		if (l2factor_remaining)
 		{
-			fz_drop_pixmap(ctx, tile);
-			fz_rethrow(ctx);
+			fz_try(ctx)
+				fz_subsample_pixmap(ctx, tile, l2factor_remaining);
+			fz_catch(ctx)
+			{
+				fz_drop_pixmap(ctx, tile);
+				fz_rethrow(ctx);
+			}
 		}
+
+		if (shared)
+			store_shared_image_tile(ctx, image, shared_digest, &key.rect, tile);
 	}
 
 	fz_try(ctx)
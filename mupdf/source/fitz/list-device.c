@@ -1699,6 +1699,12 @@ int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list)
 	return !list || list->len == 0;
 }
 
+/* SumatraPDF */
+size_t fz_display_list_len(fz_context *ctx, const fz_display_list *list)
+{
+	return list ? list->len : 0;
+}
+
 void
 fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie)
 {
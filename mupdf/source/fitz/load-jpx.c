@@ -22,9 +22,11 @@
 
 #include "mupdf/fitz.h"
 
+#include "context-imp.h"
 #include "pixmap-imp.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <string.h>
 
 #if FZ_ENABLE_JPX
@@ -69,6 +71,7 @@ typedef struct
 	fz_colorspace *cs;
 	int xres;
 	int yres;
+	int alpha;
 } fz_jpxd;
 
 typedef struct
@@ -104,6 +107,14 @@ typedef struct
 */
 __declspec(thread) static fz_context *opj_secret = NULL;
 
+/* SumatraPDF: OpenJPEG's worker threads (see opj_codec_set_threads) don't
+ * have a context. They call the allocator of the decoding thread's context
+ * directly, without taking FZ_LOCK_ALLOC (and thus without scavenging):
+ * the decoding thread may hold that lock while it waits for them. This
+ * requires a thread safe allocator, such as the default one.
+ */
+__declspec(thread) static const fz_alloc_context *opj_worker_alloc = NULL;
+
 static void set_opj_context(fz_context *ctx)
 {
 	opj_secret = ctx;
@@ -114,24 +125,39 @@ static fz_context *get_opj_context(void)
 	return opj_secret;
 }
 
-void opj_lock(fz_context *ctx)
+/* SumatraPDF: thread pools are only created for the tuning context (which
+ * outlives the clone of the context that might create it) */
+void *opj_get_thread_alloc_context(void)
+{
+	fz_context *ctx = get_opj_context();
+
+	return (void *)(ctx ? &ctx->tuning->jpx_alloc : opj_worker_alloc);
+}
+
+void opj_set_thread_alloc_context(void *alloc_ctx)
 {
-	fz_ft_lock(ctx);
+	opj_worker_alloc = (const fz_alloc_context *)alloc_ctx;
+}
 
+/* SumatraPDF: the context is per thread, so calls into OpenJPEG no longer
+ * need to be serialized (which also made all JPX decoding wait on each other) */
+void opj_lock(fz_context *ctx)
+{
 	set_opj_context(ctx);
 }
 
 void opj_unlock(fz_context *ctx)
 {
 	set_opj_context(NULL);
-
-	fz_ft_unlock(ctx);
 }
 
 void *opj_malloc(size_t size)
 {
 	fz_context *ctx = get_opj_context();
 
+	if (ctx == NULL && opj_worker_alloc != NULL)
+		return size ? opj_worker_alloc->malloc(opj_worker_alloc->user, size) : NULL;
+
 	assert(ctx != NULL);
 
 	return Memento_label(fz_malloc_no_throw(ctx, size), "opj_malloc");
@@ -141,6 +167,19 @@ void *opj_calloc(size_t n, size_t size)
 {
 	fz_context *ctx = get_opj_context();
 
+	if (ctx == NULL && opj_worker_alloc != NULL)
+	{
+		void *p;
+		if (n == 0 || size == 0)
+			return NULL;
+		if (n > SIZE_MAX / size)
+			return NULL;
+		p = opj_worker_alloc->malloc(opj_worker_alloc->user, n * size);
+		if (p)
+			memset(p, 0, n * size);
+		return p;
+	}
+
 	assert(ctx != NULL);
 
 	return fz_calloc_no_throw(ctx, n, size);
@@ -150,6 +189,18 @@ void *opj_realloc(void *ptr, size_t size)
 {
 	fz_context *ctx = get_opj_context();
 
+	if (ctx == NULL && opj_worker_alloc != NULL)
+	{
+		if (size == 0)
+		{
+			opj_worker_alloc->free(opj_worker_alloc->user, ptr);
+			return NULL;
+		}
+		if (ptr == NULL)
+			return opj_worker_alloc->malloc(opj_worker_alloc->user, size);
+		return opj_worker_alloc->realloc(opj_worker_alloc->user, ptr, size);
+	}
+
 	assert(ctx != NULL);
 
 	return fz_realloc_no_throw(ctx, ptr, size);
@@ -159,6 +210,13 @@ void opj_free(void *ptr)
 {
 	fz_context *ctx = get_opj_context();
 
+	if (ctx == NULL && opj_worker_alloc != NULL)
+	{
+		if (ptr)
+			opj_worker_alloc->free(opj_worker_alloc->user, ptr);
+		return;
+	}
+
 	assert(ctx != NULL);
 
 	fz_free(ctx, ptr);
@@ -373,7 +431,7 @@ template_copy_comp(unsigned char *dst0, int w, int h, int stride, const OPJ_INT3
 }
 
 static void
-copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
+copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx, int32_t x0, int32_t y0)
 {
 	unsigned char *dst;
 	int stride, comps;
@@ -392,8 +450,8 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 		OPJ_UINT32 cdy = comp->dy;
 		OPJ_UINT32 cw = comp->w;
 		OPJ_UINT32 ch = comp->h;
-		int32_t oy = safe_mul32(ctx, comp->y0, cdy) - jpx->y0;
-		int32_t ox = safe_mul32(ctx, comp->x0, cdx) - jpx->x0;
+		int32_t oy = safe_mul32(ctx, comp->y0, cdy) - y0;
+		int32_t ox = safe_mul32(ctx, comp->x0, cdx) - x0;
 		unsigned char *dst0 = dst + oy * stride;
 		int prec = comp->prec;
 		int sgnd = comp->sgnd;
@@ -419,8 +477,77 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 	}
 }
 
+/* SumatraPDF: the number of resolution levels which can be dropped from
+ * all components (as far as the main header tells) */
+static int
+jpx_max_reduce(opj_codec_t *codec)
+{
+	opj_codestream_info_v2_t *info = opj_get_cstr_info(codec);
+	int reduce = 0;
+	OPJ_UINT32 k;
+
+	if (!info)
+		return 0;
+	if (info->m_default_tile_info.tccp_info && info->nbcomps > 0)
+	{
+		reduce = INT_MAX;
+		for (k = 0; k < info->nbcomps; k++)
+		{
+			int numres = (int)info->m_default_tile_info.tccp_info[k].numresolutions;
+			if (numres - 1 < reduce)
+				reduce = numres - 1;
+		}
+		if (reduce < 0)
+			reduce = 0;
+	}
+	opj_destroy_cstr_info(&info);
+	return reduce;
+}
+
+/* SumatraPDF: smaller images aren't worth waking threads for */
+#define JPX_MIN_THREADED_SIZE (256 * 1024)
+
+/* SumatraPDF: returns OpenJPEG's process wide thread pool (creating it with
+ * the context's number of JPX threads if needed) unless another decoder is
+ * using it, so that the number of worker threads doesn't grow with the
+ * number of open documents. it has to be given back with
+ * jpx_release_thread_pool */
+static struct opj_thread_pool_t *
+jpx_take_thread_pool(fz_context *ctx)
+{
+	struct opj_thread_pool_t *tp;
+	const fz_alloc_context *worker_alloc;
+
+	if (ctx->tuning->jpx_threads <= 1 || !opj_has_thread_support())
+		return NULL;
+	/* the pool outlives the context which creates it, so its workers
+	 * allocate through the default allocator, which all contexts using
+	 * the pool must share */
+	if (memcmp(&ctx->alloc, &fz_alloc_default, sizeof(fz_alloc_context)) != 0)
+		return NULL;
+
+	worker_alloc = opj_worker_alloc;
+	set_opj_context(NULL);
+	opj_worker_alloc = &fz_alloc_default;
+	tp = opj_take_shared_thread_pool(ctx->tuning->jpx_threads);
+	opj_worker_alloc = worker_alloc;
+	set_opj_context(ctx);
+	return tp;
+}
+
+static void
+jpx_release_thread_pool(fz_context *ctx, struct opj_thread_pool_t *tp)
+{
+	opj_give_back_shared_thread_pool(tp);
+}
+
+/* SumatraPDF: reduce is the number of resolution levels to drop (halving the
+ * size for each) and is reset to 0 if that can't be done. onlymeta only
+ * decodes the lowest resolution level (which is needed for the number
+ * of color and alpha channels). tp is a thread pool for decoding code-blocks
+ * (see jpx_take_thread_pool) or NULL */
 static fz_pixmap *
-jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta)
+jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta, int *reduce, struct opj_thread_pool_t *tp)
 {
 	fz_pixmap *img = NULL;
 	opj_dparameters_t params;
@@ -432,6 +559,8 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 	int w, h;
 	stream_block sb;
 	OPJ_UINT32 i;
+	int32_t x0, y0;
+	int r = 0;
 
 	fz_var(img);
 
@@ -458,6 +587,10 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_LIBRARY, "j2k decode failed");
 	}
 
+	/* SumatraPDF: decode code-blocks of large images on worker threads */
+	if (tp)
+		opj_codec_set_thread_pool(codec, tp);
+
 	stream = opj_stream_default_create(OPJ_TRUE);
 	sb.data = data;
 	sb.pos = 0;
@@ -477,6 +610,18 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_LIBRARY, "Failed to read JPX header");
 	}
 
+	/* SumatraPDF: only decode the resolution levels which are needed */
+	if (onlymeta || (reduce && *reduce > 0))
+	{
+		r = jpx_max_reduce(codec);
+		if (!onlymeta && r > *reduce)
+			r = *reduce;
+		if (r > 0 && !opj_set_decoded_resolution_factor(codec, (OPJ_UINT32)r))
+			r = 0;
+	}
+	if (reduce)
+		*reduce = r;
+
 	if (!opj_decode(codec, stream, jpx))
 	{
 		opj_stream_destroy(stream);
@@ -511,8 +656,17 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		}
 	}
 
+	state->alpha = !!a;
 	w = state->width = jpx->x1 - jpx->x0;
 	h = state->height = jpx->y1 - jpx->y0;
+	/* SumatraPDF: the reference grid of a reduced resolution decode */
+	x0 = (int32_t)(((int64_t)jpx->x0 + (1 << r) - 1) >> r);
+	y0 = (int32_t)(((int64_t)jpx->y0 + (1 << r) - 1) >> r);
+	if (r > 0)
+	{
+		w = (int32_t)(((int64_t)jpx->x1 + (1 << r) - 1) >> r) - x0;
+		h = (int32_t)(((int64_t)jpx->y1 + (1 << r) - 1) >> r) - y0;
+	}
 	state->xres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 	state->yres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 
@@ -587,7 +741,7 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		a = !!a; /* ignore any superfluous alpha channels */
 		img = fz_new_pixmap(ctx, state->cs, w, h, NULL, a);
 		fz_clear_pixmap_with_value(ctx, img, 0);
-		copy_jpx_to_pixmap(ctx, img, jpx);
+		copy_jpx_to_pixmap(ctx, img, jpx, x0, y0);
 
 		if (jpx->color_space == OPJ_CLRSPC_SYCC && n == 3 && a == 0)
 			jpx_ycc_to_rgb(ctx, img, 1, 1);
@@ -610,23 +764,72 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 
 fz_pixmap *
 fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs)
+{
+	return fz_load_jpx_reduced(ctx, data, size, defcs, NULL);
+}
+
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *l2factor)
 {
 	fz_jpxd state = { 0 };
 	fz_pixmap *pix = NULL;
+	int reduce = l2factor ? *l2factor : 0;
+	struct opj_thread_pool_t *tp = NULL;
+
+	fz_var(tp);
 
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		pix = jpx_read_image(ctx, &state, data, size, defcs, 0);
+		if (size >= JPX_MIN_THREADED_SIZE)
+			tp = jpx_take_thread_pool(ctx);
+		fz_try(ctx)
+			pix = jpx_read_image(ctx, &state, data, size, defcs, 0, &reduce, tp);
+		fz_catch(ctx)
+		{
+			/* SumatraPDF: tiles may have fewer resolution levels than the main header */
+			if (reduce == 0)
+				fz_rethrow(ctx);
+			fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
+			fz_report_error(ctx);
+			reduce = 0;
+			pix = jpx_read_image(ctx, &state, data, size, defcs, 0, &reduce, tp);
+		}
 	}
 	fz_always(ctx)
+	{
+		jpx_release_thread_pool(ctx, tp);
 		opj_unlock(ctx);
+	}
 	fz_catch(ctx)
 		fz_rethrow(ctx);
 
+	if (l2factor)
+		*l2factor -= reduce;
 	return pix;
 }
 
+void
+fz_load_jpx_header(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *wp, int *hp, int *alphap, fz_colorspace **cspacep)
+{
+	fz_jpxd state = { 0 };
+
+	fz_try(ctx)
+	{
+		opj_lock(ctx);
+		jpx_read_image(ctx, &state, data, size, defcs, 1, NULL, NULL);
+	}
+	fz_always(ctx)
+		opj_unlock(ctx);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	*cspacep = state.cs;
+	*wp = state.width;
+	*hp = state.height;
+	*alphap = state.alpha;
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -635,7 +838,7 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		jpx_read_image(ctx, &state, data, size, NULL, 1);
+		jpx_read_image(ctx, &state, data, size, NULL, 1, NULL, NULL);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -657,6 +860,18 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "JPX support disabled");
 }
 
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *l2factor)
+{
+	fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "JPX support disabled");
+}
+
+void
+fz_load_jpx_header(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *wp, int *hp, int *alphap, fz_colorspace **cspacep)
+{
+	fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "JPX support disabled");
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
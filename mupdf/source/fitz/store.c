@@ -36,8 +36,19 @@ typedef struct fz_item
 	struct fz_item *prev;
 	fz_store *store;
 	const fz_store_type *type;
+	/* SumatraPDF: chain of items with unhashable keys in the same bucket */
+	struct fz_item *bucket_next;
+	struct fz_item *bucket_prev;
+	int in_bucket;
 } fz_item;
 
+/* SumatraPDF: items whose keys can't be hashed used to be found by walking
+ * the whole LRU list with FZ_LOCK_ALLOC held, which stalls every other
+ * renderer sharing the store. Partition them by their drop function so that
+ * a lookup only walks items of the same kind. The LRU list (and therefore
+ * eviction and scavenging order) is unchanged. */
+#define FZ_STORE_UNHASHED_BUCKETS 32
+
 /* Every entry in fz_store is protected by the alloc lock */
 struct fz_store
 {
@@ -52,6 +63,9 @@ struct fz_store
 	 * entries (those whose keys are indirect objects). */
 	fz_hash_table *hash;
 
+	/* SumatraPDF: the other entries, partitioned by drop function */
+	fz_item *unhashed[FZ_STORE_UNHASHED_BUCKETS];
+
 	/* We keep track of the size of the store, and keep it below max. */
 	size_t max;
 	size_t size;
@@ -100,6 +114,61 @@ void *fz_keep_key_storable(fz_context *ctx, const fz_key_storable *sc)
 	return fz_keep_storable(ctx, &sc->storable);
 }
 
+/* SumatraPDF */
+static fz_item **
+unhashed_bucket(fz_store *store, fz_store_drop_fn *drop)
+{
+	uintptr_t h = (uintptr_t)drop;
+	h ^= h >> 7;
+	return &store->unhashed[(h >> 4) % FZ_STORE_UNHASHED_BUCKETS];
+}
+
+static void
+link_unhashed(fz_store *store, fz_item *item)
+{
+	fz_item **bucket = unhashed_bucket(store, item->val->drop);
+	item->bucket_prev = NULL;
+	item->bucket_next = *bucket;
+	if (*bucket)
+		(*bucket)->bucket_prev = item;
+	*bucket = item;
+	item->in_bucket = 1;
+}
+
+/*
+	Unlink an item from the LRU list (if it made it there) and
+	from its unhashed bucket (if any). Entered with FZ_LOCK_ALLOC held.
+*/
+static void
+unlink_item(fz_store *store, fz_item *item)
+{
+	/* Momentarily things can be in the hash table without being
+	 * in the list. Don't attempt to unlink these. We indicate
+	 * such items by setting item->next == item. */
+	if (item->next != item)
+	{
+		if (item->next)
+			item->next->prev = item->prev;
+		else
+			store->tail = item->prev;
+		if (item->prev)
+			item->prev->next = item->next;
+		else
+			store->head = item->next;
+	}
+	if (item->in_bucket)
+	{
+		if (item->bucket_next)
+			item->bucket_next->bucket_prev = item->bucket_prev;
+		if (item->bucket_prev)
+			item->bucket_prev->bucket_next = item->bucket_next;
+		else
+			*unhashed_bucket(store, item->val->drop) = item->bucket_next;
+		item->bucket_next = item->bucket_prev = NULL;
+		item->in_bucket = 0;
+	}
+}
+
 /*
 	Entered with FZ_LOCK_ALLOC held.
 	Drops FZ_LOCK_ALLOC.
@@ -135,14 +204,7 @@ do_reap(fz_context *ctx)
 		store->size -= item->size;
 
 		/* Unlink from the linked list */
-		if (item->next)
-			item->next->prev = item->prev;
-		else
-			store->tail = item->prev;
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			store->head = item->next;
+		unlink_item(store, item);
 
 		/* Remove from the hash table */
 		if (item->type->make_hash_key)
@@ -280,14 +342,7 @@ evict(fz_context *ctx, fz_item *item)
 
 	store->size -= item->size;
 	/* Unlink from the linked list */
-	if (item->next)
-		item->next->prev = item->prev;
-	else
-		store->tail = item->prev;
-	if (item->prev)
-		item->prev->next = item->next;
-	else
-		store->head = item->next;
+	unlink_item(store, item);
 
 	/* Drop a reference to the value (freeing if required) */
 	if (item->val->refs > 0)
@@ -352,14 +407,7 @@ ensure_space(fz_context *ctx, size_t tofree)
 		store->size -= item->size;
 
 		/* Unlink from the linked list */
-		if (item->next)
-			item->next->prev = item->prev;
-		else
-			store->tail = item->prev;
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			store->head = item->next;
+		unlink_item(store, item);
 
 		/* Remove from the hash table */
 		if (item->type->make_hash_key)
@@ -568,6 +616,8 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 
 	/* Regardless of whether it's indexed, it goes into the linked list */
 	touch(store, item);
+	if (!use_hash)
+		link_unhashed(store, item);
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	return NULL;
@@ -601,8 +651,8 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_
 	}
 	else
 	{
-		/* Others we have to hunt for slowly */
-		for (item = store->head; item; item = item->next)
+		/* Others we have to hunt for slowly, but only among their kind */
+		for (item = *unhashed_bucket(store, drop); item; item = item->bucket_next)
 		{
 			if (item->val->drop == drop && !type->cmp_key(ctx, item->key, key))
 				break;
@@ -654,27 +704,14 @@ fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_stor
 	}
 	else
 	{
-		/* Others we have to hunt for slowly */
-		for (item = store->head; item; item = item->next)
+		/* Others we have to hunt for slowly, but only among their kind */
+		for (item = *unhashed_bucket(store, drop); item; item = item->bucket_next)
 			if (item->val->drop == drop && !type->cmp_key(ctx, item->key, key))
 				break;
 	}
 	if (item)
 	{
-		/* Momentarily things can be in the hash table without being
-		 * in the list. Don't attempt to unlink these. We indicate
-		 * such items by setting item->next == item. */
-		if (item->next != item)
-		{
-			if (item->next)
-				item->next->prev = item->prev;
-			else
-				store->tail = item->prev;
-			if (item->prev)
-				item->prev->next = item->next;
-			else
-				store->head = item->next;
-		}
+		unlink_item(store, item);
 		if (item->val->refs > 0)
 			(void)Memento_dropRef(item->val);
 		dodrop = (item->val->refs > 0 && --item->val->refs == 0);
@@ -1004,6 +1041,44 @@ fz_shrink_store(fz_context *ctx, unsigned int percent)
 	return success;
 }
 
+/* SumatraPDF: see store.h */
+size_t
+fz_store_size(fz_context *ctx, size_t *max)
+{
+	fz_store *store = ctx->store;
+	size_t size;
+
+	if (store == NULL)
+	{
+		if (max)
+			*max = 0;
+		return 0;
+	}
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	size = store->size;
+	if (max)
+		*max = store->max;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return size;
+}
+
+void
+fz_set_store_max(fz_context *ctx, size_t max)
+{
+	fz_store *store = ctx->store;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	store->max = max;
+	if (max != FZ_STORE_UNLIMITED && store->size > max)
+		scavenge(ctx, store->size - max);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
 void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const fz_store_type *type)
 {
 	fz_store *store;
@@ -1030,14 +1105,7 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 		store->size -= item->size;
 
 		/* Unlink from the linked list */
-		if (item->next)
-			item->next->prev = item->prev;
-		else
-			store->tail = item->prev;
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			store->head = item->next;
+		unlink_item(store, item);
 
 		/* Remove from the hash table */
 		if (item->type->make_hash_key)
@@ -40,6 +40,25 @@ typedef struct
 	int length;
 } pdf_crypt_filter;
 
+/* SumatraPDF: per-object keys are derived with an MD5 over the file key
+   and the object number/generation every time a string or stream is
+   decrypted. The same fonts, images and resources are reopened on every
+   page render, so remember the most recently derived keys (and their
+   expanded AES decryption schedules). Protected by FZ_LOCK_ALLOC. */
+#define PDF_CRYPT_KEY_CACHE_SIZE 128
+
+typedef struct
+{
+	int num;
+	int gen;
+	int method;
+	int length;
+	int key_len; /* 0 if the slot is empty */
+	unsigned char key[16];
+	int has_aes;
+	fz_aes aes;
+} pdf_crypt_key_entry;
+
 struct pdf_crypt
 {
 	pdf_obj *id;
@@ -60,6 +79,12 @@ struct pdf_crypt
 	int encrypt_metadata;
 
 	unsigned char key[32]; /* decryption key generated from password */
+
+	/* SumatraPDF: derived object key cache, valid for key_cache_key */
+	unsigned char key_cache_key[32];
+	pdf_crypt_key_entry key_cache[PDF_CRYPT_KEY_CACHE_SIZE];
+	int key_cache_hits;
+	int key_cache_misses;
 };
 
 static void pdf_parse_crypt_filter(fz_context *ctx, pdf_crypt_filter *cf, pdf_crypt *crypt, pdf_obj *name);
@@ -1057,7 +1082,7 @@ pdf_crypt_permissions_encryption(fz_context *ctx, pdf_crypt *crypt)
  */
 
 static int
-pdf_compute_object_key(pdf_crypt *crypt, pdf_crypt_filter *cf, int num, int gen, unsigned char *key, int max_len)
+pdf_derive_object_key(pdf_crypt *crypt, pdf_crypt_filter *cf, int num, int gen, unsigned char *key, int max_len)
 {
 	fz_md5 md5;
 	unsigned char message[5];
@@ -1094,6 +1119,131 @@ pdf_compute_object_key(pdf_crypt *crypt, pdf_crypt_filter *cf, int num, int gen,
 	return key_len + 5;
 }
 
+/* SumatraPDF: must be called with FZ_LOCK_ALLOC held */
+static pdf_crypt_key_entry *
+pdf_lookup_key_cache_entry(pdf_crypt *crypt, pdf_crypt_filter *cf, int num, int gen, int *found)
+{
+	pdf_crypt_key_entry *entry;
+	unsigned int h = ((unsigned int)num * 31 + (unsigned int)gen) % PDF_CRYPT_KEY_CACHE_SIZE;
+
+	/* the file key can be replaced after authentication (e.g. when a
+	   remembered key is restored), which invalidates all derived keys */
+	if (memcmp(crypt->key_cache_key, crypt->key, sizeof crypt->key))
+	{
+		memset(crypt->key_cache, 0, sizeof crypt->key_cache);
+		memcpy(crypt->key_cache_key, crypt->key, sizeof crypt->key);
+	}
+
+	entry = &crypt->key_cache[h];
+	*found = entry->key_len > 0 && entry->num == num && entry->gen == gen &&
+		entry->method == cf->method && entry->length == crypt->length;
+	return entry;
+}
+
+static int
+pdf_compute_object_key(fz_context *ctx, pdf_crypt *crypt, pdf_crypt_filter *cf, int num, int gen, unsigned char *key, int max_len)
+{
+	pdf_crypt_key_entry *entry;
+	unsigned char derived[16];
+	int found, key_len;
+
+	/* nothing is derived for these, the file key is used as is */
+	if (crypt->v == 0 || cf->method == PDF_CRYPT_AESV3)
+		return pdf_derive_object_key(crypt, cf, num, gen, key, max_len);
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	entry = pdf_lookup_key_cache_entry(crypt, cf, num, gen, &found);
+	if (found)
+	{
+		crypt->key_cache_hits++;
+		key_len = fz_mini(entry->key_len, max_len);
+		memcpy(key, entry->key, key_len);
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		return key_len;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	/* derive outside of the lock; another thread might derive the same key
+	   concurrently, which is harmless */
+	key_len = pdf_derive_object_key(crypt, cf, num, gen, key, max_len);
+	if (key_len > (int)sizeof derived)
+		return key_len;
+	memcpy(derived, key, key_len);
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	entry = pdf_lookup_key_cache_entry(crypt, cf, num, gen, &found);
+	crypt->key_cache_misses++;
+	if (!found)
+	{
+		entry->num = num;
+		entry->gen = gen;
+		entry->method = cf->method;
+		entry->length = crypt->length;
+		entry->key_len = key_len;
+		memcpy(entry->key, derived, key_len);
+		entry->has_aes = 0;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return key_len;
+}
+
+/* fz_aes keeps a pointer into its own round key buffer */
+static void
+pdf_copy_aes(fz_aes *dst, const fz_aes *src)
+{
+	*dst = *src;
+	dst->rk = dst->buf + (src->rk - src->buf);
+}
+
+/* SumatraPDF: expanded AES decryption schedule for the key derived for (num, gen) */
+static void
+pdf_compute_object_aes_dec(fz_context *ctx, pdf_crypt *crypt, pdf_crypt_filter *cf, int num, int gen, unsigned char *key, int keylen, fz_aes *aes)
+{
+	pdf_crypt_key_entry *entry;
+	int found = 0;
+
+	if (crypt->v != 0 && cf->method == PDF_CRYPT_AESV2)
+	{
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		entry = pdf_lookup_key_cache_entry(crypt, cf, num, gen, &found);
+		found = found && entry->has_aes;
+		if (found)
+			pdf_copy_aes(aes, &entry->aes);
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		if (found)
+			return;
+	}
+
+	if (fz_aes_setkey_dec(aes, key, keylen * 8))
+		fz_throw(ctx, FZ_ERROR_FORMAT, "AES key init failed (keylen=%d)", keylen * 8);
+
+	if (crypt->v != 0 && cf->method == PDF_CRYPT_AESV2)
+	{
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		entry = pdf_lookup_key_cache_entry(crypt, cf, num, gen, &found);
+		if (found && !entry->has_aes)
+		{
+			pdf_copy_aes(&entry->aes, aes);
+			entry->has_aes = 1;
+		}
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+	}
+}
+
+void
+pdf_crypt_key_cache_stats(fz_context *ctx, pdf_crypt *crypt, int *hits, int *misses)
+{
+	*hits = 0;
+	*misses = 0;
+	if (!crypt)
+		return;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	*hits = crypt->key_cache_hits;
+	*misses = crypt->key_cache_misses;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
 /*
  * PDF 1.7 algorithm 3.1 and ExtensionLevel 3 algorithm 3.1a
  *
@@ -1110,8 +1260,19 @@ static int is_signature(fz_context *ctx, pdf_obj *obj)
 	return 0;
 }
 
+/* SumatraPDF: the AES schedule is only expanded for the first encrypted string */
+typedef struct
+{
+	int num;
+	int gen;
+	unsigned char key[32];
+	int keylen;
+	int has_aes;
+	fz_aes aes;
+} pdf_crypt_obj_state;
+
 static void
-pdf_crypt_obj_imp(fz_context *ctx, pdf_crypt *crypt, pdf_obj *obj, unsigned char *key, int keylen)
+pdf_crypt_obj_imp(fz_context *ctx, pdf_crypt *crypt, pdf_obj *obj, pdf_crypt_obj_state *st)
 {
 	unsigned char *s;
 	int i;
@@ -1127,7 +1288,7 @@ pdf_crypt_obj_imp(fz_context *ctx, pdf_crypt *crypt, pdf_obj *obj, unsigned char
 		if (crypt->strf.method == PDF_CRYPT_RC4)
 		{
 			fz_arc4 arc4;
-			fz_arc4_init(&arc4, key, keylen);
+			fz_arc4_init(&arc4, st->key, st->keylen);
 			fz_arc4_encrypt(&arc4, s, s, n);
 		}
 
@@ -1142,11 +1303,13 @@ pdf_crypt_obj_imp(fz_context *ctx, pdf_crypt *crypt, pdf_obj *obj, unsigned char
 			else
 			{
 				unsigned char iv[16];
-				fz_aes aes;
 				memcpy(iv, s, 16);
-				if (fz_aes_setkey_dec(&aes, key, keylen * 8))
-					fz_throw(ctx, FZ_ERROR_FORMAT, "AES key init failed (keylen=%d)", keylen * 8);
-				fz_aes_crypt_cbc(&aes, FZ_AES_DECRYPT, n - 16, iv, s + 16, s);
+				if (!st->has_aes)
+				{
+					pdf_compute_object_aes_dec(ctx, crypt, &crypt->strf, st->num, st->gen, st->key, st->keylen, &st->aes);
+					st->has_aes = 1;
+				}
+				fz_aes_crypt_cbc(&st->aes, FZ_AES_DECRYPT, n - 16, iv, s + 16, s);
 				/* delete space used for iv and padding bytes at end */
 				if (s[n - 17] < 1 || s[n - 17] > 16)
 					fz_warn(ctx, "aes padding out of range");
@@ -1161,7 +1324,7 @@ pdf_crypt_obj_imp(fz_context *ctx, pdf_crypt *crypt, pdf_obj *obj, unsigned char
 		int n = pdf_array_len(ctx, obj);
 		for (i = 0; i < n; i++)
 		{
-			pdf_crypt_obj_imp(ctx, crypt, pdf_array_get(ctx, obj, i), key, keylen);
+			pdf_crypt_obj_imp(ctx, crypt, pdf_array_get(ctx, obj, i), st);
 		}
 	}
 
@@ -1173,7 +1336,7 @@ pdf_crypt_obj_imp(fz_context *ctx, pdf_crypt *crypt, pdf_obj *obj, unsigned char
 			if (pdf_dict_get_key(ctx, obj, i) == PDF_NAME(Contents) && is_signature(ctx, obj))
 				continue;
 
-			pdf_crypt_obj_imp(ctx, crypt, pdf_dict_get_val(ctx, obj, i), key, keylen);
+			pdf_crypt_obj_imp(ctx, crypt, pdf_dict_get_val(ctx, obj, i), st);
 		}
 	}
 }
@@ -1181,12 +1344,14 @@ pdf_crypt_obj_imp(fz_context *ctx, pdf_crypt *crypt, pdf_obj *obj, unsigned char
 void
 pdf_crypt_obj(fz_context *ctx, pdf_crypt *crypt, pdf_obj *obj, int num, int gen)
 {
-	unsigned char key[32];
-	int len;
+	pdf_crypt_obj_state st;
 
-	len = pdf_compute_object_key(crypt, &crypt->strf, num, gen, key, 32);
+	st.num = num;
+	st.gen = gen;
+	st.has_aes = 0;
+	st.keylen = pdf_compute_object_key(ctx, crypt, &crypt->strf, num, gen, st.key, 32);
 
-	pdf_crypt_obj_imp(ctx, crypt, obj, key, len);
+	pdf_crypt_obj_imp(ctx, crypt, obj, &st);
 }
 
 /*
@@ -1200,7 +1365,7 @@ pdf_open_crypt_imp(fz_context *ctx, fz_stream *chain, pdf_crypt *crypt, pdf_cryp
 	unsigned char key[32];
 	int len;
 
-	len = pdf_compute_object_key(crypt, stmf, num, gen, key, 32);
+	len = pdf_compute_object_key(ctx, crypt, stmf, num, gen, key, 32);
 
 	if (stmf->method == PDF_CRYPT_RC4)
 		return fz_open_arc4(ctx, chain, key, len);
@@ -1266,7 +1431,7 @@ void pdf_encrypt_data(fz_context *ctx, pdf_crypt *crypt, int num, int gen, void
 		return;
 	}
 
-	keylen = pdf_compute_object_key(crypt, &crypt->strf, num, gen, key, 32);
+	keylen = pdf_compute_object_key(ctx, crypt, &crypt->strf, num, gen, key, 32);
 
 	if (crypt->strf.method == PDF_CRYPT_RC4)
 	{
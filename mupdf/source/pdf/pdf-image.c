@@ -246,6 +246,140 @@ pdf_is_jpx_image(fz_context *ctx, pdf_obj *dict)
 	return 0;
 }
 
+/* SumatraPDF: JPX images (other than soft masks and images with an alpha
+ * channel) are decoded when they're drawn instead of when they're loaded,
+ * and only at the resolution which is needed. The Decode array is applied
+ * to the decoded pixmap, as before. */
+typedef struct
+{
+	fz_image super;
+	fz_buffer *buffer;
+	fz_colorspace *defcs;
+	int use_decode;
+	float decode[FZ_MAX_COLORS * 2];
+} pdf_jpx_image;
+
+static fz_pixmap *
+pdf_jpx_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea, int w, int h, int *l2factor)
+{
+	pdf_jpx_image *image = (pdf_jpx_image *)image_;
+	fz_pixmap *pix;
+	unsigned char *data;
+	size_t len;
+
+	/* The whole image is always decoded */
+	if (subarea)
+	{
+		subarea->x0 = 0;
+		subarea->y0 = 0;
+		subarea->x1 = image->super.w;
+		subarea->y1 = image->super.h;
+	}
+
+	len = fz_buffer_storage(ctx, image->buffer, &data);
+	pix = fz_load_jpx_reduced(ctx, data, len, image->defcs, l2factor);
+	if (image->use_decode)
+	{
+		fz_try(ctx)
+			fz_decode_tile(ctx, pix, image->decode);
+		fz_catch(ctx)
+		{
+			fz_drop_pixmap(ctx, pix);
+			fz_rethrow(ctx);
+		}
+	}
+	return pix;
+}
+
+static size_t
+pdf_jpx_image_get_size(fz_context *ctx, fz_image *image_)
+{
+	pdf_jpx_image *image = (pdf_jpx_image *)image_;
+
+	if (image == NULL)
+		return 0;
+
+	return sizeof(pdf_jpx_image) + (image->buffer ? image->buffer->len : 0);
+}
+
+static void
+pdf_jpx_image_drop(fz_context *ctx, fz_image *image_)
+{
+	pdf_jpx_image *image = (pdf_jpx_image *)image_;
+
+	fz_drop_buffer(ctx, image->buffer);
+	fz_drop_colorspace(ctx, image->defcs);
+}
+
+/* returns NULL for images with an alpha channel, which fz_image can only
+ * represent by the decoded pixmap */
+static fz_image *
+pdf_load_jpx_lazy(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
+{
+	fz_buffer *buf = NULL;
+	fz_colorspace *colorspace = NULL;
+	fz_colorspace *cs = NULL;
+	fz_image *mask = NULL;
+	pdf_jpx_image *img = NULL;
+	pdf_obj *obj;
+
+	fz_var(buf);
+	fz_var(colorspace);
+	fz_var(cs);
+	fz_var(mask);
+
+	buf = pdf_load_stream(ctx, dict);
+
+	fz_try(ctx)
+	{
+		unsigned char *data;
+		size_t len;
+		int w, h, alpha, i;
+
+		obj = pdf_dict_get(ctx, dict, PDF_NAME(ColorSpace));
+		if (obj)
+			colorspace = pdf_load_colorspace(ctx, obj);
+
+		len = fz_buffer_storage(ctx, buf, &data);
+		fz_load_jpx_header(ctx, data, len, colorspace, &w, &h, &alpha, &cs);
+		if (alpha)
+			break;
+
+		obj = pdf_dict_geta(ctx, dict, PDF_NAME(SMask), PDF_NAME(Mask));
+		if (pdf_is_dict(ctx, obj))
+			mask = pdf_load_image_imp(ctx, doc, NULL, obj, NULL, 1);
+
+		/* OpenJPEG doesn't read the resolution, see fz_load_jpx_info */
+		img = fz_new_derived_image(ctx, w, h, 8, cs, 72, 72, 0, 0, NULL, NULL, mask,
+			pdf_jpx_image, pdf_jpx_image_get_pixmap, pdf_jpx_image_get_size, pdf_jpx_image_drop);
+		img->buffer = fz_keep_buffer(ctx, buf);
+		img->defcs = fz_keep_colorspace(ctx, colorspace);
+
+		obj = pdf_dict_geta(ctx, dict, PDF_NAME(Decode), PDF_NAME(D));
+		if (obj && !fz_colorspace_is_indexed(ctx, colorspace))
+		{
+			img->use_decode = 1;
+			for (i = 0; i < FZ_MAX_COLORS * 2; i++)
+				img->decode[i] = pdf_array_get_real(ctx, obj, i);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_image(ctx, mask);
+		fz_drop_colorspace(ctx, cs);
+		fz_drop_colorspace(ctx, colorspace);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_morph_error(ctx, FZ_ERROR_FORMAT, FZ_ERROR_SYNTAX);
+		fz_morph_error(ctx, FZ_ERROR_LIBRARY, FZ_ERROR_SYNTAX);
+		fz_rethrow(ctx);
+	}
+
+	return img ? &img->super : NULL;
+}
+
 static fz_image *
 pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 {
@@ -261,6 +395,13 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 	fz_var(colorspace);
 	fz_var(mask);
 
+	if (!forcemask)
+	{
+		img = pdf_load_jpx_lazy(ctx, doc, dict);
+		if (img)
+			return img;
+	}
+
 	buf = pdf_load_stream(ctx, dict);
 
 	/* FIXME: We can't handle decode arrays for indexed images currently */
@@ -865,8 +865,369 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 	}
 }
 
+/* SumatraPDF: large content streams are compiled into a compact bytecode the
+ * first time they are processed. It's kept in the store so that processing
+ * them again (e.g. rendering at another zoom level) replays the operators
+ * without decompressing and lexing the stream. Each operator is recorded
+ * together with the operand state pdf_process_keyword sees:
+ *
+ *	u8 flags (PDF_BC_*), u8 number of numeric operands
+ *	float operands[n]
+ *	if PDF_BC_NAME: u8 length, name
+ *	if PDF_BC_STRING: u16 length, string
+ *	if PDF_BC_OBJ: int index into objs
+ *	u8 length, keyword
+ *
+ * Only streams that were processed without errors and without inline
+ * images (which are read directly from the stream) are cached.
+ */
+
+enum
+{
+	PDF_BC_NAME = 1,
+	PDF_BC_STRING = 2,
+	PDF_BC_OBJ = 4,
+};
+
+typedef struct
+{
+	fz_storable storable;
+	unsigned char *data;
+	size_t len;
+	pdf_obj **objs;
+	int num_objs;
+	int num_ops;
+} pdf_content_bytecode;
+
+typedef struct
+{
+	unsigned char *data;
+	size_t len, cap;
+	pdf_obj **objs;
+	int num_objs, cap_objs;
+	int num_ops;
+	int failed;
+} pdf_bytecode_writer;
+
+static void
+pdf_drop_content_bytecode_imp(fz_context *ctx, fz_storable *bc_)
+{
+	pdf_content_bytecode *bc = (pdf_content_bytecode *)bc_;
+	int i;
+
+	for (i = 0; i < bc->num_objs; i++)
+		pdf_drop_obj(ctx, bc->objs[i]);
+	fz_free(ctx, bc->objs);
+	fz_free(ctx, bc->data);
+	fz_free(ctx, bc);
+}
+
+static void
+pdf_drop_content_bytecode(fz_context *ctx, pdf_content_bytecode *bc)
+{
+	if (bc)
+		fz_drop_storable(ctx, &bc->storable);
+}
+
+static void
+pdf_bytecode_writer_fin(fz_context *ctx, pdf_bytecode_writer *w)
+{
+	int i;
+
+	for (i = 0; i < w->num_objs; i++)
+		pdf_drop_obj(ctx, w->objs[i]);
+	fz_free(ctx, w->objs);
+	fz_free(ctx, w->data);
+	memset(w, 0, sizeof *w);
+}
+
+static void
+pdf_bytecode_write(fz_context *ctx, pdf_bytecode_writer *w, const void *data, size_t len)
+{
+	if (w->len + len > w->cap)
+	{
+		size_t cap = fz_maxz(w->cap * 2, 4096);
+		unsigned char *p;
+		while (cap < w->len + len)
+			cap *= 2;
+		p = fz_realloc_no_throw(ctx, w->data, cap);
+		if (!p)
+		{
+			w->failed = 1;
+			return;
+		}
+		w->data = p;
+		w->cap = cap;
+	}
+	memcpy(w->data + w->len, data, len);
+	w->len += len;
+}
+
+static void
+pdf_bytecode_write_byte(fz_context *ctx, pdf_bytecode_writer *w, int c)
+{
+	unsigned char b = (unsigned char)c;
+	pdf_bytecode_write(ctx, w, &b, 1);
+}
+
+/* called for every operator, before it's processed */
+static void
+pdf_bytecode_record(fz_context *ctx, pdf_bytecode_writer *w, pdf_csi *csi, const char *word)
+{
+	size_t name_len, word_len;
+	int flags = 0;
+
+	if (w->failed)
+		return;
+
+	name_len = strlen(csi->name);
+	word_len = strlen(word);
+	/* inline image data is read from the stream by the operator */
+	if (!strcmp(word, "BI") || word_len > 255 || name_len > 255)
+	{
+		w->failed = 1;
+		return;
+	}
+
+	if (name_len > 0)
+		flags |= PDF_BC_NAME;
+	if (csi->string_len > 0)
+		flags |= PDF_BC_STRING;
+	if (csi->obj)
+	{
+		if (w->num_objs == w->cap_objs)
+		{
+			int cap = fz_maxi(w->cap_objs * 2, 64);
+			pdf_obj **objs = fz_realloc_no_throw(ctx, w->objs, cap * sizeof *objs);
+			if (!objs)
+			{
+				w->failed = 1;
+				return;
+			}
+			w->objs = objs;
+			w->cap_objs = cap;
+		}
+		w->objs[w->num_objs++] = pdf_keep_obj(ctx, csi->obj);
+		flags |= PDF_BC_OBJ;
+	}
+
+	pdf_bytecode_write_byte(ctx, w, flags);
+	pdf_bytecode_write_byte(ctx, w, csi->top);
+	pdf_bytecode_write(ctx, w, csi->stack, csi->top * sizeof(float));
+	if (flags & PDF_BC_NAME)
+	{
+		pdf_bytecode_write_byte(ctx, w, (int)name_len);
+		pdf_bytecode_write(ctx, w, csi->name, name_len);
+	}
+	if (flags & PDF_BC_STRING)
+	{
+		pdf_bytecode_write_byte(ctx, w, csi->string_len & 0xff);
+		pdf_bytecode_write_byte(ctx, w, (int)(csi->string_len >> 8));
+		pdf_bytecode_write(ctx, w, csi->string, csi->string_len);
+	}
+	if (flags & PDF_BC_OBJ)
+	{
+		int idx = w->num_objs - 1;
+		pdf_bytecode_write(ctx, w, &idx, sizeof idx);
+	}
+	pdf_bytecode_write_byte(ctx, w, (int)word_len);
+	pdf_bytecode_write(ctx, w, word, word_len);
+	w->num_ops++;
+}
+
+static pdf_content_bytecode *
+pdf_find_content_bytecode(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj)
+{
+	if (doc->content_bytecode_min_ops <= 0 || !pdf_is_indirect(ctx, stmobj))
+		return NULL;
+	return pdf_find_item(ctx, pdf_drop_content_bytecode_imp, stmobj);
+}
+
+static int
+pdf_can_cache_content_bytecode(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj)
+{
+	/* arrays of content streams aren't cached and local objects are only
+	 * used while synthesizing appearance streams */
+	return doc->content_bytecode_min_ops > 0 && pdf_is_indirect(ctx, stmobj) &&
+		pdf_is_stream(ctx, stmobj) && !pdf_is_local_object(ctx, doc, stmobj);
+}
+
+static void
+pdf_store_content_bytecode(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj, pdf_bytecode_writer *w)
+{
+	pdf_content_bytecode *bc = NULL;
+	unsigned char *data;
+
+	if (w->failed || w->num_ops < doc->content_bytecode_min_ops)
+		return;
+
+	data = fz_realloc_no_throw(ctx, w->data, w->len);
+	if (data)
+		w->data = data;
+
+	fz_var(bc);
+	fz_try(ctx)
+	{
+		bc = fz_malloc_struct(ctx, pdf_content_bytecode);
+		FZ_INIT_STORABLE(bc, 1, pdf_drop_content_bytecode_imp);
+		/* take over the recorded data */
+		bc->data = w->data;
+		bc->len = w->len;
+		bc->objs = w->objs;
+		bc->num_objs = w->num_objs;
+		bc->num_ops = w->num_ops;
+		memset(w, 0, sizeof *w);
+		pdf_store_item(ctx, stmobj, bc, sizeof *bc + bc->len + bc->num_objs * sizeof(pdf_obj *));
+	}
+	fz_always(ctx)
+		pdf_drop_content_bytecode(ctx, bc);
+	fz_catch(ctx)
+	{
+		/* not being able to cache it isn't an error */
+		fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
+		fz_report_error(ctx);
+	}
+}
+
+void
+pdf_set_content_bytecode_threshold(fz_context *ctx, pdf_document *doc, int min_ops)
+{
+	doc->content_bytecode_min_ops = fz_maxi(min_ops, 0);
+}
+
+void
+pdf_drop_cached_content_bytecode(fz_context *ctx, pdf_document *doc, int num, int gen)
+{
+	pdf_obj *ref;
+
+	if (num <= 0 || doc->content_bytecode_min_ops <= 0)
+		return;
+	/* the store compares indirect keys by both num and gen */
+	ref = pdf_new_indirect(ctx, doc, num, gen);
+	fz_try(ctx)
+		pdf_remove_item(ctx, pdf_drop_content_bytecode_imp, ref);
+	fz_always(ctx)
+		pdf_drop_obj(ctx, ref);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* returns 1 if processing a content stream should stop because of the caught error */
+static int
+pdf_handle_stream_error(fz_context *ctx, fz_cookie *cookie, int *syntax_errors)
+{
+	int caught = fz_caught(ctx);
+
+	if (caught == FZ_ERROR_TRYLATER)
+	{
+		fz_ignore_error(ctx);
+		if (cookie)
+			cookie->incomplete++;
+		return 1;
+	}
+	if (caught == FZ_ERROR_SYNTAX)
+	{
+		fz_report_error(ctx);
+		if (cookie)
+			cookie->errors++;
+		if (++*syntax_errors >= MAX_SYNTAX_ERRORS)
+		{
+			fz_warn(ctx, "too many syntax errors; ignoring rest of page");
+			return 1;
+		}
+		return 0;
+	}
+	fz_rethrow(ctx);
+	return 1;
+}
+
+static void
+pdf_process_bytecode(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, pdf_content_bytecode *bc)
+{
+	fz_cookie *cookie = csi->cookie;
+	const unsigned char *p = bc->data;
+	const unsigned char *end = bc->data + bc->len;
+	int syntax_errors = 0;
+	int done = 0;
+	char word[256];
+
+	pdf_clear_stack(ctx, csi);
+
+	fz_var(p);
+	fz_var(done);
+
+	if (cookie)
+	{
+		cookie->progress_max = bc->num_ops;
+		cookie->progress = 0;
+	}
+
+	while (!done && p < end)
+	{
+		fz_try(ctx)
+		{
+			while (p < end)
+			{
+				int flags, n;
+				size_t len;
+
+				if (cookie)
+				{
+					if (cookie->abort)
+					{
+						p = end;
+						break;
+					}
+					cookie->progress++;
+				}
+
+				flags = *p++;
+				n = *p++;
+				memcpy(csi->stack, p, n * sizeof(float));
+				csi->top = n;
+				p += n * sizeof(float);
+				if (flags & PDF_BC_NAME)
+				{
+					len = *p++;
+					memcpy(csi->name, p, len);
+					csi->name[len] = 0;
+					p += len;
+				}
+				if (flags & PDF_BC_STRING)
+				{
+					len = p[0] | (p[1] << 8);
+					memcpy(csi->string, p + 2, len);
+					csi->string_len = len;
+					p += 2 + len;
+				}
+				if (flags & PDF_BC_OBJ)
+				{
+					int idx;
+					memcpy(&idx, p, sizeof idx);
+					p += sizeof idx;
+					csi->obj = pdf_keep_obj(ctx, bc->objs[idx]);
+				}
+				len = *p++;
+				memcpy(word, p, len);
+				word[len] = 0;
+				p += len;
+
+				pdf_process_keyword(ctx, proc, csi, NULL, word);
+				pdf_clear_stack(ctx, csi);
+			}
+		}
+		fz_always(ctx)
+			pdf_clear_stack(ctx, csi);
+		fz_catch(ctx)
+			done = pdf_handle_stream_error(ctx, cookie, &syntax_errors);
+	}
+
+	if (syntax_errors > 0)
+		fz_warn(ctx, "encountered syntax errors; page may not be correct");
+}
+
 static void
-pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm)
+pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm, pdf_bytecode_writer *rec)
 {
 	pdf_document *doc = csi->doc;
 	pdf_lexbuf *buf = csi->buf;
@@ -899,6 +1260,9 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 				{
 					if (cookie->abort)
 					{
+						/* don't cache a partially processed stream */
+						if (rec)
+							rec->failed = 1;
 						tok = PDF_TOK_EOF;
 						break;
 					}
@@ -1025,6 +1389,8 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 					break;
 
 				case PDF_TOK_KEYWORD:
+					if (rec)
+						pdf_bytecode_record(ctx, rec, csi, buf->scratch);
 					pdf_process_keyword(ctx, proc, csi, stm, buf->scratch);
 					pdf_clear_stack(ctx, csi);
 					break;
@@ -1041,59 +1407,11 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 		}
 		fz_catch(ctx)
 		{
-			int caught = fz_caught(ctx);
-			if (cookie)
-			{
-				if (caught == FZ_ERROR_TRYLATER)
-				{
-					fz_ignore_error(ctx);
-					cookie->incomplete++;
-					tok = PDF_TOK_EOF;
-				}
-				else if (caught == FZ_ERROR_ABORT)
-				{
-					fz_rethrow(ctx);
-				}
-				else if (caught == FZ_ERROR_SYNTAX)
-				{
-					fz_report_error(ctx);
-					cookie->errors++;
-					if (++syntax_errors >= MAX_SYNTAX_ERRORS)
-					{
-						fz_warn(ctx, "too many syntax errors; ignoring rest of page");
-						tok = PDF_TOK_EOF;
-					}
-				}
-				else
-				{
-					fz_rethrow(ctx);
-				}
-			}
-			else
-			{
-				if (caught == FZ_ERROR_TRYLATER)
-				{
-					fz_ignore_error(ctx);
-					tok = PDF_TOK_EOF;
-				}
-				else if (caught == FZ_ERROR_ABORT)
-				{
-					fz_rethrow(ctx);
-				}
-				else if (caught == FZ_ERROR_SYNTAX)
-				{
-					fz_report_error(ctx);
-					if (++syntax_errors >= MAX_SYNTAX_ERRORS)
-					{
-						fz_warn(ctx, "too many syntax errors; ignoring rest of page");
-						tok = PDF_TOK_EOF;
-					}
-				}
-				else
-				{
-					fz_rethrow(ctx);
-				}
-			}
+			/* the bytecode must replay the stream exactly */
+			if (rec)
+				rec->failed = 1;
+			if (pdf_handle_stream_error(ctx, cookie, &syntax_errors))
+				tok = PDF_TOK_EOF;
 
 			/* If we do catch an error, then reset ourselves to a base lexing state */
 			in_text_array = 0;
@@ -1121,11 +1439,14 @@ pdf_process_raw_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc
 	pdf_csi csi;
 	pdf_lexbuf buf;
 	fz_stream *stm = NULL;
+	pdf_content_bytecode *bc = NULL;
+	pdf_bytecode_writer rec = { 0 };
 
 	if (!stmobj)
 		return;
 
 	fz_var(stm);
+	fz_var(bc);
 
 	pdf_lexbuf_init(ctx, &buf, PDF_LEXBUF_SMALL);
 	pdf_init_csi(ctx, &csi, doc, rdb, &buf, cookie);
@@ -1133,14 +1454,25 @@ pdf_process_raw_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc
 	fz_try(ctx)
 	{
 		fz_defer_reap_start(ctx);
-		stm = pdf_open_contents_stream(ctx, doc, stmobj);
-		pdf_process_stream(ctx, proc, &csi, stm);
+		bc = pdf_find_content_bytecode(ctx, doc, stmobj);
+		if (bc)
+			pdf_process_bytecode(ctx, proc, &csi, bc);
+		else
+		{
+			int cache = pdf_can_cache_content_bytecode(ctx, doc, stmobj);
+			stm = pdf_open_contents_stream(ctx, doc, stmobj);
+			pdf_process_stream(ctx, proc, &csi, stm, cache ? &rec : NULL);
+			if (cache)
+				pdf_store_content_bytecode(ctx, doc, stmobj, &rec);
+		}
 		pdf_process_end(ctx, proc, &csi);
 	}
 	fz_always(ctx)
 	{
 		fz_defer_reap_end(ctx);
 		fz_drop_stream(ctx, stm);
+		pdf_drop_content_bytecode(ctx, bc);
+		pdf_bytecode_writer_fin(ctx, &rec);
 		pdf_clear_stack(ctx, &csi);
 		pdf_lexbuf_fin(ctx, &buf);
 	}
@@ -1252,7 +1584,7 @@ pdf_process_glyph(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_o
 	{
 		pdf_processor_push_resources(ctx, proc, rdb);
 		stm = fz_open_buffer(ctx, contents);
-		pdf_process_stream(ctx, proc, &csi, stm);
+		pdf_process_stream(ctx, proc, &csi, stm, NULL);
 		pdf_process_end(ctx, proc, &csi);
 	}
 	fz_always(ctx)
@@ -49,6 +49,69 @@ static void add_root(fz_context *ctx, pdf_obj *obj, pdf_obj ***roots, int *num_r
 	(*roots)[(*num_roots)++] = pdf_keep_obj(ctx, obj);
 }
 
+/* SumatraPDF: look for the "endstream" keyword a buffer at a time with
+ * memchr instead of a byte at a time. Damaged files often have indirect or
+ * wrong stream lengths, so for large (e.g. scanned) files this used to be
+ * most of the repair time. As before, the stream is left positioned after
+ * the keyword, or at EOF if there is none. */
+static void
+skip_to_endstream(fz_context *ctx, fz_stream *file)
+{
+	static const char keyword[] = "endstream";
+	enum { KW_LEN = 9, CHUNK = 64 << 10 };
+	/* the last few bytes of the previous buffer, in which a match may start */
+	unsigned char tail[KW_LEN - 1];
+	unsigned char tmp[2 * (KW_LEN - 1)];
+	size_t t = 0, n, m, o, keep;
+	unsigned char *p, *q, *end;
+
+	while (1)
+	{
+		n = fz_available(ctx, file, CHUNK);
+		if (n == 0)
+			return;
+		p = file->rp;
+		end = p + n;
+
+		if (t > 0)
+		{
+			m = fz_minz(n, KW_LEN - 1);
+			memcpy(tmp, tail, t);
+			memcpy(tmp + t, p, m);
+			for (o = 0; o < t && o + KW_LEN <= t + m; o++)
+			{
+				if (memcmp(tmp + o, keyword, KW_LEN) == 0)
+				{
+					file->rp = p + (o + KW_LEN - t);
+					return;
+				}
+			}
+			if (n < KW_LEN - 1)
+			{
+				/* no match can start in such a short buffer */
+				keep = fz_minz(KW_LEN - 1, t + n);
+				memmove(tail, tmp + t + n - keep, keep);
+				t = keep;
+				file->rp = end;
+				continue;
+			}
+		}
+
+		for (q = p; (q = memchr(q, 'e', end - q)) != NULL && end - q >= KW_LEN; q++)
+		{
+			if (memcmp(q, keyword, KW_LEN) == 0)
+			{
+				file->rp = q + KW_LEN;
+				return;
+			}
+		}
+
+		t = fz_minz(n, KW_LEN - 1);
+		memcpy(tail, end - t, t);
+		file->rp = end;
+	}
+}
+
 int
 pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, int64_t *stmofsp, int64_t *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, int64_t *tmpofs, pdf_obj **root)
 {
@@ -199,16 +262,7 @@ pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, int64_t *stm
 			fz_seek(ctx, file, *stmofsp, 0);
 		}
 
-		(void)fz_read(ctx, file, (unsigned char *) buf->scratch, 9);
-
-		while (memcmp(buf->scratch, "endstream", 9) != 0)
-		{
-			c = fz_read_byte(ctx, file);
-			if (c == EOF)
-				break;
-			memmove(&buf->scratch[0], &buf->scratch[1], 8);
-			buf->scratch[8] = c;
-		}
+		skip_to_endstream(ctx, file);
 
 		if (stmlenp)
 			*stmlenp = fz_tell(ctx, file) - *stmofsp - 9;
@@ -326,6 +380,232 @@ static int is_white(int c)
 	return c == '\x00' || c == '\x09' || c == '\x0a' || c == '\x0c' || c == '\x0d' || c == '\x20';
 }
 
+/* SumatraPDF: between objects, pdf_repair_xref used to lex every token up to
+ * the next "<num> <gen> obj". In damaged files that can be many MB of binary
+ * data (e.g. after a stream whose "stream" keyword is broken). Instead, look
+ * for the "obj" keyword and for "<<" (which may start a trailer) with memchr a
+ * buffer at a time, skipping comments like pdf_lex_no_string does, and leave
+ * the stream at the header's first number, at the "<<" or at EOF. Headers
+ * that don't fit into HEADER_LOOKBACK bytes or have a comment near them are
+ * left to the lexer (up to *lex_until). */
+enum { HEADER_LOOKBACK = 64 };
+
+static int is_delim(int c)
+{
+	return c == '(' || c == ')' || c == '<' || c == '>' || c == '[' || c == ']' ||
+		c == '{' || c == '}' || c == '/' || c == '%';
+}
+
+/* does pdf_lex read s[0..n) as an integer that isn't negative? (see lex_number) */
+static int is_int_token(const unsigned char *s, ptrdiff_t n)
+{
+	ptrdiff_t i;
+
+	if (s[0] != '+' && (s[0] < '0' || s[0] > '9'))
+		return 0;
+	for (i = 1; i < n; i++)
+		if (s[i] != '-' && (s[i] < '0' || s[i] > '9'))
+			return 0;
+	return 1;
+}
+
+/* is the end of s[0..n) inside a comment, given whether its start is? */
+static int ends_in_comment(const unsigned char *s, size_t n, int in_comment)
+{
+	size_t i = n;
+
+	while (i > 0 && s[i - 1] != '\n' && s[i - 1] != '\r')
+		i--;
+	if (i > 0)
+		in_comment = 0;
+	return in_comment || memchr(s + i, '%', n - i) != NULL;
+}
+
+/* s[e] is the 'o' of an "obj" keyword. returns the index of "<num>" in
+ * "<num> <gen> obj" before it, -1 if there isn't one and -2 if it might
+ * start before s (unless the lexer stopped at s) */
+static ptrdiff_t
+obj_header_start(const unsigned char *s, ptrdiff_t e, int at_start)
+{
+	ptrdiff_t i = e, end;
+	int part;
+
+	/* whitespace, <gen>, whitespace, <num> */
+	for (part = 0; part < 4; part++)
+	{
+		end = i;
+		if (part % 2 == 0)
+			while (i > 0 && is_white(s[i - 1]))
+				i--;
+		else
+			while (i > 0 && !is_white(s[i - 1]) && !is_delim(s[i - 1]))
+				i--;
+		if (i == end)
+			return -1;
+		if (i == 0 && !at_start)
+			return -2;
+		if (part % 2 == 1 && !is_int_token(s + i, end - i))
+			return -1;
+		if (i == 0)
+			return part == 3 ? 0 : -1;
+	}
+	/* "/<num>" is a name */
+	return s[i - 1] != '/' ? i : -1;
+}
+
+static void
+skip_to_obj_header(fz_context *ctx, fz_stream *file, int64_t *lex_until)
+{
+	enum { CHUNK = 64 << 10, AFTER = 4 };
+	/* the last bytes of the previous buffer. a header may start in them and
+	 * candidates in the last few of them couldn't be checked yet */
+	unsigned char tail[HEADER_LOOKBACK];
+	unsigned char win[HEADER_LOOKBACK + AFTER];
+	/* indices into tail followed by the buffer: the next candidate and
+	 * how far in_comment is known */
+	size_t t = 0, j = 0, seen = 0;
+	size_t len, n, k, w, keep;
+	int64_t start, base, ofs;
+	ptrdiff_t hdr;
+	unsigned char *p, *q, *r;
+	int c, c2, eof, in_comment = 0;
+
+#define AT(i) ((i) < t ? tail[i] : p[(i) - t])
+#define SEEN(to) do { \
+		if (seen < t) \
+			in_comment = ends_in_comment(tail + seen, fz_minz(to, t) - seen, in_comment), seen = fz_minz(to, t); \
+		if (seen < (to)) \
+			in_comment = ends_in_comment(p + (seen - t), (to) - seen, in_comment), seen = (to); \
+	} while (0)
+
+	/* the lexer stopped at a token boundary, outside of any comment */
+	start = fz_tell(ctx, file);
+	if (start < *lex_until)
+		return;
+	while (1)
+	{
+		n = fz_available(ctx, file, CHUNK);
+		p = file->rp;
+		eof = n == 0;
+		base = fz_tell(ctx, file) - (int64_t)t;
+		len = t + n;
+
+		while (j < len)
+		{
+			if (j >= t)
+			{
+				/* the next 'o' or '<' in the buffer */
+				q = memchr(p + (j - t), 'o', n - (j - t));
+				r = memchr(p + (j - t), '<', (q ? q : p + n) - (p + (j - t)));
+				if (r)
+					q = r;
+				if (!q)
+				{
+					j = len;
+					break;
+				}
+				j = t + (q - p);
+			}
+			c = AT(j);
+			if (c != 'o' && c != '<')
+			{
+				j++;
+				continue;
+			}
+
+			/* "obj" and the character after it (or "<<") must be available */
+			w = c == 'o' ? AFTER : 2;
+			if (j + w > len && !eof)
+				break;
+			for (k = 0; k < w; k++)
+				win[HEADER_LOOKBACK + k] = j + k < len ? AT(j + k) : 0;
+			if (c == '<')
+			{
+				if (win[HEADER_LOOKBACK + 1] == '<' && j + 1 < len)
+				{
+					SEEN(j);
+					if (!in_comment)
+					{
+						ofs = base + (int64_t)j;
+						goto found;
+					}
+				}
+				j++;
+				continue;
+			}
+			c2 = j + 3 < len ? win[HEADER_LOOKBACK + 3] : ' ';
+			if (j + 2 >= len || memcmp(win + HEADER_LOOKBACK, "obj", 3) != 0 ||
+				!(is_white(c2) || is_delim(c2)))
+			{
+				j++;
+				continue;
+			}
+			/* e.g. "endobj" or "]obj" can't end a header */
+			if (base + (int64_t)j == start || !is_white(AT(j - 1)))
+			{
+				j++;
+				continue;
+			}
+
+			/* copy what's before "obj" (and after start) next to it. the
+			 * tail holds AFTER more bytes, so that seen stays before it */
+			keep = fz_minz(j - (start > base ? (size_t)(start - base) : 0), HEADER_LOOKBACK - AFTER);
+			for (k = 0; k < keep; k++)
+				win[HEADER_LOOKBACK - keep + k] = AT(j - keep + k);
+			hdr = obj_header_start(win + HEADER_LOOKBACK - keep, (ptrdiff_t)keep, base + (int64_t)(j - keep) == start);
+			if (hdr == -1 && !memchr(win + HEADER_LOOKBACK - keep, '%', keep))
+			{
+				j++;
+				continue;
+			}
+			if (hdr >= 0)
+			{
+				SEEN(j - keep + hdr);
+				if (!in_comment)
+				{
+					ofs = base + (int64_t)(j - keep) + hdr;
+					goto found;
+				}
+			}
+
+			/* the header might start before the window, or comments might
+			 * hide or join its numbers: let the lexer find out */
+			*lex_until = base + (int64_t)j + 3;
+			ofs = start;
+			goto found;
+		}
+
+		if (eof)
+			return;
+
+		/* carry over the end of the buffer, including candidates
+		 * that couldn't be checked yet */
+		keep = fz_minz(len, HEADER_LOOKBACK);
+		SEEN(len - keep);
+		if (len - keep < t)
+		{
+			memmove(tail, tail + (len - keep), t - (len - keep));
+			memcpy(tail + t - (len - keep), p, n);
+		}
+		else
+			memcpy(tail, p + (len - keep - t), keep);
+		j -= len - keep;
+		seen -= len - keep;
+		t = keep;
+		file->rp = p + n;
+	}
+
+found:
+#undef SEEN
+#undef AT
+	/* file->rp is still p */
+	base = fz_tell(ctx, file);
+	if (ofs >= base && ofs <= base + (int64_t)n)
+		file->rp = p + (ofs - base);
+	else
+		fz_seek(ctx, file, ofs, SEEK_SET);
+}
+
 void
 pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 {
@@ -346,6 +626,7 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 	int gen = 0;
 	int64_t tmpofs, stm_ofs, numofs = 0, genofs = 0;
 	int64_t stm_len;
+	int64_t lex_until = 0;
 	pdf_token tok;
 	int next;
 	int i;
@@ -574,6 +855,8 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 			{
 				num = 0;
 				gen = 0;
+				/* SumatraPDF: skip to the next object header without lexing */
+				skip_to_obj_header(ctx, doc->file, &lex_until);
 			}
 		}
 
@@ -2919,6 +2919,14 @@ pdf_update_local_object(fz_context *ctx, pdf_document *doc, int num, pdf_obj *ne
 	pdf_set_obj_parent(ctx, newobj, num);
 }
 
+/* SumatraPDF: generation number of the object described by x. for objects in
+ * object streams, gen holds the index within the stream and the generation is 0 */
+static int
+pdf_xref_entry_gen(pdf_xref_entry *x)
+{
+	return x->type == 'o' ? 0 : x->gen;
+}
+
 void
 pdf_update_object(fz_context *ctx, pdf_document *doc, int num, pdf_obj *newobj)
 {
@@ -2939,6 +2947,10 @@ pdf_update_object(fz_context *ctx, pdf_document *doc, int num, pdf_obj *newobj)
 		return;
 	}
 
+	/* SumatraPDF: the cached bytecode is for the old object */
+	x = pdf_get_xref_entry_no_null(ctx, doc, num);
+	pdf_drop_cached_content_bytecode(ctx, doc, num, pdf_xref_entry_gen(x));
+
 	if (!newobj)
 	{
 		pdf_delete_object(ctx, doc, num);
@@ -2960,6 +2972,7 @@ void
 pdf_update_stream(fz_context *ctx, pdf_document *doc, pdf_obj *obj, fz_buffer *newbuf, int compressed)
 {
 	int num;
+	int is_local = 0;
 	pdf_xref_entry *x;
 
 	if (pdf_is_indirect(ctx, obj))
@@ -2975,6 +2988,7 @@ pdf_update_stream(fz_context *ctx, pdf_document *doc, pdf_obj *obj, fz_buffer *n
 	if (doc->local_xref && doc->local_xref_nesting > 0)
 	{
 		x = pdf_get_local_xref_entry(ctx, doc, num);
+		is_local = 1;
 	}
 	else
 	{
@@ -2990,6 +3004,10 @@ pdf_update_stream(fz_context *ctx, pdf_document *doc, pdf_obj *obj, fz_buffer *n
 	fz_drop_buffer(ctx, x->stm_buf);
 	x->stm_buf = fz_keep_buffer(ctx, newbuf);
 
+	/* SumatraPDF: the cached bytecode is for the old contents. local objects are never cached */
+	if (!is_local)
+		pdf_drop_cached_content_bytecode(ctx, doc, num, pdf_xref_entry_gen(x));
+
 	if (!compressed)
 	{
 		pdf_dict_del(ctx, obj, PDF_NAME(Filter));
@@ -3208,6 +3226,8 @@ pdf_new_document(fz_context *ctx, fz_stream *file)
 
 	pdf_lexbuf_init(ctx, &doc->lexbuf.base, PDF_LEXBUF_LARGE);
 	doc->file = fz_keep_stream(ctx, file);
+	/* SumatraPDF: cache the bytecode of large content streams */
+	doc->content_bytecode_min_ops = PDF_CONTENT_BYTECODE_MIN_OPS;
 
 	/* Default to PDF-1.7 if the version header is missing and for new documents */
 	doc->version = 17;
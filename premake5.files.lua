@@ -748,6 +748,7 @@ function utils_files()
     "HtmlPullParser.*",
     "HtmlPrettyPrint.*",
     "HttpUtil.*",
+    "ImageDecoder.*",
     "JsonParser.*",
     "Log.*",
     "LzmaSimpleArchive.*",
@@ -1161,6 +1162,7 @@ function test_util_files()
     "HtmlParserLookup.*",
     "HtmlPrettyPrint.*",
     "HtmlPullParser.*",
+    "ImageDecoder.*",
     "JsonParser.*",
     "Scoped.*",
     "SettingsUtil.*",
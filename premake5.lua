@@ -457,6 +457,8 @@ workspace "SumatraPDF"
     -- msvc will include the one in ext/openjpeg/src/lib/openjp2 first
     -- because #include "opj_config_private.h" searches current directory first
     defines { "_CRT_SECURE_NO_WARNINGS", "USE_JPIP", "OPJ_STATIC", "OPJ_EXPORTS" }
+    -- thread pool for decoding code-blocks of large images in parallel
+    defines { "MUTEX_win32" }
     openjpeg_files()
 
     -- freetype
@@ -695,8 +697,13 @@ workspace "SumatraPDF"
     cppdialect "C++latest"
     mixed_dbg_rel_conf()
     disablewarnings { "4838" }
-    includedirs { "src" }
+    -- ImageDecoder is tested without the decoders that aren't part of mupdf
+    defines { "NO_LIBWEBP", "NO_AVIF", "NO_TGA" }
+    uses_zlib()
+    includedirs { "src", "mupdf/include" }
     test_util_files()
+    links_zlib()
+    links { "mupdf" }
     links { "gdiplus", "comctl32", "shlwapi", "Version", "wininet", "shcore", "wintrust", "crypt32" }
 
   project "sizer"
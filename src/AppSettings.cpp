@@ -440,6 +440,8 @@ static void ReloadSettings() {
 
     ok = LoadSettings();
     ReportIf(!ok || !gGlobalPrefs);
+    // applies to documents opened from now on
+    EngineMupdfSetDefaultRenderBandThreads(gGlobalPrefs->renderBandThreads);
 
     // TODO: about window doesn't have to be at position 0
     if (gWindows.size() > 0 && gWindows.at(0)->IsCurrentTabAbout()) {
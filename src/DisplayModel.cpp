@@ -305,6 +305,9 @@ DisplayModel::DisplayModel(EngineBase* engine, DocControllerCallback* cb) : DocC
     pageSpacing.dx += 4;
     pageSpacing.dy += 4;
 #endif
+    if (engine->preferredLayout.noPageSpacing) {
+        pageSpacing.dy = 0;
+    }
 
     textCache = new DocumentTextCache(engine);
     textSelection = new TextSelection(engine, textCache);
@@ -12,6 +12,7 @@ void CleanupEngineDjVu();
 bool IsEngineDjVuSupportedFileType(Kind kind);
 EngineBase* CreateEngineDjVuFromFile(const char* path);
 EngineBase* CreateEngineDjVuFromStream(IStream* stream);
+void EngineDjVuSetPageCacheSize(size_t maxSize);
 
 /* EngineEbook.cpp */
 EngineBase* CreateEngineEpubFromFile(const char* fileName);
@@ -40,6 +41,8 @@ EngineBase* CreateEngineImageDirFromFile(const char* fileName);
 bool IsEngineCbxSupportedFileType(Kind kind);
 EngineBase* CreateEngineCbxFromFile(const char* path);
 EngineBase* CreateEngineCbxFromStream(IStream* stream);
+void EngineImagesSetDecodeThreads(int nAvifThreads, int nPrefetchPages);
+void EngineCbxSetCacheDir(const char* dir);
 
 /* EngineMupdf.cpp */
 
@@ -58,6 +61,20 @@ bool EngineMupdfSupportsAnnotations(EngineBase*);
 bool EngineMupdfSaveUpdated(EngineBase* engine, const char* path, const ShowErrorCb& showErrorFunc);
 Annotation* EngineMupdfGetAnnotationAtPos(EngineBase*, int pageNo, PointF pos, Annotation*);
 ByteSlice EngineMupdfLoadAttachment(EngineBase*, int attachmentNo);
+void EngineMupdfSetRenderBandThreads(EngineBase*, int nThreads);
+void EngineMupdfSetDefaultRenderBandThreads(int nThreads);
+void EngineMupdfSetContentBytecodeThreshold(EngineBase*, int minOps);
+TempStr EngineMupdfLockStatsTemp(EngineBase*);
+TempStr EngineMupdfGlyphCacheStatsTemp(EngineBase*);
+bool EngineMupdfGetCryptKeyCacheStats(EngineBase*, int* hits, int* misses);
+bool EngineMupdfFileFingerprint(const char* path, u8 digest[16]);
+void EngineMupdfSetLayoutCacheDir(const char* dir);
+void EngineMupdfSetProgressiveLoadKbps(int kbps);
+bool EngineMupdfIsLoadingProgressively(EngineBase*);
+void EngineMupdfCancelOpening(const char* path);
+void EngineMupdfSetSharedImageCacheSize(size_t maxSize);
+TempStr EngineMupdfSharedImageCacheStatsTemp();
+TempStr EngineMupdfStoreStatsTemp(EngineBase*);
 
 /* EnginePs.cpp */
 
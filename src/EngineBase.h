@@ -37,6 +37,8 @@ struct PageLayout {
     Type type{Type::Single};
     bool r2l = false;
     bool nonContinuous = false;
+    // pages are parts of a single image and are shown without gaps
+    bool noPageSpacing = false;
 };
 
 extern Kind kindDestinationNone;
@@ -391,6 +393,11 @@ struct RenderPageArgs {
     RectF* pageRect = nullptr;
     RenderTarget target = RenderTarget::View;
     AbortCookie** cookie_out = nullptr;
+    // set by the engine if the page couldn't be (fully) rendered because
+    // its data hasn't been loaded yet. the caller should try again later
+    bool tryLater = false;
+    // the page is rendered as a thumbnail (engines shouldn't e.g. prefetch the following pages)
+    bool isThumbnail = false;
 
     RenderPageArgs(int pageNo, float zoom, int rotation, RectF* pageRect = nullptr,
                    RenderTarget target = RenderTarget::View, AbortCookie** cookie_out = nullptr);
@@ -538,6 +545,7 @@ class EngineBase {
 };
 
 struct PasswordUI {
+    // fileDigest is nullptr if the file's fingerprint couldn't be calculated
     virtual char* GetPassword(const char* fileName, u8* fileDigest, u8 decryptionKeyOut[32], bool* saveKey) = 0;
     virtual ~PasswordUI() = default;
 };
@@ -123,113 +123,131 @@ static TocItem* NewDjVuTocItem(TocItem* parent, const char* title, const char* l
     return res;
 }
 
+// each document has its own ddjvu context (and thus message queue), so that
+// pages of different documents (and different pages of the same document)
+// can be decoded concurrently. libdjvu is thread-safe, only the messages
+// have to be pumped until the job we're waiting for is done
 struct DjVuContext {
     ddjvu_context_t* ctx = nullptr;
-    int refCount = 1;
+    // serializes pumping of the message queue
     CRITICAL_SECTION lock;
+    // set by libdjvu (from a decoding thread) whenever a message is queued
+    HANDLE msgEvent = nullptr;
 
-    DjVuContext() {
-        InitializeCriticalSection(&lock);
+    DjVuContext();
+    ~DjVuContext();
+
+    void SpinMessageLoop(bool wait = true);
+    ddjvu_document_t* OpenFile(const char* fileName);
+    ddjvu_document_t* OpenData(const ByteSlice& d);
+};
+
+static void DjVuMessageCallback(ddjvu_context_t*, void* closure) {
+    DjVuContext* djvu = (DjVuContext*)closure;
+    SetEvent(djvu->msgEvent);
+}
+
+// ddjvu_context_create changes the process-wide locale, which isn't thread-safe
+static CRITICAL_SECTION* GetDjVuCreateLock() {
+    static CRITICAL_SECTION* cs = [] {
+        auto res = new CRITICAL_SECTION();
+        InitializeCriticalSection(res);
+        return res;
+    }();
+    return cs;
+}
+
+DjVuContext::DjVuContext() {
+    InitializeCriticalSection(&lock);
+    msgEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    {
+        ScopedCritSec scope(GetDjVuCreateLock());
         ctx = ddjvu_context_create("DjVuEngine");
         // reset the locale to "C" as most other code expects
         setlocale(LC_ALL, "C");
-        ReportIf(!ctx);
     }
-
-    int AddRef() {
-        EnterCriticalSection(&lock);
-        ++refCount;
-        int res = refCount;
-        LeaveCriticalSection(&lock);
-        return res;
-    }
-
-    int Release() {
-        EnterCriticalSection(&lock);
-        ReportIf(refCount <= 0);
-        --refCount;
-        LeaveCriticalSection(&lock);
-        return refCount;
+    ReportIf(!ctx);
+    if (ctx) {
+        ddjvu_message_set_callback(ctx, DjVuMessageCallback, this);
     }
+}
 
-    ~DjVuContext() {
-        EnterCriticalSection(&lock);
-        if (ctx) {
-            ddjvu_context_release(ctx);
-        }
-        LeaveCriticalSection(&lock);
-        DeleteCriticalSection(&lock);
+DjVuContext::~DjVuContext() {
+    if (ctx) {
+        ddjvu_message_set_callback(ctx, nullptr, nullptr);
+        ddjvu_context_release(ctx);
     }
+    CloseHandle(msgEvent);
+    DeleteCriticalSection(&lock);
+}
 
-    void SpinMessageLoop(bool wait = true) const {
-        const ddjvu_message_t* msg = nullptr;
-        if (wait) {
-            ddjvu_message_wait(ctx);
-        }
-        while ((msg = ddjvu_message_peek(ctx)) != nullptr) {
-            auto tag = msg->m_any.tag;
-            if (DDJVU_NEWSTREAM == tag) {
-                auto streamId = msg->m_newstream.streamid;
-                if (streamId != 0) {
-                    BOOL stop = FALSE;
-                    ddjvu_stream_close(msg->m_any.document, streamId, stop);
-                }
+// several threads may wait for (different) jobs at the same time, so instead of
+// ddjvu_message_wait (which would block forever if another thread popped the
+// message we're waiting for) all of them wait for msgEvent and the first one
+// to wake up empties the queue. callers re-check their job's status after this
+void DjVuContext::SpinMessageLoop(bool wait) {
+    if (wait) {
+        // the timeout is only a safety net, messages are usually signaled
+        WaitForSingleObject(msgEvent, 100);
+    }
+    ScopedCritSec scope(&lock);
+    // reset before popping, so that messages queued afterwards signal again
+    ResetEvent(msgEvent);
+    const ddjvu_message_t* msg = nullptr;
+    while ((msg = ddjvu_message_peek(ctx)) != nullptr) {
+        auto tag = msg->m_any.tag;
+        if (DDJVU_NEWSTREAM == tag) {
+            auto streamId = msg->m_newstream.streamid;
+            if (streamId != 0) {
+                BOOL stop = FALSE;
+                ddjvu_stream_close(msg->m_any.document, streamId, stop);
             }
-            ddjvu_message_pop(ctx);
         }
+        ddjvu_message_pop(ctx);
     }
+}
 
-    ddjvu_document_t* OpenFile(const char* fileName) {
-        ScopedCritSec scope(&lock);
-        // TODO: libdjvu sooner or later crashes inside its caching code; cf.
-        //       http://code.google.com/p/sumatrapdf/issues/detail?id=1434
-        return ddjvu_document_create_by_filename_utf8(ctx, fileName, /* cache */ FALSE);
-    }
-
-    ddjvu_document_t* OpenStream(IStream* stream) {
-        ScopedCritSec scope(&lock);
-        ByteSlice d = GetDataFromStream(stream, nullptr);
-        AutoFree dFree(d.Get());
-        if (d.empty() || d.size() > ULONG_MAX) {
-            return nullptr;
-        }
-        auto res = ddjvu_document_create_by_data(ctx, d, (ULONG)d.size());
-        return res;
-    }
-};
-
-// TODO: make it non-static because it accesses other static state
-// in djvu which got deleted first
-static DjVuContext* gDjVuContext;
-
-static DjVuContext* GetDjVuContext() {
-    if (!gDjVuContext) {
-        gDjVuContext = new DjVuContext();
-    } else {
-        gDjVuContext->AddRef();
-    }
-    return gDjVuContext;
+ddjvu_document_t* DjVuContext::OpenFile(const char* fileName) {
+    // TODO: libdjvu sooner or later crashes inside its caching code; cf.
+    //       http://code.google.com/p/sumatrapdf/issues/detail?id=1434
+    return ddjvu_document_create_by_filename_utf8(ctx, fileName, /* cache */ FALSE);
 }
 
-static void ReleaseDjVuContext() {
-    ReportIf(!gDjVuContext);
-    int refCount = gDjVuContext->Release();
-    if (refCount != 0) {
-        return;
+// libdjvu makes its own copy of the data
+ddjvu_document_t* DjVuContext::OpenData(const ByteSlice& d) {
+    if (d.empty() || d.size() > ULONG_MAX) {
+        return nullptr;
     }
+    auto res = ddjvu_document_create_by_data(ctx, d, (ULONG)d.size());
+    return res;
 }
 
 void CleanupEngineDjVu() {
-    if (gDjVuContext) {
-        ReportIf(gDjVuContext->refCount != 0);
-        delete gDjVuContext;
-        gDjVuContext = nullptr;
-    }
     minilisp_finish();
 }
 
+// decoded pages are kept so that rendering further tiles or zoom levels of
+// the same page doesn't decode its IW44 and JB2 layers again.
+// the limit applies to each document separately
+constexpr size_t kDjVuPageCacheSize = 96 * 1024 * 1024;
+static size_t gDjVuPageCacheSize = kDjVuPageCacheSize;
+
+struct DjVuCachedPage {
+    ddjvu_page_t* page = nullptr;
+    int pageNo = 0;
+    // estimated memory use of the decoded page
+    size_t size = 0;
+    bool sizeIsEstimate = true;
+    // 1 for being in the cache + 1 for each GetCachedPage() not yet dropped
+    int refs = 1;
+    // ddjvu_page_set_rotation and ddjvu_page_render modify the page
+    CRITICAL_SECTION renderAccess;
+};
+
 struct DjVuPageInfo {
     RectF mediabox;
+    // 0 if not known without decoding the page
+    int dpi = 0;
     Vec<IPageElement*> allElements;
     miniexp_t annos{miniexp_dummy};
     bool gotAllElements = false;
@@ -277,8 +295,11 @@ class EngineDjVu : public EngineBase {
 
     Vec<DjVuPageInfo*> pages;
 
+    DjVuContext* djvu = nullptr;
     ddjvu_document_t* doc = nullptr;
     miniexp_t outline = miniexp_nil;
+    // protects pages' annotations, elements and dpi and tocTree
+    CRITICAL_SECTION docAccess;
     TocTree* tocTree = nullptr;
 
     Vec<ddjvu_fileinfo_t> fileInfos;
@@ -287,8 +308,20 @@ class EngineDjVu : public EngineBase {
     bool ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>& coords);
     TempStr ResolveNamedDestTemp(const char* name);
     TocItem* BuildTocTree(TocItem* parent, miniexp_t entry, int& idCounter);
-    bool FinishLoading();
-    bool LoadMediaboxes();
+    bool FinishLoading(const ByteSlice& data, bool isMapped = false);
+    bool LoadMediaboxes(const ByteSlice& data);
+    bool LoadMediaboxesFromMappedFile(const ByteSlice& data);
+    float GetDpiFactor(int pageNo);
+
+    // most recently used page is last
+    Vec<DjVuCachedPage*> pageCache;
+    size_t pageCacheSize = 0;
+    CRITICAL_SECTION pageCacheAccess;
+
+    DjVuCachedPage* GetCachedPage(int pageNo, bool prefetch = false);
+    void DropCachedPage(DjVuCachedPage* cp);
+    void UpdateCachedPageSize(DjVuCachedPage* cp);
+    void ShrinkPageCache(size_t maxSize);
 };
 
 EngineDjVu::EngineDjVu() {
@@ -296,14 +329,16 @@ EngineDjVu::EngineDjVu() {
     str::ReplaceWithCopy(&defaultExt, ".djvu");
     // DPI isn't constant for all pages and thus premultiplied
     fileDPI = 300.0f;
-    GetDjVuContext();
+    InitializeCriticalSection(&docAccess);
+    InitializeCriticalSection(&pageCacheAccess);
+    djvu = new DjVuContext();
 }
 
 EngineDjVu::~EngineDjVu() {
-    ScopedCritSec scope(&gDjVuContext->lock);
-
     delete tocTree;
 
+    ShrinkPageCache(0);
+
     for (auto pi : pages) {
         if (pi->annos && pi->annos != miniexp_dummy) {
             ddjvu_miniexp_release(doc, pi->annos);
@@ -321,7 +356,10 @@ EngineDjVu::~EngineDjVu() {
     if (stream) {
         stream->Release();
     }
-    ReleaseDjVuContext();
+    // the document must be released before its context
+    delete djvu;
+    DeleteCriticalSection(&pageCacheAccess);
+    DeleteCriticalSection(&docAccess);
 }
 
 EngineBase* EngineDjVu::Clone() {
@@ -359,15 +397,6 @@ bool EngineDjVu::BenchLoadPage(int) {
 // so try to either only use them when actually needed or replace them
 // with a function that extracts all the data at once:
 
-static bool ReadBytes(HANDLE h, DWORD offset, void* buffer, DWORD count) {
-    DWORD res = SetFilePointer(h, offset, nullptr, FILE_BEGIN);
-    if (res != offset) {
-        return false;
-    }
-    bool ok = ReadFile(h, buffer, count, &res, nullptr);
-    return ok && res == count;
-}
-
 #define DJVU_MARK_MAGIC 0x41542654L /* AT&T */
 #define DJVU_MARK_FORM 0x464F524DL  /* FORM */
 #define DJVU_MARK_DJVM 0x444A564DL  /* DJVM */
@@ -387,46 +416,78 @@ struct DjVuInfoChunk {
 
 static_assert(sizeof(DjVuInfoChunk) == 10, "wrong size of DjVuInfoChunk structure");
 
-bool EngineDjVu::LoadMediaboxes() {
-    const char* path = FilePath();
-    if (!path) {
-        return false;
-    }
+// maps a file read-only into memory, so that scanning its chunk headers
+// only reads the parts of the file that contain them
+struct MappedFile {
+    HANDLE hMap = nullptr;
+    ByteSlice data;
+
+    explicit MappedFile(const char* path);
+    ~MappedFile();
+};
+
+MappedFile::MappedFile(const char* path) {
     AutoCloseHandle h(file::OpenReadOnly(path));
     if (!h.IsValid()) {
-        return false;
+        return;
+    }
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(h, &size) || size.QuadPart == 0 || (u64)size.QuadPart > (u64)SIZE_MAX) {
+        return;
     }
-    char buffer[16];
-    ByteReader r(buffer, sizeof(buffer));
-    if (!ReadBytes(h, 0, buffer, 16) || r.DWordBE(0) != DJVU_MARK_MAGIC || r.DWordBE(4) != DJVU_MARK_FORM) {
+    hMap = CreateFileMappingW(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!hMap) {
+        return;
+    }
+    void* d = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    if (d) {
+        data = ByteSlice((u8*)d, (size_t)size.QuadPart);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (data.data()) {
+        UnmapViewOfFile(data.data());
+    }
+    if (hMap) {
+        CloseHandle(hMap);
+    }
+}
+
+// reads the INFO chunks of all pages in a single pass over the top-level chunks
+// (DIRM, NAVM, shared DJVI and the pages' FORM:DJVU) without decoding anything.
+// only works for single page and bundled documents, as the pages of indirect
+// documents are in separate files
+bool EngineDjVu::LoadMediaboxes(const ByteSlice& data) {
+    ByteReader r(data);
+    size_t len = data.size();
+    if (len < 16 || r.DWordBE(0) != DJVU_MARK_MAGIC || r.DWordBE(4) != DJVU_MARK_FORM) {
         return false;
     }
 
-    DWORD offset = r.DWordBE(12) == DJVU_MARK_DJVM ? 16 : 4;
-    for (int pageNo = 0; pageNo < pageCount; /* no op, must inc inside isMark */) {
-        if (!ReadBytes(h, offset, buffer, 16)) {
+    size_t offset = r.DWordBE(12) == DJVU_MARK_DJVM ? 16 : 4;
+    int pageNo = 0;
+    while (pageNo < pageCount) {
+        if (offset + 16 > len) {
             return false;
         }
-        int partLen = r.DWordBE(4);
-        if (partLen < 0) {
+        size_t partLen = r.DWordBE(offset + 4);
+        if (partLen > len - offset - 8) {
             return false;
         }
-        bool isMark =
-            r.DWordBE(0) == DJVU_MARK_FORM && r.DWordBE(8) == DJVU_MARK_DJVU && r.DWordBE(12) == DJVU_MARK_INFO;
-        if (isMark) {
-            if (!ReadBytes(h, offset + 16, buffer, 14)) {
+        bool isPage = r.DWordBE(offset) == DJVU_MARK_FORM && r.DWordBE(offset + 8) == DJVU_MARK_DJVU &&
+                      r.DWordBE(offset + 12) == DJVU_MARK_INFO;
+        if (isPage) {
+            DjVuInfoChunk info;
+            if (offset + 20 + sizeof(info) > len || !r.UnpackBE(&info, sizeof(info), "2w6b", offset + 20)) {
                 return false;
             }
-            DjVuInfoChunk info;
-            bool ok = r.UnpackBE(&info, sizeof(info), "2w6b", 4);
-            ReportIf(!ok);
             int dpi = MAKEWORD(info.dpiLo, info.dpiHi); // dpi is little-endian
             // DjVuLibre ignores DPI values outside 25 to 6000 in DjVuInfo::decode
             if (dpi < 25 || 6000 < dpi) {
                 dpi = 300;
             }
             DjVuPageInfo* pi = pages[pageNo];
-            // auto&& mediabox = pi->mediabox;
             float dx = GetFileDPI() * info.width / dpi;
             float dy = GetFileDPI() * info.height / dpi;
             if (info.flags & 4) {
@@ -436,6 +497,7 @@ bool EngineDjVu::LoadMediaboxes() {
                 pi->mediabox.dx = dx;
                 pi->mediabox.dy = dy;
             }
+            pi->dpi = dpi;
             pageNo++;
         }
         offset += 8 + partLen + (partLen & 1);
@@ -444,26 +506,39 @@ bool EngineDjVu::LoadMediaboxes() {
     return true;
 }
 
+// reading a mapped file raises EXCEPTION_IN_PAGE_ERROR instead of failing if the file
+// can't be read (e.g. it's on a network drive that went away or was truncated meanwhile)
+bool EngineDjVu::LoadMediaboxesFromMappedFile(const ByteSlice& data) {
+    __try {
+        return LoadMediaboxes(data);
+    } __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER
+                                                                : EXCEPTION_CONTINUE_SEARCH) {
+        return false;
+    }
+}
+
 bool EngineDjVu::Load(const char* fileName) {
     SetFilePath(fileName);
-    doc = gDjVuContext->OpenFile(fileName);
-    return FinishLoading();
+    doc = djvu->OpenFile(fileName);
+    MappedFile file(fileName);
+    return FinishLoading(file.data, true);
 }
 
 bool EngineDjVu::Load(IStream* stream) {
-    doc = gDjVuContext->OpenStream(stream);
-    return FinishLoading();
+    ByteSlice d = GetDataFromStream(stream, nullptr);
+    AutoFree dFree(d.Get());
+    doc = djvu->OpenData(d);
+    return FinishLoading(d);
 }
 
-bool EngineDjVu::FinishLoading() {
+// data is used for reading the mediaboxes and can be empty
+bool EngineDjVu::FinishLoading(const ByteSlice& data, bool isMapped) {
     if (!doc) {
         return false;
     }
 
-    ScopedCritSec scope(&gDjVuContext->lock);
-
     while (!ddjvu_document_decoding_done(doc)) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
 
     if (ddjvu_document_decoding_error(doc)) {
@@ -478,14 +553,14 @@ bool EngineDjVu::FinishLoading() {
     for (int i = 0; i < pageCount; i++) {
         pages.Append(new DjVuPageInfo());
     }
-    bool ok = LoadMediaboxes();
+    bool ok = isMapped ? LoadMediaboxesFromMappedFile(data) : LoadMediaboxes(data);
     if (!ok) {
         // fall back to the slower but safer way to extract page mediaboxes
         for (int i = 0; i < pageCount; i++) {
             ddjvu_status_t status;
             ddjvu_pageinfo_t info;
             while ((status = ddjvu_document_get_pageinfo(doc, i, &info)) < DDJVU_JOB_OK) {
-                gDjVuContext->SpinMessageLoop();
+                djvu->SpinMessageLoop();
             }
             if (DDJVU_JOB_OK == status) {
                 DjVuPageInfo* pi = pages[i];
@@ -493,12 +568,13 @@ bool EngineDjVu::FinishLoading() {
                 float dy = (float)info.height * GetFileDPI() / (float)info.dpi;
                 pi->mediabox.dx = dx;
                 pi->mediabox.dy = dy;
+                pi->dpi = info.dpi;
             }
         }
     }
 
     while ((outline = ddjvu_document_get_outline(doc)) == miniexp_dummy) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
     if (!miniexp_consp(outline) || miniexp_car(outline) != miniexp_symbol("bookmarks")) {
         ddjvu_miniexp_release(doc, outline);
@@ -510,7 +586,7 @@ bool EngineDjVu::FinishLoading() {
         ddjvu_status_t status;
         ddjvu_fileinfo_s info;
         while ((status = ddjvu_document_get_fileinfo(doc, i, &info)) < DDJVU_JOB_OK) {
-            gDjVuContext->SpinMessageLoop();
+            djvu->SpinMessageLoop();
         }
         if (DDJVU_JOB_OK == status && info.type == 'P' && info.pageno >= 0) {
             fileInfos.Append(info);
@@ -521,6 +597,106 @@ bool EngineDjVu::FinishLoading() {
     return true;
 }
 
+static void DjVuCachedPageRelease(DjVuCachedPage* cp) {
+    if (--cp->refs > 0) {
+        return;
+    }
+    ddjvu_page_release(cp->page);
+    DeleteCriticalSection(&cp->renderAccess);
+    delete cp;
+}
+
+// must be called with pageCacheAccess held
+void EngineDjVu::ShrinkPageCache(size_t maxSize) {
+    while (pageCacheSize > maxSize && pageCache.size() > 0) {
+        DjVuCachedPage* cp = pageCache.PopAt(0);
+        pageCacheSize -= cp->size;
+        DjVuCachedPageRelease(cp);
+    }
+}
+
+// JB2 masks take about a bit per pixel and IW44 layers 2 bytes per coefficient
+// for each of the 3 color components. the IW44 background of compound pages
+// is usually subsampled by 3 in both directions
+static size_t DjVuPageMemSize(int dx, int dy, ddjvu_page_type_t type) {
+    size_t nPixels = (size_t)std::max(dx, 0) * (size_t)std::max(dy, 0);
+    size_t iw44Size = nPixels * 2 * 3;
+    switch (type) {
+        case DDJVU_PAGETYPE_BITONAL:
+            return nPixels / 8;
+        case DDJVU_PAGETYPE_PHOTO:
+            return iw44Size;
+        default:
+            return nPixels / 8 + iw44Size / 9;
+    }
+}
+
+// must be called with pageCacheAccess held
+void EngineDjVu::UpdateCachedPageSize(DjVuCachedPage* cp) {
+    if (!cp->sizeIsEstimate || !ddjvu_page_decoding_done(cp->page)) {
+        return;
+    }
+    ddjvu_page_type_t type = ddjvu_page_get_type(cp->page);
+    size_t size = DjVuPageMemSize(ddjvu_page_get_width(cp->page), ddjvu_page_get_height(cp->page), type);
+    cp->sizeIsEstimate = false;
+    if (pageCache.Contains(cp)) {
+        pageCacheSize = pageCacheSize - cp->size + size;
+    }
+    cp->size = size;
+}
+
+// returns the cached page (which might still be decoding) or starts decoding it.
+// for prefetching, the page is only added to the cache and nullptr is returned
+DjVuCachedPage* EngineDjVu::GetCachedPage(int pageNo, bool prefetch) {
+    ScopedCritSec scope(&pageCacheAccess);
+    for (int i = pageCache.Size() - 1; i >= 0; i--) {
+        DjVuCachedPage* cp = pageCache.at(i);
+        if (cp->pageNo == pageNo) {
+            if (prefetch) {
+                return nullptr;
+            }
+            pageCache.RemoveAt(i);
+            pageCache.Append(cp);
+            UpdateCachedPageSize(cp);
+            cp->refs++;
+            return cp;
+        }
+    }
+
+    if (prefetch && gDjVuPageCacheSize == 0) {
+        return nullptr;
+    }
+    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+    if (!page) {
+        return nullptr;
+    }
+    auto cp = new DjVuCachedPage();
+    cp->page = page;
+    cp->pageNo = pageNo;
+    // until the page is decoded, assume it's a compound page at 300 dpi
+    RectF mbox = pages[pageNo - 1]->mediabox;
+    cp->size = DjVuPageMemSize((int)mbox.dx, (int)mbox.dy, DDJVU_PAGETYPE_COMPOUND);
+    InitializeCriticalSection(&cp->renderAccess);
+    if (gDjVuPageCacheSize == 0) {
+        // not cached, the caller's DropCachedPage() releases it
+        return cp;
+    }
+    if (!prefetch) {
+        cp->refs++;
+    }
+    pageCache.Append(cp);
+    pageCacheSize += cp->size;
+    ShrinkPageCache(gDjVuPageCacheSize);
+    return prefetch ? nullptr : cp;
+}
+
+void EngineDjVu::DropCachedPage(DjVuCachedPage* cp) {
+    ScopedCritSec scope(&pageCacheAccess);
+    UpdateCachedPageSize(cp);
+    DjVuCachedPageRelease(cp);
+    ShrinkPageCache(gDjVuPageCacheSize);
+}
+
 RenderedBitmap* EngineDjVu::CreateRenderedBitmap(const char* bmpData, Size size, bool grayscale) const {
     int stride = ((size.dx * (grayscale ? 1 : 3) + 3) / 4) * 4;
 
@@ -558,7 +734,6 @@ RenderedBitmap* EngineDjVu::CreateRenderedBitmap(const char* bmpData, Size size,
 }
 
 RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
-    ScopedCritSec scope(&gDjVuContext->lock);
     auto pageRect = args.pageRect;
     auto zoom = args.zoom;
     auto pageNo = args.pageNo;
@@ -568,17 +743,26 @@ RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
     Rect full = Transform(PageMediabox(pageNo), pageNo, zoom, rotation).Round();
     screen = full.Intersect(screen);
 
-    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
-    if (!page) {
+    DjVuCachedPage* cp = GetCachedPage(pageNo);
+    if (!cp) {
         return nullptr;
     }
+    defer {
+        DropCachedPage(cp);
+    };
+    ddjvu_page_t* page = cp->page;
     while (!ddjvu_page_decoding_done(page)) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
     if (ddjvu_page_decoding_error(page)) {
         return nullptr;
     }
+    // start decoding the next page in the background, it's likely to be rendered next
+    if (pageNo < pageCount) {
+        GetCachedPage(pageNo + 1, true);
+    }
 
+    ScopedCritSec scope(&cp->renderAccess);
     ddjvu_page_rotation_t rot = DDJVU_ROTATE_0;
     switch (rotation) {
         case 0:
@@ -607,7 +791,6 @@ RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
 
     defer {
         ddjvu_format_release(fmt);
-        ddjvu_page_release(page);
     };
 
     int topToBottom = TRUE;
@@ -639,20 +822,23 @@ RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
 }
 
 RectF EngineDjVu::PageContentBox(int pageNo, RenderTarget) {
-    ScopedCritSec scope(&gDjVuContext->lock);
-
     RectF pageRc = PageMediabox(pageNo);
-    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
-    if (!page) {
+    DjVuCachedPage* cp = GetCachedPage(pageNo);
+    if (!cp) {
         return pageRc;
     }
+    defer {
+        DropCachedPage(cp);
+    };
+    ddjvu_page_t* page = cp->page;
 
     while (!ddjvu_page_decoding_done(page)) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
     if (ddjvu_page_decoding_error(page)) {
         return pageRc;
     }
+    ScopedCritSec scope(&cp->renderAccess);
     ddjvu_page_set_rotation(page, DDJVU_ROTATE_0);
 
     // render the page in 8-bit grayscale up to 250x250 px in size
@@ -660,7 +846,6 @@ RectF EngineDjVu::PageContentBox(int pageNo, RenderTarget) {
 
     defer {
         ddjvu_format_release(fmt);
-        ddjvu_page_release(page);
     };
 
     ddjvu_format_set_row_order(fmt, /* top_to_bottom */ TRUE);
@@ -779,6 +964,31 @@ bool EngineDjVu::SaveFileAs(const char* dstPath) {
     return file::Copy(dstPath, srcPath, false);
 }
 
+// factor from the page's pixels to our coordinates (which are at fileDPI)
+float EngineDjVu::GetDpiFactor(int pageNo) {
+    DjVuPageInfo* pi = pages[pageNo - 1];
+    int dpi;
+    {
+        ScopedCritSec scope(&docAccess);
+        dpi = pi->dpi;
+    }
+    if (dpi == 0) {
+        // not read by LoadMediaboxes
+        ddjvu_status_t status;
+        ddjvu_pageinfo_t info;
+        while ((status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info)) < DDJVU_JOB_OK) {
+            djvu->SpinMessageLoop();
+        }
+        if (DDJVU_JOB_OK != status || info.dpi <= 0) {
+            return 1.0f;
+        }
+        dpi = info.dpi;
+        ScopedCritSec scope(&docAccess);
+        pi->dpi = dpi;
+    }
+    return GetFileDPI() / dpi;
+}
+
 static void AppendNewline(str::WStr& extracted, Vec<Rect>& coords, const WCHAR* lineSep) {
     if (extracted.size() > 0 && ' ' == extracted.Last()) {
         extracted.RemoveLast();
@@ -790,6 +1000,9 @@ static void AppendNewline(str::WStr& extracted, Vec<Rect>& coords, const WCHAR*
 
 bool EngineDjVu::ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>& coords) {
     const WCHAR* lineSep = L"\n";
+    // symbols are interned, looking them up for every zone is needlessly slow
+    static miniexp_t symChar = miniexp_symbol("char");
+    static miniexp_t symWord = miniexp_symbol("word");
     miniexp_t type = miniexp_car(item);
     if (!miniexp_symbolp(type)) {
         return false;
@@ -820,7 +1033,7 @@ bool EngineDjVu::ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>
 
     miniexp_t str = miniexp_car(item);
     if (miniexp_stringp(str) && !miniexp_cdr(item)) {
-        if (type != miniexp_symbol("char") && type != miniexp_symbol("word") ||
+        if (type != symChar && type != symWord ||
             coords.size() > 0 && rect.y < coords.Last().y - coords.Last().dy * 0.8) {
             AppendNewline(extracted, coords, lineSep);
         }
@@ -834,7 +1047,7 @@ bool EngineDjVu::ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>
             }
             extracted.Append(value);
         }
-        if (miniexp_symbol("word") == type) {
+        if (symWord == type) {
             extracted.AppendChar(' ');
             coords.Append(Rect(rect.x + rect.dx, rect.y, 2, rect.dy));
         }
@@ -850,11 +1063,10 @@ bool EngineDjVu::ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>
 
 PageText EngineDjVu::ExtractPageText(int pageNo) {
     const WCHAR* lineSep = L"\n";
-    ScopedCritSec scope(&gDjVuContext->lock);
 
     miniexp_t pagetext;
     while ((pagetext = ddjvu_document_get_pagetext(doc, pageNo - 1, nullptr)) == miniexp_dummy) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
     if (miniexp_nil == pagetext) {
         return {};
@@ -874,15 +1086,7 @@ PageText EngineDjVu::ExtractPageText(int pageNo) {
     PageText res;
 
     ReportIf(str::Len(extracted.Get()) != coords.size());
-    ddjvu_status_t status;
-    ddjvu_pageinfo_t info;
-    while ((status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info)) < DDJVU_JOB_OK) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    float dpiFactor = 1.0;
-    if (DDJVU_JOB_OK == status) {
-        dpiFactor = GetFileDPI() / info.dpi;
-    }
+    float dpiFactor = GetDpiFactor(pageNo);
 
     // TODO: the coordinates aren't completely correct yet
     Rect page = PageMediabox(pageNo).Round();
@@ -908,6 +1112,7 @@ PageText EngineDjVu::ExtractPageText(int pageNo) {
 
 Vec<IPageElement*> EngineDjVu::GetElements(int pageNo) {
     ReportIf(pageNo < 1 || pageNo > PageCount());
+    ScopedCritSec scope(&docAccess);
     auto pi = pages[pageNo - 1];
     if (pi->gotAllElements) {
         return pi->allElements;
@@ -916,11 +1121,10 @@ Vec<IPageElement*> EngineDjVu::GetElements(int pageNo) {
     auto& els = pi->allElements;
 
     if (pi->annos == miniexp_dummy) {
-        ScopedCritSec scope(&gDjVuContext->lock);
         while (pi->annos == miniexp_dummy) {
             pi->annos = ddjvu_document_get_pageanno(doc, pageNo - 1);
             if (pi->annos == miniexp_dummy) {
-                gDjVuContext->SpinMessageLoop();
+                djvu->SpinMessageLoop();
             }
         }
     }
@@ -929,19 +1133,9 @@ Vec<IPageElement*> EngineDjVu::GetElements(int pageNo) {
         return els;
     }
 
-    ScopedCritSec scope(&gDjVuContext->lock);
-
     Rect page = PageMediabox(pageNo).Round();
 
-    ddjvu_status_t status;
-    ddjvu_pageinfo_t info;
-    while ((status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info)) < DDJVU_JOB_OK) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    float dpiFactor = 1.0;
-    if (DDJVU_JOB_OK == status) {
-        dpiFactor = GetFileDPI() / info.dpi;
-    }
+    float dpiFactor = GetDpiFactor(pageNo);
 
     miniexp_t* links = ddjvu_anno_get_hyperlinks(pi->annos);
     for (int i = 0; links[i]; i++) {
@@ -1156,10 +1350,10 @@ TocTree* EngineDjVu::GetToc() {
         return nullptr;
     }
 
+    ScopedCritSec scope(&docAccess);
     if (tocTree) {
         return tocTree;
     }
-    ScopedCritSec scope(&gDjVuContext->lock);
     int idCounter = 0;
     TocItem* root = BuildTocTree(nullptr, outline, idCounter);
     if (!root) {
@@ -1191,6 +1385,12 @@ int EngineDjVu::GetPageByLabel(const char* label) const {
     return EngineBase::GetPageByLabel(label);
 }
 
+// maximum size of the decoded pages cached by each document.
+// maxSize of 0 disables caching decoded pages
+void EngineDjVuSetPageCacheSize(size_t maxSize) {
+    gDjVuPageCacheSize = maxSize;
+}
+
 bool IsEngineDjVuSupportedFileType(Kind kind) {
     return kind == kindFileDjVu;
 }
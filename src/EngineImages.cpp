@@ -3,6 +3,9 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/Archive.h"
+#include "utils/ByteOrderDecoder.h"
+#include "utils/ByteWriter.h"
+#include "utils/CryptoUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
@@ -13,6 +16,9 @@
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
 #include "utils/DirIter.h"
+#include "utils/ThreadUtil.h"
+#include "utils/AvifReader.h"
+#include "utils/ImageDecoder.h"
 
 #include "wingui/UIModels.h"
 
@@ -25,6 +31,10 @@
 
 #include "utils/Log.h"
 
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
 using Gdiplus::ARGB;
 using Gdiplus::Bitmap;
 using Gdiplus::Color;
@@ -52,6 +62,23 @@ Kind kindEngineComicBooks = "engineComicBooks";
 // number of decoded bitmaps to cache for quicker rendering
 #define MAX_IMAGE_PAGE_CACHE 10
 
+// pages rendered at small zoom levels (e.g. thumbnails) are decoded
+// at most at 1/2^kMaxImageReduce of their size (if the format allows)
+constexpr int kMaxImageReduce = 3;
+
+// number of pages after a rendered page that are decoded in the background
+// (one at a time), so that they're ready when scrolling reaches them
+static int gImagePrefetchPages = 2;
+// threads used by the AV1 decoder for an AVIF page, 0 divides the cores
+// between the rendered page and the page being prefetched
+static int gAvifDecodeThreads = 0;
+
+// nAvifThreads: 0 is the default, nPrefetchPages: 0 disables prefetching
+void EngineImagesSetDecodeThreads(int nAvifThreads, int nPrefetchPages) {
+    gAvifDecodeThreads = std::max(nAvifThreads, 0);
+    gImagePrefetchPages = std::max(nPrefetchPages, 0);
+}
+
 ///// EngineImages methods apply to all types of engines handling full-page images /////
 
 struct ImagePage {
@@ -59,6 +86,13 @@ struct ImagePage {
     Bitmap* bmp = nullptr;
     bool ownBmp = true;
     int refs = 1;
+    // bmp was decoded at 1/2^reduce of the page's size
+    int reduce = 0;
+    // bmp is being decoded (outside of cacheAccess)
+    bool isLoading = false;
+    // isLoading page that's waiting in prefetchQueue, decoded at 1/2^prefetchReduce
+    bool isQueued = false;
+    int prefetchReduce = 0;
 
     ImagePage(int pageNo, Bitmap* bmp) {
         this->pageNo = pageNo;
@@ -109,16 +143,31 @@ class EngineImages : public EngineBase {
     ScopedComPtr<IStream> fileStream;
 
     CRITICAL_SECTION cacheAccess;
+    // signaled (with cacheAccess) when a page has been decoded
+    CONDITION_VARIABLE pageLoaded;
     Vec<ImagePage*> pageCache;
     Vec<ImagePageInfo*> pages;
+    // set by engines whose LoadBitmapForPage() can run on several threads
+    bool canPrefetch = false;
+    // pages to be decoded by the prefetch worker (protected by cacheAccess)
+    Vec<ImagePage*> prefetchQueue;
+    bool prefetchWorkerRunning = false;
+    AvifDecoderPool* avifDecoders = nullptr;
+    // cloned (with fz_clone_context()) by the threads decoding pages with ImageDecoder
+    fz_context* fzCtx = nullptr;
 
     void GetTransform(Matrix& m, int pageNo, float zoom, int rotation);
 
-    virtual Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) = 0;
+    // targetSize is a hint for formats that can be decoded at a lower resolution
+    virtual Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse, Size targetSize) = 0;
     virtual RectF LoadMediabox(int pageNo) = 0;
 
-    ImagePage* GetPage(int pageNo, bool tryOnly = false);
+    ImagePage* GetPage(int pageNo, bool tryOnly = false, int reduce = 0);
+    ImagePage* AddLoadingPage(int pageNo);
+    bool LoadPage(ImagePage* page, int reduce, Rect mbox);
     void DropPage(ImagePage* page, bool forceRemove);
+    void PrefetchPage(int pageNo, int reduce);
+    Bitmap* BitmapFromPageData(const ByteSlice& data, Size targetSize);
 
     RectF PageContentBox(int pageNo, RenderTarget) override;
 };
@@ -131,6 +180,10 @@ EngineImages::EngineImages() {
     isImageCollection = true;
 
     InitializeCriticalSection(&cacheAccess);
+    InitializeConditionVariable(&pageLoaded);
+    // a decoder for the rendered page and one for the prefetch worker
+    avifDecoders = NewAvifDecoderPool(2);
+    fzCtx = fz_new_context_windows();
 }
 
 EngineImages::~EngineImages() {
@@ -143,6 +196,10 @@ EngineImages::~EngineImages() {
     DeleteVecMembers(pages);
     LeaveCriticalSection(&cacheAccess);
     DeleteCriticalSection(&cacheAccess);
+    DeleteAvifDecoderPool(avifDecoders);
+    if (fzCtx) {
+        fz_drop_context_windows(fzCtx);
+    }
 }
 
 RectF EngineImages::PageMediabox(int pageNo) {
@@ -163,7 +220,15 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     auto zoom = args.zoom;
     auto rotation = args.rotation;
 
-    ImagePage* page = GetPage(pageNo);
+    // GetPage() needs the mediabox for decoding at a lower resolution
+    RectF mediabox = PageMediabox(pageNo);
+    // at zoom levels <= 1/2^n, a page decoded at 1/2^n of its size
+    // looks the same and is much faster to decode
+    int reduce = 0;
+    while (reduce < kMaxImageReduce && zoom * (float)(2 << reduce) <= 1.f) {
+        reduce++;
+    }
+    ImagePage* page = GetPage(pageNo, false, reduce);
     if (!page) {
         return nullptr;
     }
@@ -176,7 +241,7 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
         }
     };
 
-    RectF pageRc = pageRect ? *pageRect : PageMediabox(pageNo);
+    RectF pageRc = pageRect ? *pageRect : mediabox;
     Rect screen = Transform(pageRc, pageNo, zoom, rotation).Round();
     Point screenTL = screen.TL();
     screen.Offset(-screen.x, -screen.y);
@@ -203,15 +268,29 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     m.Translate((float)-screenTL.x, (float)-screenTL.y, MatrixOrderAppend);
     g.SetTransform(&m);
 
-    Rect pageRcI = PageMediabox(pageNo).Round();
+    Rect pageRcI = mediabox.Round();
+    Rect srcRc = pageRcI;
+    if (page->reduce > 0) {
+        // a reduced bitmap covers the whole page
+        srcRc = Rect(0, 0, (int)page->bmp->GetWidth(), (int)page->bmp->GetHeight());
+    }
     ImageAttributes imgAttrs;
     imgAttrs.SetWrapMode(WrapModeTileFlipXY);
-    Status ok =
-        g.DrawImage(page->bmp, ToGdipRect(pageRcI), pageRcI.x, pageRcI.y, pageRcI.dx, pageRcI.dy, UnitPixel, &imgAttrs);
+    Status ok = g.DrawImage(page->bmp, ToGdipRect(pageRcI), srcRc.x, srcRc.y, srcRc.dx, srcRc.dy, UnitPixel, &imgAttrs);
 
     DropPage(page, false);
     DeleteDC(hDC);
 
+    // only prefetch when a whole page is rendered for display, not
+    // for a tile of a zoomed in page or for a thumbnail
+    Rect pageOnScreen = Transform(mediabox, pageNo, zoom, rotation).Round();
+    bool isTile = screen.dx + 1 < pageOnScreen.dx || screen.dy + 1 < pageOnScreen.dy;
+    if (canPrefetch && args.target == RenderTarget::View && !args.isThumbnail && !isTile) {
+        for (int i = 1; i <= gImagePrefetchPages && pageNo + i <= PageCount(); i++) {
+            PrefetchPage(pageNo + i, reduce);
+        }
+    }
+
     if (ok != Ok) {
         DeleteObject(hbmp);
         CloseHandle(hMap);
@@ -321,40 +400,64 @@ bool EngineImages::SaveFileAs(const char* dstPath) {
     return file::WriteFile(dstPath, d);
 }
 
-ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly) {
+// reduce > 0 accepts a bitmap decoded at 1/2^reduce of the page's size
+// pages are decoded outside of cacheAccess so that several pages can be
+// decoded in parallel; a page is only ever decoded by one thread at a time
+ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly, int reduce) {
+    Rect mbox;
+    if (reduce > 0) {
+        // LoadMediabox() might need cacheAccess
+        mbox = PageMediabox(pageNo).Round();
+    }
+
     ScopedCritSec scope(&cacheAccess);
 
     ImagePage* result = nullptr;
-
-    for (size_t i = 0; i < pageCache.size(); i++) {
-        if (pageCache.at(i)->pageNo == pageNo) {
-            result = pageCache.at(i);
+    for (;;) {
+        result = nullptr;
+        for (size_t i = 0; i < pageCache.size(); i++) {
+            if (pageCache.at(i)->pageNo == pageNo) {
+                result = pageCache.at(i);
+                break;
+            }
+        }
+        if (!result || !result->isLoading) {
             break;
         }
+        if (tryOnly) {
+            return nullptr;
+        }
+        if (result->isQueued) {
+            // decode the page right away instead of waiting for the prefetch
+            // worker to get to it. the queue's reference is passed to the caller
+            prefetchQueue.Remove(result);
+            result->isQueued = false;
+            return LoadPage(result, reduce, mbox) ? result : nullptr;
+        }
+        // wait for the thread that's decoding this page
+        SleepConditionVariableCS(&pageLoaded, &cacheAccess, INFINITE);
+    }
+    if (result && result->reduce > reduce) {
+        // the cached bitmap's resolution is too low, so decode the page again
+        // (the old one is deleted once it's no longer used)
+        DropPage(result, true);
+        result = nullptr;
     }
     if (!result && tryOnly) {
         return nullptr;
     }
 
     if (!result) {
-        // TODO: drop most memory intensive pages first
-        if (pageCache.size() >= MAX_IMAGE_PAGE_CACHE) {
-            ReportIf(pageCache.size() != MAX_IMAGE_PAGE_CACHE);
-            DropPage(pageCache.Last(), true);
-        }
-        result = new ImagePage(pageNo, nullptr);
-        result->bmp = LoadBitmapForPage(pageNo, result->ownBmp);
-        pageCache.InsertAt(0, result);
-    } else if (result != pageCache.at(0)) {
+        result = AddLoadingPage(pageNo);
+        return LoadPage(result, reduce, mbox) ? result : nullptr;
+    }
+    if (result != pageCache.at(0)) {
         // keep the list Most Recently Used first
         pageCache.Remove(result);
         pageCache.InsertAt(0, result);
     }
     // return nullptr if a page failed to load
-    if (result && !result->bmp) {
-        return nullptr;
-    }
-    if (!result) {
+    if (!result->bmp) {
         return nullptr;
     }
 
@@ -362,6 +465,51 @@ ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly) {
     return result;
 }
 
+// adds a placeholder for a page that's about to be decoded (with cacheAccess held).
+// the returned page has an extra reference for the thread that decodes it
+ImagePage* EngineImages::AddLoadingPage(int pageNo) {
+    // TODO: drop most memory intensive pages first
+    if (pageCache.size() >= MAX_IMAGE_PAGE_CACHE) {
+        ReportIf(pageCache.size() != MAX_IMAGE_PAGE_CACHE);
+        DropPage(pageCache.Last(), true);
+    }
+    ImagePage* page = new ImagePage(pageNo, nullptr);
+    page->isLoading = true;
+    // keep the page alive while it's decoded, even if it's evicted
+    page->refs++;
+    pageCache.InsertAt(0, page);
+    return page;
+}
+
+// decodes a page returned by AddLoadingPage() with cacheAccess held (it's released
+// while decoding). if decoding fails, the decoding thread's reference is dropped
+bool EngineImages::LoadPage(ImagePage* page, int reduce, Rect mbox) {
+    Size targetSize;
+    if (reduce > 0) {
+        int round = (1 << reduce) - 1;
+        targetSize = Size((mbox.dx + round) >> reduce, (mbox.dy + round) >> reduce);
+    }
+
+    bool ownBmp = true;
+    LeaveCriticalSection(&cacheAccess);
+    Bitmap* bmp = LoadBitmapForPage(page->pageNo, ownBmp, targetSize);
+    EnterCriticalSection(&cacheAccess);
+
+    page->bmp = bmp;
+    page->ownBmp = ownBmp;
+    // not all formats can be decoded at a lower resolution
+    if (bmp && reduce > 0 && (int)bmp->GetWidth() < mbox.dx) {
+        page->reduce = reduce;
+    }
+    page->isLoading = false;
+    WakeAllConditionVariable(&pageLoaded);
+    if (!bmp) {
+        DropPage(page, false);
+        return false;
+    }
+    return true;
+}
+
 void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
     ScopedCritSec scope(&cacheAccess);
     page->refs--;
@@ -379,10 +527,99 @@ void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
     }
 }
 
+static void ImagePrefetchWorker(EngineImages* e) {
+    while (true) {
+        ImagePage* page = nullptr;
+        {
+            ScopedCritSec scope(&e->cacheAccess);
+            if (e->prefetchQueue.IsEmpty()) {
+                e->prefetchWorkerRunning = false;
+                break;
+            }
+            // pages are queued in the order in which they're likely to be looked at
+            page = e->prefetchQueue.PopAt(0);
+            page->isQueued = false;
+        }
+        int reduce = page->prefetchReduce;
+        Rect mbox;
+        if (reduce > 0) {
+            mbox = e->PageMediabox(page->pageNo).Round();
+        }
+        ScopedCritSec scope(&e->cacheAccess);
+        if (!e->pageCache.Contains(page)) {
+            // evicted before it was decoded
+            page->isLoading = false;
+            WakeAllConditionVariable(&e->pageLoaded);
+            e->DropPage(page, false);
+            continue;
+        }
+        if (e->LoadPage(page, reduce, mbox)) {
+            e->DropPage(page, false);
+        }
+    }
+    e->Release();
+}
+
+// queues the page for decoding unless it's already cached or being decoded.
+// pages are decoded one at a time by a single worker thread per engine
+void EngineImages::PrefetchPage(int pageNo, int reduce) {
+    ScopedCritSec scope(&cacheAccess);
+    for (ImagePage* page : pageCache) {
+        if (page->pageNo == pageNo && (page->isLoading || page->reduce <= reduce)) {
+            return;
+        }
+    }
+    // the placeholder makes GetPage() wait for (or take over) the decoding
+    ImagePage* page = AddLoadingPage(pageNo);
+    page->isQueued = true;
+    page->prefetchReduce = reduce;
+    prefetchQueue.Append(page);
+    if (prefetchWorkerRunning) {
+        return;
+    }
+    prefetchWorkerRunning = true;
+    // keep the engine alive until the queue has been processed
+    AddRef();
+    auto fn = MkFunc0<EngineImages>(ImagePrefetchWorker, this);
+    RunAsync(fn, "ImagePrefetchWorker");
+}
+
+// pages are decoded by ImageDecoder, AVIF pages with this engine's (reused)
+// AV1 decoders, by fewer threads each when pages are also being prefetched.
+// GDI+/WIC is only used for formats that ImageDecoder doesn't support
+// (e.g. JPEG XR or HEIC)
+Bitmap* EngineImages::BitmapFromPageData(const ByteSlice& data, Size targetSize) {
+    ImageDecodeOptions opts;
+    opts.targetDx = targetSize.dx;
+    opts.targetDy = targetSize.dy;
+    opts.nThreads = gAvifDecodeThreads;
+    if (opts.nThreads == 0) {
+        int nDecoders = gImagePrefetchPages > 0 ? 2 : 1;
+        opts.nThreads = std::max(GetCpuCount() / nDecoders, 1);
+    }
+    opts.avifDecoders = avifDecoders ? avifDecoders->contexts : nullptr;
+
+    Bitmap* bmp = nullptr;
+    // a fz_context can only be used by one thread at a time
+    fz_context* ctx = fzCtx ? fz_clone_context(fzCtx) : nullptr;
+    if (ctx) {
+        DecodedImage* img = DecodeImage(ctx, (const u8*)data.data(), data.size(), opts);
+        if (img) {
+            bmp = BitmapFromDecodedImage(img);
+            FreeDecodedImage(img);
+        }
+        fz_drop_context(ctx);
+    }
+    if (bmp) {
+        return bmp;
+    }
+    return BitmapFromData(data, targetSize);
+}
+
 // Get content box for image by cropping out margins of similar color
 RectF EngineImages::PageContentBox(int pageNo, RenderTarget target) {
     // try to load bitmap for the image
-    auto page = GetPage(pageNo, true);
+    auto page = GetPage(pageNo, true, kMaxImageReduce);
     if (!page)
         return RectF{};
     defer {
@@ -486,11 +723,25 @@ RectF EngineImages::PageContentBox(int pageNo, RenderTarget target) {
     }
     bmp->UnlockBits(&bmpData);
 
-    return ToRectF(r);
+    RectF res = ToRectF(r);
+    if (page->reduce > 0) {
+        // scale from the reduced bitmap to the page
+        RectF mbox = PageMediabox(pageNo);
+        float scaleX = mbox.dx / (float)w, scaleY = mbox.dy / (float)h;
+        res = RectF(res.x * scaleX, res.y * scaleY, res.dx * scaleX, res.dy * scaleY);
+    }
+    return res;
 }
 
 ///// ImageEngine handles a single image file /////
 
+// PNG and JPEG images at least this tall and 4 times taller than wide (e.g.
+// webtoons) are shown as pages of kStripBandRatio times their width that are
+// decoded when shown, instead of being decoded at once
+constexpr int kMinStripDy = 8192;
+constexpr float kStripBandRatio = 1.5f;
+constexpr int kMinStripBandDy = 512;
+
 class EngineImage : public EngineImages {
   public:
     EngineImage();
@@ -506,25 +757,49 @@ class EngineImage : public EngineImages {
     Bitmap* image = nullptr;
     Kind imageFormat = nullptr;
 
+    // set instead of image for very tall images, each page is a band of
+    // stripBandDy rows. strip reads from stripData and is used with stripAccess
+    ImageRowDecoder* strip = nullptr;
+    ByteSlice stripData;
+    fz_context* stripCtx = nullptr;
+    CRITICAL_SECTION stripAccess;
+    int stripBandDy = 0;
+    // 1x1 bitmap with the strip image's properties, for GetPropertyTemp()
+    Bitmap* stripProps = nullptr;
+
     bool LoadSingleFile(const char* fileName);
     bool LoadFromStream(IStream* stream);
+    bool LoadStrip(const ByteSlice& data);
     bool FinishLoading();
 
-    Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
+    Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse, Size targetSize) override;
     RectF LoadMediabox(int pageNo) override;
 };
 
 EngineImage::EngineImage() {
     kind = kindEngineImage;
+    InitializeCriticalSection(&stripAccess);
 }
 
 EngineImage::~EngineImage() {
     delete image;
+    delete strip;
+    delete stripProps;
+    // dropped before the engine's fzCtx it was cloned from
+    fz_drop_context(stripCtx);
+    stripData.Free();
+    DeleteCriticalSection(&stripAccess);
 }
 
 EngineBase* EngineImage::Clone() {
-    Bitmap* bmp = image->Clone(0, 0, image->GetWidth(), image->GetHeight(), PixelFormat32bppARGB);
-    if (!bmp) {
+    Bitmap* bmp = nullptr;
+    ByteSlice data;
+    if (strip) {
+        data = stripData.Clone();
+    } else {
+        bmp = image->Clone(0, 0, image->GetWidth(), image->GetHeight(), PixelFormat32bppARGB);
+    }
+    if (!bmp && data.empty()) {
         return nullptr;
     }
 
@@ -537,6 +812,11 @@ EngineBase* EngineImage::Clone() {
         fileStream->Clone(&clone->fileStream);
     }
     clone->image = bmp;
+    if (strip && !clone->LoadStrip(data)) {
+        data.Free();
+        SafeEngineRelease(&clone);
+        return nullptr;
+    }
     clone->FinishLoading();
 
     return clone;
@@ -572,6 +852,9 @@ bool EngineImage::LoadSingleFile(const char* path) {
         fileExt = "";
     }
     str::ReplaceWithCopy(&defaultExt, fileExt);
+    if (LoadStrip(data)) {
+        return FinishLoading();
+    }
     image = BitmapFromData(data);
     data.Free();
     return FinishLoading();
@@ -596,11 +879,65 @@ bool EngineImage::LoadFromStream(IStream* stream) {
     str::ReplaceWithCopy(&defaultExt, path::GetExtTemp(fileExtA));
 
     ByteSlice data = GetDataFromStream(stream, nullptr);
+    if (LoadStrip(data)) {
+        return FinishLoading();
+    }
     image = BitmapFromData(data);
     data.Free();
     return FinishLoading();
 }
 
+// GDI+ only reads the headers until the pixels are accessed. The properties are
+// copied to a 1x1 bitmap so that the stream's copy of data isn't kept around
+static Bitmap* BitmapPropertiesFromData(const ByteSlice& data) {
+    ScopedComPtr<IStream> stream(CreateStreamFromData(data));
+    if (!stream) {
+        return nullptr;
+    }
+    Bitmap* bmp = Bitmap::FromStream(stream);
+    if (!bmp || bmp->GetLastStatus() != Ok) {
+        delete bmp;
+        return nullptr;
+    }
+    Bitmap* res = nullptr;
+    uint size = 0, count = 0;
+    PropertyItem* items = nullptr;
+    if (bmp->GetPropertySize(&size, &count) == Ok && count > 0) {
+        items = (PropertyItem*)malloc(size);
+    }
+    if (items && bmp->GetAllPropertyItems(size, count, items) == Ok) {
+        res = new Bitmap(1, 1, PixelFormat24bppRGB);
+        for (uint i = 0; i < count; i++) {
+            res->SetPropertyItem(&items[i]);
+        }
+    }
+    free(items);
+    delete bmp;
+    return res;
+}
+
+// takes ownership of data if it's a very tall image that can be decoded in bands
+bool EngineImage::LoadStrip(const ByteSlice& data) {
+    Size size;
+    if (!BitmapSizeFromHeader(data, size) || size.dy < kMinStripDy || size.dy < size.dx * 4) {
+        return false;
+    }
+    fz_context* ctx = fzCtx ? fz_clone_context(fzCtx) : nullptr;
+    if (!ctx) {
+        return false;
+    }
+    // CMYK and progressive JPEGs and interlaced PNGs are decoded at once
+    strip = NewImageRowDecoder(ctx, data.data(), data.size());
+    if (!strip) {
+        fz_drop_context(ctx);
+        return false;
+    }
+    stripCtx = ctx;
+    stripData = data;
+    stripProps = BitmapPropertiesFromData(data);
+    return true;
+}
+
 static bool IsMultiImage(Kind fmt) {
     return (fmt == kindFileTiff) || (fmt == kindFileGif);
 }
@@ -615,6 +952,26 @@ static void ReportIfNotMultiImage(EngineImage* e) {
 }
 
 bool EngineImage::FinishLoading() {
+    if (strip) {
+        fileDPI = (float)strip->xres;
+        stripBandDy = std::max((int)(strip->dx * kStripBandRatio), kMinStripBandDy);
+        for (int y = 0; y < strip->dy; y += stripBandDy) {
+            auto pi = new ImagePageInfo();
+            int dy = std::min(stripBandDy, strip->dy - y);
+            pi->mediabox = RectF(0, 0, (float)strip->dx, (float)dy);
+            pi->hasMediaBox = true;
+            pages.Append(pi);
+        }
+        pageCount = pages.Size();
+        // bands are shown one below the other as if they were a single page
+        preferredLayout.nonContinuous = false;
+        preferredLayout.noPageSpacing = true;
+        // bands are decoded one at a time but the next ones are decoded
+        // while the current one is shown
+        canPrefetch = true;
+        return pageCount > 0;
+    }
+
     if (!image || image->GetLastStatus() != Ok) {
         return false;
     }
@@ -675,28 +1032,47 @@ static TempStr GetImagePropertyTemp(Bitmap* bmp, PROPID id, PROPID altId = 0) {
 }
 
 TempStr EngineImage::GetPropertyTemp(const char* name) {
+    Bitmap* bmp = image ? image : stripProps;
+    if (!bmp) {
+        return nullptr;
+    }
     if (str::Eq(name, kPropTitle)) {
-        return GetImagePropertyTemp(image, PropertyTagImageDescription, PropertyTagXPTitle);
+        return GetImagePropertyTemp(bmp, PropertyTagImageDescription, PropertyTagXPTitle);
     }
     if (str::Eq(name, kPropSubject)) {
-        return GetImagePropertyTemp(image, PropertyTagXPSubject);
+        return GetImagePropertyTemp(bmp, PropertyTagXPSubject);
     }
     if (str::Eq(name, kPropAuthor)) {
-        return GetImagePropertyTemp(image, PropertyTagArtist, PropertyTagXPAuthor);
+        return GetImagePropertyTemp(bmp, PropertyTagArtist, PropertyTagXPAuthor);
     }
     if (str::Eq(name, kPropCopyright)) {
-        return GetImagePropertyTemp(image, PropertyTagCopyright);
+        return GetImagePropertyTemp(bmp, PropertyTagCopyright);
     }
     if (str::Eq(name, kPropCreationDate)) {
-        return GetImagePropertyTemp(image, PropertyTagDateTime, PropertyTagExifDTDigitized);
+        return GetImagePropertyTemp(bmp, PropertyTagDateTime, PropertyTagExifDTDigitized);
     }
     if (str::Eq(name, kPropCreatorApp)) {
-        return GetImagePropertyTemp(image, PropertyTagSoftwareUsed);
+        return GetImagePropertyTemp(bmp, PropertyTagSoftwareUsed);
     }
     return nullptr;
 }
 
-Bitmap* EngineImage::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
+Bitmap* EngineImage::LoadBitmapForPage(int pageNo, bool& deleteAfterUse, Size targetSize) {
+    if (strip) {
+        ImageDecodeOptions opts;
+        opts.targetDx = targetSize.dx;
+        opts.targetDy = targetSize.dy;
+        Bitmap* bmp = nullptr;
+        ScopedCritSec scope(&stripAccess);
+        DecodedImage* img = strip->DecodeRows((pageNo - 1) * stripBandDy, stripBandDy, opts);
+        if (img) {
+            bmp = BitmapFromDecodedImage(img);
+            FreeDecodedImage(img);
+        }
+        deleteAfterUse = true;
+        return bmp;
+    }
+
     if (1 == pageNo) {
         deleteAfterUse = false;
         return image;
@@ -721,6 +1097,10 @@ Bitmap* EngineImage::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
 }
 
 RectF EngineImage::LoadMediabox(int pageNo) {
+    if (strip) {
+        // set by FinishLoading()
+        return pages[pageNo - 1]->mediabox;
+    }
     if (1 == pageNo) {
         return RectF(0, 0, (float)image->GetWidth(), (float)image->GetHeight());
     }
@@ -799,6 +1179,7 @@ class EngineImageDir : public EngineImages {
     EngineImageDir() {
         fileDPI = 96.0f;
         kind = kindEngineImageDir;
+        canPrefetch = true;
         str::ReplaceWithCopy(&defaultExt, "");
         // TODO: is there a better place to expose pageFileNames
         // than through page labels?
@@ -835,7 +1216,7 @@ class EngineImageDir : public EngineImages {
 
     // protected:
 
-    Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
+    Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse, Size targetSize) override;
     RectF LoadMediabox(int pageNo) override;
 
     StrVec pageFileNames;
@@ -948,14 +1329,14 @@ bool EngineImageDir::SaveFileAs(const char* dstPath) {
     return ok;
 }
 
-Bitmap* EngineImageDir::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
+Bitmap* EngineImageDir::LoadBitmapForPage(int pageNo, bool& deleteAfterUse, Size targetSize) {
     char* path = pageFileNames.At(pageNo - 1);
     ByteSlice bmpData = file::ReadFile(path);
     if (!bmpData) {
         return nullptr;
     }
     deleteAfterUse = true;
-    Bitmap* res = BitmapFromData(bmpData);
+    Bitmap* res = BitmapFromPageData(bmpData, targetSize);
     bmpData.Free();
     return res;
 }
@@ -1110,17 +1491,23 @@ class EngineCbx : public EngineImages {
     static EngineBase* CreateFromFile(const char* path);
     static EngineBase* CreateFromStream(IStream* stream);
 
+    void ProbeMediaboxes(MultiFormatArchive* archive, AtomicInt* nextPage);
+
   protected:
-    Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
+    Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse, Size targetSize) override;
     RectF LoadMediabox(int pageNo) override;
 
     bool LoadFromFile(const char* fileName);
     bool LoadFromStream(IStream* stream);
     bool FinishLoading();
+    bool LoadFromCache(const char* cachePath);
+    void SaveToCache(const char* cachePath);
+    void ProbeAllMediaboxes();
 
     ByteSlice GetImageData(int pageNo);
 
-    // access to cbxFile must be protected after initialization (with cacheAccess)
+    // access to cbxFile must be protected after initialization (with archiveAccess)
+    CRITICAL_SECTION archiveAccess;
     MultiFormatArchive* cbxFile = nullptr;
     Vec<MultiFormatArchive::FileInfo*> files;
     TocTree* tocTree = nullptr;
@@ -1132,11 +1519,14 @@ class EngineCbx : public EngineImages {
 EngineCbx::EngineCbx(MultiFormatArchive* arch) {
     cbxFile = arch;
     kind = kindEngineComicBooks;
+    canPrefetch = true;
+    InitializeCriticalSection(&archiveAccess);
 }
 
 EngineCbx::~EngineCbx() {
     delete tocTree;
     delete cbxFile;
+    DeleteCriticalSection(&archiveAccess);
 }
 
 EngineBase* EngineCbx::Clone() {
@@ -1172,11 +1562,105 @@ bool EngineCbx::LoadFromStream(IStream* stream) {
     return FinishLoading();
 }
 
-static bool cmpArchFileInfoByName(MultiFormatArchive::FileInfo* f1, MultiFormatArchive::FileInfo* f2) {
-    const char* s1 = f1->name;
-    const char* s2 = f2->name;
-    int res = str::CmpNatural(s1, s2);
-    return res < 0;
+// sorts by str::CmpNatural() order but computes the sort key of every name
+// once instead of parsing both names in every comparison
+static void SortArchFileInfosByName(Vec<MultiFormatArchive::FileInfo*>& fileInfos) {
+    struct SortItem {
+        char* key;
+        MultiFormatArchive::FileInfo* fileInfo;
+    };
+    Vec<SortItem> items;
+    for (auto* fileInfo : fileInfos) {
+        items.Append({str::NaturalSortKey(fileInfo->name), fileInfo});
+    }
+    std::sort(items.begin(), items.end(), [](const SortItem& a, const SortItem& b) {
+        int res = strcmp(a.key, b.key);
+        if (res == 0) {
+            res = strcmp(a.fileInfo->name, b.fileInfo->name);
+        }
+        return res < 0;
+    });
+    for (int i = 0; i < items.Size(); i++) {
+        fileInfos[i] = items[i].fileInfo;
+        str::Free(items[i].key);
+    }
+}
+
+// for archives with thousands of images, sorting the pages, reading the size of
+// every page and the metadata takes a while. That is saved in a cache file
+// (one per archive) which is used as long as the archive's size and
+// modification time don't change
+static char* gCbxCacheDir = nullptr;
+constexpr int kMaxCbxCacheFiles = 512;
+constexpr u32 kCbxCacheMagic = 0x58424353; // "SCBX"
+// 2: sizes of JPEG pages account for their EXIF orientation
+constexpr u32 kCbxCacheVersion = 2;
+
+// enough for the size of most images (JPEG files can start with a large EXIF thumbnail)
+constexpr size_t kImageHeaderProbeSize = 64 * 1024;
+constexpr int kMaxProbeThreads = 8;
+
+void EngineCbxSetCacheDir(const char* dir) {
+    str::ReplaceWithCopy(&gCbxCacheDir, dir);
+}
+
+static TempStr GetCbxCachePathTemp(const char* path) {
+    if (!gCbxCacheDir || !path) {
+        return nullptr;
+    }
+    u8 digest[16]{};
+    CalcMD5Digest(path, str::Leni(path), digest);
+    AutoFreeStr fingerprint = str::MemToHex(digest, dimof(digest));
+    return path::JoinTemp(gCbxCacheDir, str::JoinTemp(fingerprint, ".cbxcache"));
+}
+
+// keep only the caches of the most recently opened archives
+static void TrimCbxCacheDir() {
+    struct CacheFile {
+        char* path;
+        FILETIME modified;
+    };
+    Vec<CacheFile> files;
+    DirIter di{gCbxCacheDir};
+    for (DirIterEntry* de : di) {
+        if (path::Match(de->filePath, "*.cbxcache")) {
+            files.Append({str::Dup(de->filePath), de->fd->ftLastWriteTime});
+        }
+    }
+    if (files.Size() > kMaxCbxCacheFiles) {
+        std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) {
+            return CompareFileTime(&a.modified, &b.modified) > 0;
+        });
+        for (int i = kMaxCbxCacheFiles; i < files.Size(); i++) {
+            file::Delete(files[i].path);
+        }
+    }
+    for (auto& f : files) {
+        str::Free(f.path);
+    }
+}
+
+static void WriteCacheStr(ByteWriter& w, const char* s) {
+    u32 len = s ? (u32)str::Len(s) : 0;
+    w.Write32(len);
+    if (len > 0) {
+        w.d.Append(s, len);
+    }
+}
+
+// returns nullptr for an empty string
+static char* ReadCacheStr(ByteOrderDecoder& r, size_t dataLen) {
+    u32 len = r.UInt32();
+    if (!r.IsOk() || len == 0 || len > dataLen) {
+        return nullptr;
+    }
+    char* s = AllocArray<char>((size_t)len + 1);
+    r.Bytes(s, len);
+    if (!r.IsOk()) {
+        str::Free(s);
+        return nullptr;
+    }
+    return s;
 }
 
 static const char* GetExtFromArchiveType(MultiFormatArchive* cbxFile) {
@@ -1215,54 +1699,65 @@ bool EngineCbx::FinishLoading() {
     const char* ext = GetExtFromArchiveType(cbxFile);
     str::ReplaceWithCopy(&defaultExt, ext);
 
-    Vec<MultiFormatArchive::FileInfo*> pageFiles;
+    TempStr cachePath = GetCbxCachePathTemp(FilePath());
+    bool fromCache = cachePath && LoadFromCache(cachePath);
+    if (fromCache) {
+        logf("EngineCbx::FinishLoading(): loaded %d pages from cache\n", pageCount);
+    } else {
+        Vec<MultiFormatArchive::FileInfo*> pageFiles;
+
+        auto& fileInfos = cbxFile->GetFileInfos();
+        size_t n = fileInfos.size();
+        for (size_t i = 0; i < n; i++) {
+            auto* fileInfo = fileInfos[i];
+            const char* fileName = fileInfo->name;
+            if (str::Len(fileName) == 0) {
+                continue;
+            }
+            if (MultiFormatArchive::Format::Zip == cbxFile->format && str::StartsWithI(fileName, "_rels/.rels")) {
+                // bail, if we accidentally try to load an XPS file
+                return false;
+            }
 
-    auto& fileInfos = cbxFile->GetFileInfos();
-    size_t n = fileInfos.size();
-    for (size_t i = 0; i < n; i++) {
-        auto* fileInfo = fileInfos[i];
-        const char* fileName = fileInfo->name;
-        if (str::Len(fileName) == 0) {
-            continue;
-        }
-        if (MultiFormatArchive::Format::Zip == cbxFile->format && str::StartsWithI(fileName, "_rels/.rels")) {
-            // bail, if we accidentally try to load an XPS file
-            return false;
+            Kind kind = GuessFileTypeFromName(fileName);
+            if (IsEngineImageSupportedFileType(kind) &&
+                // OS X occasionally leaves metadata with image extensions
+                !str::StartsWith(path::GetBaseNameTemp(fileName), ".")) {
+                pageFiles.Append(fileInfo);
+            }
         }
 
-        Kind kind = GuessFileTypeFromName(fileName);
-        if (IsEngineImageSupportedFileType(kind) &&
-            // OS X occasionally leaves metadata with image extensions
-            !str::StartsWith(path::GetBaseNameTemp(fileName), ".")) {
-            pageFiles.Append(fileInfo);
+        ByteSlice metadata = cbxFile->GetFileDataByName("ComicInfo.xml");
+        if (metadata) {
+            cip.Parse(metadata);
+            metadata.Free();
+        }
+        const char* comment = cbxFile->GetComment();
+        if (comment) {
+            json::Parse(comment, &cip);
         }
-    }
 
-    ByteSlice metadata = cbxFile->GetFileDataByName("ComicInfo.xml");
-    if (metadata) {
-        cip.Parse(metadata);
-        metadata.Free();
-    }
-    const char* comment = cbxFile->GetComment();
-    if (comment) {
-        json::Parse(comment, &cip);
-    }
+        int nFiles = pageFiles.Size();
+        if (nFiles == 0) {
+            delete cbxFile;
+            cbxFile = nullptr;
+            return false;
+        }
 
-    int nFiles = pageFiles.Size();
-    if (nFiles == 0) {
-        delete cbxFile;
-        cbxFile = nullptr;
-        return false;
-    }
+        SortArchFileInfosByName(pageFiles);
 
-    std::sort(pageFiles.begin(), pageFiles.end(), cmpArchFileInfoByName);
+        for (int i = 0; i < nFiles; i++) {
+            auto pi = new ImagePageInfo();
+            pages.Append(pi);
+        }
+        files = std::move(pageFiles);
+        pageCount = nFiles;
 
-    for (int i = 0; i < nFiles; i++) {
-        auto pi = new ImagePageInfo();
-        pages.Append(pi);
+        if (cachePath) {
+            ProbeAllMediaboxes();
+            SaveToCache(cachePath);
+        }
     }
-    files = std::move(pageFiles);
-    pageCount = nFiles;
 
     TocItem* root = nullptr;
     TocItem* curr = nullptr;
@@ -1288,6 +1783,215 @@ bool EngineCbx::FinishLoading() {
     return true;
 }
 
+// the cache has the order of pages (as file ids), the size of every page and the metadata
+bool EngineCbx::LoadFromCache(const char* cachePath) {
+    const char* path = FilePath();
+    i64 archiveSize = file::GetSize(path);
+    FILETIME archiveModified = file::GetModificationTime(path);
+    if (archiveSize < 0) {
+        return false;
+    }
+    ByteSlice data = file::ReadFile(cachePath);
+    if (!data) {
+        return false;
+    }
+    defer {
+        data.Free();
+    };
+
+    ByteOrderDecoder r(data.data(), data.size(), ByteOrderDecoder::LittleEndian);
+    auto& fileInfos = cbxFile->GetFileInfos();
+    if (r.UInt32() != kCbxCacheMagic || r.UInt32() != kCbxCacheVersion || r.UInt64() != (u64)archiveSize ||
+        r.UInt32() != archiveModified.dwLowDateTime || r.UInt32() != archiveModified.dwHighDateTime ||
+        r.UInt32() != (u32)fileInfos.size()) {
+        return false;
+    }
+    u32 nPages = r.UInt32();
+    if (!r.IsOk() || nPages == 0 || nPages > fileInfos.size()) {
+        return false;
+    }
+    Vec<MultiFormatArchive::FileInfo*> pageFiles;
+    Vec<Size> sizes;
+    for (u32 i = 0; i < nPages; i++) {
+        u32 fileId = r.UInt32();
+        int dx = r.Int32();
+        int dy = r.Int32();
+        if (!r.IsOk() || fileId >= fileInfos.size()) {
+            return false;
+        }
+        pageFiles.Append(fileInfos[fileId]);
+        sizes.Append(Size(dx, dy));
+    }
+
+    ComicInfoParser info;
+    info.propTitle.Set(ReadCacheStr(r, data.size()));
+    info.propDate.Set(ReadCacheStr(r, data.size()));
+    info.propModDate.Set(ReadCacheStr(r, data.size()));
+    info.propCreator.Set(ReadCacheStr(r, data.size()));
+    info.propSummary.Set(ReadCacheStr(r, data.size()));
+    u32 nAuthors = r.UInt32();
+    for (u32 i = 0; r.IsOk() && i < nAuthors; i++) {
+        AutoFreeStr author = ReadCacheStr(r, data.size());
+        if (author) {
+            info.propAuthors.Append(author.Get());
+        }
+    }
+    if (!r.IsOk()) {
+        return false;
+    }
+
+    cip.propTitle.Set(info.propTitle.Release());
+    cip.propDate.Set(info.propDate.Release());
+    cip.propModDate.Set(info.propModDate.Release());
+    cip.propCreator.Set(info.propCreator.Release());
+    cip.propSummary.Set(info.propSummary.Release());
+    for (char* author : info.propAuthors) {
+        cip.propAuthors.Append(author);
+    }
+    for (Size size : sizes) {
+        auto pi = new ImagePageInfo();
+        // pages whose size couldn't be determined are loaded on demand
+        if (!size.IsEmpty()) {
+            pi->mediabox = RectF(0, 0, (float)size.dx, (float)size.dy);
+            pi->hasMediaBox = true;
+        }
+        pages.Append(pi);
+    }
+    files = std::move(pageFiles);
+    pageCount = (int)nPages;
+
+    // keep the cache of recently opened archives when trimming the cache directory
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    file::SetModificationTime(cachePath, now);
+    return true;
+}
+
+void EngineCbx::SaveToCache(const char* cachePath) {
+    const char* path = FilePath();
+    i64 archiveSize = file::GetSize(path);
+    FILETIME archiveModified = file::GetModificationTime(path);
+    if (archiveSize < 0) {
+        return;
+    }
+
+    ByteWriterLE w;
+    w.Write32(kCbxCacheMagic);
+    w.Write32(kCbxCacheVersion);
+    w.Write64((u64)archiveSize);
+    w.Write32(archiveModified.dwLowDateTime);
+    w.Write32(archiveModified.dwHighDateTime);
+    w.Write32((u32)cbxFile->GetFileInfos().size());
+    w.Write32((u32)pageCount);
+    for (int i = 0; i < pageCount; i++) {
+        ImagePageInfo* pi = pages[i];
+        Size size = pi->hasMediaBox ? pi->mediabox.Round().Size() : Size();
+        w.Write32((u32)files[i]->fileId);
+        w.Write32((u32)size.dx);
+        w.Write32((u32)size.dy);
+    }
+    WriteCacheStr(w, cip.propTitle);
+    WriteCacheStr(w, cip.propDate);
+    WriteCacheStr(w, cip.propModDate);
+    WriteCacheStr(w, cip.propCreator);
+    WriteCacheStr(w, cip.propSummary);
+    w.Write32((u32)cip.propAuthors.Size());
+    for (char* author : cip.propAuthors) {
+        WriteCacheStr(w, author);
+    }
+
+    dir::CreateAll(gCbxCacheDir);
+    if (!file::WriteFile(cachePath, w.AsByteSlice())) {
+        file::Delete(cachePath);
+        return;
+    }
+    TrimCbxCacheDir();
+}
+
+struct ProbeMediaboxesData {
+    EngineCbx* engine = nullptr;
+    MultiFormatArchive* archive = nullptr;
+    AtomicInt* nextPage = nullptr;
+};
+
+static void ProbeMediaboxesThread(ProbeMediaboxesData* d) {
+    d->engine->ProbeMediaboxes(d->archive, d->nextPage);
+}
+
+// sets the mediabox of pages taken from nextPage, from the start of their image data.
+// archive is the thread's own copy of cbxFile, if nullptr cbxFile is used
+void EngineCbx::ProbeMediaboxes(MultiFormatArchive* archive, AtomicInt* nextPage) {
+    for (;;) {
+        int pageNo = nextPage->Inc();
+        if (pageNo > pageCount) {
+            break;
+        }
+        size_t fileId = files[pageNo - 1]->fileId;
+        ByteSlice data;
+        if (archive) {
+            data = archive->GetFileDataStartById(fileId, kImageHeaderProbeSize);
+        } else {
+            ScopedCritSec scope(&archiveAccess);
+            data = cbxFile->GetFileDataStartById(fileId, kImageHeaderProbeSize);
+        }
+        Size size;
+        bool ok = BitmapSizeFromHeader(data, size);
+        data.Free();
+        if (ok) {
+            pages[pageNo - 1]->mediabox = RectF(0, 0, (float)size.dx, (float)size.dy);
+            pages[pageNo - 1]->hasMediaBox = true;
+        }
+    }
+}
+
+// determines the size of all pages when opening instead of one by one when
+// the layout asks for them. unarr can only uncompress one file at a time so
+// additional threads uncompress from their own copy of the archive. That's
+// only done for .zip archives which can be opened quickly and whose files can be
+// uncompressed individually (unlike in solid RAR and 7z archives)
+void EngineCbx::ProbeAllMediaboxes() {
+    auto timeStart = TimeGet();
+    const char* path = FilePath();
+    int nThreads = 1;
+    if (path && cbxFile->format == MultiFormatArchive::Format::Zip) {
+        nThreads = std::min(GetCpuCount(), kMaxProbeThreads);
+        // don't bother for a few pages
+        nThreads = std::max(1, std::min(nThreads, pageCount / 64));
+    }
+
+    AtomicInt nextPage;
+    ProbeMediaboxesData threadData[kMaxProbeThreads];
+    HANDLE threads[kMaxProbeThreads]{};
+    int nStarted = 0;
+    for (int i = 1; i < nThreads; i++) {
+        ProbeMediaboxesData* d = &threadData[nStarted];
+        d->engine = this;
+        d->nextPage = &nextPage;
+        d->archive = OpenZipArchive(path, false);
+        if (!d->archive) {
+            break;
+        }
+        auto fn = MkFunc0(ProbeMediaboxesThread, d);
+        threads[nStarted] = StartThread(fn, "ProbeMediaboxesThread");
+        if (!threads[nStarted]) {
+            delete d->archive;
+            d->archive = nullptr;
+            break;
+        }
+        nStarted++;
+    }
+    ProbeMediaboxes(nullptr, &nextPage);
+    if (nStarted > 0) {
+        WaitForMultipleObjects(nStarted, threads, TRUE, INFINITE);
+    }
+    for (int i = 0; i < nStarted; i++) {
+        CloseHandle(threads[i]);
+        delete threadData[i].archive;
+    }
+    logf("EngineCbx::ProbeAllMediaboxes(): %d pages with %d threads in %.2f ms\n", pageCount, nStarted + 1,
+         TimeSinceInMs(timeStart));
+}
+
 TocTree* EngineCbx::GetToc() {
     return tocTree;
 }
@@ -1295,6 +1999,7 @@ TocTree* EngineCbx::GetToc() {
 ByteSlice EngineCbx::GetImageData(int pageNo) {
     ReportIf((pageNo < 1) || (pageNo > PageCount()));
     size_t fileId = files[pageNo - 1]->fileId;
+    ScopedCritSec scope(&archiveAccess);
     ByteSlice d = cbxFile->GetFileDataById(fileId);
     return d;
 }
@@ -1328,7 +2033,7 @@ TempStr EngineCbx::GetPropertyTemp(const char* name) {
     return nullptr;
 }
 
-Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
+Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, bool& deleteAfterUse, Size targetSize) {
     auto timeStart = TimeGet();
     defer {
         auto dur = TimeSinceInMs(timeStart);
@@ -1340,7 +2045,7 @@ Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
         return nullptr;
     }
     deleteAfterUse = true;
-    auto res = BitmapFromData(img);
+    auto res = BitmapFromPageData(img, targetSize);
     img.Free();
     return res;
 }
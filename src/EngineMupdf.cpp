@@ -19,6 +19,9 @@ extern "C" {
 #include "utils/TrivialHtmlParser.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
+#include "utils/CryptoUtil.h"
+#include "utils/DirIter.h"
+#include "utils/ThreadUtil.h"
 #include "utils/Timer.h"
 
 #include "wingui/UIModels.h"
@@ -48,6 +51,12 @@ static float layoutA4DyPt = 842.f;
 
 static float layoutFontEm = 11.f;
 
+// directory for layout accelerators of reflowable documents, nullptr if they're not cached
+static char* gLayoutCacheDir = nullptr;
+constexpr int kMaxLayoutCacheFiles = 128;
+// layout accelerators are keyed on the size and this many bytes from the start and the end of the file
+constexpr size_t kLayoutKeyChunkSize = 64 * 1024;
+
 // in mupdf_load_system_font.c
 extern "C" void install_load_windows_font_funcs(fz_context* ctx);
 
@@ -508,32 +517,367 @@ static fz_stream* FzOpenOrReadFile(fz_context* ctx, const char* path) {
     return stm;
 }
 
-static void FzStreamFingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16]) {
-    i64 fileLen = -1;
-    fz_buffer* buf = nullptr;
+// -1: only linearized PDFs on non-fixed (network, removable) drives are loaded
+// progressively. otherwise all large linearized PDFs are, with reading throttled
+// to this many KB/s (0 means no throttling), which simulates a slow network drive
+static int gProgressiveLoadKbps = -1;
+
+// smaller files are read quickly enough even from a slow drive
+constexpr i64 kMinProgressiveFileSize = 4 * 1024 * 1024;
+
+// how long to wait for more data before re-trying to open a progressively loaded file
+constexpr int kProgressiveRetryMs = 50;
+// opening a progressively loaded file fails if no data has arrived for this long
+constexpr double kProgressiveStallTimeoutMs = 30 * 1000;
+
+// a file stream which only hands out the part of the file that a background thread
+// has already read and throws FZ_ERROR_TRYLATER for the rest. The background thread
+// reads the file sequentially (which pulls it into the system file cache) and lets
+// mupdf show the first pages of a linearized PDF long before all of it has arrived
+struct FzProgressiveFile {
+    char* path = nullptr;
+    // used by the stream, the background thread uses its own handle
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    i64 size = 0;
+    int kbps = 0;
+    HANDLE thread = nullptr;
+
+    // protects available, failed, stop, opening, lastData and digest
+    CRITICAL_SECTION access;
+    i64 available = 0;
+    bool failed = false;
+    bool stop = false;
+    // until the document has been opened, see EngineMupdfCancelOpening()
+    bool opening = true;
+    // when data last arrived
+    LARGE_INTEGER lastData{};
+    // md5 of the file, calculated by the read-ahead while reading it
+    bool hasDigest = false;
+    u8 digest[16]{};
+
+    u8 buf[64 * 1024];
+};
+
+static CRITICAL_SECTION gProgressiveFilesCs;
+static Vec<FzProgressiveFile*>* gProgressiveFiles;
+
+static void ProgressiveFilesInit() {
+    static bool initialized = [] {
+        InitializeCriticalSection(&gProgressiveFilesCs);
+        gProgressiveFiles = new Vec<FzProgressiveFile*>();
+        return true;
+    }();
+    (void)initialized;
+}
+
+static void FzProgressiveReadAhead(FzProgressiveFile* f) {
+    constexpr DWORD kChunkSize = 256 * 1024;
+    u8* chunk = AllocArray<u8>(kChunkSize);
+    HANDLE h = file::OpenReadOnly(f->path);
+    bool ok = chunk && h != INVALID_HANDLE_VALUE;
+    auto timeStart = TimeGet();
+    i64 nRead = 0;
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    u8 digest[16]{};
+    while (ok && nRead < f->size) {
+        DWORD n = 0;
+        ok = ReadFile(h, chunk, kChunkSize, &n, nullptr) && n > 0;
+        nRead += ok ? n : 0;
+        // the whole file is read anyway, so this saves FzStreamFingerprint()
+        // from waiting for it and then reading it again
+        if (ok) {
+            fz_md5_update(&md5, chunk, (size_t)std::min((i64)n, f->size - (nRead - n)));
+        }
+        if (ok && nRead >= f->size) {
+            fz_md5_final(&md5, digest);
+        }
+        // throttle to f->kbps while checking if we should stop
+        while (ok && f->kbps > 0) {
+            double msNeeded = (double)nRead * 1000.0 / ((double)f->kbps * 1024.0);
+            double msLeft = msNeeded - TimeSinceInMs(timeStart);
+            if (msLeft <= 0) {
+                break;
+            }
+            Sleep((DWORD)std::min(msLeft, 50.0) + 1);
+            ScopedCritSec scope(&f->access);
+            ok = !f->stop;
+        }
+        ScopedCritSec scope(&f->access);
+        f->available = std::min(nRead, f->size);
+        f->lastData = TimeGet();
+        if (f->available == f->size) {
+            memcpy(f->digest, digest, sizeof(digest));
+            f->hasDigest = true;
+        }
+        ok = ok && !f->stop;
+    }
+    ScopedCritSec scope(&f->access);
+    if (f->available < f->size) {
+        f->failed = true;
+    }
+    if (h != INVALID_HANDLE_VALUE) {
+        CloseHandle(h);
+    }
+    free(chunk);
+    DestroyTempAllocator();
+}
+
+static int FzProgressiveNext(fz_context* ctx, fz_stream* stm, size_t len) {
+    FzProgressiveFile* f = (FzProgressiveFile*)stm->state;
+    i64 available;
+    bool failed;
+    {
+        ScopedCritSec scope(&f->access);
+        available = f->available;
+        failed = f->failed;
+    }
+    if (stm->pos >= available) {
+        if (available >= f->size) {
+            return EOF;
+        }
+        if (failed) {
+            fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot read '%s'", f->path);
+        }
+        fz_throw(ctx, FZ_ERROR_TRYLATER, "data at %lld hasn't been read yet", (long long)stm->pos);
+    }
+    len = (size_t)std::min((i64)std::min(len, sizeof(f->buf)), available - stm->pos);
+    LARGE_INTEGER off;
+    off.QuadPart = stm->pos;
+    DWORD n = 0;
+    if (!SetFilePointerEx(f->hFile, off, nullptr, FILE_BEGIN) || !ReadFile(f->hFile, f->buf, (DWORD)len, &n, nullptr)) {
+        fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot read '%s'", f->path);
+    }
+    if (n == 0) {
+        return EOF;
+    }
+    stm->rp = f->buf;
+    stm->wp = f->buf + n;
+    stm->pos += n;
+    return *stm->rp++;
+}
+
+static void FzProgressiveSeek(fz_context* ctx, fz_stream* stm, i64 offset, int whence) {
+    FzProgressiveFile* f = (FzProgressiveFile*)stm->state;
+    if (whence == SEEK_END) {
+        offset += f->size;
+    } else if (whence == SEEK_CUR) {
+        offset += stm->pos;
+    }
+    if (offset < 0 || offset > f->size) {
+        fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot seek to %lld", (long long)offset);
+    }
+    stm->pos = offset;
+    stm->rp = stm->wp = f->buf;
+}
+
+static void FzProgressiveDrop(fz_context*, void* state) {
+    FzProgressiveFile* f = (FzProgressiveFile*)state;
+    {
+        ScopedCritSec scope(&gProgressiveFilesCs);
+        gProgressiveFiles->Remove(f);
+    }
+    if (f->thread) {
+        {
+            ScopedCritSec scope(&f->access);
+            f->stop = true;
+        }
+        WaitForSingleObject(f->thread, INFINITE);
+        CloseHandle(f->thread);
+    }
+    CloseHandle(f->hFile);
+    DeleteCriticalSection(&f->access);
+    str::Free(f->path);
+    delete f;
+}
+
+// true while a stream from FzOpenProgressiveFile() is still waiting for data
+static bool FzIsLoadingProgressively(fz_stream* stm) {
+    if (!stm || stm->next != FzProgressiveNext) {
+        return false;
+    }
+    FzProgressiveFile* f = (FzProgressiveFile*)stm->state;
+    ScopedCritSec scope(&f->access);
+    return f->available < f->size && !f->failed;
+}
+
+// waits a bit for the read-ahead to read more of a stream from FzOpenProgressiveFile().
+// returns false if opening the file was canceled or no data has arrived for
+// kProgressiveStallTimeoutMs, so that we don't wait forever for a stalled network drive
+static bool FzWaitForProgressiveData(fz_stream* stm) {
+    Sleep(kProgressiveRetryMs);
+    FzProgressiveFile* f = (FzProgressiveFile*)stm->state;
+    ScopedCritSec scope(&f->access);
+    if (f->stop || f->failed) {
+        return false;
+    }
+    if (TimeSinceInMs(f->lastData) > kProgressiveStallTimeoutMs) {
+        logf("FzWaitForProgressiveData: no data for '%s' in %.0f s\n", f->path, kProgressiveStallTimeoutMs / 1000);
+        return false;
+    }
+    return true;
+}
+
+// after which EngineMupdfCancelOpening() no longer stops reading the file
+static void FzProgressiveOpened(fz_stream* stm) {
+    if (!stm || stm->next != FzProgressiveNext) {
+        return;
+    }
+    FzProgressiveFile* f = (FzProgressiveFile*)stm->state;
+    ScopedCritSec scope(&f->access);
+    f->opening = false;
+}
+
+// stops waiting for the data of progressively loaded files at path which are
+// still being opened, e.g. when the user closes the "Loading..." notification
+void EngineMupdfCancelOpening(const char* path) {
+    ProgressiveFilesInit();
+    ScopedCritSec scope(&gProgressiveFilesCs);
+    for (FzProgressiveFile* f : *gProgressiveFiles) {
+        ScopedCritSec scopeFile(&f->access);
+        if (f->opening && str::EqI(f->path, path)) {
+            f->stop = true;
+        }
+    }
+}
+
+static fz_stream* FzOpenProgressiveFile(fz_context* ctx, const char* path, int kbps) {
+    HANDLE h = file::OpenReadOnly(path);
+    if (h == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(h, &size)) {
+        CloseHandle(h);
+        return nullptr;
+    }
+    auto f = new FzProgressiveFile();
+    f->path = str::Dup(path);
+    f->hFile = h;
+    f->size = size.QuadPart;
+    f->kbps = kbps;
+    f->lastData = TimeGet();
+    InitializeCriticalSection(&f->access);
+    ProgressiveFilesInit();
 
+    fz_stream* stm = nullptr;
     fz_try(ctx) {
-        fz_seek(ctx, stm, 0, 2);
-        fileLen = fz_tell(ctx, stm);
-        fz_seek(ctx, stm, 0, 0);
-        buf = fz_read_all(ctx, stm, fileLen);
+        // drops f on failure
+        stm = fz_new_stream(ctx, f, FzProgressiveNext, FzProgressiveDrop);
     }
     fz_catch(ctx) {
-        fz_warn(ctx, "couldn't read stream data, using a nullptr fingerprint instead");
-        ZeroMemory(digest, 16);
         fz_report_error(ctx);
-        return;
+        return nullptr;
+    }
+    stm->seek = FzProgressiveSeek;
+    stm->progressive = 1;
+    {
+        ScopedCritSec scope(&gProgressiveFilesCs);
+        gProgressiveFiles->Append(f);
+    }
+
+    auto fn = MkFunc0<FzProgressiveFile>(FzProgressiveReadAhead, f);
+    f->thread = StartThread(fn, "ProgressiveReadAhead");
+    if (!f->thread) {
+        // read directly, without the read-ahead
+        ScopedCritSec scope(&f->access);
+        f->available = f->size;
+    }
+    return stm;
+}
+
+// only linearized PDFs can be shown before they're fully loaded
+static bool ShouldLoadProgressively(const char* path) {
+    if (gProgressiveLoadKbps < 0 && path::IsOnFixedDrive(path)) {
+        return false;
+    }
+    if (file::GetSize(path) < kMinProgressiveFileSize) {
+        return false;
+    }
+    // the linearization dictionary must be the first object in the file
+    char buf[1024];
+    int n = file::ReadN(path, buf, dimof(buf));
+    if (n <= 0 || str::BufFind(buf, n, "%PDF-") != 0) {
+        return false;
+    }
+    return str::BufFind(buf, n, "/Linearized") > 0;
+}
+
+void EngineMupdfSetProgressiveLoadKbps(int kbps) {
+    gProgressiveLoadKbps = kbps;
+}
+
+// md5 of the whole stream, used as a key for remembered decryption keys.
+// hashes the data as it's read so that we never hold the whole file in memory.
+// the digest must stay the same as md5 of the file data because it's saved
+// in decryptionKey in history. returns false if the data couldn't be read.
+// for a progressively loaded file, waits for the read-ahead which calculates it
+static bool FzStreamFingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16]) {
+    if (stm->next == FzProgressiveNext) {
+        while (FzIsLoadingProgressively(stm)) {
+            if (!FzWaitForProgressiveData(stm)) {
+                return false;
+            }
+        }
+        FzProgressiveFile* f = (FzProgressiveFile*)stm->state;
+        ScopedCritSec scope(&f->access);
+        if (f->hasDigest) {
+            memcpy(digest, f->digest, sizeof(f->digest));
+            return true;
+        }
+        // the read-ahead failed or didn't start, if all data is available
+        // it's hashed below
+    }
+
+    // fz_read() reads through the stream's own (4 KB for files) buffer
+    // as often as needed to fill chunk
+    constexpr size_t kChunkSize = 256 * 1024;
+    u8* chunk = AllocArray<u8>(kChunkSize);
+    if (!chunk) {
+        return false;
     }
-    ReportIf(nullptr == buf);
-    u8* data;
-    size_t size = fz_buffer_extract(ctx, buf, &data);
-    ReportIf((size_t)fileLen != size);
-    fz_drop_buffer(ctx, buf);
 
     fz_md5 md5;
     fz_md5_init(&md5);
-    fz_md5_update(&md5, data, size);
+    fz_try(ctx) {
+        fz_seek(ctx, stm, 0, 0);
+        while (true) {
+            size_t n = fz_read(ctx, stm, chunk, kChunkSize);
+            if (n == 0) {
+                break;
+            }
+            fz_md5_update(&md5, chunk, n);
+        }
+    }
+    fz_always(ctx) {
+        free(chunk);
+    }
+    fz_catch(ctx) {
+        if (fz_caught(ctx) == FZ_ERROR_TRYLATER) {
+            fz_ignore_error(ctx);
+        } else {
+            fz_report_error(ctx);
+        }
+        return false;
+    }
     fz_md5_final(&md5, digest);
+    return true;
+}
+
+// for verifying that FzStreamFingerprint() matches md5 of the file data
+bool EngineMupdfFileFingerprint(const char* path, u8 digest[16]) {
+    fz_context* ctx = fz_new_context(nullptr, nullptr, FZ_STORE_UNLIMITED);
+    if (!ctx) {
+        return false;
+    }
+    bool ok = false;
+    fz_stream* stm = FzOpenOrReadFile(ctx, path);
+    if (stm) {
+        ok = FzStreamFingerprint(ctx, stm, digest);
+        fz_drop_stream(ctx, stm);
+    }
+    fz_drop_context(ctx);
+    return ok;
 }
 
 static ByteSlice FzExtractStreamData(fz_context* ctx, fz_stream* stream) {
@@ -616,7 +960,8 @@ static void AddLineSep(str::WStr& s, Vec<Rect>& rects, const WCHAR* lineSep, siz
     }
 }
 
-static WCHAR* FzTextPageToStr(fz_stext_page* text, Rect** coordsOut) {
+// text of annotText (if given) is appended after the text of text
+static WCHAR* FzTextPageToStr(fz_stext_page* text, Rect** coordsOut, fz_stext_page* annotText = nullptr) {
     const WCHAR* lineSep = L"\n";
 
     size_t lineSepLen = str::Len(lineSep);
@@ -625,24 +970,27 @@ static WCHAR* FzTextPageToStr(fz_stext_page* text, Rect** coordsOut) {
     // by always calculating it
     Vec<Rect> rects;
 
-    fz_stext_block* block = text->first_block;
-    while (block) {
-        if (block->type != FZ_STEXT_BLOCK_TEXT) {
-            block = block->next;
-            continue;
-        }
-        fz_stext_line* line = block->u.t.first_line;
-        while (line) {
-            fz_stext_char* c = line->first_char;
-            while (c) {
-                AddChar(line, c, content, rects);
-                c = c->next;
+    fz_stext_page* texts[2] = {text, annotText};
+    for (fz_stext_page* t : texts) {
+        fz_stext_block* block = t ? t->first_block : nullptr;
+        while (block) {
+            if (block->type != FZ_STEXT_BLOCK_TEXT) {
+                block = block->next;
+                continue;
+            }
+            fz_stext_line* line = block->u.t.first_line;
+            while (line) {
+                fz_stext_char* c = line->first_char;
+                while (c) {
+                    AddChar(line, c, content, rects);
+                    c = c->next;
+                }
+                AddLineSep(content, rects, lineSep, lineSepLen);
+                line = line->next;
             }
-            AddLineSep(content, rects, lineSep, lineSepLen);
-            line = line->next;
-        }
 
-        block = block->next;
+            block = block->next;
+        }
     }
 
     ReportIf(content.size() != rects.size());
@@ -1209,17 +1557,7 @@ static void FzFindImagePositions(fz_context* ctx, int pageNo, Vec<FitzPageImageI
     }
 }
 
-static fz_image* FzFindImageAtIdx(fz_context* ctx, FzPageInfo* pageInfo, int idx) {
-    fz_stext_options opts{};
-    opts.flags = FZ_STEXT_PRESERVE_IMAGES;
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
-    }
-    fz_catch(ctx) {
-        fz_report_error(ctx);
-    }
+static fz_image* FzFindImageAtIdx(fz_context* ctx, fz_stext_page* stext, int idx) {
     if (!stext) {
         return nullptr;
     }
@@ -1237,15 +1575,12 @@ static fz_image* FzFindImageAtIdx(fz_context* ctx, FzPageInfo* pageInfo, int idx
             // TODO: this is probably not right
             if (idx == 0) {
                 // TODO: or maybe get pixmap here
-                image = fz_keep_image(ctx, image);
-                fz_drop_stext_page(ctx, stext);
-                return image;
+                return fz_keep_image(ctx, image);
             }
             idx--;
         }
         block = block->next;
     }
-    fz_drop_stext_page(ctx, stext);
     return nullptr;
 }
 
@@ -1543,7 +1878,16 @@ struct PageTreeStackItem {
 
 static void fz_lock_context_cs(void* user, int lock) {
     EngineMupdf* e = (EngineMupdf*)user;
-    EnterCriticalSection(&e->mutexes[lock]);
+    CRITICAL_SECTION* cs = &e->mutexes[lock];
+    if (TryEnterCriticalSection(cs)) {
+        return;
+    }
+    // contended: measure how long we wait. the stats are
+    // protected by the lock we're acquiring
+    auto t = TimeGet();
+    EnterCriticalSection(cs);
+    e->lockStats[lock].nWaits++;
+    e->lockStats[lock].waitMs += TimeSinceInMs(t);
 }
 
 static void fz_unlock_context_cs(void* user, int lock) {
@@ -1607,15 +1951,400 @@ void ReleasePerThreadContext(EngineMupdf* engine) {
     }
 }
 
+// decoded images shared by all documents (each of which has its own fz_context
+// and fz_store), so that e.g. the logo and scans repeated in similar reports
+// opened in multiple tabs are only decoded once. see fz_set_shared_image_cache()
+constexpr size_t kSharedImageCacheSize = 64 * 1024 * 1024;
+// smaller images are cheap enough to decode again
+constexpr size_t kMinSharedImageSize = 16 * 1024;
+
+struct SharedImageTile {
+    u8 digest[16]{};
+    fz_shared_image_tile tile{};
+    size_t size = 0;
+    // 1 for being in the cache + 1 for each find() not yet released
+    int refs = 1;
+    // next tile in the same SharedImageCache::buckets entry
+    SharedImageTile* hashNext = nullptr;
+    // neighbours in the least recently used list
+    SharedImageTile* prev = nullptr;
+    SharedImageTile* next = nullptr;
+};
+
+// at most kSharedImageCacheSize / kMinSharedImageSize (4096) tiles fit in the cache
+constexpr int kSharedImageBuckets = 1024;
+
+struct SharedImageCache {
+    fz_shared_image_cache fz{};
+    CRITICAL_SECTION access;
+    // tiles by digest
+    SharedImageTile* buckets[kSharedImageBuckets]{};
+    // least recently used first
+    SharedImageTile* first = nullptr;
+    SharedImageTile* last = nullptr;
+    int nTiles = 0;
+    size_t size = 0;
+    size_t maxSize = kSharedImageCacheSize;
+    int hits = 0;
+    int misses = 0;
+
+    SharedImageCache();
+};
+
+static void SharedImageTileRelease(SharedImageTile* t) {
+    if (--t->refs == 0) {
+        free(t);
+    }
+}
+
+// digests are md5 so any of their bytes make a good hash
+static SharedImageTile** SharedImageBucket(SharedImageCache* cache, const u8* digest) {
+    u32 h;
+    memcpy(&h, digest, sizeof(h));
+    return &cache->buckets[h % kSharedImageBuckets];
+}
+
+// the functions below must be called with cache->access held
+
+static SharedImageTile* SharedImageLookup(SharedImageCache* cache, const u8* digest) {
+    SharedImageTile* t = *SharedImageBucket(cache, digest);
+    while (t && !memeq(t->digest, digest, sizeof(t->digest))) {
+        t = t->hashNext;
+    }
+    return t;
+}
+
+static void SharedImageLruRemove(SharedImageCache* cache, SharedImageTile* t) {
+    if (t->prev) {
+        t->prev->next = t->next;
+    } else {
+        cache->first = t->next;
+    }
+    if (t->next) {
+        t->next->prev = t->prev;
+    } else {
+        cache->last = t->prev;
+    }
+    t->prev = t->next = nullptr;
+}
+
+static void SharedImageLruAppend(SharedImageCache* cache, SharedImageTile* t) {
+    t->prev = cache->last;
+    t->next = nullptr;
+    if (cache->last) {
+        cache->last->next = t;
+    } else {
+        cache->first = t;
+    }
+    cache->last = t;
+}
+
+static void SharedImageCacheAdd(SharedImageCache* cache, SharedImageTile* t) {
+    SharedImageTile** bucket = SharedImageBucket(cache, t->digest);
+    t->hashNext = *bucket;
+    *bucket = t;
+    SharedImageLruAppend(cache, t);
+    cache->nTiles++;
+    cache->size += t->size;
+}
+
+static void SharedImageCacheRemove(SharedImageCache* cache, SharedImageTile* t) {
+    SharedImageTile** pt = SharedImageBucket(cache, t->digest);
+    while (*pt != t) {
+        pt = &(*pt)->hashNext;
+    }
+    *pt = t->hashNext;
+    t->hashNext = nullptr;
+    SharedImageLruRemove(cache, t);
+    cache->nTiles--;
+    cache->size -= t->size;
+    SharedImageTileRelease(t);
+}
+
+static void SharedImageCacheShrink(SharedImageCache* cache, size_t maxSize) {
+    while (cache->size > maxSize && cache->first) {
+        SharedImageCacheRemove(cache, cache->first);
+    }
+}
+
+static const fz_shared_image_tile* SharedImageFind(void* opaque, const unsigned char digest[16]) {
+    SharedImageCache* cache = (SharedImageCache*)opaque;
+    ScopedCritSec scope(&cache->access);
+    SharedImageTile* t = SharedImageLookup(cache, digest);
+    if (t) {
+        SharedImageLruRemove(cache, t);
+        SharedImageLruAppend(cache, t);
+        t->refs++;
+        cache->hits++;
+        return &t->tile;
+    }
+    if (cache->maxSize > 0) {
+        cache->misses++;
+    }
+    return nullptr;
+}
+
+static void SharedImageRelease(void* opaque, const fz_shared_image_tile* tile) {
+    SharedImageCache* cache = (SharedImageCache*)opaque;
+    ScopedCritSec scope(&cache->access);
+    SharedImageTile* t = (SharedImageTile*)((u8*)tile - offsetof(SharedImageTile, tile));
+    SharedImageTileRelease(t);
+}
+
+static void SharedImageStore(void* opaque, const unsigned char digest[16], const fz_shared_image_tile* tile) {
+    SharedImageCache* cache = (SharedImageCache*)opaque;
+    size_t size = (size_t)tile->w * tile->h * tile->n;
+    {
+        ScopedCritSec scope(&cache->access);
+        if (size < kMinSharedImageSize || size > cache->maxSize / 4) {
+            return;
+        }
+    }
+
+    // copy outside the lock, the samples can be tens of MB
+    SharedImageTile* t = (SharedImageTile*)malloc(sizeof(SharedImageTile) + size);
+    if (!t) {
+        return;
+    }
+    *t = SharedImageTile();
+    u8* samples = (u8*)(t + 1);
+    memcpy(samples, tile->samples, size);
+    memcpy(t->digest, digest, sizeof(t->digest));
+    t->tile = *tile;
+    t->tile.samples = samples;
+    t->size = size;
+
+    ScopedCritSec scope(&cache->access);
+    if (SharedImageLookup(cache, digest)) {
+        // decoded by another document at the same time
+        free(t);
+        return;
+    }
+    SharedImageCacheAdd(cache, t);
+    SharedImageCacheShrink(cache, cache->maxSize);
+}
+
+SharedImageCache::SharedImageCache() {
+    InitializeCriticalSection(&access);
+    fz.opaque = this;
+    fz.find = SharedImageFind;
+    fz.release = SharedImageRelease;
+    fz.store = SharedImageStore;
+    fz_set_shared_image_cache(&fz);
+}
+
+static SharedImageCache* GetSharedImageCache() {
+    static SharedImageCache cache;
+    return &cache;
+}
+
+// maxSize of 0 disables sharing decoded images between documents
+void EngineMupdfSetSharedImageCacheSize(size_t maxSize) {
+    SharedImageCache* cache = GetSharedImageCache();
+    ScopedCritSec scope(&cache->access);
+    cache->maxSize = maxSize;
+    SharedImageCacheShrink(cache, maxSize);
+}
+
+TempStr EngineMupdfSharedImageCacheStatsTemp() {
+    SharedImageCache* cache = GetSharedImageCache();
+    ScopedCritSec scope(&cache->access);
+    str::Str s;
+    s.AppendFmt("%d hits, %d misses, %d images, %d KB of %d KB", cache->hits, cache->misses, cache->nTiles,
+                (int)(cache->size / 1024), (int)(cache->maxSize / 1024));
+    return str::DupTemp(s.Get());
+}
+
+// instead of each document's fz_store having a fixed limit, a total budget
+// is divided between all open documents, with the most recently rendered ones
+// getting the largest share. a single large scan can use all of it, while
+// background tabs are shrunk.
+// the limits are only decided under gStoreBudgetCs. they're applied right away
+// to engines whose ctxAccess isn't held (e.g. background tabs). an engine that
+// is busy on another thread applies its own limit when it next renders a page
+constexpr size_t kMinStoreSize = 16 * 1024 * 1024;
+// re-divide the budget at most this often while the same document is rendered
+constexpr double kStoreBudgetRebalanceMs = 1000;
+
+static CRITICAL_SECTION gStoreBudgetCs;
+static Vec<EngineMupdf*>* gStoreBudgetEngines;
+static size_t gStoreBudget = 0;
+static EngineMupdf* gStoreBudgetActive = nullptr;
+static LARGE_INTEGER gStoreBudgetLastRebalance{};
+// to only log when the system starts running low on memory
+static bool gStoreBudgetLowMemory = false;
+
+static size_t DefaultStoreBudget() {
+    MEMORYSTATUSEX ms{};
+    ms.dwLength = sizeof(ms);
+    size_t maxBudget = IsProcess64() ? (size_t)4096 * 1024 * 1024 : (size_t)768 * 1024 * 1024;
+    if (!GlobalMemoryStatusEx(&ms)) {
+        return FZ_STORE_DEFAULT;
+    }
+    u64 budget = ms.ullTotalPhys / 4;
+    return (size_t)std::clamp(budget, (u64)FZ_STORE_DEFAULT, (u64)maxBudget);
+}
+
+static void StoreBudgetInit() {
+    static bool initialized = [] {
+        InitializeCriticalSection(&gStoreBudgetCs);
+        gStoreBudgetEngines = new Vec<EngineMupdf*>();
+        gStoreBudget = DefaultStoreBudget();
+        return true;
+    }();
+    (void)initialized;
+}
+
+// sets the engine's fz_store limit to storeLimit. shrinking evicts what doesn't
+// fit anymore. must be called with ctxAccess and gStoreBudgetCs held
+static void StoreBudgetSetLimit(EngineMupdf* engine) {
+    auto ctx = engine->Ctx();
+    if (engine->storeLimit != engine->appliedStoreLimit) {
+        fz_set_store_max(ctx, engine->storeLimit);
+        engine->appliedStoreLimit = engine->storeLimit;
+    }
+    engine->storeUsed = fz_store_size(ctx, nullptr);
+}
+
+// must be called with gStoreBudgetCs held. engines that are busy (i.e. hold
+// ctxAccess) are skipped, they call StoreBudgetApply() before rendering
+static void StoreBudgetApplyToIdle() {
+    for (EngineMupdf* e : *gStoreBudgetEngines) {
+        if (e->storeLimit == e->appliedStoreLimit) {
+            continue;
+        }
+        if (!TryEnterCriticalSection(e->ctxAccess)) {
+            continue;
+        }
+        StoreBudgetSetLimit(e);
+        LeaveCriticalSection(e->ctxAccess);
+    }
+}
+
+// must be called with gStoreBudgetCs held
+static void StoreBudgetRebalance() {
+    gStoreBudgetLastRebalance = TimeGet();
+    Vec<EngineMupdf*> engines;
+    for (EngineMupdf* e : *gStoreBudgetEngines) {
+        engines.Append(e);
+    }
+    if (engines.Size() == 0) {
+        return;
+    }
+    std::sort(engines.begin(), engines.end(),
+              [](EngineMupdf* a, EngineMupdf* b) { return a->lastUsed.QuadPart > b->lastUsed.QuadPart; });
+
+    size_t budget = gStoreBudget;
+    // when the system runs low on memory, give back half of what's cached
+    MEMORYSTATUSEX ms{};
+    ms.dwLength = sizeof(ms);
+    bool lowMemory = GlobalMemoryStatusEx(&ms) && ms.dwMemoryLoad >= 90;
+    if (lowMemory) {
+        size_t used = 0;
+        for (EngineMupdf* e : engines) {
+            used += e->storeUsed;
+        }
+        budget = std::min(budget, used / 2);
+        if (!gStoreBudgetLowMemory) {
+            logf("StoreBudgetRebalance: memory load %d%%, shrinking fz_store budget to %d MB\n",
+                 (int)ms.dwMemoryLoad, (int)(budget / (1024 * 1024)));
+        }
+    }
+    gStoreBudgetLowMemory = lowMemory;
+
+    // every document gets at least kMinStoreSize (less if there are too many
+    // for the budget), the rest is divided with weights 8, 4 and 2 for the
+    // 3 most recently used documents and 1 for all others
+    int n = engines.Size();
+    size_t minSize = std::min(kMinStoreSize, budget / n);
+    size_t rest = budget - minSize * n;
+    size_t totalWeight = 0;
+    for (int i = 0; i < n; i++) {
+        totalWeight += (size_t)1 << std::max(3 - i, 0);
+    }
+    for (int i = 0; i < n; i++) {
+        size_t weight = (size_t)1 << std::max(3 - i, 0);
+        engines[i]->storeLimit = minSize + (size_t)((u64)rest * weight / totalWeight);
+    }
+    StoreBudgetApplyToIdle();
+}
+
+static void StoreBudgetRegister(EngineMupdf* engine) {
+    StoreBudgetInit();
+    ScopedCritSec scope(&gStoreBudgetCs);
+    engine->lastUsed = TimeGet();
+    gStoreBudgetEngines->Append(engine);
+    gStoreBudgetActive = engine;
+    StoreBudgetRebalance();
+}
+
+static void StoreBudgetUnregister(EngineMupdf* engine) {
+    ScopedCritSec scope(&gStoreBudgetCs);
+    gStoreBudgetEngines->Remove(engine);
+    if (gStoreBudgetActive == engine) {
+        gStoreBudgetActive = nullptr;
+    }
+    StoreBudgetRebalance();
+}
+
+// called when a page is about to be rendered, must not be called with ctxAccess held
+static void StoreBudgetTouch(EngineMupdf* engine) {
+    ScopedCritSec scope(&gStoreBudgetCs);
+    engine->lastUsed = TimeGet();
+    if (gStoreBudgetActive == engine && TimeSinceInMs(gStoreBudgetLastRebalance) < kStoreBudgetRebalanceMs) {
+        return;
+    }
+    gStoreBudgetActive = engine;
+    StoreBudgetRebalance();
+}
+
+// sets the engine's own fz_store limit to what StoreBudgetRebalance() decided
+// (if that couldn't be done while another thread was using the engine) and
+// reports back how much it uses. must not be called with ctxAccess held
+static void StoreBudgetApply(EngineMupdf* engine) {
+    ScopedCritSec scope(engine->ctxAccess);
+    ScopedCritSec scopeBudget(&gStoreBudgetCs);
+    StoreBudgetSetLimit(engine);
+}
+
+// size and current limit of the engine's fz_store
+TempStr EngineMupdfStoreStatsTemp(EngineBase* engine) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    if (!epdf) {
+        return nullptr;
+    }
+    size_t max = 0;
+    size_t size = fz_store_size(epdf->Ctx(), &max);
+    str::Str s;
+    s.AppendFmt("%d KB of %d KB", (int)(size / 1024), (int)(max / 1024));
+    return str::DupTemp(s.Get());
+}
+
+// text-dense pages at high zoom and CJK fonts easily overflow fitz's
+// default 1 MB glyph cache
+constexpr size_t kGlyphCacheSize = 8 * 1024 * 1024;
+
+// memory used by cached structured text of pages, see GetPageStext()
+constexpr size_t kMaxStextCacheSize = 32 * 1024 * 1024;
+
+// large JPX images are decoded by up to this many threads (started once for
+// all documents and used by one image at a time). more don't help much
+constexpr int kMaxJpxThreads = 8;
+
+// renderBandThreads of new engines, RenderBandThreads in the settings
+static int gRenderBandThreads = 0;
+
 EngineMupdf::EngineMupdf() {
     kind = kindEngineMupdf;
     defaultExt = str::Dup(".pdf");
     fileDPI = 72.0f;
+    renderBandThreads = gRenderBandThreads;
 
     for (size_t i = 0; i < dimof(mutexes); i++) {
         InitializeCriticalSection(&mutexes[i]);
     }
     InitializeCriticalSection(&pagesAccess);
+    InitializeCriticalSection(&fullLoadAccess);
     ctxAccess = &mutexes[FZ_LOCK_ALLOC];
 
     fz_locks_ctx.user = this;
@@ -1623,9 +2352,13 @@ EngineMupdf::EngineMupdf() {
     fz_locks_ctx.unlock = fz_unlock_context_cs;
     _ctx = fz_new_context(nullptr, &fz_locks_ctx, FZ_STORE_DEFAULT);
     InstallFitzErrorCallbacks(_ctx);
+    fz_set_glyph_cache_size(_ctx, kGlyphCacheSize);
+    fz_tune_jpx_threads(_ctx, std::min(GetCpuCount(), kMaxJpxThreads));
 
     install_load_windows_font_funcs(_ctx);
     fz_register_document_handlers(_ctx);
+    GetSharedImageCache();
+    StoreBudgetRegister(this);
 }
 
 fz_context* EngineMupdf::Ctx() const {
@@ -1633,6 +2366,7 @@ fz_context* EngineMupdf::Ctx() const {
 }
 
 EngineMupdf::~EngineMupdf() {
+    StoreBudgetUnregister(this);
     EnterCriticalSection(&pagesAccess);
 
     auto ctx = Ctx();
@@ -1644,6 +2378,12 @@ EngineMupdf::~EngineMupdf() {
         if (pi->retainedLinks) {
             fz_drop_link(ctx, pi->retainedLinks);
         }
+        if (pi->stext) {
+            fz_drop_stext_page(ctx, pi->stext);
+        }
+        if (pi->annotStext) {
+            fz_drop_stext_page(ctx, pi->annotStext);
+        }
         if (pi->page) {
             fz_drop_page(ctx, pi->page);
         }
@@ -1666,12 +2406,14 @@ EngineMupdf::~EngineMupdf() {
     delete pageLabels;
     delete tocTree;
     DeleteVecMembers(pages);
+    str::Free(layoutCachePath);
 
     for (size_t i = 0; i < dimof(mutexes); i++) {
         DeleteCriticalSection(&mutexes[i]);
     }
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
+    DeleteCriticalSection(&fullLoadAccess);
 }
 
 class PasswordCloner : public PasswordUI {
@@ -1897,7 +2639,13 @@ bool EngineMupdf::Load(const char* path, PasswordUI* pwdUI) {
         return FinishLoading();
     }
 
-    fz_stream* file = FzOpenOrReadFile(ctx, fnCopy);
+    fz_stream* file = nullptr;
+    if (streamNo < 0 && ShouldLoadProgressively(fnCopy)) {
+        file = FzOpenProgressiveFile(ctx, fnCopy, std::max(gProgressiveLoadKbps, 0));
+    }
+    if (!file) {
+        file = FzOpenOrReadFile(ctx, fnCopy);
+    }
     ok = LoadFromStream(file, FilePath(), pwdUI);
     if (!ok) {
         return false;
@@ -1983,20 +2731,152 @@ bool EngineMupdf::Load(IStream* stream, const char* nameHint, PasswordUI* pwdUI)
 // TODO: allow setting per
 extern EBookUI* GetEBookUI();
 
-// stm is either freed or retained via _doc
-bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordUI* pwdUI) {
-    if (!stm) {
+void EngineMupdfSetLayoutCacheDir(const char* dir) {
+    str::ReplaceWithCopy(&gLayoutCacheDir, dir);
+}
+
+// a cheap stand-in for FzStreamFingerprint(): an EPUB is a zip file whose central
+// directory at the end has the sizes and CRC-32s of all entries, so the size of
+// the file and its first and last few KB identify it well enough
+static bool FzStreamLayoutKey(fz_context* ctx, fz_stream* stm, u8 digest[16]) {
+    if (stm->next == FzProgressiveNext) {
+        // the read-ahead is sequential, the end of the file arrives last
+        while (FzIsLoadingProgressively(stm)) {
+            if (!FzWaitForProgressiveData(stm)) {
+                return false;
+            }
+        }
+    }
+
+    u8* chunk = AllocArray<u8>(kLayoutKeyChunkSize);
+    if (!chunk) {
         return false;
     }
-    auto ctx = Ctx();
 
-#if 0
-    /* a heuristic. a layout page size for .epub is A5 but that makes a font size too
-       large for non-epub files like .txt or .xml, so for those use larger A4 */
-    float ldx = layoutA4DxPt;
-    float ldy = layoutA4DyPt;
-    const char* ext = path::GetExtTemp(nameHint);
-    if (str::EqI(ext, ".epub")) {
+    bool ok = true;
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    fz_try(ctx) {
+        fz_seek(ctx, stm, 0, SEEK_END);
+        i64 size = fz_tell(ctx, stm);
+        fz_md5_update(&md5, (const u8*)&size, sizeof(size));
+        i64 tailStart = std::max(size - (i64)kLayoutKeyChunkSize, (i64)0);
+        for (i64 offset : {(i64)0, tailStart}) {
+            fz_seek(ctx, stm, offset, SEEK_SET);
+            size_t n = fz_read(ctx, stm, chunk, kLayoutKeyChunkSize);
+            fz_md5_update(&md5, chunk, n);
+        }
+    }
+    fz_always(ctx) {
+        free(chunk);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        ok = false;
+    }
+    if (ok) {
+        fz_md5_final(&md5, digest);
+    }
+    return ok;
+}
+
+// MuPDF can save the number of pages in each chapter of an EPUB for a given layout
+// (an "accelerator") so that re-opening it doesn't require laying out every chapter.
+// The file name includes everything that affects the layout so that switching
+// between layouts doesn't throw the saved data away
+static TempStr GetLayoutCachePathTemp(fz_context* ctx, fz_stream* stm, float dx, float dy, float fontDy) {
+    u8 digest[16]{};
+    if (!FzStreamLayoutKey(ctx, stm, digest)) {
+        return nullptr;
+    }
+    fz_try(ctx) {
+        fz_seek(ctx, stm, 0, 0);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        return nullptr;
+    }
+    AutoFreeStr fingerprint = str::MemToHex(digest, dimof(digest));
+
+    // user CSS is part of the layout as well
+    const char* css = fz_user_css(ctx);
+    u8 cssDigest[16]{};
+    CalcMD5Digest(css ? css : "", css ? str::Leni(css) : 0, cssDigest);
+    AutoFreeStr cssHash = str::MemToHex(cssDigest, 4);
+
+    TempStr name = str::FormatTemp("%s-%dx%d-%d-%s%s.accel", fingerprint.Get(), (int)(dx * 100), (int)(dy * 100),
+                                   (int)(fontDy * 100), cssHash.Get(), fz_use_document_css(ctx) ? "" : "-nocss");
+    return path::JoinTemp(gLayoutCacheDir, name);
+}
+
+// keep only the most recently used layout accelerators
+static void TrimLayoutCacheDir() {
+    struct CacheFile {
+        char* path;
+        FILETIME modified;
+    };
+    Vec<CacheFile> files;
+    DirIter di{gLayoutCacheDir};
+    for (DirIterEntry* de : di) {
+        if (path::Match(de->filePath, "*.accel")) {
+            files.Append({str::Dup(de->filePath), de->fd->ftLastWriteTime});
+        }
+    }
+    if (files.Size() > kMaxLayoutCacheFiles) {
+        std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) {
+            return CompareFileTime(&a.modified, &b.modified) > 0;
+        });
+        for (int i = kMaxLayoutCacheFiles; i < files.Size(); i++) {
+            file::Delete(files[i].path);
+        }
+    }
+    for (auto& f : files) {
+        str::Free(f.path);
+    }
+}
+
+// save the layout after all chapters have been laid out, unless it's been
+// loaded from the cache in which case only the modification time is updated
+static void SaveLayoutCache(EngineMupdf* e) {
+    if (!e->layoutCachePath) {
+        return;
+    }
+    auto ctx = e->Ctx();
+    if (!fz_document_supports_accelerator(ctx, e->_doc)) {
+        return;
+    }
+    if (e->layoutFromCache) {
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        file::SetModificationTime(e->layoutCachePath, now);
+        return;
+    }
+    dir::CreateAll(gLayoutCacheDir);
+    fz_try(ctx) {
+        fz_save_accelerator(ctx, e->_doc, e->layoutCachePath);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        file::Delete(e->layoutCachePath);
+        return;
+    }
+    TrimLayoutCacheDir();
+}
+
+// stm is either freed or retained via _doc
+bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordUI* pwdUI) {
+    if (!stm) {
+        return false;
+    }
+    auto ctx = Ctx();
+
+#if 0
+    /* a heuristic. a layout page size for .epub is A5 but that makes a font size too
+       large for non-epub files like .txt or .xml, so for those use larger A4 */
+    float ldx = layoutA4DxPt;
+    float ldy = layoutA4DyPt;
+    const char* ext = path::GetExtTemp(nameHint);
+    if (str::EqI(ext, ".epub")) {
         ldx = layoutA5DxPt;
         ldy = layoutA5DyPt;
     }
@@ -2027,32 +2907,62 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
         fz_set_use_document_css(ctx, useDocCss);
     }
 
-    float dx, dy, fontDy;
-    _doc = nullptr;
-    fz_var(dx);
-    fz_var(dy);
-    fz_var(fontDy);
-    fz_try(ctx) {
-        _doc = fz_open_document_with_stream(ctx, nameHint, stm);
-        pdfdoc = pdf_specifics(ctx, _doc);
-        dx = DpiScale(ldx, displayDPI);
-        dy = DpiScale(ldy, displayDPI);
-        fontDy = DpiScale(lfontDy, displayDPI);
-        fz_layout_document(ctx, _doc, dx, dy, fontDy);
-    }
-    fz_always(ctx) {
-        fz_drop_stream(ctx, stm);
+    float dx = DpiScale(ldx, displayDPI);
+    float dy = DpiScale(ldy, displayDPI);
+    float fontDy = DpiScale(lfontDy, displayDPI);
+
+    // only EPUB supports accelerators: the other html formats are laid out
+    // as a single flow which has to be done in full to render any page
+    str::FreePtr(&layoutCachePath);
+    layoutFromCache = false;
+    fz_stream* accel = nullptr;
+    if (gLayoutCacheDir && str::EndsWithI(nameHint, ".epub")) {
+        layoutCachePath = str::Dup(GetLayoutCachePathTemp(ctx, stm, dx, dy, fontDy));
+        if (layoutCachePath && file::Exists(layoutCachePath)) {
+            fz_try(ctx) {
+                accel = fz_open_file(ctx, layoutCachePath);
+            }
+            fz_catch(ctx) {
+                fz_report_error(ctx);
+                accel = nullptr;
+            }
+            layoutFromCache = accel != nullptr;
+        }
     }
-    fz_catch(ctx) {
-        fz_report_error(ctx);
-        _doc = nullptr;
+
+    _doc = nullptr;
+    bool tryLater = true;
+    while (tryLater) {
+        tryLater = false;
+        fz_try(ctx) {
+            // MuPDF silently ignores invalid accelerator data
+            _doc = fz_open_accelerated_document_with_stream(ctx, nameHint, stm, accel);
+            pdfdoc = pdf_specifics(ctx, _doc);
+            fz_layout_document(ctx, _doc, dx, dy, fontDy);
+        }
+        fz_catch(ctx) {
+            // for a progressively loaded file, wait until mupdf has enough data
+            // to parse the first page's objects
+            tryLater = fz_caught(ctx) == FZ_ERROR_TRYLATER && FzIsLoadingProgressively(stm);
+            if (tryLater) {
+                fz_ignore_error(ctx);
+                tryLater = FzWaitForProgressiveData(stm);
+            } else {
+                fz_report_error(ctx);
+            }
+            fz_drop_document(ctx, _doc);
+            _doc = nullptr;
+        }
     }
+    fz_drop_stream(ctx, stm);
+    fz_drop_stream(ctx, accel);
     if (!_doc) {
         return false;
     }
 
     isPasswordProtected = fz_needs_password(ctx, _doc);
     if (!isPasswordProtected) {
+        FzProgressiveOpened(pdfdoc ? pdfdoc->file : nullptr);
         return true;
     }
 
@@ -2062,9 +2972,8 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
 
     // TODO: make this work for non-PDF formats?
     u8 digest[16 + 32]{};
-    if (pdfdoc) {
-        FzStreamFingerprint(ctx, pdfdoc->file, digest);
-    }
+    // without a fingerprint, a decryption key can't be remembered or looked up
+    bool hasDigest = pdfdoc && FzStreamFingerprint(ctx, pdfdoc->file, digest);
 
     bool ok = false;
     bool saveKey = false;
@@ -2073,7 +2982,7 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
         if (pdfdoc) {
             decryptKey = pdf_crypt_key(ctx, pdfdoc->crypt);
         }
-        AutoFreeStr pwd(pwdUI->GetPassword(FilePath(), digest, decryptKey, &saveKey));
+        AutoFreeStr pwd(pwdUI->GetPassword(FilePath(), hasDigest ? digest : nullptr, decryptKey, &saveKey));
         if (!pwd) {
             // password not given or encryption key has been remembered
             ok = saveKey;
@@ -2103,10 +3012,13 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
         }
     }
 
-    if (pdfdoc && ok && saveKey) {
+    if (hasDigest && ok && saveKey) {
         memcpy(digest + 16, pdf_crypt_key(ctx, pdfdoc->crypt), 32);
         decryptionKey = _MemToHex(&digest);
     }
+    if (ok) {
+        FzProgressiveOpened(pdfdoc ? pdfdoc->file : nullptr);
+    }
     // TODO: if !ok,
     return ok;
 }
@@ -2181,6 +3093,33 @@ static bool IsLinearizedFile(EngineMupdf* e) {
     return isLinear;
 }
 
+// page objects of a progressively loaded file are only available once they've
+// been read, until then this throws FZ_ERROR_TRYLATER
+static pdf_obj* PdfLookupPageObj(fz_context* ctx, pdf_document* doc, int pageNo) {
+    if (!doc->file_reading_linearly) {
+        return pdf_lookup_page_obj(ctx, doc, pageNo);
+    }
+    pdf_obj* pageref = pdf_progressive_advance(ctx, doc, pageNo);
+    if (!pageref) {
+        fz_throw(ctx, FZ_ERROR_TRYLATER, "page %d not available yet", pageNo);
+    }
+    return pageref;
+}
+
+// true if the document is being loaded progressively and hasn't been fully read yet
+static bool IsLoadingProgressively(EngineMupdf* e) {
+    if (!e->pdfdoc) {
+        return false;
+    }
+    ScopedCritSec scope(e->ctxAccess);
+    return e->pdfdoc->file_reading_linearly && FzIsLoadingProgressively(e->pdfdoc->file);
+}
+
+bool EngineMupdfIsLoadingProgressively(EngineBase* engine) {
+    EngineMupdf* e = AsEngineMupdf(engine);
+    return e && IsLoadingProgressively(e);
+}
+
 static void FinishNonPDFLoading(EngineMupdf* e) {
     ScopedCritSec scope(e->ctxAccess);
 
@@ -2246,6 +3185,7 @@ bool EngineMupdf::FinishLoading() {
         fz_warn(ctx, "document has no pages");
         return false;
     }
+    SaveLayoutCache(this);
 
     preferredLayout = GetPreferredLayout(ctx, _doc);
     allowsPrinting = fz_has_permission(ctx, _doc, FZ_PERMISSION_PRINT);
@@ -2262,21 +3202,35 @@ bool EngineMupdf::FinishLoading() {
 
     ScopedCritSec scope(ctxAccess);
 
+    // pages of a progressively loaded file arrive in order, so once a page
+    // isn't available, none of the following ones are either
+    bool pagesPending = false;
     for (int pageNo = 0; pageNo < pageCount; pageNo++) {
         pdf_obj* pageref = nullptr;
         fz_rect mbox{};
         fz_matrix page_ctm{};
         fz_var(pageref);
         fz_var(mbox);
-        fz_try(ctx) {
-            // note: don't pdf_drop_obj() this
-            pageref = pdf_lookup_page_obj(ctx, pdfdoc, pageNo);
-            pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
-            mbox = fz_transform_rect(mbox, page_ctm);
+        if (!pagesPending) {
+            fz_try(ctx) {
+                // note: don't pdf_drop_obj() this
+                pageref = PdfLookupPageObj(ctx, pdfdoc, pageNo);
+                pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
+                mbox = fz_transform_rect(mbox, page_ctm);
+            }
+            fz_catch(ctx) {
+                if (fz_caught(ctx) == FZ_ERROR_TRYLATER) {
+                    fz_ignore_error(ctx);
+                    pagesPending = true;
+                } else {
+                    fz_report_error(ctx);
+                }
+                mbox = {};
+            }
         }
-        fz_catch(ctx) {
-            fz_report_error(ctx);
-            mbox = {};
+        if (pagesPending && pageNo > 0) {
+            // until the page has been loaded, assume it's the size of the first page
+            mbox = ToFzRect(pages[0]->mediabox);
         }
         if (fz_is_empty_rect(mbox)) {
             logfa("cannot find page size for page %d", pageNo);
@@ -2287,6 +3241,7 @@ bool EngineMupdf::FinishLoading() {
         }
         FzPageInfo* pageInfo = pages[pageNo];
         pageInfo->mediabox = ToRectF(mbox);
+        pageInfo->mediaboxPending = pagesPending;
         pageInfo->pageNo = pageNo + 1;
     }
 
@@ -2563,15 +3518,22 @@ IPageDestination* EngineMupdf::GetNamedDest(const char* name) {
 }
 #endif
 
-// return a page but only if is fully loaded
+// return a page but only if is fully loaded. never waits for a page being
+// loaded, instead schedules loading it and returns nullptr ("not ready yet")
 FzPageInfo* EngineMupdf::GetFzPageInfoFast(int pageNo) {
-    ScopedCritSec scope(&pagesAccess);
     ReportIf(pageNo < 1 || pageNo > pageCount);
     FzPageInfo* pageInfo = pages[pageNo - 1];
-    if (!pageInfo->page || !pageInfo->fullyLoaded) {
-        return nullptr;
+    // pagesAccess is held while a page is being published, which is
+    // brief but we don't want to wait for it on the UI thread
+    if (TryEnterCriticalSection(&pagesAccess)) {
+        bool isReady = pageInfo->page && pageInfo->fullyLoaded;
+        LeaveCriticalSection(&pagesAccess);
+        if (isReady) {
+            return pageInfo;
+        }
     }
-    return pageInfo;
+    ScheduleFullPageLoad(pageInfo);
+    return nullptr;
 }
 
 static IPageElement* NewFzComment(const char* comment, int pageNo, RectF rect) {
@@ -2698,7 +3660,11 @@ FzPageInfo* EngineMupdf::GetFzPageInfoCanFail(int pageNo) {
     if (!TryEnterCriticalSection(&pagesAccess)) {
         return nullptr;
     }
-    if (TryEnterCriticalSection(ctxAccess)) {
+    FzPageInfo* pageInfo = pages[pageNo - 1];
+    if (pageInfo->page) {
+        // already published, no need for ctxAccess
+        res = pageInfo;
+    } else if (TryEnterCriticalSection(ctxAccess)) {
         // CRITICAL_SECTION locking is recursive
         res = GetFzPageInfo(pageNo, true);
         LeaveCriticalSection(ctxAccess);
@@ -2736,89 +3702,343 @@ fz_stext_page* fz_new_stext_page_from_page2(fz_context* ctx, fz_page* page, cons
     return text;
 }
 
-// Maybe: handle FZ_ERROR_TRYLATER, which can happen when parsing from network.
-// (I don't think we read from network now).
-// Maybe: when loading fully, cache extracted text in FzPageInfo
-// so that we don't have to re-do fz_new_stext_page_from_page() when doing search
-FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick, fz_cookie* cookie) {
-    auto ctx = Ctx();
-    // TODO: minimize time spent under pagesAccess when fully loading
-    ScopedCritSec scope(&pagesAccess);
+// text of annotations and widgets is kept apart from page contents so that
+// it's searchable and selectable but not linkified. returns nullptr if there's none
+static fz_stext_page* FzNewStextPageFromAnnots(fz_context* ctx, fz_page* page, const fz_stext_options* options,
+                                               fz_cookie* cookie) {
+    fz_stext_page* text = fz_new_stext_page(ctx, fz_bound_page(ctx, page));
+    fz_device* dev = nullptr;
+    fz_var(dev);
+    fz_try(ctx) {
+        dev = fz_new_stext_device(ctx, text, options);
+        fz_run_page_annots(ctx, page, dev, fz_identity, cookie);
+        fz_run_page_widgets(ctx, page, dev, fz_identity, cookie);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        fz_drop_stext_page(ctx, text);
+        fz_rethrow(ctx);
+    }
+    if (!text->first_block) {
+        fz_drop_stext_page(ctx, text);
+        return nullptr;
+    }
+    return text;
+}
 
-    ReportIf(pageNo < 1 || pageNo > pageCount);
-    int pageIdx = pageNo - 1;
-    FzPageInfo* pageInfo = pages[pageIdx];
+// pool memory of stext plus the images its image blocks keep alive
+static size_t FzStextPageSize(fz_context* ctx, fz_stext_page* stext) {
+    if (!stext) {
+        return 0;
+    }
+    size_t size = fz_pool_size(ctx, stext->pool);
+    for (fz_stext_block* block = stext->first_block; block; block = block->next) {
+        if (block->type == FZ_STEXT_BLOCK_IMAGE) {
+            size += fz_image_size(ctx, block->u.i.image);
+        }
+    }
+    return size;
+}
 
-    ScopedCritSec ctxScope(ctxAccess);
+// building structured text runs the text device over the whole page so it's kept
+// for the most recently used pages, within kMaxStextCacheSize bytes.
+// must be called with ctxAccess held and the result is only valid while it's held
+fz_stext_page* EngineMupdf::GetPageStext(FzPageInfo* pageInfo, fz_cookie* cookie) {
+    if (pageInfo->stext) {
+        stextPages.Remove(pageInfo);
+        stextPages.Append(pageInfo);
+        return pageInfo->stext;
+    }
     if (!pageInfo->page) {
+        return nullptr;
+    }
+
+    auto ctx = Ctx();
+    fz_stext_page* stext = nullptr;
+    fz_stext_page* annotStext = nullptr;
+    fz_var(stext);
+    fz_var(annotStext);
+    fz_stext_options opts{};
+    opts.flags = FZ_STEXT_PRESERVE_IMAGES;
+    fz_try(ctx) {
+        stext = fz_new_stext_page_from_page2(ctx, pageInfo->page, &opts, cookie);
+        fz_stext_options annotOpts{};
+        annotStext = FzNewStextPageFromAnnots(ctx, pageInfo->page, &annotOpts, cookie);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+    }
+    if (!stext || (cookie && cookie->abort)) {
+        // failed or incomplete, must be re-built
+        fz_drop_stext_page(ctx, stext);
+        fz_drop_stext_page(ctx, annotStext);
+        return nullptr;
+    }
+
+    size_t size = FzStextPageSize(ctx, stext) + FzStextPageSize(ctx, annotStext);
+    while (stextPages.Size() > 0 && stextCacheSize + size > kMaxStextCacheSize) {
+        DropPageStext(stextPages[0]);
+    }
+    pageInfo->stext = stext;
+    pageInfo->annotStext = annotStext;
+    pageInfo->stextSize = size;
+    stextCacheSize += size;
+    stextPages.Append(pageInfo);
+    return stext;
+}
+
+void EngineMupdf::DropPageStext(FzPageInfo* pageInfo) {
+    if (!pageInfo->stext) {
+        return;
+    }
+    ScopedCritSec scope(ctxAccess);
+    fz_drop_stext_page(Ctx(), pageInfo->stext);
+    fz_drop_stext_page(Ctx(), pageInfo->annotStext);
+    pageInfo->stext = nullptr;
+    pageInfo->annotStext = nullptr;
+    stextCacheSize -= pageInfo->stextSize;
+    pageInfo->stextSize = 0;
+    stextPages.Remove(pageInfo);
+}
+
+// Pages are loaded in two steps: quick (fz_page, annotations and comments) and full
+// (links, auto-detected links and images). The work is done into a temporary
+// FzPageInfo holding only ctxAccess (which fitz needs) and the results are then
+// published under pagesAccess. Readers that only want published state
+// (GetFzPageInfoFast(), hit-testing) therefore never wait for a page being loaded.
+// If two threads load the same page at the same time, the second result is discarded.
+
+static void DropUnpublishedPageInfo(EngineMupdf* e, FzPageInfo* tmp) {
+    auto ctx = e->Ctx();
+    ScopedCritSec ctxScope(e->ctxAccess);
+    DeleteVecMembers(tmp->annotations);
+    DeleteVecMembers(tmp->comments);
+    DeleteVecMembers(tmp->links);
+    DeleteVecMembers(tmp->autoLinks);
+    DeleteVecMembers(tmp->images);
+    fz_drop_link(ctx, tmp->retainedLinks);
+    fz_drop_page(ctx, tmp->page);
+    tmp->retainedLinks = nullptr;
+    tmp->page = nullptr;
+}
+
+bool EngineMupdf::LoadPageQuick(FzPageInfo* pageInfo) {
+    auto ctx = Ctx();
+    int pageNo = pageInfo->pageNo;
+    FzPageInfo tmp;
+    tmp.pageNo = pageNo;
+    {
+        ScopedCritSec ctxScope(ctxAccess);
         fz_try(ctx) {
-            pageInfo->page = fz_load_page(ctx, _doc, pageIdx);
+            tmp.page = fz_load_page(ctx, _doc, pageNo - 1);
+        }
+        fz_catch(ctx) {
+            // page of a progressively loaded file that hasn't arrived yet
+            if (fz_caught(ctx) == FZ_ERROR_TRYLATER) {
+                fz_ignore_error(ctx);
+            } else {
+                fz_report_error(ctx);
+            }
+        }
+        if (!tmp.page) {
+            return false;
+        }
+
+        if (pdfdoc) {
+            fz_try(ctx) {
+                pdf_page* pdfpage = pdf_page_from_fz_page(ctx, tmp.page);
+                pdf_annot* annot = pdf_first_annot(ctx, pdfpage);
+                while (annot) {
+                    Annotation* a = MakeAnnotationWrapper(this, annot, pageNo);
+                    if (a) {
+                        tmp.annotations.Append(a);
+                    }
+                    annot = pdf_next_annot(ctx, annot);
+                }
+            }
+            fz_catch(ctx) {
+                fz_report_error(ctx);
+            }
+            RebuildCommentsFromAnnotations(ctx, &tmp);
+        }
+    }
+
+    // the size of a page that hadn't arrived yet in FinishLoading() was a guess
+    fz_rect mbox{};
+    if (pageInfo->mediaboxPending) {
+        ScopedCritSec ctxScope(ctxAccess);
+        fz_try(ctx) {
+            mbox = fz_bound_page(ctx, tmp.page);
         }
         fz_catch(ctx) {
             fz_report_error(ctx);
+            mbox = {};
         }
     }
 
-    fz_page* page = pageInfo->page;
-    if (!page) {
-        return nullptr;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (!fz_is_empty_rect(mbox)) {
+            pageInfo->mediabox = ToRectF(mbox);
+            pageInfo->mediaboxPending = false;
+        }
+        if (!pageInfo->page) {
+            pageInfo->page = tmp.page;
+            pageInfo->annotations = tmp.annotations;
+            pageInfo->comments = tmp.comments;
+            pageInfo->elementsNeedRebuilding = true;
+            tmp.page = nullptr;
+            tmp.annotations.Reset();
+            tmp.comments.Reset();
+        }
     }
+    DropUnpublishedPageInfo(this, &tmp);
+    return true;
+}
 
-    // build annotations info on first access
-    if (pdfdoc && pageInfo->annotations.Size() == 0) {
+void EngineMupdf::LoadPageFull(FzPageInfo* pageInfo, fz_cookie* cookie) {
+    auto ctx = Ctx();
+    int pageNo = pageInfo->pageNo;
+    FzPageInfo tmp;
+    tmp.pageNo = pageNo;
+    {
+        ScopedCritSec ctxScope(ctxAccess);
+        // the page is published and never replaced so it can be used without pagesAccess
+        fz_page* page = pageInfo->page;
+        fz_stext_page* stext = GetPageStext(pageInfo, cookie);
+        if (!stext && cookie && cookie->abort) {
+            // try again the next time the page is needed
+            return;
+        }
+
+        fz_link* link = nullptr;
         fz_try(ctx) {
-            pdf_page* pdfpage = pdf_page_from_fz_page(ctx, pageInfo->page);
-            pdf_annot* annot = pdf_first_annot(ctx, pdfpage);
-            while (annot) {
-                Annotation* a = MakeAnnotationWrapper(this, annot, pageNo);
-                if (a) {
-                    pageInfo->annotations.Append(a);
-                }
-                annot = pdf_next_annot(ctx, annot);
-            }
+            link = fz_load_links(ctx, page);
         }
         fz_catch(ctx) {
             fz_report_error(ctx);
         }
-        RebuildCommentsFromAnnotations(ctx, pageInfo);
+        link = FixupPageLinks(link); // TOOD: is this necessary?
+        tmp.retainedLinks = link;
+        while (link) {
+            auto pel = NewLinkDestination(pageNo, ctx, _doc, link, nullptr);
+            tmp.links.Append(pel);
+            link = link->next;
+        }
+
+        if (stext) {
+            FzLinkifyPageText(&tmp, stext);
+            FzFindImagePositions(ctx, pageNo, tmp.images, stext);
+        }
     }
 
-    if (loadQuick || pageInfo->fullyLoaded) {
-        return pageInfo;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (!pageInfo->fullyLoaded) {
+            pageInfo->retainedLinks = tmp.retainedLinks;
+            pageInfo->links = tmp.links;
+            pageInfo->autoLinks = tmp.autoLinks;
+            pageInfo->images = tmp.images;
+            pageInfo->elementsNeedRebuilding = true;
+            // must be set last, readers check it before using the above
+            pageInfo->fullyLoaded = true;
+            tmp.retainedLinks = nullptr;
+            tmp.links.Reset();
+            tmp.autoLinks.Reset();
+            tmp.images.Reset();
+        }
     }
+    DropUnpublishedPageInfo(this, &tmp);
+}
 
+// returns nullptr for pages of a progressively loaded file that haven't arrived yet
+FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick, fz_cookie* cookie) {
+    ReportIf(pageNo < 1 || pageNo > pageCount);
+    FzPageInfo* pageInfo = pages[pageNo - 1];
     ReportIf(pageInfo->pageNo != pageNo);
 
-    pageInfo->fullyLoaded = true;
-
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-    fz_stext_options opts{};
-    opts.flags = FZ_STEXT_PRESERVE_IMAGES;
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page2(ctx, page, &opts, cookie);
+    bool hasPage, isFullyLoaded;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        hasPage = pageInfo->page != nullptr;
+        isFullyLoaded = pageInfo->fullyLoaded;
     }
-    fz_catch(ctx) {
-        fz_report_error(ctx);
+    if (!hasPage && !LoadPageQuick(pageInfo)) {
+        return nullptr;
     }
-
-    fz_link* link = fz_load_links(ctx, page);
-    link = FixupPageLinks(link); // TOOD: is this necessary?
-    pageInfo->retainedLinks = link;
-    while (link) {
-        auto pel = NewLinkDestination(pageNo, ctx, _doc, link, nullptr);
-        pageInfo->links.Append(pel);
-        link = link->next;
+    if (loadQuick || isFullyLoaded) {
+        return pageInfo;
     }
+    LoadPageFull(pageInfo, cookie);
+    return pageInfo;
+}
 
-    if (!stext) {
-        return pageInfo;
+// after a page failed to fully load, wait this long before loading it again,
+// doubling it for every further failure up to kMaxFullLoadRetryMs
+constexpr double kFullLoadRetryMs = 250;
+constexpr double kMaxFullLoadRetryMs = 10 * 1000;
+
+static void FullPageLoadWorker(EngineMupdf* e) {
+    while (true) {
+        FzPageInfo* pageInfo = nullptr;
+        {
+            ScopedCritSec scope(&e->fullLoadAccess);
+            if (e->fullLoadQueue.IsEmpty()) {
+                e->fullLoadWorkerRunning = false;
+                break;
+            }
+            // the most recently requested page is the most likely to be looked at
+            pageInfo = e->fullLoadQueue.Pop();
+        }
+        e->GetFzPageInfo(pageInfo->pageNo, false);
+        bool ok;
+        {
+            ScopedCritSec scope(&e->pagesAccess);
+            ok = pageInfo->fullyLoaded;
+        }
+        {
+            // if loading failed (e.g. page of a progressively loaded file
+            // that hasn't arrived yet), it can be scheduled again later
+            ScopedCritSec scope(&e->fullLoadAccess);
+            pageInfo->fullLoadScheduled = false;
+            pageInfo->fullLoadFailures = ok ? 0 : pageInfo->fullLoadFailures + 1;
+            if (!ok) {
+                pageInfo->fullLoadFailedAt = TimeGet();
+            }
+        }
     }
+    e->Release();
+}
 
-    FzLinkifyPageText(pageInfo, stext);
-    FzFindImagePositions(ctx, pageNo, pageInfo->images, stext);
-    fz_drop_stext_page(ctx, stext);
-    return pageInfo;
+// fully loads the page on a worker thread unless it's already been scheduled
+// or has recently failed to load. pages are loaded one at a time by a single
+// thread per engine
+void EngineMupdf::ScheduleFullPageLoad(FzPageInfo* pageInfo) {
+    ScopedCritSec scope(&fullLoadAccess);
+    if (pageInfo->fullLoadScheduled) {
+        return;
+    }
+    if (pageInfo->fullLoadFailures > 0) {
+        // called e.g. on every mouse move, so back off from pages that keep failing
+        int shift = std::min(pageInfo->fullLoadFailures - 1, 10);
+        double retryMs = std::min(kFullLoadRetryMs * (1 << shift), kMaxFullLoadRetryMs);
+        if (TimeSinceInMs(pageInfo->fullLoadFailedAt) < retryMs) {
+            return;
+        }
+    }
+    pageInfo->fullLoadScheduled = true;
+    fullLoadQueue.Append(pageInfo);
+    if (fullLoadWorkerRunning) {
+        return;
+    }
+    fullLoadWorkerRunning = true;
+    // keep the engine alive until the queue has been processed
+    AddRef();
+    auto fn = MkFunc0<EngineMupdf>(FullPageLoadWorker, this);
+    RunAsync(fn, "FullPageLoadWorker");
 }
 
 RectF EngineMupdf::PageMediabox(int pageNo) {
@@ -2903,7 +4123,239 @@ RectF EngineMupdf::Transform(const RectF& rect, int pageNo, float zoom, int rota
     return ToRectF(rect2);
 }
 
+// pages rendered to bitmaps at least this large are rasterized in
+// horizontal bands, in parallel
+constexpr i64 kMinBandPixels = 1024 * 1024;
+// every band re-runs the whole display list (clipped to the band) so the more
+// complex the page, the more pixels a band must cover to be worth a thread
+constexpr i64 kBandPixelsPerListNode = 32;
+constexpr int kMaxRenderBands = 16;
+// how often an abort of the render is forwarded to band threads
+constexpr DWORD kBandAbortPollMs = 20;
+
+// upper bound for CalcRenderBandCount(), known before the page is recorded
+static int CalcMaxRenderBandCount(fz_irect bbox, int maxThreads) {
+    i64 dy = bbox.y1 - bbox.y0;
+    i64 n = ((i64)(bbox.x1 - bbox.x0) * dy) / kMinBandPixels;
+    // don't create bands that are just a few rows high
+    n = std::min(n, dy / 64);
+    n = std::min(n, (i64)maxThreads);
+    n = std::min(n, (i64)kMaxRenderBands);
+    return (int)std::max(n, (i64)1);
+}
+
+static int CalcRenderBandCount(fz_context* ctx, fz_display_list* list, fz_irect bbox, int maxThreads) {
+    i64 pixels = (i64)(bbox.x1 - bbox.x0) * (i64)(bbox.y1 - bbox.y0);
+    i64 nodes = (i64)fz_display_list_len(ctx, list);
+    i64 minBandPixels = kMinBandPixels + nodes * kBandPixelsPerListNode;
+    i64 n = std::min(pixels / minBandPixels, (i64)CalcMaxRenderBandCount(bbox, maxThreads));
+    return (int)std::max(n, (i64)1);
+}
+
+struct RenderBandData {
+    // each band is rendered with its own context, cloned from engine's
+    fz_context* ctx = nullptr;
+    fz_display_list* list = nullptr;
+    // pixmap for the whole page, shared between bands
+    fz_pixmap* pix = nullptr;
+    fz_irect band{};
+    fz_matrix ctm{};
+    // bands don't share the caller's cookie because they would race updating
+    // its counters. results are added to it once all bands are done
+    fz_cookie cookie{};
+    bool ok = false;
+};
+
+static void RenderBand(RenderBandData* d) {
+    fz_context* ctx = d->ctx;
+    fz_pixmap* bandPix = nullptr;
+    fz_device* dev = nullptr;
+    fz_var(bandPix);
+    fz_var(dev);
+    fz_try(ctx) {
+        // shares samples with d->pix
+        bandPix = fz_new_pixmap_from_pixmap(ctx, d->pix, &d->band);
+        dev = fz_new_draw_device(ctx, fz_identity, bandPix);
+        fz_run_display_list(ctx, d->list, dev, d->ctm, fz_rect_from_irect(d->band), &d->cookie);
+        fz_close_device(ctx, dev);
+        d->ok = true;
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, bandPix);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+    }
+}
+
+static void AbortRenderBands(RenderBandData* bands, int nBands, fz_cookie* cookie) {
+    if (!cookie || !cookie->abort) {
+        return;
+    }
+    for (int i = 0; i < nBands; i++) {
+        bands[i].cookie.abort = 1;
+    }
+}
+
+// rasterizes list into pix, split into nBands horizontal bands rendered in parallel.
+// must not be called with ctxAccess held because band threads need the fitz locks
+static bool RenderDisplayListInBands(fz_context* ctx, fz_display_list* list, fz_pixmap* pix, fz_matrix ctm,
+                                     int nBands, fz_cookie* cookie) {
+    fz_irect bbox = fz_pixmap_bbox(ctx, pix);
+    int dy = bbox.y1 - bbox.y0;
+    RenderBandData bands[kMaxRenderBands];
+    HANDLE threads[kMaxRenderBands]{};
+    int nThreads = 0;
+    for (int i = 0; i < nBands; i++) {
+        RenderBandData* d = &bands[i];
+        d->list = list;
+        d->pix = pix;
+        d->ctm = ctm;
+        d->cookie.abort = cookie ? cookie->abort : 0;
+        d->band = bbox;
+        d->band.y0 = bbox.y0 + (int)(((i64)dy * i) / nBands);
+        d->band.y1 = bbox.y0 + (int)(((i64)dy * (i + 1)) / nBands);
+        d->ctx = fz_clone_context(ctx);
+        if (!d->ctx) {
+            continue;
+        }
+        // all bands are rendered on threads so that this thread is free
+        // to forward an abort to them
+        auto fn = MkFunc0(RenderBand, d);
+        threads[nThreads] = StartThread(fn, "RenderBandThread");
+        if (threads[nThreads]) {
+            nThreads++;
+        } else {
+            // couldn't start a thread, render it on this thread
+            RenderBand(d);
+            AbortRenderBands(bands, nBands, cookie);
+        }
+    }
+    while (nThreads > 0) {
+        DWORD res = WaitForMultipleObjects(nThreads, threads, TRUE, kBandAbortPollMs);
+        if (res != WAIT_TIMEOUT) {
+            break;
+        }
+        AbortRenderBands(bands, nBands, cookie);
+    }
+
+    bool ok = true;
+    for (int i = 0; i < nBands; i++) {
+        RenderBandData* d = &bands[i];
+        ok = ok && d->ok;
+        if (d->ctx) {
+            fz_drop_context(d->ctx);
+        }
+        if (cookie) {
+            cookie->errors += d->cookie.errors;
+            cookie->incomplete += d->cookie.incomplete;
+        }
+    }
+    for (int i = 0; i < nThreads; i++) {
+        CloseHandle(threads[i]);
+    }
+    return ok;
+}
+
+// rasterizes list into a new bitmap, in parallel bands if nBands > 1.
+// takes ownership of list. returns nullptr on error
+static RenderedBitmap* RenderDisplayList(fz_context* ctx, fz_display_list* list, fz_matrix ctm, fz_irect ibounds,
+                                         int nBands, fz_cookie* cookie) {
+    fz_pixmap* pix = nullptr;
+    fz_device* dev = nullptr;
+    RenderedBitmap* bitmap = nullptr;
+    fz_var(pix);
+    fz_var(dev);
+    fz_var(bitmap);
+    fz_try(ctx) {
+        pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), ibounds, nullptr, 1);
+        fz_clear_pixmap_with_value(ctx, pix, 0xff);
+        if (nBands > 1) {
+            if (RenderDisplayListInBands(ctx, list, pix, ctm, nBands, cookie)) {
+                bitmap = NewRenderedFzPixmap(ctx, pix);
+            }
+        } else {
+            dev = fz_new_draw_device(ctx, fz_identity, pix);
+            fz_run_display_list(ctx, list, dev, ctm, fz_rect_from_irect(ibounds), cookie);
+            fz_close_device(ctx, dev);
+            bitmap = NewRenderedFzPixmap(ctx, pix);
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, pix);
+        fz_drop_display_list(ctx, list);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        delete bitmap;
+        bitmap = nullptr;
+    }
+    return bitmap;
+}
+
+// large pages are recorded into a display list once and then rasterized
+// in parallel bands on cloned contexts. returns nullptr on error
+static RenderedBitmap* RenderPageInBands(EngineMupdf* e, fz_page* page, fz_matrix ctm, fz_irect ibounds,
+                                         const char* usage, int maxThreads, fz_cookie* cookie) {
+    fz_context* ctx = e->Ctx();
+    fz_display_list* list = nullptr;
+    fz_device* dev = nullptr;
+    fz_context* rctx = nullptr;
+    fz_var(list);
+    fz_var(dev);
+
+    int nBands = 1;
+    {
+        ScopedCritSec cs(e->ctxAccess);
+        fz_try(ctx) {
+            list = fz_new_display_list(ctx, fz_bound_page(ctx, page));
+            dev = fz_new_list_device(ctx, list);
+            if (e->pdfdoc) {
+                pdf_page* pdfpage = pdf_page_from_fz_page(ctx, page);
+                pdf_run_page_with_usage(ctx, pdfpage, dev, fz_identity, usage, cookie);
+            } else {
+                fz_run_page_contents(ctx, page, dev, fz_identity, cookie);
+            }
+            fz_close_device(ctx, dev);
+        }
+        fz_always(ctx) {
+            fz_drop_device(ctx, dev);
+        }
+        fz_catch(ctx) {
+            fz_report_error(ctx);
+            fz_drop_display_list(ctx, list);
+            return nullptr;
+        }
+        nBands = CalcRenderBandCount(ctx, list, ibounds, maxThreads);
+        if (nBands == 1) {
+            // the page is too complex for its size to be worth splitting
+            return RenderDisplayList(ctx, list, ctm, ibounds, 1, cookie);
+        }
+        // the engine's context may be used by other threads as soon as
+        // ctxAccess is released, so rasterize on a context of our own
+        rctx = fz_clone_context(ctx);
+        if (!rctx) {
+            fz_drop_display_list(ctx, list);
+            return nullptr;
+        }
+    }
+
+    RenderedBitmap* bitmap = RenderDisplayList(rctx, list, ctm, ibounds, nBands, cookie);
+    fz_drop_context(rctx);
+    return bitmap;
+}
+
+// mupdf skips resources (fonts, images) of a progressively loaded file
+// which haven't arrived yet
+static bool IsRenderIncomplete(EngineMupdf* e, fz_cookie* cookie) {
+    return cookie && cookie->incomplete > 0 && IsLoadingProgressively(e);
+}
+
 RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
+    StoreBudgetTouch(this);
+    StoreBudgetApply(this);
     auto ctx = Ctx();
     auto pageNo = args.pageNo;
 
@@ -2917,23 +4369,26 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
 
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false, fzcookie);
     if (!pageInfo || !pageInfo->page) {
+        args.tryLater = IsLoadingProgressively(this);
         return nullptr;
     }
     fz_page* page = pageInfo->page;
 
-    ScopedCritSec cs(ctxAccess);
-
     auto pageRect = args.pageRect;
     auto zoom = args.zoom;
     auto rotation = args.rotation;
     fz_rect pRect;
-    if (pageRect) {
-        pRect = ToFzRect(*pageRect);
-    } else {
-        // TODO(port): use pageInfo->mediabox?
-        pRect = fz_bound_page(ctx, page);
+    fz_matrix ctm;
+    {
+        ScopedCritSec cs(ctxAccess);
+        if (pageRect) {
+            pRect = ToFzRect(*pageRect);
+        } else {
+            // TODO(port): use pageInfo->mediabox?
+            pRect = fz_bound_page(ctx, page);
+        }
+        ctm = viewctm(page, zoom, rotation);
     }
-    fz_matrix ctm = viewctm(page, zoom, rotation);
     fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
     fz_colorspace* csRgb = fz_device_rgb(ctx);
@@ -2954,6 +4409,15 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
             break;
     }
 
+    int maxBandThreads = renderBandThreads > 0 ? renderBandThreads : GetCpuCount();
+    if (CalcMaxRenderBandCount(ibounds, maxBandThreads) > 1) {
+        bitmap = RenderPageInBands(this, page, ctm, ibounds, usage, maxBandThreads, fzcookie);
+        args.tryLater = IsRenderIncomplete(this, fzcookie);
+        return bitmap;
+    }
+
+    ScopedCritSec cs(ctxAccess);
+
     pdf_page* pdfpage = nullptr;
     fz_var(pdfpage);
     if (pdfdoc) {
@@ -3003,13 +4467,29 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
         }
     }
 
+    args.tryLater = IsRenderIncomplete(this, fzcookie);
     return bitmap;
 }
 
 // don't delete the result
 IPageElement* EngineMupdf::GetElementAtPos(int pageNo, PointF pt) {
     FzPageInfo* pageInfo = GetFzPageInfoCanFail(pageNo);
-    return FzGetElementAtPos(pageInfo, pt);
+    if (!pageInfo) {
+        return nullptr;
+    }
+    // this is called on the UI thread (e.g. on mouse move) so we don't wait
+    // for a page being published
+    if (!TryEnterCriticalSection(&pagesAccess)) {
+        return nullptr;
+    }
+    bool isFullyLoaded = pageInfo->fullyLoaded;
+    IPageElement* res = FzGetElementAtPos(pageInfo, pt);
+    LeaveCriticalSection(&pagesAccess);
+    if (!isFullyLoaded) {
+        // links and images will be there next time
+        ScheduleFullPageLoad(pageInfo);
+    }
+    return res;
 }
 
 // TOOD: optimize by returning reference or pointer so that
@@ -3139,7 +4619,7 @@ RenderedBitmap* EngineMupdf::GetPageImage(int pageNo, RectF rect, int imageIdx)
 
     ScopedCritSec scope(ctxAccess);
 
-    fz_image* image = FzFindImageAtIdx(ctx, pageInfo, imageIdx);
+    fz_image* image = FzFindImageAtIdx(ctx, GetPageStext(pageInfo), imageIdx);
     ReportIf(!image);
     if (!image) {
         return nullptr;
@@ -3167,8 +4647,6 @@ RenderedBitmap* EngineMupdf::GetPageImage(int pageNo, RectF rect, int imageIdx)
 }
 
 PageText EngineMupdf::ExtractPageText(int pageNo) {
-    auto ctx = Ctx();
-
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
     if (!pageInfo) {
         return {};
@@ -3176,22 +4654,13 @@ PageText EngineMupdf::ExtractPageText(int pageNo) {
 
     ScopedCritSec scope(ctxAccess);
 
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-    fz_stext_options opts{};
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
-    }
-    fz_catch(ctx) {
-        fz_report_error(ctx);
-    }
+    fz_stext_page* stext = GetPageStext(pageInfo);
     if (!stext) {
         return {};
     }
     PageText res;
     // TODO: convert to return PageText
-    WCHAR* text = FzTextPageToStr(stext, &res.coords);
-    fz_drop_stext_page(ctx, stext);
+    WCHAR* text = FzTextPageToStr(stext, &res.coords, pageInfo->annotStext);
     res.text = text;
     res.len = (int)str::Len(text);
     return res;
@@ -3744,12 +5213,14 @@ void EngineMupdfGetAnnotations(EngineBase* engine, Vec<Annotation*>& annotsOut)
     if (!e->pdfdoc) {
         return;
     }
-    ScopedCritSec scope(&e->pagesAccess);
     for (int i = 1; i <= e->pageCount; i++) {
-        FzPageInfo* pi = e->GetFzPageInfo(i, false);
+        // annotations are part of the quick load. loading takes pagesAccess itself,
+        // only for publishing, so it mustn't be held across loading all pages
+        FzPageInfo* pi = e->GetFzPageInfo(i, true);
         if (!pi) {
             continue;
         }
+        ScopedCritSec scope(&e->pagesAccess);
         annotsOut.Append(pi->annotations);
     }
 }
@@ -3791,6 +5262,76 @@ ByteSlice EngineMupdfLoadAttachment(EngineBase* engine, int attachmentNo) {
     return res;
 }
 
+// how often and for how long fitz lock requests had to wait for another thread
+TempStr EngineMupdfLockStatsTemp(EngineBase* engine) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    if (!epdf) {
+        return nullptr;
+    }
+    static const char* lockNames[FZ_LOCK_MAX] = {"alloc", "freetype", "glyphcache"};
+    str::Str s;
+    for (int i = 0; i < FZ_LOCK_MAX; i++) {
+        ScopedCritSec cs(&epdf->mutexes[i]);
+        auto& stats = epdf->lockStats[i];
+        s.AppendFmt("%s%s: %d waits, %.2f ms", i > 0 ? ", " : "", lockNames[i], stats.nWaits, stats.waitMs);
+    }
+    return str::DupTemp(s.Get());
+}
+
+TempStr EngineMupdfGlyphCacheStatsTemp(EngineBase* engine) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    if (!epdf) {
+        return nullptr;
+    }
+    fz_glyph_cache_stats stats;
+    {
+        ScopedCritSec cs(epdf->ctxAccess);
+        fz_get_glyph_cache_stats(epdf->Ctx(), &stats);
+    }
+    int nLookups = stats.hits + stats.front_hits + stats.misses;
+    double hitRate = nLookups > 0 ? 100.0 * (stats.hits + stats.front_hits) / nLookups : 0;
+    str::Str s;
+    s.AppendFmt("%d hits (%d front), %d misses (%.1f%% hit rate), %d evictions, %d glyphs, ",
+                stats.hits + stats.front_hits, stats.front_hits, stats.misses, hitRate, stats.evictions, stats.entries);
+    s.AppendFmt("%d KB (%d KB front) of %d KB", (int)((stats.size + stats.front_size) / 1024),
+                (int)(stats.front_size / 1024), (int)(stats.max_size / 1024));
+    return str::DupTemp(s.Get());
+}
+
+void EngineMupdfSetRenderBandThreads(EngineBase* engine, int nThreads) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    if (epdf) {
+        epdf->renderBandThreads = nThreads;
+    }
+}
+
+// for documents opened after this, 1 disables rendering in bands
+void EngineMupdfSetDefaultRenderBandThreads(int nThreads) {
+    gRenderBandThreads = std::max(nThreads, 0);
+}
+
+// content streams with at least minOps operators are cached as bytecode
+// in the fz_store (PDF_CONTENT_BYTECODE_MIN_OPS by default), 0 disables it
+void EngineMupdfSetContentBytecodeThreshold(EngineBase* engine, int minOps) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    if (!epdf || !epdf->pdfdoc) {
+        return;
+    }
+    ScopedCritSec scope(epdf->ctxAccess);
+    pdf_set_content_bytecode_threshold(epdf->Ctx(), epdf->pdfdoc, minOps);
+}
+
+// number of per-object decryption keys re-used from (hits) or added to (misses)
+// the derived key cache. returns false for unencrypted documents
+bool EngineMupdfGetCryptKeyCacheStats(EngineBase* engine, int* hits, int* misses) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    if (!epdf || !epdf->pdfdoc || !epdf->pdfdoc->crypt) {
+        return false;
+    }
+    pdf_crypt_key_cache_stats(epdf->Ctx(), epdf->pdfdoc->crypt, hits, misses);
+    return true;
+}
+
 // if an elements fully obscures another, remove it from the list
 static bool RemoveHeWhoFullyContains(Vec<Annotation*>& els) {
     int n = els.Size();
@@ -3910,6 +5451,8 @@ NO_INLINE void MarkNotificationAsModified(EngineMupdf* e, Annotation* annot, Ann
     auto ctx = e->Ctx();
     RebuildCommentsFromAnnotations(ctx, pageInfo);
     pageInfo->elementsNeedRebuilding = true;
+    // annotations are part of the extracted text
+    e->DropPageStext(pageInfo);
 }
 
 // creates Annotation wrapper around pdf_annot
@@ -31,11 +31,30 @@ struct FzPageInfo {
     bool elementsNeedRebuilding = true;
 
     RectF mediabox{};
+    // true if the page of a progressively loaded file hadn't been read yet
+    // when the document was opened, in which case mediabox is a guess
+    bool mediaboxPending = false;
     Vec<FitzPageImageInfo*> images;
 
+    // structured text (with images) of page contents used for linkification,
+    // finding images and text extraction. only valid while ctxAccess is held, see GetPageStext()
+    fz_stext_page* stext = nullptr;
+    // text of annotations and widgets, only used for text extraction (nullptr if none)
+    fz_stext_page* annotStext = nullptr;
+    // memory used by stext and annotStext, including images they hold on to
+    size_t stextSize = 0;
+
     // if false, only loaded page (fast)
     // if true, loaded expensive info (extracted text etc.)
+    // page, the element lists and fullyLoaded are published under pagesAccess
     bool fullyLoaded = false;
+    // set while the page is queued for (or being) fully loaded by the worker thread,
+    // see ScheduleFullPageLoad(). protected by EngineMupdf::fullLoadAccess
+    bool fullLoadScheduled = false;
+    // failed full loads in a row and when the last one failed, also protected
+    // by fullLoadAccess. the page isn't scheduled again until some time has passed
+    int fullLoadFailures = 0;
+    LARGE_INTEGER fullLoadFailedAt{};
 };
 
 class EngineMupdf : public EngineBase {
@@ -78,15 +97,44 @@ class EngineMupdf : public EngineBase {
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION* ctxAccess;
     CRITICAL_SECTION pagesAccess;
+    // protects fullLoadQueue, fullLoadWorkerRunning and FzPageInfo::fullLoad*.
+    // only held briefly and never while taking another lock
+    CRITICAL_SECTION fullLoadAccess;
+    // pages waiting to be fully loaded by a single worker thread
+    Vec<FzPageInfo*> fullLoadQueue;
+    bool fullLoadWorkerRunning = false;
 
     CRITICAL_SECTION mutexes[FZ_LOCK_MAX];
+    // contention of mutexes when taken by fitz, for diagnostics
+    struct LockStats {
+        int nWaits = 0;
+        double waitMs = 0;
+    };
+    LockStats lockStats[FZ_LOCK_MAX];
 
     fz_context* _ctx = nullptr;
     fz_locks_context fz_locks_ctx;
     int displayDPI{96};
+    // max number of threads rendering bands of a large page. 0 means number of cores,
+    // 1 disables band rendering
+    int renderBandThreads = 0;
+    // when a page was last rendered, see StoreBudgetTouch(). protected by gStoreBudgetCs
+    LARGE_INTEGER lastUsed{};
+    // fz_store limit decided by StoreBudgetRebalance() and the store's size when
+    // it was last applied. protected by gStoreBudgetCs
+    size_t storeLimit = FZ_STORE_DEFAULT;
+    size_t storeUsed = 0;
+    // limit set on _ctx, written with both ctxAccess and gStoreBudgetCs held
+    size_t appliedStoreLimit = FZ_STORE_DEFAULT;
+    // where the layout of a reflowable document is cached, nullptr if it isn't
+    char* layoutCachePath = nullptr;
+    bool layoutFromCache = false;
     fz_document* _doc = nullptr;
     pdf_document* pdfdoc = nullptr;
     Vec<FzPageInfo*> pages;
+    // pages with cached stext, least recently used first. protected by ctxAccess
+    Vec<FzPageInfo*> stextPages;
+    size_t stextCacheSize = 0;
     fz_outline* outline = nullptr;
     fz_outline* attachments = nullptr;
     pdf_obj* pdfInfo = nullptr;
@@ -109,6 +157,11 @@ class EngineMupdf : public EngineBase {
     FzPageInfo* GetFzPageInfoCanFail(int pageNo);
     FzPageInfo* GetFzPageInfoFast(int pageNo);
     FzPageInfo* GetFzPageInfo(int pageNo, bool loadQuick, fz_cookie* cookie = nullptr);
+    bool LoadPageQuick(FzPageInfo* pageInfo);
+    void LoadPageFull(FzPageInfo* pageInfo, fz_cookie* cookie);
+    void ScheduleFullPageLoad(FzPageInfo* pageInfo);
+    fz_stext_page* GetPageStext(FzPageInfo* pageInfo, fz_cookie* cookie = nullptr);
+    void DropPageStext(FzPageInfo* pageInfo);
     fz_matrix viewctm(int pageNo, float zoom, int rotation);
     fz_matrix viewctm(fz_page* page, float zoom, int rotation) const;
     TocItem* BuildTocTree(TocItem* parent, fz_outline* outline, int& idCounter, bool isAttachment);
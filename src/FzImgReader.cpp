@@ -252,8 +252,8 @@ Gdiplus::Bitmap* FzImageFromData(const ByteSlice& d) {
     return result;
 }
 
-Gdiplus::Bitmap* BitmapFromData(const ByteSlice& bmpData) {
-    auto res = BitmapFromDataWin(bmpData);
+Gdiplus::Bitmap* BitmapFromData(const ByteSlice& bmpData, Size targetSize) {
+    auto res = BitmapFromDataWin(bmpData, targetSize);
     if (res) {
         return res;
     }
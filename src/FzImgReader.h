@@ -10,5 +10,5 @@ void fz_drop_context_windows(fz_context* ctx);
 
 Gdiplus::Bitmap* FzImageFromData(const ByteSlice&);
 
-Gdiplus::Bitmap* BitmapFromData(const ByteSlice&);
+Gdiplus::Bitmap* BitmapFromData(const ByteSlice&, Size targetSize = {});
 RenderedBitmap* LoadRenderedBitmap(const char* path);
@@ -28,6 +28,9 @@
    due to insufficient (GDI) memory. */
 #define CONSERVE_MEMORY
 
+// how long to wait before re-requesting a page whose data hasn't been loaded yet
+constexpr DWORD kTryLaterDelayMs = 200;
+
 bool gShowTileLayout = false;
 
 RenderCache::RenderCache() : maxTileSize({GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN)}) {
@@ -525,6 +528,7 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
     newRequest->abort = false;
     newRequest->abortCookie = nullptr;
     newRequest->timestamp = GetTickCount();
+    newRequest->notBefore = 0;
     newRequest->renderCb = renderCb;
 
     SetEvent(startRendering);
@@ -548,8 +552,11 @@ int RenderCache::GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile)
     return RENDER_DELAY_UNDEFINED;
 }
 
-bool RenderCache::GetNextRequest(PageRenderRequest* req) {
+// if there are only requests that have to wait (see RequeueTryLater()),
+// returns false and sets waitMs to how long until the first one is due
+bool RenderCache::GetNextRequest(PageRenderRequest* req, DWORD* waitMs) {
     ScopedCritSec scope(&requestAccess);
+    *waitMs = 0;
 
     if (requestCount == 0) {
         return false;
@@ -557,8 +564,26 @@ bool RenderCache::GetNextRequest(PageRenderRequest* req) {
 
     ReportIf(requestCount < 0);
     ReportIf(requestCount > MAX_PAGE_REQUESTS);
+    // the most recent request is the last one
+    DWORD now = GetTickCount();
+    int idx = requestCount - 1;
+    for (; idx >= 0; idx--) {
+        DWORD notBefore = requests[idx].notBefore;
+        if (notBefore == 0 || (int)(notBefore - now) <= 0) {
+            break;
+        }
+        DWORD wait = notBefore - now;
+        if (*waitMs == 0 || wait < *waitMs) {
+            *waitMs = wait;
+        }
+    }
+    if (idx < 0) {
+        return false;
+    }
+    *req = requests[idx];
     requestCount--;
-    *req = requests[requestCount];
+    memmove(&(requests[idx]), &(requests[idx + 1]), sizeof(PageRenderRequest) * (requestCount - idx));
+    req->notBefore = 0;
     curReq = req;
     ReportIf(requestCount < 0);
     ReportIf(req->abort);
@@ -577,6 +602,33 @@ bool RenderCache::ClearCurrentRequest() {
     return isQueueEmpty;
 }
 
+// re-queues a request for a page whose data hasn't been loaded yet (RenderPageArgs::tryLater)
+// with the lowest priority and to be rendered no sooner than kTryLaterDelayMs from now.
+// other requests (e.g. of other tabs) are rendered in the meantime
+void RenderCache::RequeueTryLater(PageRenderRequest& req) {
+    ScopedCritSec scope(&requestAccess);
+    if (req.abort || requestCount == MAX_PAGE_REQUESTS) {
+        return;
+    }
+    for (int i = 0; i < requestCount; i++) {
+        PageRenderRequest* other = &(requests[i]);
+        if (other->dm == req.dm && other->pageNo == req.pageNo && other->tile == req.tile) {
+            // the page has been requested again in the meantime
+            return;
+        }
+    }
+    memmove(&(requests[1]), &(requests[0]), sizeof(PageRenderRequest) * requestCount);
+    requestCount++;
+    PageRenderRequest* newRequest = &(requests[0]);
+    *newRequest = req;
+    // owned by (and deleted with) the current request
+    newRequest->abortCookie = nullptr;
+    newRequest->notBefore = GetTickCount() + kTryLaterDelayMs;
+    if (newRequest->notBefore == 0) {
+        newRequest->notBefore = 1;
+    }
+}
+
 /* Wait until rendering of a page beloging to <dm> has finished. */
 /* TODO: this might take some time, would be good to show a dialog to let the
    user know he has to wait until we finish */
@@ -647,7 +699,12 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             }
         }
 
-        if (!cache->GetNextRequest(&req)) {
+        DWORD waitMs = 0;
+        if (!cache->GetNextRequest(&req, &waitMs)) {
+            if (waitMs > 0) {
+                // only requests waiting for their page's data are queued
+                WaitForSingleObject(cache->startRendering, waitMs);
+            }
             continue;
         }
 
@@ -664,14 +721,19 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
 
         // make sure that we have extracted page text for
         // all rendered pages to allow text selection and
-        // searching without any further delays
-        if (!req.dm->textCache->HasTextForPage(req.pageNo)) {
+        // searching without any further delays. the text of a page of
+        // a progressively loaded document might not have arrived yet
+        // so it's only extracted once the page could be rendered
+        EngineBase* engine = req.dm->GetEngine();
+        bool extractTextLater = EngineMupdfIsLoadingProgressively(engine);
+        if (!extractTextLater && !req.dm->textCache->HasTextForPage(req.pageNo)) {
             req.dm->textCache->GetTextForPage(req.pageNo);
         }
 
         ReportIf(req.abortCookie != nullptr);
-        EngineBase* engine = req.dm->GetEngine();
         RenderPageArgs args(req.pageNo, req.zoom, req.rotation, &req.pageRect, RenderTarget::View, &req.abortCookie);
+        // only thumbnails are requested with a callback
+        args.isThumbnail = req.renderCb != nullptr;
         auto timeStart = TimeGet();
         bmp = engine->RenderPage(args);
         if (req.abort) {
@@ -681,6 +743,18 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             }
             continue;
         }
+        if (args.tryLater && !req.renderCb) {
+            // the page's data hasn't been loaded yet. don't cache the (partial)
+            // result and try again a bit later
+            delete bmp;
+            cache->RequeueTryLater(req);
+            ResetTempAllocator();
+            continue;
+        }
+
+        if (extractTextLater && !req.dm->textCache->HasTextForPage(req.pageNo)) {
+            req.dm->textCache->GetTextForPage(req.pageNo);
+        }
         auto durMs = TimeSinceInMs(timeStart);
         if (durMs > 100) {
             auto path = engine->FilePath();
@@ -79,6 +79,8 @@ struct PageRenderRequest {
     bool abort = false;
     AbortCookie* abortCookie = nullptr;
     DWORD timestamp = 0;
+    // if not 0, the request isn't rendered before GetTickCount() reaches it (see RequeueTryLater())
+    DWORD notBefore = 0;
     // owned by the PageRenderRequest (use it before reusing the request)
     // on rendering success, the callback gets handed the RenderedBitmap
     const OnBitmapRendered* renderCb = nullptr;
@@ -125,7 +127,8 @@ struct RenderCache {
     int Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageInfo* pageInfo, bool* renderOutOfDateCue);
 
     bool ClearCurrentRequest();
-    bool GetNextRequest(PageRenderRequest* req);
+    bool GetNextRequest(PageRenderRequest* req, DWORD* waitMs);
+    void RequeueTryLater(PageRenderRequest& req);
     void Add(PageRenderRequest& req, RenderedBitmap* bmp);
 
     USHORT GetTileRes(DisplayModel* dm, int pageNo) const;
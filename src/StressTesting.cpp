@@ -158,6 +158,11 @@ static void BenchFile(const char* path, const char* pagesSpec) {
         }
     }
 
+    int keyHits, keyMisses;
+    if (EngineMupdfGetCryptKeyCacheStats(engine, &keyHits, &keyMisses)) {
+        logf("crypt keys: %d derived, %d derivations saved by cache\n", keyMisses, keyHits);
+    }
+
     SafeEngineRelease(&engine);
 
     logf("Finished (in %.2f ms): %s\n", TimeSinceInMs(total), path);
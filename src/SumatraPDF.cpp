@@ -456,7 +456,8 @@ class HwndPasswordUI : public PasswordUI {
    dialog box or if the encryption key has been filled in instead.
    Caller needs to free() the result. */
 char* HwndPasswordUI::GetPassword(const char* path, u8* fileDigest, u8 decryptionKeyOut[32], bool* saveKey) {
-    FileState* fileFromHistory = gFileHistory.FindByName(path, nullptr);
+    // fileDigest is nullptr if the file's data couldn't be read in full
+    FileState* fileFromHistory = fileDigest ? gFileHistory.FindByName(path, nullptr) : nullptr;
     if (fileFromHistory && fileFromHistory->decryptionKey) {
         AutoFreeStr fingerprint = str::MemToHex(fileDigest, 16);
         *saveKey = str::StartsWith(fileFromHistory->decryptionKey, fingerprint.Get());
@@ -1849,11 +1850,13 @@ MainWindow* LoadDocumentFinish(LoadArgs* args) {
     return win;
 }
 
-static NotificationWnd* ShowLoadingNotif(MainWindow* win, const char* path) {
+static NotificationWnd* ShowLoadingNotif(MainWindow* win, const char* path,
+                                         const NotificationWndRemoved& onRemoved = {}) {
     NotificationCreateArgs nargs;
     nargs.hwndParent = win->hwndCanvas;
     nargs.groupId = path;
     nargs.msg = str::FormatTemp(_TRA("Loading %s ..."), path);
+    nargs.onRemoved = onRemoved;
     return ShowNotification(nargs);
 }
 
@@ -1914,6 +1917,14 @@ static void LoadDocumentAsyncFinish(LoadDocumentAsyncData* d) {
     LoadDocumentFinish(args);
 }
 
+// closing the notification stops waiting for a file that is
+// loaded progressively from a slow (e.g. network) drive
+static void CancelLoadDocumentAsync(LoadDocumentAsyncData* d, NotificationWnd* wnd) {
+    EngineMupdfCancelOpening(d->args->FilePath());
+    RemoveNotification(wnd);
+    d->wndNotif = nullptr;
+}
+
 static void LoadDocumentAsync(LoadDocumentAsyncData* d) {
     auto args = d->args;
     gDangerousThreadCount.Inc();
@@ -1959,7 +1970,6 @@ void StartLoadDocument(LoadArgs* argsIn) {
         return;
     }
 
-    auto wndNotif = ShowLoadingNotif(win, path);
     LoadArgs* args = argsIn->Clone();
 
     // when using mshtml to display CHM files, we can't load in a thread
@@ -1972,6 +1982,7 @@ void StartLoadDocument(LoadArgs* argsIn) {
         if (isChm) {
             // TODO: repeating the code below
             DocController* ctrl = nullptr;
+            auto wndNotif = ShowLoadingNotif(win, path);
             HwndPasswordUI pwdUI(win->hwndFrame ? win->hwndFrame : nullptr);
             EngineBase* engine = args->engine;
             args->ctrl = CreateControllerForEngineOrFile(engine, path, &pwdUI, win);
@@ -1989,8 +2000,8 @@ void StartLoadDocument(LoadArgs* argsIn) {
     }
 
     auto data = new LoadDocumentAsyncData;
-    data->wndNotif = wndNotif;
     data->args = args;
+    data->wndNotif = ShowLoadingNotif(win, path, MkFunc1(CancelLoadDocumentAsync, data));
     auto fn = MkFunc0<LoadDocumentAsyncData>(LoadDocumentAsync, data);
     RunAsync(fn, "LoadDocumentThread");
 }
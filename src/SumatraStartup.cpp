@@ -1147,6 +1147,9 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
 
     LoadSettings();
     UpdateGlobalPrefs(flags);
+    EngineMupdfSetLayoutCacheDir(path::JoinTemp(GetThumbnailCacheDirTemp(), "layout"));
+    EngineCbxSetCacheDir(path::JoinTemp(GetThumbnailCacheDirTemp(), "comics"));
+    EngineMupdfSetDefaultRenderBandThreads(gGlobalPrefs->renderBandThreads);
     SetCurrentLang(flags.lang ? flags.lang : gGlobalPrefs->uiLanguage);
 
     if (flags.showConsole) {
@@ -5,6 +5,13 @@
    executable and related makefile additions for each test, we have one test
    driver which dispatches desired test based on cmd-line arguments. */
 
+#pragma warning(disable : 4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+
+extern "C" {
+#include <mupdf/fitz.h>
+#include <mupdf/pdf.h>
+}
+
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/CmdLineArgsIter.h"
@@ -16,6 +23,7 @@
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPrettyPrint.h"
 #include "mui/Mui.h"
+#include "utils/ThreadUtil.h"
 #include "utils/Timer.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
@@ -26,11 +34,13 @@
 #include "DocProperties.h"
 #include "DocController.h"
 #include "EngineBase.h"
+#include "EngineAll.h"
 #include "EbookBase.h"
 #include "PalmDbReader.h"
 #include "MobiDoc.h"
 #include "HtmlFormatter.h"
 #include "EbookFormatter.h"
+#include "FzImgReader.h"
 
 // if true, we'll save html content of a mobi ebook as well
 // as pretty-printed html to kMobiSaveDir. The name will be
@@ -53,6 +63,23 @@ static int Usage() {
     printf("  -save-images - will save images extracted from mobi files\n");
     printf("  -zip-create - creates a sample zip file that needs to be manually checked that it worked\n");
     printf("  -bench-md5 - compare Window's md5 vs. our code\n");
+    printf("  -fingerprint file - check that streamed fingerprint matches md5 of file data\n");
+    printf("  -bench-bands file - render page 1 at 400%% with 1..N band rendering threads\n");
+    printf("  -bench-store file - render pages concurrently and report fitz lock contention\n");
+    printf("  -bench-open file - time opening an ebook with and without a cached layout\n");
+    printf("  -stress-hittest file - hit-test pages while another thread loads and renders them\n");
+    printf("  -bench-ops file - re-render page 1 at different zoom levels with and without the bytecode cache\n");
+    printf("  -bench-progressive file kbps - time to first and last page of a linearized PDF read at kbps\n");
+    printf("  -bench-shared-images file n - open and render a document n times with and without sharing images\n");
+    printf("  -bench-pan file - render parts of page 1 at 400%% while panning across it, then re-zoom\n");
+    printf("  -bench-tile file - render a 1/16 tile from the top, middle and bottom of page 1\n");
+    printf("  -bench-concurrent file - render pages with 1..N threads sharing one engine\n");
+    printf("  -bench-djvu-tiles file - render page 1 as 4 tiles at 3 zoom levels with and without caching decoded pages\n");
+    printf("  -bench-text file - time opening a document and extracting the text of all pages (as a first search does)\n");
+    printf("  -bench-jbig2 dirOrFile - decode all JBIG2 images of PDF documents and report MB/s by template\n");
+    printf("  -bench-image-decode dirOrFile - decode and draw images at 1/2, 1/4 and 1/8 of their size\n");
+    printf("  -bench-comic file - page by page reading of a comic book, with and without prefetching\n");
+    printf("  -bench-cbx-open file - time opening a comic book and getting all page sizes, with and without a cache\n");
     system("pause");
     return 1;
 }
@@ -191,6 +218,696 @@ void ZipCreateTest() {
     }
 }
 
+// the fingerprint is saved with decryptionKey in history so it must
+// not change when we change how it's calculated
+static void FingerprintTest(const char* path) {
+    auto t = TimeGet();
+    u8 streamed[16]{};
+    bool ok = EngineMupdfFileFingerprint(path, streamed);
+    double streamedMs = TimeSinceInMs(t);
+    if (!ok) {
+        printf("failed to read '%s'\n", path);
+        return;
+    }
+
+    t = TimeGet();
+    ByteSlice d = file::ReadFile(path);
+    u8 expected[16]{};
+    CalcMD5Digest(d.data(), (int)d.size(), expected);
+    double readAllMs = TimeSinceInMs(t);
+    d.Free();
+
+    AutoFreeStr s1 = _MemToHex(&streamed);
+    AutoFreeStr s2 = _MemToHex(&expected);
+    bool same = memeq(streamed, expected, sizeof(expected));
+    printf("%s: %s (%.2f ms streamed, %.2f ms read whole file) %s\n", same ? "ok" : "MISMATCH", s1.Get(), streamedMs,
+           readAllMs, path);
+    if (!same) {
+        printf("  expected: %s\n", s2.Get());
+    }
+}
+
+// opens the document, runs bench with it and releases it.
+// returns false if the document couldn't be opened
+template <typename Fn>
+static bool BenchWithEngine(const char* path, const Fn& bench) {
+    EngineBase* engine = CreateEngineFromFile(path, nullptr, false);
+    if (!engine) {
+        printf("failed to open '%s'\n", path);
+        return false;
+    }
+    bench(engine);
+    SafeEngineRelease(&engine);
+    return true;
+}
+
+// renders (and discards) a page, returns how long that took in ms
+static double TimeRenderPage(EngineBase* engine, int pageNo, float zoom, RectF* pageRect = nullptr) {
+    RenderPageArgs args(pageNo, zoom, 0, pageRect);
+    auto t = TimeGet();
+    RenderedBitmap* bmp = engine->RenderPage(args);
+    double ms = TimeSinceInMs(t);
+    delete bmp;
+    return ms;
+}
+
+// renders a (preferably large format) page at 400% zoom with increasing
+// number of band rendering threads
+static void BenchRenderBands(const char* path) {
+    BenchWithEngine(path, [path](EngineBase* engine) {
+        int maxThreads = GetCpuCount();
+        for (int nThreads = 1; nThreads <= maxThreads; nThreads++) {
+            EngineMupdfSetRenderBandThreads(engine, nThreads);
+            RenderPageArgs args(1, 4.f, 0);
+            auto t = TimeGet();
+            RenderedBitmap* bmp = engine->RenderPage(args);
+            double ms = TimeSinceInMs(t);
+            if (!bmp) {
+                printf("failed to render page 1 of '%s'\n", path);
+                break;
+            }
+            Size size = bmp->GetSize();
+            printf("threads: %2d, %dx%d: %.2f ms\n", nThreads, size.dx, size.dy, ms);
+            delete bmp;
+        }
+    });
+}
+
+struct ConcurrentRenderData {
+    EngineBase* engine = nullptr;
+    int nPages = 0;
+    float zoom = 1.f;
+    AtomicInt nextPage;
+};
+
+static void RenderNextPages(ConcurrentRenderData* d) {
+    for (;;) {
+        int pageNo = d->nextPage.Inc();
+        if (pageNo > d->nPages) {
+            break;
+        }
+        TimeRenderPage(d->engine, pageNo, d->zoom);
+    }
+}
+
+// renders all pages with nThreads threads sharing d->engine, returns how long that took in ms
+static double RenderPagesConcurrently(ConcurrentRenderData* d, int nThreads) {
+    d->nextPage.Set(0);
+    Vec<HANDLE> threads;
+    auto t = TimeGet();
+    for (int i = 0; i < nThreads; i++) {
+        HANDLE thread = StartThread(MkFunc0<ConcurrentRenderData>(RenderNextPages, d), "RenderNextPages");
+        if (thread) {
+            threads.Append(thread);
+        }
+    }
+    for (HANDLE thread : threads) {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+    return TimeSinceInMs(t);
+}
+
+// renders up to 50 pages at 300% on one thread per core, which share the engine's
+// fz_store, glyph cache etc. and reports how long those threads waited for fitz locks
+static void BenchStoreContention(const char* path) {
+    BenchWithEngine(path, [](EngineBase* engine) {
+        ConcurrentRenderData data;
+        data.engine = engine;
+        data.nPages = std::min(engine->PageCount(), 50);
+        data.zoom = 3.f;
+        int nThreads = GetCpuCount();
+        double ms = RenderPagesConcurrently(&data, nThreads);
+        printf("rendered %d pages with %d threads in %.2f ms\n", data.nPages, nThreads, ms);
+        TempStr stats = EngineMupdfLockStatsTemp(engine);
+        printf("lock waits: %s\n", stats ? stats : "n/a");
+        stats = EngineMupdfGlyphCacheStatsTemp(engine);
+        printf("glyph cache: %s\n", stats ? stats : "n/a");
+        stats = EngineMupdfStoreStatsTemp(engine);
+        printf("store: %s\n", stats ? stats : "n/a");
+    });
+}
+
+// renders page 1 at 4 zoom levels, which re-interprets its content stream each time.
+// for operator-dense (e.g. CAD) pages most of the time is spent parsing the content
+// stream unless its bytecode is cached
+static void BenchContentBytecode(const char* path) {
+    float zooms[] = {1.f, 1.5f, 2.f, 0.5f};
+    for (int minOps : {0, 1}) {
+        bool ok = BenchWithEngine(path, [&](EngineBase* engine) {
+            EngineMupdfSetContentBytecodeThreshold(engine, minOps);
+            printf("%s:\n", minOps ? "bytecode cache" : "no bytecode cache");
+            for (float zoom : zooms) {
+                printf("  zoom %.0f%%: %.2f ms\n", zoom * 100, TimeRenderPage(engine, 1, zoom));
+            }
+        });
+        if (!ok) {
+            return;
+        }
+    }
+}
+
+// opens the same document n times (like n tabs of similar documents) and renders
+// its first pages in each, without and with sharing decoded images between them
+static void BenchSharedImages(const char* path, int nDocs) {
+    for (size_t cacheSize : {(size_t)0, (size_t)256 * 1024 * 1024}) {
+        EngineMupdfSetSharedImageCacheSize(cacheSize);
+        printf("%s:\n", cacheSize ? "shared images" : "no shared images");
+        Vec<EngineBase*> engines;
+        for (int i = 0; i < nDocs; i++) {
+            auto t = TimeGet();
+            EngineBase* engine = CreateEngineFromFile(path, nullptr, false);
+            if (!engine) {
+                printf("failed to open '%s'\n", path);
+                break;
+            }
+            int nPages = std::min(engine->PageCount(), 5);
+            for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+                TimeRenderPage(engine, pageNo, 1.f);
+            }
+            printf("  document %d: %.2f ms\n", i + 1, TimeSinceInMs(t));
+            engines.Append(engine);
+        }
+        printf("  %s\n", EngineMupdfSharedImageCacheStatsTemp());
+        for (EngineBase* engine : engines) {
+            SafeEngineRelease(&engine);
+        }
+    }
+    EngineMupdfSetSharedImageCacheSize(64 * 1024 * 1024);
+}
+
+// renders a part of page 1 at 400% while panning across it the way tiles are
+// rendered when scrolling through a zoomed in scan, then zooms in and out at the
+// last position. images which only partially overlap the rendered area are decoded
+// in blocks which are re-used between views at the same subsampling level
+static void BenchPanZoomed(const char* path) {
+    BenchWithEngine(path, [](EngineBase* engine) {
+        RectF mediabox = engine->PageMediabox(1);
+        constexpr int kPanSteps = 8;
+        float zooms[] = {4.f, 4.5f, 3.5f, 4.f};
+        double totalMs = 0;
+        for (int view = 0; view < kPanSteps + (int)dimof(zooms); view++) {
+            int step = std::min(view, kPanSteps - 1);
+            float zoom = view < kPanSteps ? 4.f : zooms[view - kPanSteps];
+            RectF rect(mediabox.x + mediabox.dx * step / 16, mediabox.y + mediabox.dy * step / 32,
+                       mediabox.dx / 4, mediabox.dy / 6);
+            double ms = TimeRenderPage(engine, 1, zoom, &rect);
+            totalMs += ms;
+            printf("view %d (step %d, %d%%): %.2f ms\n", view, step, (int)(zoom * 100), ms);
+        }
+        printf("total: %.2f ms\n", totalMs);
+    });
+}
+
+// renders a single tile (a quarter of the width and height of page 1) at 100%
+// from the top, the middle and the bottom of the page. every tile is rendered
+// by a freshly opened engine, so that JPEG images have to be decoded again but
+// only the blocks covering the tile are
+static void BenchRenderTile(const char* path) {
+    const char* names[] = {"top", "middle", "bottom", "page"};
+    // offset of the tile in eighths of the page
+    int offsets[] = {0, 3, 6};
+    for (int pos = 0; pos < 4; pos++) {
+        bool ok = BenchWithEngine(path, [&](EngineBase* engine) {
+            RectF rect = engine->PageMediabox(1);
+            if (pos < 3) {
+                rect.x += rect.dx * offsets[pos] / 8;
+                rect.y += rect.dy * offsets[pos] / 8;
+                rect.dx /= 4;
+                rect.dy /= 4;
+            }
+            printf("%s: %.2f ms\n", names[pos], TimeRenderPage(engine, 1, 1.f, &rect));
+        });
+        if (!ok) {
+            return;
+        }
+    }
+}
+
+static double TimeOpenFile(const char* path) {
+    auto t = TimeGet();
+    EngineBase* engine = CreateEngineFromFile(path, nullptr, false);
+    double ms = TimeSinceInMs(t);
+    if (!engine) {
+        return -1;
+    }
+    SafeEngineRelease(&engine);
+    return ms;
+}
+
+// opens a reflowable document without a layout cache, then with an empty one
+// (which saves the layout) and then again (which loads it)
+static void BenchOpenWithLayoutCache(const char* path) {
+    TempStr cacheDir = path::GetTempFilePathTemp("accel");
+    if (!cacheDir) {
+        return;
+    }
+    file::Delete(cacheDir);
+    EngineMupdfSetLayoutCacheDir(nullptr);
+    printf("no cache: %.2f ms\n", TimeOpenFile(path));
+    EngineMupdfSetLayoutCacheDir(cacheDir);
+    printf("saving layout: %.2f ms\n", TimeOpenFile(path));
+    printf("cached layout: %.2f ms\n", TimeOpenFile(path));
+    EngineMupdfSetLayoutCacheDir(nullptr);
+    dir::RemoveAll(cacheDir);
+}
+
+struct HitTestStressData {
+    EngineBase* engine = nullptr;
+    AtomicInt done;
+};
+
+static void RenderAllPages(HitTestStressData* d) {
+    int nPages = d->engine->PageCount();
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        TimeRenderPage(d->engine, pageNo, 1.f);
+    }
+    d->done.Set(1);
+}
+
+// the ui thread hit-tests pages (as when moving the mouse) while they're being
+// loaded by the render thread. hit-testing must never wait for a page to load
+static void StressHitTest(const char* path) {
+    BenchWithEngine(path, [](EngineBase* engine) {
+        HitTestStressData data;
+        data.engine = engine;
+        int nPages = engine->PageCount();
+        HANDLE thread = StartThread(MkFunc0<HitTestStressData>(RenderAllPages, &data), "RenderAllPages");
+        if (!thread) {
+            return;
+        }
+
+        int nCalls = 0;
+        int nHits = 0;
+        double maxMs = 0;
+        auto total = TimeGet();
+        while (data.done.Get() == 0) {
+            int pageNo = 1 + (nCalls % nPages);
+            RectF mbox = engine->PageMediabox(pageNo);
+            float x = mbox.x + (float)((nCalls * 37) % 100) * mbox.dx / 100;
+            float y = mbox.y + (float)((nCalls * 59) % 100) * mbox.dy / 100;
+            PointF pt(x, y);
+            auto t = TimeGet();
+            IPageElement* el = engine->GetElementAtPos(pageNo, pt);
+            maxMs = std::max(maxMs, TimeSinceInMs(t));
+            if (el) {
+                nHits++;
+            }
+            nCalls++;
+        }
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+        printf("%d pages rendered in %.2f ms\n", nPages, TimeSinceInMs(total));
+        printf("%d hit-tests (%d found an element), slowest: %.2f ms\n", nCalls, nHits, maxMs);
+    });
+}
+
+// renders page 1 as 4 tiles at 3 zoom levels, which decodes the page 12 times
+// unless decoded pages are cached
+static void BenchDjVuTiles(const char* path) {
+    float zooms[] = {1.f, 2.f, 0.5f};
+    for (size_t cacheSize : {(size_t)0, (size_t)96 * 1024 * 1024}) {
+        EngineDjVuSetPageCacheSize(cacheSize);
+        bool ok = BenchWithEngine(path, [&](EngineBase* engine) {
+            RectF mediabox = engine->PageMediabox(1);
+            double ms = 0;
+            for (float zoom : zooms) {
+                for (int tile = 0; tile < 4; tile++) {
+                    RectF rect(mediabox.x + (tile % 2) * mediabox.dx / 2, mediabox.y + (tile / 2) * mediabox.dy / 2,
+                               mediabox.dx / 2, mediabox.dy / 2);
+                    ms += TimeRenderPage(engine, 1, zoom, &rect);
+                }
+            }
+            printf("%s: %.2f ms\n", cacheSize ? "page cache" : "no page cache", ms);
+        });
+        if (!ok) {
+            break;
+        }
+    }
+}
+
+// opening a document reads all mediaboxes and the first search extracts
+// the text of every page, both of which are slow for large scanned books
+static void BenchOpenAndExtractText(const char* path) {
+    auto t = TimeGet();
+    BenchWithEngine(path, [&t](EngineBase* engine) {
+        printf("open: %.2f ms\n", TimeSinceInMs(t));
+        int nPages = engine->PageCount();
+        int nChars = 0;
+        t = TimeGet();
+        for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+            PageText pageText = engine->ExtractPageText(pageNo);
+            nChars += pageText.len;
+            FreePageText(&pageText);
+        }
+        printf("text of %d pages (%d chars): %.2f ms\n", nPages, nChars, TimeSinceInMs(t));
+    });
+}
+
+static u32 Jbig2ReadU32(const u8* d) {
+    return ((u32)d[0] << 24) | ((u32)d[1] << 16) | ((u32)d[2] << 8) | d[3];
+}
+
+// classifies an embedded JBIG2 stream by its first generic region segment:
+// 0 to 3 for the arithmetic coding templates, 4 for MMR and 5 if there's no
+// generic region (i.e. for symbol dictionaries, text and halftone regions)
+static int Jbig2StreamKind(const u8* d, size_t len) {
+    size_t off = 0;
+    while (off + 11 <= len) {
+        u32 segNo = Jbig2ReadU32(d + off);
+        u8 flags = d[off + 4];
+        size_t pos = off + 5;
+        size_t nRefs = d[pos] >> 5;
+        if (nRefs == 7) {
+            if (pos + 4 > len) {
+                break;
+            }
+            nRefs = Jbig2ReadU32(d + pos) & 0x1fffffff;
+            pos += 4 + (nRefs + 8) / 8;
+        } else {
+            pos += 1;
+        }
+        if (nRefs > len) {
+            break;
+        }
+        pos += nRefs * (segNo <= 256 ? 1 : segNo <= 65536 ? 2 : 4);
+        pos += (flags & 0x40) ? 4 : 1;
+        if (pos + 4 > len) {
+            break;
+        }
+        u32 dataLen = Jbig2ReadU32(d + pos);
+        pos += 4;
+        int type = flags & 0x3f;
+        if (type == 36 || type == 38 || type == 39) {
+            // the generic region flags follow the 17 bytes of region segment info
+            if (pos + 18 > len) {
+                break;
+            }
+            u8 regionFlags = d[pos + 17];
+            return (regionFlags & 1) ? 4 : (regionFlags >> 1) & 3;
+        }
+        if (dataLen > len - pos) {
+            break;
+        }
+        off = pos + dataLen;
+    }
+    return 5;
+}
+
+// decodes all JBIG2 images of a PDF document and reports the decoding speed
+// (in MB of decoded bitmaps per second) by generic region template
+static void BenchJbig2File(const char* path) {
+    static const char* kindNames[] = {"template 0", "template 1", "template 2", "template 3", "mmr", "other"};
+    int nImages[dimof(kindNames)] = {};
+    double bytes[dimof(kindNames)] = {};
+    double ms[dimof(kindNames)] = {};
+
+    fz_context* ctx = fz_new_context_windows();
+    if (!ctx) {
+        return;
+    }
+    pdf_document* doc = nullptr;
+    fz_var(doc);
+    fz_try(ctx) {
+        doc = pdf_open_document(ctx, path);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+    }
+    if (!doc) {
+        printf("failed to open '%s'\n", path);
+        fz_drop_context_windows(ctx);
+        return;
+    }
+
+    int nObjects = pdf_count_objects(ctx, doc);
+    for (int num = 1; num < nObjects; num++) {
+        pdf_obj* obj = nullptr;
+        fz_buffer* data = nullptr;
+        fz_image* image = nullptr;
+        fz_pixmap* pix = nullptr;
+        fz_var(obj);
+        fz_var(data);
+        fz_var(image);
+        fz_var(pix);
+        fz_try(ctx) {
+            obj = pdf_load_object(ctx, doc, num);
+            pdf_obj* filter = pdf_dict_get(ctx, obj, PDF_NAME(Filter));
+            if (pdf_is_array(ctx, filter) && pdf_array_len(ctx, filter) == 1) {
+                filter = pdf_array_get(ctx, filter, 0);
+            }
+            if (pdf_is_stream(ctx, obj) && filter == PDF_NAME(JBIG2Decode)) {
+                data = pdf_load_raw_stream_number(ctx, doc, num);
+                u8* d = nullptr;
+                size_t len = fz_buffer_storage(ctx, data, &d);
+                int kind = Jbig2StreamKind(d, len);
+
+                image = pdf_load_image(ctx, doc, obj);
+                auto t = TimeGet();
+                pix = fz_get_pixmap_from_image(ctx, image, nullptr, nullptr, nullptr, nullptr);
+                ms[kind] += TimeSinceInMs(t);
+                bytes[kind] += (double)image->w * image->h / 8;
+                nImages[kind]++;
+            }
+        }
+        fz_always(ctx) {
+            fz_drop_pixmap(ctx, pix);
+            fz_drop_image(ctx, image);
+            fz_drop_buffer(ctx, data);
+            pdf_drop_obj(ctx, obj);
+        }
+        fz_catch(ctx) {
+            fz_report_error(ctx);
+        }
+    }
+    pdf_drop_document(ctx, doc);
+    fz_drop_context_windows(ctx);
+
+    printf("%s:\n", path);
+    bool found = false;
+    for (size_t i = 0; i < dimof(kindNames); i++) {
+        if (nImages[i] == 0) {
+            continue;
+        }
+        double mbPerSec = ms[i] > 0 ? bytes[i] / (1024 * 1024) / (ms[i] / 1000) : 0;
+        printf("%s: %d images, %.2f ms, %.2f MB/s\n", kindNames[i], nImages[i], ms[i], mbPerSec);
+        found = true;
+    }
+    if (!found) {
+        printf("no JBIG2 images\n");
+    }
+}
+
+// decodes the JBIG2 images of a PDF document or of all PDF documents in
+// a directory (such as scans from a document management system)
+static void BenchJbig2(const char* dirOrFile) {
+    if (!path::IsDirectory(dirOrFile)) {
+        BenchJbig2File(dirOrFile);
+        return;
+    }
+    DirIter di{dirOrFile};
+    di.recurse = true;
+    for (DirIterEntry* de : di) {
+        const char* path = de->filePath;
+        if (GuessFileTypeFromName(path) == kindFilePDF) {
+            BenchJbig2File(path);
+        }
+    }
+}
+
+// time to decode an image and draw it at 1/2^n of its size, either from
+// the full image or from one decoded at (or near) the target size
+static void BenchImageDecodeFile(const char* path) {
+    ByteSlice data = file::ReadFile(path);
+    if (!data) {
+        printf("failed to read '%s'\n", path);
+        return;
+    }
+    Size size = BitmapSizeFromData(data);
+    printf("%s (%d x %d):\n", path, size.dx, size.dy);
+    for (int reduce = 1; reduce <= 3 && !size.IsEmpty(); reduce++) {
+        int round = (1 << reduce) - 1;
+        Size target((size.dx + round) >> reduce, (size.dy + round) >> reduce);
+        double ms[2] = {};
+        for (int i = 0; i < 2; i++) {
+            auto t = TimeGet();
+            Gdiplus::Bitmap* bmp = BitmapFromData(data, i == 0 ? Size() : target);
+            if (!bmp) {
+                printf("  failed to decode\n");
+                data.Free();
+                return;
+            }
+            Gdiplus::Bitmap dst(target.dx, target.dy, PixelFormat32bppARGB);
+            Gdiplus::Graphics g(&dst);
+            g.SetInterpolationMode(Gdiplus::InterpolationModeHighQualityBicubic);
+            g.DrawImage(bmp, Gdiplus::Rect(0, 0, target.dx, target.dy), 0, 0, (int)bmp->GetWidth(),
+                        (int)bmp->GetHeight(), Gdiplus::UnitPixel);
+            ms[i] = TimeSinceInMs(t);
+            delete bmp;
+        }
+        printf("  1/%d: full decode %.2f ms, reduced decode %.2f ms\n", 1 << reduce, ms[0], ms[1]);
+    }
+    data.Free();
+}
+
+static void BenchImageDecode(const char* dirOrFile) {
+    if (!path::IsDirectory(dirOrFile)) {
+        BenchImageDecodeFile(dirOrFile);
+        return;
+    }
+    DirIter di{dirOrFile};
+    for (DirIterEntry* de : di) {
+        const char* path = de->filePath;
+        if (IsEngineImageSupportedFileType(GuessFileTypeFromName(path))) {
+            BenchImageDecodeFile(path);
+        }
+    }
+}
+
+// renders the pages of a comic book (or image directory) in order, with a
+// pause between pages as when reading; time spent waiting for a page is
+// what prefetching (and the parallel decoding of AVIF pages) saves.
+// Compare a comic with AVIF pages to the same one with JPEG pages.
+static void BenchComic(const char* path) {
+    for (int nPrefetch : {0, 2}) {
+        EngineImagesSetDecodeThreads(0, nPrefetch);
+        bool ok = BenchWithEngine(path, [nPrefetch](EngineBase* engine) {
+            int nPages = std::min(engine->PageCount(), 50);
+            double totalMs = 0, maxMs = 0;
+            for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+                double ms = TimeRenderPage(engine, pageNo, 1.f);
+                totalMs += ms;
+                maxMs = std::max(maxMs, ms);
+                Sleep(200);
+            }
+            printf("prefetch %d pages: %d pages in %.2f ms (slowest: %.2f ms)\n", nPrefetch, nPages, totalMs,
+                   maxMs);
+        });
+        if (!ok) {
+            break;
+        }
+    }
+    EngineImagesSetDecodeThreads(0, 2);
+}
+
+// opens a comic book and gets the size of every page (as the layout does)
+static double TimeOpenComic(const char* path) {
+    auto t = TimeGet();
+    EngineBase* engine = CreateEngineFromFile(path, nullptr, false);
+    if (!engine) {
+        return -1;
+    }
+    for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+        engine->PageMediabox(pageNo);
+    }
+    double ms = TimeSinceInMs(t);
+    SafeEngineRelease(&engine);
+    return ms;
+}
+
+// opens a comic book without a cache, then with an empty one (which probes
+// all pages in parallel and saves them) and then again (which loads them)
+static void BenchOpenComicWithCache(const char* path) {
+    TempStr cacheDir = path::GetTempFilePathTemp("cbx");
+    if (!cacheDir) {
+        return;
+    }
+    file::Delete(cacheDir);
+    EngineCbxSetCacheDir(nullptr);
+    printf("no cache: %.2f ms\n", TimeOpenComic(path));
+    EngineCbxSetCacheDir(cacheDir);
+    printf("saving cache: %.2f ms\n", TimeOpenComic(path));
+    printf("cached: %.2f ms\n", TimeOpenComic(path));
+    EngineCbxSetCacheDir(nullptr);
+    dir::RemoveAll(cacheDir);
+}
+
+// renders up to 32 pages with an increasing number of threads which share
+// a single engine (e.g. DjVu pages are decoded concurrently)
+static void BenchRenderConcurrently(const char* path) {
+    BenchWithEngine(path, [](EngineBase* engine) {
+        ConcurrentRenderData data;
+        data.engine = engine;
+        data.nPages = std::min(data.engine->PageCount(), 32);
+        int maxThreads = GetCpuCount();
+        for (int nThreads = 1; nThreads <= maxThreads; nThreads++) {
+            double ms = RenderPagesConcurrently(&data, nThreads);
+            printf("threads: %2d, %d pages: %.2f ms\n", nThreads, data.nPages, ms);
+        }
+    });
+}
+
+// renders a page of a progressively loaded file, re-trying until its data has arrived
+static bool RenderPageWhenLoaded(EngineBase* engine, int pageNo) {
+    for (;;) {
+        // with a cookie, pages missing some resources are reported as incomplete
+        AbortCookie* cookie = nullptr;
+        RenderPageArgs args(pageNo, 1.f, 0, nullptr, RenderTarget::View, &cookie);
+        RenderedBitmap* bmp = engine->RenderPage(args);
+        bool ok = bmp != nullptr;
+        delete bmp;
+        delete cookie;
+        if (!args.tryLater) {
+            return ok;
+        }
+        Sleep(50);
+    }
+}
+
+// opens a linearized PDF as if it was read from a drive delivering kbps KB/s
+// and reports how soon the first and the last page could be shown
+static void BenchProgressiveLoad(const char* path, int kbps) {
+    EngineMupdfSetProgressiveLoadKbps(kbps);
+    auto t = TimeGet();
+    EngineBase* engine = CreateEngineFromFile(path, nullptr, false);
+    if (!engine) {
+        printf("failed to open '%s'\n", path);
+        EngineMupdfSetProgressiveLoadKbps(-1);
+        return;
+    }
+    printf("opened: %.2f ms\n", TimeSinceInMs(t));
+    bool ok = RenderPageWhenLoaded(engine, 1);
+    printf("page 1 %s: %.2f ms\n", ok ? "rendered" : "failed", TimeSinceInMs(t));
+    int nPages = engine->PageCount();
+    ok = RenderPageWhenLoaded(engine, nPages);
+    printf("page %d %s: %.2f ms\n", nPages, ok ? "rendered" : "failed", TimeSinceInMs(t));
+    SafeEngineRelease(&engine);
+    EngineMupdfSetProgressiveLoadKbps(-1);
+}
+
+// options followed by a single file (or directory) argument
+struct FileTestArg {
+    const char* arg;
+    void (*fn)(const char* path);
+};
+
+static FileTestArg gFileTestArgs[] = {
+    {"-fingerprint", FingerprintTest},
+    {"-bench-bands", BenchRenderBands},
+    {"-bench-store", BenchStoreContention},
+    {"-bench-open", BenchOpenWithLayoutCache},
+    {"-stress-hittest", StressHitTest},
+    {"-bench-ops", BenchContentBytecode},
+    {"-bench-pan", BenchPanZoomed},
+    {"-bench-tile", BenchRenderTile},
+    {"-bench-concurrent", BenchRenderConcurrently},
+    {"-bench-djvu-tiles", BenchDjVuTiles},
+    {"-bench-text", BenchOpenAndExtractText},
+    {"-bench-jbig2", BenchJbig2},
+    {"-bench-image-decode", BenchImageDecode},
+    {"-bench-comic", BenchComic},
+    {"-bench-cbx-open", BenchOpenComicWithCache},
+};
+
+static FileTestArg* FindFileTestArg(const char* arg) {
+    for (FileTestArg& a : gFileTestArgs) {
+        if (str::Eq(arg, a.arg)) {
+            return &a;
+        }
+    }
+    return nullptr;
+}
+
 int TesterMain() {
     RedirectIOToConsole();
 
@@ -226,6 +943,27 @@ int TesterMain() {
         } else if (str::Eq(arg, "-save-images")) {
             gSaveImages = true;
             ++i;
+        } else if (str::Eq(arg, "-bench-progressive")) {
+            i += 2;
+            if (i >= nArgs) {
+                return Usage();
+            }
+            BenchProgressiveLoad(argv.at(i - 1), atoi(argv.at(i)));
+            ++i;
+        } else if (str::Eq(arg, "-bench-shared-images")) {
+            i += 2;
+            if (i >= nArgs) {
+                return Usage();
+            }
+            BenchSharedImages(argv.at(i - 1), atoi(argv.at(i)));
+            ++i;
+        } else if (FileTestArg* fileArg = FindFileTestArg(arg)) {
+            ++i;
+            if (i == nArgs) {
+                return Usage();
+            }
+            fileArg->fn(argv.at(i));
+            ++i;
         } else if (str::Eq(arg, "-zip-create")) {
             ZipCreateTest();
             ++i;
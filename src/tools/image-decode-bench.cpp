@@ -0,0 +1,113 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+/* Benchmarks ImageDecoder (the decoding used for comic books and image
+   folders) over a folder of images, at full size and at 1/2, 1/4 and 1/8
+   of the size. It doesn't depend on Windows so it can also be built on
+   Linux, against a Linux build of mupdf and libwebp e.g.:
+
+   g++ -O2 -std=c++17 -DNO_AVIF -DNO_TGA -Isrc/utils -Imupdf/include -Iext/libwebp/src \
+       src/tools/image-decode-bench.cpp src/utils/ImageDecoder.cpp \
+       -lmupdf -lmupdf-third -lwebp -lsharpyuv -lm -lpthread -o image-decode-bench
+
+   AVIF and HEIC need ext/libheif (which has additions that upstream libheif
+   doesn't have) built with -DHAVE_DAV1D -DLIBHEIF_STATIC_BUILD, and dav1d.
+   TGA needs TgaReader.cpp which only builds on Windows. */
+
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "ImageDecoder.h"
+
+static double TimeMs(std::chrono::steady_clock::time_point start) {
+    auto dur = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::milli>(dur).count();
+}
+
+static bool BenchFile(fz_context* ctx, const std::string& path, double totalMs[4]) {
+    std::ifstream f(path, std::ios::binary);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    if (data.empty()) {
+        return false;
+    }
+
+    ImageDecodeOptions opts;
+    auto t = std::chrono::steady_clock::now();
+    DecodedImage* img = DecodeImage(ctx, data.data(), data.size(), opts);
+    double ms = TimeMs(t);
+    if (!img) {
+        printf("%s: failed to decode\n", path.c_str());
+        return false;
+    }
+    int dx = img->dx;
+    int dy = img->dy;
+    printf("%s (%d x %d, %d components): %.2f ms", path.c_str(), dx, dy, img->n, ms);
+    totalMs[0] += ms;
+    FreeDecodedImage(img);
+
+    for (int reduce = 1; reduce <= 3; reduce++) {
+        int round = (1 << reduce) - 1;
+        opts.targetDx = (dx + round) >> reduce;
+        opts.targetDy = (dy + round) >> reduce;
+        t = std::chrono::steady_clock::now();
+        img = DecodeImage(ctx, data.data(), data.size(), opts);
+        ms = TimeMs(t);
+        if (!img) {
+            printf(", 1/%d: failed", 1 << reduce);
+            continue;
+        }
+        printf(", 1/%d: %.2f ms", 1 << reduce, ms);
+        totalMs[reduce] += ms;
+        FreeDecodedImage(img);
+    }
+    printf("\n");
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        printf("usage: image-decode-bench <dirOrFile>\n");
+        return 1;
+    }
+
+    fz_context* ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+    if (!ctx) {
+        return 1;
+    }
+
+    std::vector<std::string> paths;
+    std::error_code ec;
+    if (std::filesystem::is_directory(argv[1], ec)) {
+        for (auto& entry : std::filesystem::recursive_directory_iterator(argv[1], ec)) {
+            if (entry.is_regular_file()) {
+                paths.push_back(entry.path().string());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+    } else {
+        paths.push_back(argv[1]);
+    }
+
+    double totalMs[4] = {};
+    int nDecoded = 0;
+    for (auto& path : paths) {
+        if (BenchFile(ctx, path, totalMs)) {
+            nDecoded++;
+        }
+    }
+    printf("%d images: full %.2f ms, 1/2 %.2f ms, 1/4 %.2f ms, 1/8 %.2f ms\n", nDecoded, totalMs[0], totalMs[1],
+           totalMs[2], totalMs[3]);
+
+    fz_drop_context(ctx);
+    return 0;
+}
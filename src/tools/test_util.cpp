@@ -18,6 +18,7 @@ extern void DictTest();
 extern void FileUtilTest();
 extern void HtmlPrettyPrintTest();
 extern void HtmlPullParser_UnitTests();
+extern void ImageDecoderTest();
 extern void JsonTest();
 extern void SettingsUtilTest();
 extern void SimpleLogTest();
@@ -42,6 +43,7 @@ int main(int, char**) {
     FileUtilTest();
     HtmlPrettyPrintTest();
     HtmlPullParser_UnitTests();
+    ImageDecoderTest();
     JsonTest();
     SettingsUtilTest();
     SimpleLogTest();
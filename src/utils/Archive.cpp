@@ -160,6 +160,47 @@ ByteSlice MultiFormatArchive::GetFileDataById(size_t fileId) {
     return {data, size};
 }
 
+// like GetFileDataById() but only uncompresses (at most) the first maxSize bytes
+// e.g. for reading the header of a file. Doesn't take ownership of data
+// loaded on open. The caller must free()
+ByteSlice MultiFormatArchive::GetFileDataStartById(size_t fileId, size_t maxSize) {
+    if (fileId == (size_t)-1) {
+        return {};
+    }
+    ReportIf(fileId >= fileInfos_.size());
+
+    auto* fileInfo = fileInfos_[fileId];
+    size_t size = std::min(fileInfo->fileSizeUncompressed, maxSize);
+    if (fileInfo->data != nullptr) {
+        u8* data = (u8*)memdup(fileInfo->data, size, ZERO_PADDING_COUNT);
+        if (!data) {
+            return {};
+        }
+        return {data, size};
+    }
+
+    if (LoadedUsingUnrarDll()) {
+        // unrar.dll can only extract whole files
+        return GetFileDataByIdUnarrDll(fileId);
+    }
+
+    if (!ar_) {
+        return {};
+    }
+    if (!ar_parse_entry_at(ar_, fileInfo->filePos)) {
+        return {};
+    }
+    u8* data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+    if (!data) {
+        return {};
+    }
+    if (!ar_entry_uncompress(ar_, data, size)) {
+        free(data);
+        return {};
+    }
+    return {data, size};
+}
+
 const char* MultiFormatArchive::GetComment() {
     if (!ar_) {
         return nullptr;
@@ -3,7 +3,19 @@
 
 #ifndef NO_AVIF
 
+// AV1 decoders that are reused for decoding many images (e.g. the pages
+// of a comic book); can be used from multiple threads at once
+struct heif_decoder_context_pool;
+struct AvifDecoderPool {
+    heif_decoder_context_pool* contexts = nullptr;
+};
+AvifDecoderPool* NewAvifDecoderPool(int maxIdleDecoders);
+void DeleteAvifDecoderPool(AvifDecoderPool*);
+
 Size AvifSizeFromData(const ByteSlice&);
-Gdiplus::Bitmap* AvifImageFromData(const ByteSlice&);
+// scales the image down to targetSize if it's smaller than the image
+// nThreads limits the threads used by the AV1 decoder (0 = one per core)
+Gdiplus::Bitmap* AvifImageFromData(const ByteSlice&, Size targetSize = {}, int nThreads = 0,
+                                   AvifDecoderPool* pool = nullptr);
 
-#endif
\ No newline at end of file
+#endif
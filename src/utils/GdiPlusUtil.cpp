@@ -10,6 +10,7 @@
 #include "utils/TgaReader.h"
 #include "utils/WebpReader.h"
 #include "utils/AvifReader.h"
+#include "utils/ImageDecoder.h"
 #include "utils/WinUtil.h"
 #include "utils/GdiPlusUtil.h"
 
@@ -378,7 +379,54 @@ static Bitmap* DecodeWithGdiplus(const ByteSlice& bmpData) {
     return bmp;
 }
 
-Bitmap* BitmapFromDataWin(const ByteSlice& bmpData) {
+// converts the gray, RGB or premultiplied RGBA pixels from ImageDecoder
+Bitmap* BitmapFromDecodedImage(const DecodedImage* img) {
+    int w = img->dx, h = img->dy;
+    Gdiplus::PixelFormat fmt = img->n == 4 ? PixelFormat32bppPARGB : PixelFormat24bppRGB;
+    auto bmp = new Gdiplus::Bitmap(w, h, fmt);
+    Gdiplus::Rect bmpRect(0, 0, w, h);
+    Gdiplus::BitmapData bmpData;
+    Gdiplus::Status ok = bmp->LockBits(&bmpRect, Gdiplus::ImageLockModeWrite, fmt, &bmpData);
+    if (ok != Gdiplus::Ok) {
+        delete bmp;
+        return nullptr;
+    }
+    for (int y = 0; y < h; y++) {
+        const u8* s = img->samples + (size_t)y * img->stride;
+        u8* d = (u8*)bmpData.Scan0 + (size_t)y * bmpData.Stride;
+        if (1 == img->n) {
+            for (int x = 0; x < w; x++) {
+                d[0] = d[1] = d[2] = s[0];
+                d += 3;
+                s += 1;
+            }
+        } else if (3 == img->n) { // RGB -> BGR
+            for (int x = 0; x < w; x++) {
+                d[0] = s[2];
+                d[1] = s[1];
+                d[2] = s[0];
+                d += 3;
+                s += 3;
+            }
+        } else { // RGBA -> BGRA
+            for (int x = 0; x < w; x++) {
+                d[0] = s[2];
+                d[1] = s[1];
+                d[2] = s[0];
+                d[3] = s[3];
+                d += 4;
+                s += 4;
+            }
+        }
+    }
+    bmp->UnlockBits(&bmpData);
+    bmp->SetResolution((float)img->xres, (float)img->yres);
+    return bmp;
+}
+
+// targetSize is a hint: formats that can decode at a lower resolution
+// (WebP, AVIF) return an image of that size if it's smaller than the image
+Bitmap* BitmapFromDataWin(const ByteSlice& bmpData, Size targetSize) {
     Bitmap* bmp = nullptr;
 
     Kind kind = GuessFileTypeFromContent(bmpData);
@@ -389,14 +437,17 @@ Bitmap* BitmapFromDataWin(const ByteSlice& bmpData) {
         }
     }
     if (kindFileWebp == kind) {
-        bmp = webp::ImageFromData(bmpData);
+        bmp = webp::ImageFromData(bmpData, targetSize);
         if (bmp) {
             return bmp;
         }
     }
 
     if (kindFileHeic == kind || kindFileAvif == kind) {
-        bmp = AvifImageFromData(bmpData);
+        bmp = AvifImageFromData(bmpData, targetSize);
+        if (bmp) {
+            return bmp;
+        }
     }
 
     // those are potentially multi-image formats and WICDecodeImageFromStream
@@ -467,10 +518,36 @@ static bool GifSizeFromData(ByteReader r, Size& result) {
     return false;
 }
 
+// returns the orientation tag of the EXIF (APP1) segment at idx, 1 if it has none
+static int JpegExifOrientation(ByteReader r, size_t idx) {
+    if (idx + 18 > r.len || !memeq(r.d + idx + 4, "Exif\0\0", 6)) {
+        return 1;
+    }
+    // offsets are relative to the TIFF header after "Exif\0\0"
+    size_t base = idx + 10;
+    bool isBE = r.Byte(base) == 'M';
+    size_t ifdOff = r.DWord(base + 4, isBE);
+    if (ifdOff > r.len - base) {
+        return 1;
+    }
+    size_t ifd = base + ifdOff;
+    WORD count = r.Word(ifd, isBE);
+    for (size_t i = ifd + 2; count > 0 && i + 12 <= r.len; count--, i += 12) {
+        if (r.Word(i, isBE) == 0x0112 && r.Word(i + 2, isBE) == 3) {
+            return r.Word(i + 8, isBE);
+        }
+    }
+    return 1;
+}
+
+// the size is that of the image as displayed, i.e. width and height are
+// swapped for images rotated by 90 or 270 degrees by their EXIF orientation
+// (as GDI+ and ImageDecoder rotate them)
 static bool JpegSizeFromData(ByteReader r, Size& result) {
     // find the last start of frame marker for non-differential Huffman/arithmetic coding
     size_t n = r.len;
     size_t idx = 2;
+    int orientation = 1;
     for (;;) {
         if (idx + 9 >= n) {
             return false;
@@ -483,8 +560,14 @@ static bool JpegSizeFromData(ByteReader r, Size& result) {
         if (0xC0 <= b && b <= 0xC3 || 0xC9 <= b && b <= 0xCB) {
             result.dx = r.WordBE(idx + 7);
             result.dy = r.WordBE(idx + 5);
+            if (orientation >= 5 && orientation <= 8) {
+                std::swap(result.dx, result.dy);
+            }
             return true;
         }
+        if (0xE1 == b && 1 == orientation) {
+            orientation = JpegExifOrientation(r, idx);
+        }
         idx += (size_t)r.WordBE(idx + 2) + 2;
     }
     return false;
@@ -593,8 +676,9 @@ static bool AvifSizeFromData(ByteReader r, Size& result) {
 }
 
 // adapted from http://cpansearch.perl.org/src/RJRAY/Image-Size-3.230/lib/Image/Size.pm
-Size BitmapSizeFromData(const ByteSlice& d) {
-    Size result;
+// d can be just the start of the image data. Returns false if the size can't
+// be determined from it without decoding the whole image
+bool BitmapSizeFromHeader(const ByteSlice& d, Size& result) {
     bool ok = false;
     Kind kind = GuessFileTypeFromContent(d);
 
@@ -618,7 +702,12 @@ Size BitmapSizeFromData(const ByteSlice& d) {
     } else if (kind == kindFileAvif || kind == kindFileHeic) {
         ok = AvifSizeFromData(r, result);
     }
-    if (ok && !result.IsEmpty()) {
+    return ok && !result.IsEmpty();
+}
+
+Size BitmapSizeFromData(const ByteSlice& d) {
+    Size result;
+    if (BitmapSizeFromHeader(d, result)) {
         return result;
     }
 
@@ -19,7 +19,10 @@ RectF MeasureText(Gdiplus::Graphics* g, Gdiplus::Font* f, const WCHAR* s, size_t
 
 void GetBaseTransform(Gdiplus::Matrix& m, Gdiplus::RectF pageRect, float zoom, int rotation);
 
-Gdiplus::Bitmap* BitmapFromDataWin(const ByteSlice& bmpData);
+Gdiplus::Bitmap* BitmapFromDataWin(const ByteSlice& bmpData, Size targetSize = {});
+struct DecodedImage;
+Gdiplus::Bitmap* BitmapFromDecodedImage(const DecodedImage*);
+bool BitmapSizeFromHeader(const ByteSlice&, Size& size);
 Size BitmapSizeFromData(const ByteSlice&);
 CLSID GetEncoderClsid(const WCHAR* format);
 RenderedBitmap* LoadRenderedBitmapWin(const char* path);
@@ -0,0 +1,1003 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// note: this file is portable and must not depend on BaseUtil.h or Windows
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+#endif
+
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <zlib.h>
+
+#ifndef NO_LIBWEBP
+#include <webp/decode.h>
+#endif
+#ifndef NO_AVIF
+#include <libheif/heif.h>
+#endif
+
+#include "ImageDecoder.h"
+
+#ifndef NO_TGA
+// in utils/TgaReader.cpp (which depends on GDI+ for everything else)
+namespace tga {
+bool DecodePixels(const uint8_t* data, size_t len, int* w, int* h, int* n, uint8_t** pixels);
+}
+#endif
+
+static DecodedImage* NewDecodedImage(int dx, int dy, int n) {
+    if (dx <= 0 || dy <= 0 || (size_t)dx * (size_t)dy > SIZE_MAX / 4 / (size_t)n) {
+        return nullptr;
+    }
+    auto img = new DecodedImage();
+    img->dx = dx;
+    img->dy = dy;
+    img->n = n;
+    img->stride = dx * n;
+    img->samples = (unsigned char*)malloc((size_t)img->stride * dy);
+    if (!img->samples) {
+        delete img;
+        return nullptr;
+    }
+    img->fullDx = dx;
+    img->fullDy = dy;
+    return img;
+}
+
+void FreeDecodedImage(DecodedImage* img) {
+    if (!img) {
+        return;
+    }
+    free(img->samples);
+    delete img;
+}
+
+// the image is only ever scaled down, to exactly the target size
+static void GetTargetSize(int dx, int dy, const ImageDecodeOptions& opts, int* tx, int* ty) {
+    *tx = dx;
+    *ty = dy;
+    if (opts.targetDx > 0 && opts.targetDy > 0 && opts.targetDx < dx && opts.targetDy < dy) {
+        *tx = opts.targetDx;
+        *ty = opts.targetDy;
+    }
+}
+
+// scales n-component pixels down to img's size by averaging the source
+// pixels covered by each destination pixel; premultiply converts RGBA
+// with straight alpha to premultiplied alpha
+template <int n, bool premultiply>
+static void ScaleSamplesN(const uint8_t* src, int srcDx, int srcDy, ptrdiff_t srcStride, DecodedImage* img) {
+    int dstDx = img->dx;
+    int dstDy = img->dy;
+    std::vector<int> xs(dstDx + 1);
+    for (int x = 0; x <= dstDx; x++) {
+        xs[x] = (int)((int64_t)x * srcDx / dstDx);
+    }
+    std::vector<uint32_t> sums((size_t)dstDx * n);
+    for (int y = 0; y < dstDy; y++) {
+        int y0 = (int)((int64_t)y * srcDy / dstDy);
+        int y1 = std::max((int)((int64_t)(y + 1) * srcDy / dstDy), y0 + 1);
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int sy = y0; sy < y1; sy++) {
+            const uint8_t* row = src + sy * srcStride;
+            uint32_t* sum = sums.data();
+            for (int x = 0; x < dstDx; x++) {
+                int x1 = std::max(xs[x + 1], xs[x] + 1);
+                const uint8_t* s = row + (size_t)xs[x] * n;
+                for (int sx = xs[x]; sx < x1; sx++) {
+                    if (premultiply) {
+                        uint32_t a = s[3];
+                        sum[0] += (s[0] * a + 127) / 255;
+                        sum[1] += (s[1] * a + 127) / 255;
+                        sum[2] += (s[2] * a + 127) / 255;
+                        sum[3] += a;
+                    } else {
+                        for (int i = 0; i < n; i++) {
+                            sum[i] += s[i];
+                        }
+                    }
+                    s += n;
+                }
+                sum += n;
+            }
+        }
+        uint8_t* d = img->samples + (size_t)y * img->stride;
+        const uint32_t* sum = sums.data();
+        for (int x = 0; x < dstDx; x++) {
+            uint32_t count = (uint32_t)(y1 - y0) * (uint32_t)std::max(xs[x + 1] - xs[x], 1);
+            for (int i = 0; i < n; i++) {
+                d[i] = (uint8_t)(sum[i] / count);
+            }
+            d += n;
+            sum += n;
+        }
+    }
+}
+
+static void ScaleSamples(const uint8_t* src, int srcDx, int srcDy, ptrdiff_t srcStride, DecodedImage* img,
+                         bool premultiply = false) {
+    if (srcDx == img->dx && srcDy == img->dy && !premultiply) {
+        for (int y = 0; y < img->dy; y++) {
+            memcpy(img->samples + (size_t)y * img->stride, src + y * srcStride, (size_t)img->dx * img->n);
+        }
+        return;
+    }
+    if (premultiply) {
+        ScaleSamplesN<4, true>(src, srcDx, srcDy, srcStride, img);
+    } else if (img->n == 1) {
+        ScaleSamplesN<1, false>(src, srcDx, srcDy, srcStride, img);
+    } else if (img->n == 3) {
+        ScaleSamplesN<3, false>(src, srcDx, srcDy, srcStride, img);
+    } else {
+        ScaleSamplesN<4, false>(src, srcDx, srcDy, srcStride, img);
+    }
+}
+
+// maps pixel i of a row or column with n pixels for a coefficient of
+// fz_image_orientation_matrix() (which is 0, 1 or -1 for mirroring)
+static int OrientCoord(float m, int i, int n) {
+    if (m > 0) {
+        return i;
+    }
+    if (m < 0) {
+        return n - 1 - i;
+    }
+    return 0;
+}
+
+// rotates and/or flips img as given by fz_image_orientation_matrix()
+// (for a JPEG's EXIF orientation). img is freed
+static DecodedImage* OrientImage(DecodedImage* img, fz_matrix m) {
+    // rotated by 90 or 270 degrees
+    bool swap = m.a == 0;
+    DecodedImage* res = NewDecodedImage(swap ? img->dy : img->dx, swap ? img->dx : img->dy, img->n);
+    if (!res) {
+        FreeDecodedImage(img);
+        return nullptr;
+    }
+    int n = img->n;
+    for (int y = 0; y < img->dy; y++) {
+        const uint8_t* s = img->samples + (size_t)y * img->stride;
+        for (int x = 0; x < img->dx; x++) {
+            int ox = OrientCoord(m.a, x, img->dx) + OrientCoord(m.c, y, img->dy);
+            int oy = OrientCoord(m.b, x, img->dx) + OrientCoord(m.d, y, img->dy);
+            uint8_t* d = res->samples + (size_t)oy * res->stride + (size_t)ox * n;
+            for (int i = 0; i < n; i++) {
+                d[i] = s[i];
+            }
+            s += n;
+        }
+    }
+    res->fullDx = swap ? img->fullDy : img->fullDx;
+    res->fullDy = swap ? img->fullDx : img->fullDy;
+    res->xres = swap ? img->yres : img->xres;
+    res->yres = swap ? img->xres : img->yres;
+    FreeDecodedImage(img);
+    return res;
+}
+
+// fz_convert_pixmap() would unpremultiply the gray values and premultiply
+// them again, which loses precision
+static fz_pixmap* RgbaFromGrayAlpha(fz_context* ctx, fz_pixmap* pix) {
+    fz_pixmap* rgba = fz_new_pixmap(ctx, fz_device_rgb(ctx), pix->w, pix->h, nullptr, 1);
+    for (int y = 0; y < pix->h; y++) {
+        const uint8_t* s = pix->samples + (size_t)y * pix->stride;
+        uint8_t* d = rgba->samples + (size_t)y * rgba->stride;
+        for (int x = 0; x < pix->w; x++) {
+            d[0] = d[1] = d[2] = s[0];
+            d[3] = s[1];
+            d += 4;
+            s += 2;
+        }
+    }
+    return rgba;
+}
+
+// JPEG and JPX images are decoded at 1/2, 1/4 or 1/8 of their size if
+// that's still at least the target size. JPEGs are rotated as given by
+// their EXIF orientation
+static DecodedImage* DecodeWithMupdf(fz_context* ctx, const uint8_t* data, size_t len,
+                                     const ImageDecodeOptions& opts) {
+    fz_buffer* buf = nullptr;
+    fz_image* image = nullptr;
+    fz_pixmap* pix = nullptr;
+    fz_pixmap* rgb = nullptr;
+    DecodedImage* img = nullptr;
+
+    fz_var(buf);
+    fz_var(image);
+    fz_var(pix);
+    fz_var(rgb);
+    fz_var(img);
+
+    fz_try(ctx) {
+        buf = fz_new_buffer_from_shared_data(ctx, data, len);
+        image = fz_new_image_from_buffer(ctx, buf);
+        bool isOriented = fz_image_orientation(ctx, image) > 1;
+        fz_matrix orient = fz_image_orientation_matrix(ctx, image);
+        // the target size is for the rotated image
+        ImageDecodeOptions imgOpts = opts;
+        if (isOriented && orient.a == 0) {
+            std::swap(imgOpts.targetDx, imgOpts.targetDy);
+        }
+        int dx, dy;
+        GetTargetSize(image->w, image->h, imgOpts, &dx, &dy);
+        // mupdf only decodes at 1/2^n of the size if that's at least 2 pixels
+        // larger than requested (to allow for grid fitting when rendering),
+        // rounded down while the decoded size is rounded up
+        int reqDx = dx < image->w ? std::max(dx - 3, 1) : dx;
+        int reqDy = dy < image->h ? std::max(dy - 3, 1) : dy;
+        fz_matrix ctm = fz_scale((float)reqDx, (float)reqDy);
+        pix = fz_get_pixmap_from_image(ctx, image, nullptr, &ctm, nullptr, nullptr);
+
+        fz_pixmap* src = pix;
+        bool isGray = pix->colorspace == fz_device_gray(ctx) && pix->n == 1;
+        bool isGrayAlpha = pix->colorspace == fz_device_gray(ctx) && pix->n == 2 && pix->alpha;
+        bool isRgb = pix->colorspace == fz_device_rgb(ctx) && pix->n == 3 + pix->alpha;
+        if (isGrayAlpha) {
+            rgb = RgbaFromGrayAlpha(ctx, pix);
+            src = rgb;
+        } else if (!isGray && !isRgb) {
+            // CMYK, Lab, indexed or ICC based
+            rgb = fz_convert_pixmap(ctx, pix, fz_device_rgb(ctx), nullptr, nullptr, fz_default_color_params, 1);
+            src = rgb;
+        }
+        if (dx > src->w || dy > src->h) {
+            // never scale up
+            dx = std::min(dx, src->w);
+            dy = std::min(dy, src->h);
+        }
+        img = NewDecodedImage(dx, dy, src->n);
+        if (!img) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "image too large");
+        }
+        ScaleSamples(src->samples, src->w, src->h, src->stride, img);
+        img->fullDx = image->w;
+        img->fullDy = image->h;
+        fz_image_resolution(image, &img->xres, &img->yres);
+        if (isOriented) {
+            img = OrientImage(img, orient);
+            if (!img) {
+                fz_throw(ctx, FZ_ERROR_GENERIC, "image too large");
+            }
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_pixmap(ctx, rgb);
+        fz_drop_pixmap(ctx, pix);
+        fz_drop_image(ctx, image);
+        fz_drop_buffer(ctx, buf);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        FreeDecodedImage(img);
+        return nullptr;
+    }
+    return img;
+}
+
+#ifndef NO_LIBWEBP
+static bool IsWebp(const uint8_t* data, size_t len) {
+    return len > 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0;
+}
+
+// libwebp scales while decoding which is much faster than scaling afterwards
+static DecodedImage* DecodeWebp(const uint8_t* data, size_t len, const ImageDecodeOptions& opts) {
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config)) {
+        return nullptr;
+    }
+    if (WebPGetFeatures(data, len, &config.input) != VP8_STATUS_OK) {
+        return nullptr;
+    }
+    int dx, dy;
+    GetTargetSize(config.input.width, config.input.height, opts, &dx, &dy);
+    DecodedImage* img = NewDecodedImage(dx, dy, config.input.has_alpha ? 4 : 3);
+    if (!img) {
+        return nullptr;
+    }
+    img->fullDx = config.input.width;
+    img->fullDy = config.input.height;
+
+    if (dx != config.input.width || dy != config.input.height) {
+        config.options.use_scaling = 1;
+        config.options.scaled_width = dx;
+        config.options.scaled_height = dy;
+    }
+    config.options.use_threads = opts.nThreads != 1 ? 1 : 0;
+    config.output.colorspace = img->n == 4 ? MODE_rgbA : MODE_RGB;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = img->samples;
+    config.output.u.RGBA.stride = img->stride;
+    config.output.u.RGBA.size = (size_t)img->stride * img->dy;
+    bool ok = WebPDecode(data, len, &config) == VP8_STATUS_OK;
+    WebPFreeDecBuffer(&config.output);
+    if (!ok) {
+        FreeDecodedImage(img);
+        return nullptr;
+    }
+    return img;
+}
+#endif
+
+#ifndef NO_AVIF
+static bool IsHeif(const uint8_t* data, size_t len) {
+    int n = (int)std::min(len, (size_t)64);
+    return heif_check_filetype(data, n) == heif_filetype_yes_supported;
+}
+
+// AV1 and HEVC have no reduced-resolution decoding so the image is always
+// decoded at full size
+DecodedImage* DecodeHeif(const uint8_t* data, size_t len, const ImageDecodeOptions& opts) {
+    DecodedImage* res = nullptr;
+    struct heif_image_handle* hdl = nullptr;
+    struct heif_image* img = nullptr;
+    struct heif_decoding_options* decOpts = nullptr;
+    bool hasAlpha;
+    int dx, dy, tx, ty, stride;
+    const uint8_t* samples;
+
+    heif_context* ctx = heif_context_alloc();
+    auto err = heif_context_read_from_memory_without_copy(ctx, data, len, nullptr);
+    if (err.code != heif_error_Ok) {
+        goto Exit;
+    }
+    err = heif_context_get_primary_image_handle(ctx, &hdl);
+    if (err.code != heif_error_Ok) {
+        goto Exit;
+    }
+
+    hasAlpha = heif_image_handle_has_alpha_channel(hdl) != 0;
+    decOpts = heif_decoding_options_alloc();
+    decOpts->decoder_threads = opts.nThreads;
+    decOpts->decoder_context_pool = opts.avifDecoders;
+    err = heif_decode_image(hdl, &img, heif_colorspace_RGB,
+                            hasAlpha ? heif_chroma_interleaved_RGBA : heif_chroma_interleaved_RGB, decOpts);
+    if (err.code != heif_error_Ok) {
+        goto Exit;
+    }
+
+    // the decoded image can differ from the handle's size
+    dx = heif_image_get_width(img, heif_channel_interleaved);
+    dy = heif_image_get_height(img, heif_channel_interleaved);
+    samples = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+    if (!samples) {
+        goto Exit;
+    }
+    GetTargetSize(dx, dy, opts, &tx, &ty);
+    res = NewDecodedImage(tx, ty, hasAlpha ? 4 : 3);
+    if (res) {
+        ScaleSamples(samples, dx, dy, stride, res, hasAlpha);
+        res->fullDx = dx;
+        res->fullDy = dy;
+    }
+
+Exit:
+    if (img) {
+        heif_image_release(img);
+    }
+    if (decOpts) {
+        heif_decoding_options_free(decOpts);
+    }
+    if (hdl) {
+        heif_image_handle_release(hdl);
+    }
+    heif_context_free(ctx);
+    return res;
+}
+#endif
+
+#ifndef NO_TGA
+static DecodedImage* DecodeTga(const uint8_t* data, size_t len, const ImageDecodeOptions& opts) {
+    int dx, dy, n, tx, ty;
+    uint8_t* samples = nullptr;
+    if (!tga::DecodePixels(data, len, &dx, &dy, &n, &samples)) {
+        return nullptr;
+    }
+    GetTargetSize(dx, dy, opts, &tx, &ty);
+    DecodedImage* img = NewDecodedImage(tx, ty, n);
+    if (img) {
+        ScaleSamples(samples, dx, dy, (ptrdiff_t)dx * n, img);
+        img->fullDx = dx;
+        img->fullDy = dy;
+    }
+    free(samples);
+    return img;
+}
+#endif
+
+DecodedImage* DecodeImage(fz_context* ctx, const unsigned char* data, size_t len, const ImageDecodeOptions& opts) {
+    if (!data || len < 12) {
+        return nullptr;
+    }
+#ifndef NO_LIBWEBP
+    if (IsWebp(data, len)) {
+        return DecodeWebp(data, len, opts);
+    }
+#endif
+#ifndef NO_AVIF
+    if (IsHeif(data, len)) {
+        return DecodeHeif(data, len, opts);
+    }
+#endif
+    if (fz_recognize_image_format(ctx, (unsigned char*)data) != FZ_IMAGE_UNKNOWN) {
+        return DecodeWithMupdf(ctx, data, len, opts);
+    }
+#ifndef NO_TGA
+    // TGA has no signature and is tried last
+    return DecodeTga(data, len, opts);
+#else
+    return nullptr;
+#endif
+}
+
+///// decoding of very tall images in bands of rows /////
+
+static uint32_t ReadU32BE(const uint8_t* d) {
+    return ((uint32_t)d[0] << 24) | ((uint32_t)d[1] << 16) | ((uint32_t)d[2] << 8) | d[3];
+}
+
+static int ReadU16BE(const uint8_t* d) {
+    return (d[0] << 8) | d[1];
+}
+
+// returns the orientation tag from the TIFF structure of an EXIF segment
+// (after "Exif\0\0"), 1 if it has none
+static int ExifOrientation(const uint8_t* tiff, size_t len) {
+    if (len < 8) {
+        return 1;
+    }
+    bool isBE = tiff[0] == 'M';
+    auto u16 = [&](size_t off) { return isBE ? ReadU16BE(tiff + off) : tiff[off] | (tiff[off + 1] << 8); };
+    uint32_t ifd = isBE ? ReadU32BE(tiff + 4) : u16(4) | ((uint32_t)u16(6) << 16);
+    if (ifd > len - 2) {
+        return 1;
+    }
+    int count = u16(ifd);
+    for (size_t i = ifd + 2; count > 0 && i + 12 <= len; count--, i += 12) {
+        if (u16(i) == 0x0112 && u16(i + 2) == 3) {
+            return u16(i + 8);
+        }
+    }
+    return 1;
+}
+
+DecodedImage* ImageRowDecoder::DecodeRows(int y, int rowsDy, const ImageDecodeOptions& opts) {
+    if (y < 0 || y >= dy) {
+        return nullptr;
+    }
+    rowsDy = std::min(rowsDy, dy - y);
+    DecodedImage* band = NewDecodedImage(dx, rowsDy, n);
+    if (!band) {
+        return nullptr;
+    }
+    if (!ReadRows(y, band)) {
+        FreeDecodedImage(band);
+        return nullptr;
+    }
+    int tx, ty;
+    GetTargetSize(dx, rowsDy, opts, &tx, &ty);
+    if (tx != dx || ty != rowsDy) {
+        DecodedImage* img = NewDecodedImage(tx, ty, n);
+        if (img) {
+            ScaleSamples(band->samples, dx, rowsDy, band->stride, img);
+            img->fullDx = dx;
+            img->fullDy = rowsDy;
+        }
+        FreeDecodedImage(band);
+        band = img;
+    }
+    if (band) {
+        band->xres = xres;
+        band->yres = yres;
+    }
+    return band;
+}
+
+// inflates the IDAT chunks of a non-interlaced PNG image row by row.
+// The inflate state is saved every checkpointRows rows (about 45 KB each,
+// at most 64 of them) so that earlier rows don't have to be decoded from the start
+struct PngRowDecoder : ImageRowDecoder {
+    struct Checkpoint {
+        int row = 0;
+        size_t nextChunk = 0;
+        z_stream strm{};
+        std::vector<uint8_t> prevRow;
+
+        ~Checkpoint() {
+            inflateEnd(&strm);
+        }
+    };
+
+    const uint8_t* data = nullptr;
+    int depth = 0;
+    int colorType = 0;
+    // samples per pixel
+    int channels = 0;
+    // bytes per pixel (at least 1) for unfiltering
+    int bpp = 0;
+    size_t rowBytes = 0;
+    uint8_t palette[256][4]{};
+    bool hasTrns = false;
+    // offset and size of IDAT chunks
+    std::vector<std::pair<size_t, size_t>> idats;
+
+    z_stream strm{};
+    bool strmInited = false;
+    size_t nextChunk = 0;
+    int nextRow = 0;
+    // the filter byte and the filtered row
+    std::vector<uint8_t> row;
+    // the previous unfiltered row
+    std::vector<uint8_t> prevRow;
+    int checkpointRows = 0;
+    std::vector<std::unique_ptr<Checkpoint>> checkpoints;
+
+    ~PngRowDecoder() override {
+        if (strmInited) {
+            inflateEnd(&strm);
+        }
+    }
+
+    bool Parse(const uint8_t* d, size_t len);
+    bool Restart(int y);
+    bool ReadRow();
+    void ConvertRow(uint8_t* dst) const;
+    bool ReadRows(int y, DecodedImage* band) override;
+};
+
+bool PngRowDecoder::Parse(const uint8_t* d, size_t len) {
+    if (len < 8 || memcmp(d, "\x89PNG\r\n\x1a\n", 8) != 0) {
+        return false;
+    }
+    data = d;
+    int nPalette = 0;
+    bool hasHeader = false;
+    size_t pos = 8;
+    while (pos + 12 <= len) {
+        size_t chunkLen = ReadU32BE(d + pos);
+        const uint8_t* type = d + pos + 4;
+        const uint8_t* cd = d + pos + 8;
+        if (chunkLen > len - pos - 12) {
+            break;
+        }
+        if (memcmp(type, "IHDR", 4) == 0 && chunkLen >= 13) {
+            uint32_t w = ReadU32BE(cd);
+            uint32_t h = ReadU32BE(cd + 4);
+            depth = cd[8];
+            colorType = cd[9];
+            // cd[12] is the interlace method
+            if (w == 0 || h == 0 || w > (1 << 20) || h > (1 << 30) || cd[10] != 0 || cd[11] != 0 || cd[12] != 0) {
+                return false;
+            }
+            dx = (int)w;
+            dy = (int)h;
+            hasHeader = true;
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            nPalette = (int)std::min(chunkLen / 3, (size_t)256);
+            for (int i = 0; i < nPalette; i++) {
+                palette[i][0] = cd[i * 3];
+                palette[i][1] = cd[i * 3 + 1];
+                palette[i][2] = cd[i * 3 + 2];
+                palette[i][3] = 255;
+            }
+        } else if (memcmp(type, "tRNS", 4) == 0 && colorType == 3) {
+            size_t n = std::min(chunkLen, (size_t)256);
+            for (size_t i = 0; i < n; i++) {
+                palette[i][3] = cd[i];
+            }
+            hasTrns = n > 0;
+        } else if (memcmp(type, "pHYs", 4) == 0 && chunkLen >= 9 && cd[8] == 1) {
+            // pixels per meter
+            xres = (int)(ReadU32BE(cd) * 0.0254 + 0.5);
+            yres = (int)(ReadU32BE(cd + 4) * 0.0254 + 0.5);
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            idats.push_back({pos + 8, chunkLen});
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+        pos += chunkLen + 12;
+    }
+    if (!hasHeader || idats.empty() || xres <= 0 || yres <= 0) {
+        return false;
+    }
+
+    bool validDepth = depth == 8 || depth == 16;
+    switch (colorType) {
+        case 0:
+            channels = 1;
+            n = 1;
+            validDepth = validDepth || depth == 1 || depth == 2 || depth == 4;
+            break;
+        case 2:
+            channels = 3;
+            n = 3;
+            break;
+        case 3:
+            channels = 1;
+            n = hasTrns ? 4 : 3;
+            validDepth = (depth <= 8) && nPalette > 0;
+            break;
+        case 4:
+            channels = 2;
+            n = 4;
+            break;
+        case 6:
+            channels = 4;
+            n = 4;
+            break;
+        default:
+            return false;
+    }
+    if (!validDepth) {
+        return false;
+    }
+    bpp = std::max(channels * depth / 8, 1);
+    rowBytes = ((size_t)dx * channels * depth + 7) / 8;
+    row.resize(rowBytes + 1);
+    prevRow.resize(rowBytes);
+    checkpointRows = std::max(512, dy / 64);
+    return true;
+}
+
+// continues from the last checkpoint at or before row y
+bool PngRowDecoder::Restart(int y) {
+    Checkpoint* cp = nullptr;
+    for (auto& c : checkpoints) {
+        if (c->row <= y) {
+            cp = c.get();
+        }
+    }
+    if (strmInited) {
+        inflateEnd(&strm);
+        strmInited = false;
+    }
+    if (cp) {
+        if (inflateCopy(&strm, &cp->strm) != Z_OK) {
+            return false;
+        }
+        nextChunk = cp->nextChunk;
+        nextRow = cp->row;
+        prevRow = cp->prevRow;
+    } else {
+        memset(&strm, 0, sizeof(strm));
+        if (inflateInit(&strm) != Z_OK) {
+            return false;
+        }
+        nextChunk = 0;
+        nextRow = 0;
+        std::fill(prevRow.begin(), prevRow.end(), 0);
+    }
+    strmInited = true;
+    return true;
+}
+
+static uint8_t PaethPredictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return (uint8_t)a;
+    }
+    return (uint8_t)(pb <= pc ? b : c);
+}
+
+static bool UnfilterPngRow(int filter, uint8_t* cur, const uint8_t* prev, size_t len, int bpp) {
+    switch (filter) {
+        case 0:
+            break;
+        case 1:
+            for (size_t i = bpp; i < len; i++) {
+                cur[i] += cur[i - bpp];
+            }
+            break;
+        case 2:
+            for (size_t i = 0; i < len; i++) {
+                cur[i] += prev[i];
+            }
+            break;
+        case 3:
+            for (size_t i = 0; i < len; i++) {
+                int a = i >= (size_t)bpp ? cur[i - bpp] : 0;
+                cur[i] += (uint8_t)((a + prev[i]) >> 1);
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < len; i++) {
+                int a = i >= (size_t)bpp ? cur[i - bpp] : 0;
+                int c = i >= (size_t)bpp ? prev[i - bpp] : 0;
+                cur[i] += PaethPredictor(a, prev[i], c);
+            }
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+// inflates and unfilters row nextRow into prevRow
+bool PngRowDecoder::ReadRow() {
+    if (nextRow > 0 && nextRow % checkpointRows == 0 &&
+        (checkpoints.empty() || checkpoints.back()->row < nextRow)) {
+        auto cp = std::make_unique<Checkpoint>();
+        if (inflateCopy(&cp->strm, &strm) == Z_OK) {
+            cp->row = nextRow;
+            cp->nextChunk = nextChunk;
+            cp->prevRow = prevRow;
+            checkpoints.push_back(std::move(cp));
+        }
+    }
+
+    strm.next_out = row.data();
+    strm.avail_out = (uInt)row.size();
+    while (strm.avail_out > 0) {
+        if (strm.avail_in == 0) {
+            if (nextChunk >= idats.size()) {
+                return false;
+            }
+            strm.next_in = (Bytef*)data + idats[nextChunk].first;
+            strm.avail_in = (uInt)idats[nextChunk].second;
+            nextChunk++;
+        }
+        int ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            if (strm.avail_out > 0) {
+                return false;
+            }
+            break;
+        }
+        if (ret != Z_OK && !(ret == Z_BUF_ERROR && strm.avail_in == 0)) {
+            return false;
+        }
+    }
+    uint8_t* cur = row.data() + 1;
+    if (!UnfilterPngRow(row[0], cur, prevRow.data(), rowBytes, bpp)) {
+        return false;
+    }
+    memcpy(prevRow.data(), cur, rowBytes);
+    nextRow++;
+    return true;
+}
+
+// same rounding as fz_mul255()
+static uint8_t Premultiply(int c, int a) {
+    int x = c * a + 128;
+    return (uint8_t)((x + (x >> 8)) >> 8);
+}
+
+// converts the unfiltered row in prevRow to n-component 8-bit pixels
+void PngRowDecoder::ConvertRow(uint8_t* dst) const {
+    const uint8_t* src = prevRow.data();
+    // 16-bit samples are reduced to their high byte
+    int step = depth == 16 ? 2 : 1;
+    if (depth < 8) {
+        int maxVal = (1 << depth) - 1;
+        for (int x = 0; x < dx; x++) {
+            int bit = x * depth;
+            int v = (src[bit >> 3] >> (8 - depth - (bit & 7))) & maxVal;
+            if (colorType == 0) {
+                *dst++ = (uint8_t)(v * 255 / maxVal);
+                continue;
+            }
+            const uint8_t* c = palette[v];
+            for (int i = 0; i < n; i++) {
+                *dst++ = n == 4 && i < 3 ? Premultiply(c[i], c[3]) : c[i];
+            }
+        }
+        return;
+    }
+    for (int x = 0; x < dx; x++) {
+        const uint8_t* s = src + (size_t)x * channels * step;
+        switch (colorType) {
+            case 0:
+                dst[0] = s[0];
+                break;
+            case 2:
+                dst[0] = s[0];
+                dst[1] = s[step];
+                dst[2] = s[2 * step];
+                break;
+            case 3: {
+                const uint8_t* c = palette[s[0]];
+                if (n == 4) {
+                    dst[0] = Premultiply(c[0], c[3]);
+                    dst[1] = Premultiply(c[1], c[3]);
+                    dst[2] = Premultiply(c[2], c[3]);
+                    dst[3] = c[3];
+                } else {
+                    dst[0] = c[0];
+                    dst[1] = c[1];
+                    dst[2] = c[2];
+                }
+                break;
+            }
+            case 4: {
+                uint8_t g = Premultiply(s[0], s[step]);
+                dst[0] = g;
+                dst[1] = g;
+                dst[2] = g;
+                dst[3] = s[step];
+                break;
+            }
+            case 6:
+                dst[0] = Premultiply(s[0], s[3 * step]);
+                dst[1] = Premultiply(s[step], s[3 * step]);
+                dst[2] = Premultiply(s[2 * step], s[3 * step]);
+                dst[3] = s[3 * step];
+                break;
+        }
+        dst += n;
+    }
+}
+
+bool PngRowDecoder::ReadRows(int y, DecodedImage* band) {
+    // jump to a checkpoint if there's one after the current row and at or before y
+    bool useCheckpoint = false;
+    for (auto& cp : checkpoints) {
+        if (cp->row > nextRow && cp->row <= y) {
+            useCheckpoint = true;
+            break;
+        }
+    }
+    if (!strmInited || y < nextRow || useCheckpoint) {
+        if (!Restart(y)) {
+            return false;
+        }
+    }
+    while (nextRow < y) {
+        if (!ReadRow()) {
+            return false;
+        }
+    }
+    for (int i = 0; i < band->dy; i++) {
+        if (!ReadRow()) {
+            return false;
+        }
+        ConvertRow(band->samples + (size_t)i * band->stride);
+    }
+    return true;
+}
+
+// reads rows from mupdf's DCT decode filter. When restarting for a band,
+// the filter only does the entropy decoding of the rows above the band
+struct JpegRowDecoder : ImageRowDecoder {
+    fz_context* ctx = nullptr;
+    const uint8_t* data = nullptr;
+    size_t len = 0;
+    fz_stream* stm = nullptr;
+    int nextRow = 0;
+    std::vector<uint8_t> skipRow;
+
+    ~JpegRowDecoder() override {
+        fz_drop_stream(ctx, stm);
+    }
+
+    bool Parse(const uint8_t* d, size_t dLen);
+    bool ReadRows(int y, DecodedImage* band) override;
+};
+
+// only baseline (and extended sequential) Huffman-coded gray and RGB images are
+// supported: progressive images are fully buffered by libjpeg and CMYK would
+// need color management. Images with an EXIF orientation would need the bands
+// rotated, so they're decoded at once (and rotated) by DecodeImage()
+bool JpegRowDecoder::Parse(const uint8_t* d, size_t dLen) {
+    if (dLen < 4 || d[0] != 0xFF || d[1] != 0xD8) {
+        return false;
+    }
+    data = d;
+    len = dLen;
+    size_t pos = 2;
+    while (pos + 4 <= len) {
+        if (d[pos] != 0xFF) {
+            return false;
+        }
+        int marker = d[pos + 1];
+        if (marker == 0xFF) {
+            // fill byte
+            pos++;
+            continue;
+        }
+        size_t segLen = (size_t)ReadU16BE(d + pos + 2);
+        const uint8_t* seg = d + pos + 4;
+        if (segLen < 2 || segLen > len - pos - 2) {
+            return false;
+        }
+        if (marker == 0xE0 && segLen >= 14 && memcmp(seg, "JFIF", 5) == 0) {
+            int units = seg[7];
+            int xd = ReadU16BE(seg + 8);
+            int yd = ReadU16BE(seg + 10);
+            if (units == 1 && xd > 0 && yd > 0) {
+                xres = xd;
+                yres = yd;
+            } else if (units == 2 && xd > 0 && yd > 0) {
+                xres = (int)(xd * 2.54 + 0.5);
+                yres = (int)(yd * 2.54 + 0.5);
+            }
+        } else if (marker == 0xE1 && segLen >= 8 && memcmp(seg, "Exif\0\0", 6) == 0) {
+            if (ExifOrientation(seg + 6, segLen - 8) != 1) {
+                return false;
+            }
+        } else if (marker == 0xC0 || marker == 0xC1) {
+            if (segLen < 8 || seg[0] != 8) {
+                return false;
+            }
+            dy = ReadU16BE(seg + 1);
+            dx = ReadU16BE(seg + 3);
+            n = seg[5];
+            return dx > 0 && dy > 0 && (n == 1 || n == 3);
+        } else if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            // progressive, lossless, arithmetic coded or hierarchical
+            return false;
+        }
+        pos += 2 + segLen;
+    }
+    return false;
+}
+
+bool JpegRowDecoder::ReadRows(int y, DecodedImage* band) {
+    fz_stream* mem = nullptr;
+    fz_var(mem);
+    size_t rowLen = (size_t)dx * n;
+    fz_try(ctx) {
+        if (!stm || y < nextRow) {
+            fz_drop_stream(ctx, stm);
+            stm = nullptr;
+            nextRow = 0;
+            mem = fz_open_memory(ctx, data, len);
+            stm = fz_open_dctd(ctx, mem, -1, 0, 0, nullptr);
+            // rows above the band are returned without being fully decoded
+            fz_dctd_set_region(ctx, stm, fz_make_irect(0, y, dx, dy));
+        }
+        skipRow.resize(rowLen);
+        for (; nextRow < y; nextRow++) {
+            if (fz_read(ctx, stm, skipRow.data(), rowLen) != rowLen) {
+                fz_throw(ctx, FZ_ERROR_FORMAT, "truncated JPEG image");
+            }
+        }
+        for (int i = 0; i < band->dy; i++, nextRow++) {
+            if (fz_read(ctx, stm, band->samples + (size_t)i * band->stride, rowLen) != rowLen) {
+                fz_throw(ctx, FZ_ERROR_FORMAT, "truncated JPEG image");
+            }
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_stream(ctx, mem);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        fz_drop_stream(ctx, stm);
+        stm = nullptr;
+        return false;
+    }
+    return true;
+}
+
+ImageRowDecoder* NewImageRowDecoder(fz_context* ctx, const unsigned char* data, size_t len) {
+    if (!data) {
+        return nullptr;
+    }
+    auto png = new PngRowDecoder();
+    if (png->Parse(data, len)) {
+        return png;
+    }
+    delete png;
+    auto jpeg = new JpegRowDecoder();
+    jpeg->ctx = ctx;
+    if (jpeg->Parse(data, len)) {
+        return jpeg;
+    }
+    delete jpeg;
+    return nullptr;
+}
@@ -0,0 +1,73 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Decodes images into plain 8-bit pixel buffers. Unlike BitmapFromData()
+// this doesn't depend on GDI+ (or Windows) so that decoding can be tested
+// and benchmarked on any OS (see src/tools/image-decode-bench.cpp).
+// Uses mupdf's image loaders (JPEG, PNG, GIF, BMP, TIFF, JPX, PNM, PSD),
+// libwebp, libheif (AVIF, HEIC) and TgaReader.
+// ImageRowDecoder decodes very tall PNG and JPEG images in bands of rows.
+
+struct fz_context;
+struct heif_decoder_context_pool;
+
+struct DecodedImage {
+    int dx = 0;
+    int dy = 0;
+    // 1 (gray), 3 (RGB) or 4 (RGBA, with premultiplied alpha)
+    int n = 0;
+    int stride = 0;
+    unsigned char* samples = nullptr;
+    // size of the image before it was scaled down
+    int fullDx = 0;
+    int fullDy = 0;
+    int xres = 96;
+    int yres = 96;
+};
+
+struct ImageDecodeOptions {
+    // if smaller than the image, it's scaled down to this size (while
+    // decoding for JPEG, JPX and WebP which is much faster)
+    int targetDx = 0;
+    int targetDy = 0;
+    // threads used by the AV1 decoder (0 = one per core)
+    int nThreads = 0;
+    // reuse AV1 decoders, see heif_decoder_context_pool_alloc()
+    heif_decoder_context_pool* avifDecoders = nullptr;
+};
+
+// returns nullptr if the image can't be decoded
+DecodedImage* DecodeImage(fz_context* ctx, const unsigned char* data, size_t len, const ImageDecodeOptions& opts);
+void FreeDecodedImage(DecodedImage* img);
+// DecodeImage() for AVIF and HEIC, which doesn't need a fz_context
+// (not available if built with NO_AVIF)
+DecodedImage* DecodeHeif(const unsigned char* data, size_t len, const ImageDecodeOptions& opts);
+
+// Decodes horizontal bands of a PNG or JPEG image, for images too tall to be
+// decoded at once (e.g. webtoon strips). Only the decoder's state is kept
+// between bands: getting the rows after the last band continues from there,
+// earlier rows restart decoding (PNG from the closest of the decoder states
+// saved every few hundred rows, JPEG from the start but with the rows above
+// the band only entropy decoded). Not thread-safe
+struct ImageRowDecoder {
+    int dx = 0;
+    int dy = 0;
+    // 1 (gray), 3 (RGB) or 4 (RGBA, with premultiplied alpha)
+    int n = 0;
+    int xres = 96;
+    int yres = 96;
+
+    virtual ~ImageRowDecoder() = default;
+
+    // returns rows y to y + rowsDy - 1 (scaled down if opts ask for
+    // a smaller size) or nullptr on error
+    DecodedImage* DecodeRows(int y, int rowsDy, const ImageDecodeOptions& opts);
+
+  protected:
+    virtual bool ReadRows(int y, DecodedImage* band) = 0;
+};
+
+// returns nullptr for other formats, interlaced PNG and JPEG other than
+// baseline gray or RGB without an EXIF orientation. data must stay valid and ctx must not be used by
+// other threads while the decoder is used
+ImageRowDecoder* NewImageRowDecoder(fz_context* ctx, const unsigned char* data, size_t len);
@@ -1141,6 +1141,75 @@ int CmpNatural(const char* a, const char* b) {
     return diff;
 }
 
+// in NaturalSortKey() every special character is 0x01 followed by 2 bytes and
+// every letter or number is 0x02 followed by its value, so that special characters
+// sort before text and numbers and no byte of the key is 0
+static void AppendSortKeySpecial(str::Str& key, char c) {
+    // CmpNatural compares special characters as (signed) char
+    u8 v = (u8)c ^ 0x80;
+    key.AppendChar(0x01);
+    key.AppendChar((char)(0x40 + (v >> 4)));
+    key.AppendChar((char)(0x40 + (v & 0xf)));
+}
+
+/* returns a key for s such that strcmp() of two keys orders them like CmpNatural()
+   (except for control characters), so that sorting many strings doesn't have to
+   re-parse the numbers in them on every comparison.
+   Strings with equal keys must be ordered with strcmp(), like CmpNatural() does.
+   The caller must free() the result */
+char* NaturalSortKey(const char* s) {
+    ReportIf(!s);
+    str::Str key;
+    for (; IsWs(*s); s++) {
+        // do nothing
+    }
+    while (*s) {
+        if (IsWs(*s)) {
+            const char* end = s;
+            for (; IsWs(*end); end++) {
+                // do nothing
+            }
+            if (!*end) {
+                break;
+            }
+            AppendSortKeySpecial(key, ' ');
+            s = end;
+        } else if (IsDigit(*s)) {
+            for (; '0' == *s; s++) {
+                // do nothing
+            }
+            const char* end = s;
+            for (; IsDigit(*end); end++) {
+                // do nothing
+            }
+            // numbers sort before letters and by magnitude, then by digits
+            size_t n = end - s;
+            if (n > 0xffff) {
+                n = 0xffff;
+            }
+            key.AppendChar(0x02);
+            key.AppendChar('0');
+            for (int shift = 12; shift >= 0; shift -= 4) {
+                key.AppendChar((char)(0x40 + ((n >> shift) & 0xf)));
+            }
+            key.Append(s, n);
+            s = end;
+        } else if (IsAlNum(*s)) {
+            key.AppendChar(0x02);
+            key.AppendChar((char)tolower(*s));
+            s++;
+        } else {
+            AppendSortKeySpecial(key, *s);
+            s++;
+        }
+    }
+    // CmpNatural skips whitespace before comparing the end of one string with
+    // the other, which sorts like whitespace followed by a \0
+    AppendSortKeySpecial(key, ' ');
+    AppendSortKeySpecial(key, '\0');
+    return key.StealData();
+}
+
 bool IsEmptyOrWhiteSpace(const char* s) {
     if (!s) {
         return true;
@@ -216,6 +216,7 @@ const char* Parse(const char* str, const char* fmt, ...);
 const char* Parse(const char* str, size_t len, const char* fmt, ...);
 
 int CmpNatural(const char*, const char*);
+char* NaturalSortKey(const char*);
 
 TempStr FormatFloatWithThousandSepTemp(double number, LCID locale = LOCALE_USER_DEFAULT);
 TempStr FormatNumWithThousandSepTemp(i64 num, LCID locale = LOCALE_USER_DEFAULT);
@@ -328,16 +328,12 @@ static void ReadPixel(ReadState& s, u8* dst) {
     }
 }
 
-Gdiplus::Bitmap* ImageFromData(const ByteSlice& d) {
-    size_t len = d.size();
-    const u8* data = (const u8*)d.data();
-
+static bool InitReadState(const u8* data, size_t len, ReadState& s, Gdiplus::PixelFormat& format) {
     if (len < sizeof(TgaHeader)) {
-        return nullptr;
+        return false;
     }
 
-    ReadState s = {nullptr};
-    const TgaHeader* headerLE = (const TgaHeader*)d.data();
+    const TgaHeader* headerLE = (const TgaHeader*)data;
     s.data = data + sizeof(TgaHeader) + headerLE->idLength;
     s.end = data + len;
     if (1 == headerLE->cmapType) {
@@ -351,11 +347,21 @@ Gdiplus::Bitmap* ImageFromData(const ByteSlice& d) {
     s.n = (headerLE->bitDepth + 7) / 8;
     s.isRLE = headerLE->imageType >= 8;
 
-    Gdiplus::PixelFormat format = GetPixelFormat(headerLE, GetAlphaType(data, len));
-    if (!format) {
+    format = GetPixelFormat(headerLE, GetAlphaType(data, len));
+    return format != 0;
+}
+
+Gdiplus::Bitmap* ImageFromData(const ByteSlice& d) {
+    size_t len = d.size();
+    const u8* data = (const u8*)d.data();
+
+    ReadState s = {nullptr};
+    Gdiplus::PixelFormat format;
+    if (!InitReadState(data, len, s, format)) {
         return nullptr;
     }
 
+    const TgaHeader* headerLE = (const TgaHeader*)data;
     int w = convLE(headerLE->width);
     int h = convLE(headerLE->height);
     int n = ((format >> 8) & 0x3F) / 8;
@@ -383,6 +389,87 @@ Gdiplus::Bitmap* ImageFromData(const ByteSlice& d) {
     return bmp.Clone(0, 0, w, h, format);
 }
 
+// converts a pixel in one of the formats returned by GetPixelFormat
+// to gray, RGB or RGBA (with premultiplied alpha)
+static void ConvertPixel(const u8* src, Gdiplus::PixelFormat format, bool isGray, u8* dst) {
+    if (isGray) {
+        dst[0] = src[0];
+        return;
+    }
+    u32 a = 255;
+    switch (format) {
+        case PixelFormat16bppRGB555:
+        case PixelFormat16bppARGB1555: {
+            u16 v = readLE16((u8*)src);
+            dst[0] = (u8)(((v >> 10) & 0x1F) * 255 / 31);
+            dst[1] = (u8)(((v >> 5) & 0x1F) * 255 / 31);
+            dst[2] = (u8)((v & 0x1F) * 255 / 31);
+            a = (v & 0x8000) ? 255 : 0;
+            break;
+        }
+        default:
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+            a = src[3];
+            break;
+    }
+    if (PixelFormat16bppARGB1555 == format || PixelFormat32bppARGB == format) {
+        for (int i = 0; i < 3; i++) {
+            dst[i] = (u8)((dst[i] * a + 127) / 255);
+        }
+    }
+    if (PixelFormat16bppARGB1555 == format || PixelFormat32bppARGB == format || PixelFormat32bppPARGB == format) {
+        dst[3] = (u8)a;
+    }
+}
+
+// decodes into gray, RGB or RGBA (with premultiplied alpha) pixels
+// without going through GDI+ (for the portable ImageDecoder)
+bool DecodePixels(const u8* data, size_t len, int* wOut, int* hOut, int* nOut, u8** pixelsOut) {
+    ReadState s = {nullptr};
+    Gdiplus::PixelFormat format;
+    if (!InitReadState(data, len, s, format)) {
+        return false;
+    }
+
+    const TgaHeader* headerLE = (const TgaHeader*)data;
+    int w = convLE(headerLE->width);
+    int h = convLE(headerLE->height);
+    bool invertX = (headerLE->flags & Flag_InvertX);
+    bool invertY = (headerLE->flags & Flag_InvertY);
+    bool isGray = Type_Grayscale == s.type || Type_Grayscale_RLE == s.type;
+    bool hasAlpha = PixelFormat16bppARGB1555 == format || PixelFormat32bppARGB == format ||
+                    PixelFormat32bppPARGB == format;
+    int n = isGray ? 1 : hasAlpha ? 4 : 3;
+    if (w <= 0 || h <= 0) {
+        return false;
+    }
+
+    u8* pixels = AllocArray<u8>((size_t)w * h * n);
+    if (!pixels) {
+        return false;
+    }
+    for (int y = 0; y < h && !s.failed; y++) {
+        u8* rowOut = pixels + (size_t)w * n * (invertY ? y : h - 1 - y);
+        for (int x = 0; x < w; x++) {
+            // palette indices out of range are black, as in ImageFromData()
+            u8 pixel[4]{};
+            ReadPixel(s, pixel);
+            ConvertPixel(pixel, format, isGray, rowOut + n * (invertX ? w - 1 - x : x));
+        }
+    }
+    if (s.failed) {
+        free(pixels);
+        return false;
+    }
+    *wOut = w;
+    *hOut = h;
+    *nOut = n;
+    *pixelsOut = pixels;
+    return true;
+}
+
 inline bool memeq3(const char* pix1, const char* pix2) {
     return *(WORD*)pix1 == *(WORD*)pix2 && pix1[2] == pix2[2];
 }
@@ -9,6 +9,7 @@ namespace tga {
 
 bool HasSignature(const ByteSlice&);
 Gdiplus::Bitmap* ImageFromData(const ByteSlice&);
+bool DecodePixels(const u8* data, size_t len, int* w, int* h, int* n, u8** pixels);
 
 ByteSlice SerializeBitmap(HBITMAP hbmp);
 
@@ -83,6 +83,13 @@ void RunAsync(const Func0& fn, const char* threadName) {
     SafeCloseHandle(&hThread);
 }
 
+// number of logical processors, at least 1
+int GetCpuCount() {
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    return std::max(1, (int)si.dwNumberOfProcessors);
+}
+
 AtomicInt gDangerousThreadCount;
 
 bool AreDangerousThreadsPending() {
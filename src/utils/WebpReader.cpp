@@ -25,24 +25,59 @@ Size SizeFromData(const ByteSlice& d) {
     return size;
 }
 
-Gdiplus::Bitmap* ImageFromData(const ByteSlice& d) {
+bool DecodeInto(const ByteSlice& d, Size dstSize, u8* dst, int dstStride, int nThreads) {
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config)) {
+        return false;
+    }
+    if (WebPGetFeatures((const u8*)d.data(), d.size(), &config.input) != VP8_STATUS_OK) {
+        return false;
+    }
+    if (dstSize.dx != config.input.width || dstSize.dy != config.input.height) {
+        // libwebp scales while decoding, which is much faster than
+        // decoding the full image and scaling it afterwards
+        config.options.use_scaling = 1;
+        config.options.scaled_width = dstSize.dx;
+        config.options.scaled_height = dstSize.dy;
+    }
+    // lossy images can be filtered on a second thread
+    config.options.use_threads = nThreads != 1 ? 1 : 0;
+    config.output.colorspace = MODE_BGRA;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = dst;
+    config.output.u.RGBA.stride = dstStride;
+    config.output.u.RGBA.size = (size_t)dstStride * dstSize.dy;
+    bool ok = WebPDecode((const u8*)d.data(), d.size(), &config) == VP8_STATUS_OK;
+    WebPFreeDecBuffer(&config.output);
+    return ok;
+}
+
+Gdiplus::Bitmap* ImageFromData(const ByteSlice& d, Size targetSize, int nThreads) {
     int w, h;
     if (!WebPGetInfo((const u8*)d.data(), d.size(), &w, &h)) {
         return nullptr;
     }
+    if (!targetSize.IsEmpty() && targetSize.dx < w && targetSize.dy < h) {
+        w = targetSize.dx;
+        h = targetSize.dy;
+    }
 
-    Gdiplus::Bitmap bmp(w, h, PixelFormat32bppARGB);
+    // decode directly into the bitmap's memory
+    Gdiplus::Bitmap* bmp = new Gdiplus::Bitmap(w, h, PixelFormat32bppARGB);
     Gdiplus::Rect bmpRect(0, 0, w, h);
     Gdiplus::BitmapData bmpData;
-    Gdiplus::Status ok = bmp.LockBits(&bmpRect, Gdiplus::ImageLockModeWrite, PixelFormat32bppARGB, &bmpData);
+    Gdiplus::Status ok = bmp->LockBits(&bmpRect, Gdiplus::ImageLockModeWrite, PixelFormat32bppARGB, &bmpData);
     if (ok != Gdiplus::Ok) {
+        delete bmp;
         return nullptr;
     }
-    if (!WebPDecodeBGRAInto((const u8*)d.data(), d.size(), (u8*)bmpData.Scan0, bmpData.Stride * h, bmpData.Stride)) {
+    bool decoded = DecodeInto(d, Size(w, h), (u8*)bmpData.Scan0, bmpData.Stride, nThreads);
+    bmp->UnlockBits(&bmpData);
+    if (!decoded) {
+        delete bmp;
         return nullptr;
     }
-    bmp.UnlockBits(&bmpData);
-    return bmp.Clone(0, 0, w, h, PixelFormat32bppARGB);
+    return bmp;
 }
 
 } // namespace webp
@@ -55,9 +90,12 @@ bool HasSignature(const ByteSlice&) {
 Size SizeFromData(const ByteSlice&) {
     return Size();
 }
-Gdiplus::Bitmap* ImageFromData(const ByteSlice&) {
+Gdiplus::Bitmap* ImageFromData(const ByteSlice&, Size, int) {
     return nullptr;
 }
+bool DecodeInto(const ByteSlice&, Size, u8*, int, int) {
+    return false;
+}
 } // namespace webp
 
 #endif
@@ -5,6 +5,9 @@ namespace webp {
 
 bool HasSignature(const ByteSlice&);
 Size SizeFromData(const ByteSlice&);
-Gdiplus::Bitmap* ImageFromData(const ByteSlice&);
+// decodes at (or scaled down to) targetSize if it's smaller than the image
+Gdiplus::Bitmap* ImageFromData(const ByteSlice&, Size targetSize = {}, int nThreads = 0);
+// decodes into a caller-provided 32bpp BGRA buffer, scaling the image to dstSize
+bool DecodeInto(const ByteSlice&, Size dstSize, u8* dst, int dstStride, int nThreads = 0);
 
 } // namespace webp
@@ -0,0 +1,239 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#pragma warning(disable : 4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+
+#include "utils/BaseUtil.h"
+#include "utils/ImageDecoder.h"
+
+extern "C" {
+#include <mupdf/fitz.h>
+}
+#include <zlib.h>
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+// tall enough for PngRowDecoder to save checkpoints (every 512 rows)
+constexpr int kTestPngDx = 37;
+constexpr int kTestPngDy = 1300;
+
+static void AppendU32BE(Vec<u8>& v, u32 n) {
+    v.Append((u8)(n >> 24));
+    v.Append((u8)(n >> 16));
+    v.Append((u8)(n >> 8));
+    v.Append((u8)n);
+}
+
+static void AppendPngChunk(Vec<u8>& png, const char* type, const u8* data, size_t len) {
+    AppendU32BE(png, (u32)len);
+    size_t start = png.size();
+    png.Append((const u8*)type, 4);
+    png.Append(data, len);
+    uLong crc = crc32(0, png.LendData() + start, (uInt)(len + 4));
+    AppendU32BE(png, (u32)crc);
+}
+
+// creates a non-interlaced PNG with pseudo-random samples. Rows cycle through
+// all filter types (the random bytes are the filtered values)
+static void CreateTestPng(Vec<u8>& png, int colorType, int depth, bool withTrns) {
+    int channels = 1;
+    if (colorType == 2) {
+        channels = 3;
+    } else if (colorType == 4) {
+        channels = 2;
+    } else if (colorType == 6) {
+        channels = 4;
+    }
+    size_t rowBytes = ((size_t)kTestPngDx * channels * depth + 7) / 8;
+    Vec<u8> raw;
+    u32 seed = (u32)(colorType * 100 + depth);
+    for (int y = 0; y < kTestPngDy; y++) {
+        raw.Append((u8)(y % 5));
+        for (size_t i = 0; i < rowBytes; i++) {
+            seed = seed * 1103515245 + 12345;
+            raw.Append((u8)(seed >> 16));
+        }
+    }
+    uLong compressedLen = compressBound((uLong)raw.size());
+    Vec<u8> compressed;
+    compressed.AppendBlanks(compressedLen);
+    int res = compress2(compressed.LendData(), &compressedLen, raw.LendData(), (uLong)raw.size(), 6);
+    utassert(res == Z_OK);
+
+    png.Append((const u8*)"\x89PNG\r\n\x1a\n", 8);
+    u8 ihdr[13] = {0};
+    ihdr[3] = (u8)kTestPngDx;
+    ihdr[6] = (u8)(kTestPngDy >> 8);
+    ihdr[7] = (u8)kTestPngDy;
+    ihdr[8] = (u8)depth;
+    ihdr[9] = (u8)colorType;
+    AppendPngChunk(png, "IHDR", ihdr, sizeof(ihdr));
+    if (colorType == 3) {
+        int nColors = 1 << depth;
+        Vec<u8> plte;
+        Vec<u8> trns;
+        for (int i = 0; i < nColors; i++) {
+            plte.Append((u8)(i * 7));
+            plte.Append((u8)(255 - i));
+            plte.Append((u8)(i * 13));
+            trns.Append((u8)(i * 37));
+        }
+        AppendPngChunk(png, "PLTE", plte.LendData(), plte.size());
+        if (withTrns) {
+            AppendPngChunk(png, "tRNS", trns.LendData(), trns.size());
+        }
+    }
+    // several IDAT chunks
+    constexpr size_t kChunkSize = 4096;
+    for (size_t off = 0; off < compressedLen; off += kChunkSize) {
+        size_t len = std::min(kChunkSize, (size_t)compressedLen - off);
+        AppendPngChunk(png, "IDAT", compressed.LendData() + off, len);
+    }
+    AppendPngChunk(png, "IEND", nullptr, 0);
+}
+
+static bool RowsMatch(const DecodedImage* full, const DecodedImage* band, int y) {
+    if (!band || band->dx != full->dx || band->n != full->n) {
+        return false;
+    }
+    for (int i = 0; i < band->dy; i++) {
+        const u8* expected = full->samples + (size_t)(y + i) * full->stride;
+        const u8* actual = band->samples + (size_t)i * band->stride;
+        if (memcmp(expected, actual, (size_t)full->dx * full->n) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool DecodeRowsMatches(ImageRowDecoder* dec, const DecodedImage* full, int y, int rowsDy) {
+    ImageDecodeOptions opts;
+    DecodedImage* band = dec->DecodeRows(y, rowsDy, opts);
+    bool ok = RowsMatch(full, band, y);
+    FreeDecodedImage(band);
+    return ok;
+}
+
+// the rows decoded by ImageRowDecoder must be the same as those decoded at once
+static void ImageDecoderPngTest(fz_context* ctx, int colorType, int depth, bool withTrns = false) {
+    Vec<u8> png;
+    CreateTestPng(png, colorType, depth, withTrns);
+    ImageDecodeOptions opts;
+    DecodedImage* full = DecodeImage(ctx, png.LendData(), png.size(), opts);
+    utassert(full && full->dx == kTestPngDx && full->dy == kTestPngDy);
+    ImageRowDecoder* dec = NewImageRowDecoder(ctx, png.LendData(), png.size());
+    utassert(dec && dec->dx == kTestPngDx && dec->dy == kTestPngDy);
+    if (!full || !dec) {
+        FreeDecodedImage(full);
+        delete dec;
+        return;
+    }
+    utassert(dec->n == full->n);
+
+    // in order
+    for (int y = 0; y < kTestPngDy; y += 100) {
+        utassert(DecodeRowsMatches(dec, full, y, 100));
+    }
+    // backwards, restarting from the checkpoints saved above
+    for (int y = kTestPngDy - 150; y >= 0; y -= 150) {
+        utassert(DecodeRowsMatches(dec, full, y, 150));
+    }
+    // forward past a checkpoint, and to rows before the next one
+    utassert(DecodeRowsMatches(dec, full, 10, 5));
+    utassert(DecodeRowsMatches(dec, full, 1100, 20));
+    utassert(DecodeRowsMatches(dec, full, 600, 20));
+    utassert(DecodeRowsMatches(dec, full, 700, 20));
+    // the last band is cut off at the bottom
+    utassert(DecodeRowsMatches(dec, full, kTestPngDy - 7, 100));
+
+    delete dec;
+    FreeDecodedImage(full);
+}
+
+// JPEGs with an EXIF orientation are rotated by DecodeImage() and not decoded in bands
+static void ImageDecoderJpegOrientationTest(fz_context* ctx) {
+    fz_pixmap* pix = nullptr;
+    fz_buffer* buf = nullptr;
+    fz_var(pix);
+    fz_var(buf);
+    fz_try(ctx) {
+        pix = fz_new_pixmap(ctx, fz_device_rgb(ctx), 16, 40, nullptr, 0);
+        fz_clear_pixmap_with_value(ctx, pix, 0x80);
+        buf = fz_new_buffer_from_pixmap_as_jpeg(ctx, pix, fz_default_color_params, 90, 0);
+    }
+    fz_always(ctx) {
+        fz_drop_pixmap(ctx, pix);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        utassert(false);
+        return;
+    }
+
+    for (int orientation : {1, 6}) {
+        // APP1 segment with an IFD that only has the orientation tag
+        u8 exif[] = {0xFF, 0xE1, 0, 34, 'E', 'x', 'i', 'f', 0, 0, 'M', 'M', 0, 0x2A, 0, 0, 0, 8,
+                     0, 1, 0x01, 0x12, 0, 3, 0, 0, 0, 1, 0, (u8)orientation, 0, 0, 0, 0, 0, 0};
+        Vec<u8> jpeg;
+        jpeg.Append(buf->data, 2);
+        jpeg.Append(exif, sizeof(exif));
+        jpeg.Append(buf->data + 2, buf->len - 2);
+
+        ImageDecodeOptions opts;
+        DecodedImage* img = DecodeImage(ctx, jpeg.LendData(), jpeg.size(), opts);
+        utassert(img);
+        if (img) {
+            bool isRotated = orientation == 6;
+            utassert(img->dx == (isRotated ? 40 : 16) && img->dy == (isRotated ? 16 : 40));
+            FreeDecodedImage(img);
+        }
+
+        // mupdf writes progressive JPEGs, which aren't decoded in bands. Only the
+        // headers are read by NewImageRowDecoder(), so it's marked as baseline
+        u8* d = jpeg.LendData();
+        for (size_t i = 2; i + 4 <= jpeg.size() && d[i] == 0xFF && d[i + 1] != 0xDA;) {
+            if (d[i + 1] == 0xC2) {
+                d[i + 1] = 0xC0;
+            }
+            i += 2 + (size_t)((d[i + 2] << 8) | d[i + 3]);
+        }
+        ImageRowDecoder* dec = NewImageRowDecoder(ctx, jpeg.LendData(), jpeg.size());
+        utassert((dec != nullptr) == (orientation == 1));
+        delete dec;
+    }
+    fz_drop_buffer(ctx, buf);
+}
+
+void ImageDecoderTest() {
+    fz_context* ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+    utassert(ctx);
+    if (!ctx) {
+        return;
+    }
+    // gray
+    ImageDecoderPngTest(ctx, 0, 1);
+    ImageDecoderPngTest(ctx, 0, 2);
+    ImageDecoderPngTest(ctx, 0, 4);
+    ImageDecoderPngTest(ctx, 0, 8);
+    ImageDecoderPngTest(ctx, 0, 16);
+    // RGB
+    ImageDecoderPngTest(ctx, 2, 8);
+    ImageDecoderPngTest(ctx, 2, 16);
+    // palette, with and without transparency
+    ImageDecoderPngTest(ctx, 3, 1);
+    ImageDecoderPngTest(ctx, 3, 2);
+    ImageDecoderPngTest(ctx, 3, 4);
+    ImageDecoderPngTest(ctx, 3, 8);
+    ImageDecoderPngTest(ctx, 3, 8, true);
+    ImageDecoderPngTest(ctx, 3, 2, true);
+    // gray with alpha
+    ImageDecoderPngTest(ctx, 4, 8);
+    ImageDecoderPngTest(ctx, 4, 16);
+    // RGBA
+    ImageDecoderPngTest(ctx, 6, 8);
+    ImageDecoderPngTest(ctx, 6, 16);
+
+    ImageDecoderJpegOrientationTest(ctx);
+    fz_drop_context(ctx);
+}
@@ -402,6 +402,26 @@ void StrTest() {
     utassert(str::CmpNatural("ab0200", "AB333") < 0);
     utassert(str::CmpNatural("a b", "a  c") < 0);
 
+    {
+        // sorting by NaturalSortKey() must give the same order as CmpNatural()
+        const char* names[] = {"100.pdf", ".hg", "2.pdf", "zzz", "abc", ".svn", "ab0200", "AB333", "a b", "a  c",
+                               "page 10.jpg", "page 9.jpg", "page 09.jpg", "page 9 .jpg", "Page9.jpg", "page",
+                               "page-1", "page1", "page1a", "page01", "a\xc3\xa9", "a", "a\xc3\xa9 "};
+        int n = (int)dimof(names);
+        for (int i = 0; i < n; i++) {
+            AutoFreeStr k1 = str::NaturalSortKey(names[i]);
+            for (int j = 0; j < n; j++) {
+                AutoFreeStr k2 = str::NaturalSortKey(names[j]);
+                int cmpKeys = strcmp(k1, k2);
+                if (cmpKeys == 0) {
+                    cmpKeys = strcmp(names[i], names[j]);
+                }
+                int cmp = str::CmpNatural(names[i], names[j]);
+                utassert((cmp < 0) == (cmpKeys < 0) && (cmp > 0) == (cmpKeys > 0));
+            }
+        }
+    }
+
 #ifndef LOCALE_INVARIANT
 #define LOCALE_INVARIANT (MAKELCID(MAKELANGID(LANG_INVARIANT, SUBLANG_NEUTRAL), SORT_DEFAULT))
 #endif